@@ -0,0 +1,19 @@
+-- Lua environment of an emerge thread, see register_mapgen_script
+
+core.log("info", "Initializing emerge environment")
+
+dofile(core.get_builtin_path() .. "game" .. DIR_DELIM .. "voxelarea.lua")
+
+core.registered_on_generateds = {}
+
+function core.register_on_generated(func)
+	assert(type(func) == "function", "Invalid on_generated definition")
+	core.registered_on_generateds[#core.registered_on_generateds + 1] = func
+end
+
+-- Only runs the on_generated callbacks, which return nothing
+function core.run_callbacks(callbacks, mode, ...)
+	for i = 1, #callbacks do
+		callbacks[i](...)
+	end
+end
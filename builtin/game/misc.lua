@@ -262,6 +262,31 @@ function core.http_add_fetch(httpenv)
 end
 
 
+-- Asynchronous pathfinding
+
+local find_path_async = core.find_path_async
+local find_path_async_get = core.find_path_async_get
+core.find_path_async_get = nil
+
+function core.find_path_async(pos1, pos2, searchdistance, max_jump, max_drop,
+		algorithm, callback)
+	assert(type(callback) == "function",
+		"Invalid core.find_path_async invocation: callback is not a function")
+	local handle = find_path_async(pos1, pos2, searchdistance, max_jump,
+		max_drop, algorithm)
+
+	local function update_path_status()
+		local completed, path = find_path_async_get(handle)
+		if completed then
+			callback(path)
+		else
+			core.after(0, update_path_status)
+		end
+	end
+	core.after(0, update_path_status)
+end
+
+
 function core.close_formspec(player_name, formname)
 	return core.show_formspec(player_name, formname, "")
 end
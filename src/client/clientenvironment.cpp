@@ -285,7 +285,7 @@ void ClientEnvironment::step(float dtime)
 	/*
 		Step and handle simple objects
 	*/
-	g_profiler->avg("ClientEnv: CSO count [#]", m_simple_objects.size());
+	g_profiler->avg(PROFILER_KEY("ClientEnv: CSO count [#]"), m_simple_objects.size());
 	for (auto i = m_simple_objects.begin(); i != m_simple_objects.end();) {
 		ClientSimpleObject *simple = *i;
 
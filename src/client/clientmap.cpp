@@ -114,7 +114,7 @@ void ClientMap::getBlocksInViewRange(v3s16 cam_pos_nodes,
 
 void ClientMap::updateDrawList()
 {
-	ScopeProfiler sp(g_profiler, "CM::updateDrawList()", SPT_AVG);
+	ScopeProfiler sp(g_profiler, SCOPE_PROFILER_KEY("CM::updateDrawList()"), SPT_AVG);
 
 	for (auto &i : m_drawlist) {
 		MapBlock *block = i.second;
@@ -225,9 +225,11 @@ void ClientMap::updateDrawList()
 			m_last_drawn_sectors.insert(sp);
 	}
 
-	g_profiler->avg("MapBlock meshes in range [#]", blocks_in_range_with_mesh);
-	g_profiler->avg("MapBlocks occlusion culled [#]", blocks_occlusion_culled);
-	g_profiler->avg("MapBlocks drawn [#]", m_drawlist.size());
+	g_profiler->avg(PROFILER_KEY("MapBlock meshes in range [#]"),
+		blocks_in_range_with_mesh);
+	g_profiler->avg(PROFILER_KEY("MapBlocks occlusion culled [#]"),
+		blocks_occlusion_culled);
+	g_profiler->avg(PROFILER_KEY("MapBlocks drawn [#]"), m_drawlist.size());
 }
 
 struct MeshBufList
@@ -413,7 +415,8 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 
 	// Log only on solid pass because values are the same
 	if (pass == scene::ESNRP_SOLID) {
-		g_profiler->avg("renderMap(): animated meshes [#]", mesh_animate_count);
+		g_profiler->avg(PROFILER_KEY("renderMap(): animated meshes [#]"),
+			mesh_animate_count);
 	}
 
 	g_profiler->avg(prefix + "vertices drawn [#]", vertex_count);
@@ -495,7 +498,8 @@ static bool getVisibleBrightness(Map *map, const v3f &p0, v3f dir, float step,
 int ClientMap::getBackgroundBrightness(float max_d, u32 daylight_factor,
 		int oldvalue, bool *sunlight_seen_result)
 {
-	ScopeProfiler sp(g_profiler, "CM::getBackgroundBrightness", SPT_AVG);
+	ScopeProfiler sp(g_profiler,
+		SCOPE_PROFILER_KEY("CM::getBackgroundBrightness"), SPT_AVG);
 	static v3f z_directions[50] = {
 		v3f(-100, 0, 0)
 	};
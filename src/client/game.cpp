@@ -3879,7 +3879,8 @@ void Game::updateFrame(ProfilerGraph *graph, RunStats *stats, f32 dtime,
 	driver->endScene();
 
 	stats->drawtime = tt_draw.stop(true);
-	g_profiler->avg("Game::updateFrame(): draw scene [ms]", stats->drawtime);
+	g_profiler->avg(PROFILER_KEY("Game::updateFrame(): draw scene [ms]"),
+		stats->drawtime);
 	g_profiler->graphAdd("Update frame [ms]", tt_update.stop(true));
 }
 
@@ -125,7 +125,7 @@ void Sky::render()
 	if (!camera || !driver)
 		return;
 
-	ScopeProfiler sp(g_profiler, "Sky::render()", SPT_AVG);
+	ScopeProfiler sp(g_profiler, SCOPE_PROFILER_KEY("Sky::render()"), SPT_AVG);
 
 	// Draw perspective skybox
 
@@ -74,6 +74,25 @@ void Database_LevelDB::loadBlock(const v3s16 &pos, std::string *block)
 	*block = (status.ok()) ? datastr : "";
 }
 
+void Database_LevelDB::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	// LevelDB has no MultiGet; read all blocks from the same snapshot
+	leveldb::ReadOptions options;
+	options.snapshot = m_database->GetSnapshot();
+
+	blocks->resize(pos.size());
+	for (size_t i = 0; i < pos.size(); i++) {
+		std::string &block = (*blocks)[i];
+		leveldb::Status status = m_database->Get(options,
+			i64tos(getBlockAsInteger(pos[i])), &block);
+		if (!status.ok())
+			block.clear();
+	}
+
+	m_database->ReleaseSnapshot(options.snapshot);
+}
+
 bool Database_LevelDB::deleteBlock(const v3s16 &pos)
 {
 	leveldb::Status status = m_database->Delete(leveldb::WriteOptions(),
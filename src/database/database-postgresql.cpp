@@ -33,6 +33,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <netinet/in.h>
 #endif
 
+#include <cstring>
+
 #include "debug.h"
 #include "exceptions.h"
 #include "settings.h"
@@ -160,6 +162,11 @@ void Database_PostgreSQL::endSave()
 	checkResults(PQexec(m_conn, "COMMIT;"));
 }
 
+void Database_PostgreSQL::rollbackSave()
+{
+	checkResults(PQexec(m_conn, "ROLLBACK;"));
+}
+
 MapDatabasePostgreSQL::MapDatabasePostgreSQL(const std::string &connect_string):
 	Database_PostgreSQL(connect_string),
 	MapDatabase()
@@ -190,6 +197,13 @@ void MapDatabasePostgreSQL::initStatements()
 			"WHERE posX = $1::int4 AND posY = $2::int4 AND "
 			"posZ = $3::int4");
 
+	// Takes the coordinates as three arrays of the same length
+	prepareStatement("read_blocks",
+		"SELECT posX, posY, posZ, data FROM blocks "
+			"WHERE (posX, posY, posZ) = ANY("
+				"SELECT ($1::int4[])[i], ($2::int4[])[i], ($3::int4[])[i] "
+				"FROM generate_subscripts($1::int4[], 1) AS i)");
+
 	if (getPGVersion() < 90500) {
 		prepareStatement("write_block_insert",
 			"INSERT INTO blocks (posX, posY, posZ, data) SELECT "
@@ -273,6 +287,53 @@ void MapDatabasePostgreSQL::loadBlock(const v3s16 &pos, std::string *block)
 	PQclear(results);
 }
 
+void MapDatabasePostgreSQL::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	verifyDatabase();
+
+	blocks->assign(pos.size(), "");
+	if (pos.empty())
+		return;
+
+	// Array literals like {1,2,3}
+	std::string arrays[3];
+	for (size_t i = 0; i < pos.size(); i++) {
+		const char *sep = i == 0 ? "{" : ",";
+		arrays[0] += sep + itos(pos[i].X);
+		arrays[1] += sep + itos(pos[i].Y);
+		arrays[2] += sep + itos(pos[i].Z);
+	}
+	for (std::string &array : arrays)
+		array += "}";
+
+	const char *args[] = {
+		arrays[0].c_str(), arrays[1].c_str(), arrays[2].c_str()
+	};
+
+	// Binary results
+	PGresult *results = execPrepared("read_blocks", ARRLEN(args), args, false);
+
+	int numrows = PQntuples(results);
+	for (int row = 0; row < numrows; ++row) {
+		s32 coords[3];
+		for (int col = 0; col < 3; col++) {
+			u32 value;
+			memcpy(&value, PQgetvalue(results, row, col), sizeof(value));
+			coords[col] = (s32)ntohl(value);
+		}
+		v3s16 found(coords[0], coords[1], coords[2]);
+
+		for (size_t i = 0; i < pos.size(); i++) {
+			if (pos[i] == found)
+				(*blocks)[i].assign(PQgetvalue(results, row, 3),
+					PQgetlength(results, row, 3));
+		}
+	}
+
+	PQclear(results);
+}
+
 bool MapDatabasePostgreSQL::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
@@ -34,6 +34,7 @@ class Database_PostgreSQL: public Database
 
 	void beginSave();
 	void endSave();
+	void rollbackSave();
 
 	bool initialized() const;
 
@@ -115,11 +116,13 @@ class MapDatabasePostgreSQL : private Database_PostgreSQL, public MapDatabase
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
+	void loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> *blocks);
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
 	void beginSave() { Database_PostgreSQL::beginSave(); }
 	void endSave() { Database_PostgreSQL::endSave(); }
+	void rollbackSave() { Database_PostgreSQL::rollbackSave(); }
 
 protected:
 	virtual void createDatabase();
@@ -30,6 +30,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include <hiredis.h>
 #include <cassert>
+#include <vector>
 
 
 Database_Redis::Database_Redis(Settings &conf)
@@ -90,6 +91,15 @@ void Database_Redis::endSave() {
 	freeReplyObject(reply);
 }
 
+void Database_Redis::rollbackSave() {
+	redisReply *reply = static_cast<redisReply *>(redisCommand(ctx, "DISCARD"));
+	if (!reply) {
+		throw DatabaseException(std::string(
+			"Redis command 'DISCARD' failed: ") + ctx->errstr);
+	}
+	freeReplyObject(reply);
+}
+
 bool Database_Redis::saveBlock(const v3s16 &pos, const std::string &data)
 {
 	std::string tmp = i64tos(getBlockAsInteger(pos));
@@ -156,6 +166,55 @@ void Database_Redis::loadBlock(const v3s16 &pos, std::string *block)
 		"Redis command 'HGET %s %s' gave invalid reply."));
 }
 
+void Database_Redis::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	blocks->assign(pos.size(), "");
+	if (pos.empty())
+		return;
+
+	// HMGET <hash> <field>...
+	std::vector<std::string> args;
+	args.reserve(pos.size() + 2);
+	args.emplace_back("HMGET");
+	args.push_back(hash);
+	for (const v3s16 &p : pos)
+		args.push_back(i64tos(getBlockAsInteger(p)));
+
+	std::vector<const char *> argv;
+	std::vector<size_t> argvlen;
+	for (const std::string &arg : args) {
+		argv.push_back(arg.c_str());
+		argvlen.push_back(arg.size());
+	}
+
+	redisReply *reply = static_cast<redisReply *>(redisCommandArgv(ctx,
+			argv.size(), argv.data(), argvlen.data()));
+
+	if (!reply) {
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s ...' failed: ") + ctx->errstr);
+	}
+
+	if (reply->type != REDIS_REPLY_ARRAY || reply->elements != pos.size()) {
+		std::string errstr = reply->type == REDIS_REPLY_ERROR ?
+			std::string(reply->str, reply->len) : "invalid reply";
+		freeReplyObject(reply);
+		errorstream << "loadBlocks: loading " << pos.size()
+			<< " blocks failed: " << errstr << std::endl;
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s ...' errored: ") + errstr);
+	}
+
+	for (size_t i = 0; i < reply->elements; i++) {
+		redisReply *element = reply->element[i];
+		// REDIS_REPLY_NIL means the block is not in the database
+		if (element->type == REDIS_REPLY_STRING)
+			(*blocks)[i].assign(element->str, element->len);
+	}
+	freeReplyObject(reply);
+}
+
 bool Database_Redis::deleteBlock(const v3s16 &pos)
 {
 	std::string tmp = i64tos(getBlockAsInteger(pos));
@@ -36,6 +36,7 @@ SQLite format specification:
 #include "content_sao.h"
 #include "remoteplayer.h"
 
+#include <algorithm>
 #include <cassert>
 
 // When to print messages when the database is being held locked by another process
@@ -46,6 +47,9 @@ SQLite format specification:
 #define BUSY_FATAL_TRESHOLD	3000	// Allow SQLITE_BUSY to be returned, which will cause a minetest crash.
 #define BUSY_ERROR_INTERVAL	10000	// Safety net: report again every 10 seconds
 
+// Number of positions in the IN list of the batched block read query
+#define READ_MANY_COUNT 16
+
 
 #define SQLRES(s, r, m) \
 	if ((s) != (r)) { \
@@ -135,6 +139,17 @@ void Database_SQLite3::endSave()
 	sqlite3_reset(m_stmt_end);
 }
 
+void Database_SQLite3::rollbackSave()
+{
+	verifyDatabase();
+	// Nothing to roll back if the transaction didn't even begin
+	if (sqlite3_get_autocommit(m_database))
+		return;
+	SQLRES(sqlite3_step(m_stmt_rollback), SQLITE_DONE,
+		"Failed to roll back SQLite3 transaction");
+	sqlite3_reset(m_stmt_rollback);
+}
+
 void Database_SQLite3::openDatabase()
 {
 	if (m_database) return;
@@ -179,6 +194,7 @@ void Database_SQLite3::verifyDatabase()
 
 	PREPARE_STATEMENT(begin, "BEGIN;");
 	PREPARE_STATEMENT(end, "COMMIT;");
+	PREPARE_STATEMENT(rollback, "ROLLBACK;");
 
 	initStatements();
 
@@ -189,6 +205,7 @@ Database_SQLite3::~Database_SQLite3()
 {
 	FINALIZE_STATEMENT(m_stmt_begin)
 	FINALIZE_STATEMENT(m_stmt_end)
+	FINALIZE_STATEMENT(m_stmt_rollback)
 
 	SQLOK_ERRSTREAM(sqlite3_close(m_database), "Failed to close database");
 }
@@ -206,6 +223,7 @@ MapDatabaseSQLite3::MapDatabaseSQLite3(const std::string &savedir):
 MapDatabaseSQLite3::~MapDatabaseSQLite3()
 {
 	FINALIZE_STATEMENT(m_stmt_read)
+	FINALIZE_STATEMENT(m_stmt_read_many)
 	FINALIZE_STATEMENT(m_stmt_write)
 	FINALIZE_STATEMENT(m_stmt_list)
 	FINALIZE_STATEMENT(m_stmt_delete)
@@ -236,6 +254,14 @@ void MapDatabaseSQLite3::initStatements()
 	PREPARE_STATEMENT(delete, "DELETE FROM `blocks` WHERE `pos` = ?");
 	PREPARE_STATEMENT(list, "SELECT `pos` FROM `blocks`");
 
+	std::string read_many = "SELECT `pos`, `data` FROM `blocks` WHERE `pos` IN (?";
+	for (int i = 1; i < READ_MANY_COUNT; i++)
+		read_many += ", ?";
+	read_many += ")";
+	SQLOK(sqlite3_prepare_v2(m_database, read_many.c_str(), -1,
+			&m_stmt_read_many, NULL),
+		"Failed to prepare query '" + read_many + "'");
+
 	verbosestream << "ServerMap: SQLite3 database opened." << std::endl;
 }
 
@@ -309,6 +335,34 @@ void MapDatabaseSQLite3::loadBlock(const v3s16 &pos, std::string *block)
 	sqlite3_reset(m_stmt_read);
 }
 
+void MapDatabaseSQLite3::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	verifyDatabase();
+
+	blocks->assign(pos.size(), "");
+
+	for (size_t start = 0; start < pos.size(); start += READ_MANY_COUNT) {
+		size_t count = std::min<size_t>(pos.size() - start, READ_MANY_COUNT);
+
+		// Unused parameters repeat the first position
+		for (int i = 0; i < READ_MANY_COUNT; i++)
+			bindPos(m_stmt_read_many, pos[start + (i < (int)count ? i : 0)], i + 1);
+
+		while (sqlite3_step(m_stmt_read_many) == SQLITE_ROW) {
+			s64 found = sqlite3_column_int64(m_stmt_read_many, 0);
+			const char *data = (const char *) sqlite3_column_blob(m_stmt_read_many, 1);
+			size_t len = sqlite3_column_bytes(m_stmt_read_many, 1);
+
+			for (size_t i = start; i < start + count; i++) {
+				if (getBlockAsInteger(pos[i]) == found && data)
+					(*blocks)[i].assign(data, len);
+			}
+		}
+		sqlite3_reset(m_stmt_read_many);
+	}
+}
+
 void MapDatabaseSQLite3::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	verifyDatabase();
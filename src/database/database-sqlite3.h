@@ -35,6 +35,7 @@ class Database_SQLite3 : public Database
 
 	void beginSave();
 	void endSave();
+	void rollbackSave();
 
 	bool initialized() const { return m_initialized; }
 protected:
@@ -134,6 +135,7 @@ class Database_SQLite3 : public Database
 
 	sqlite3_stmt *m_stmt_begin = nullptr;
 	sqlite3_stmt *m_stmt_end = nullptr;
+	sqlite3_stmt *m_stmt_rollback = nullptr;
 
 	s64 m_busy_handler_data[2];
 
@@ -148,11 +150,13 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
+	void loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> *blocks);
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
 	void beginSave() { Database_SQLite3::beginSave(); }
 	void endSave() { Database_SQLite3::endSave(); }
+	void rollbackSave() { Database_SQLite3::rollbackSave(); }
 protected:
 	virtual void createDatabase();
 	virtual void initStatements();
@@ -162,6 +166,7 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 
 	// Map
 	sqlite3_stmt *m_stmt_read = nullptr;
+	sqlite3_stmt *m_stmt_read_many = nullptr;
 	sqlite3_stmt *m_stmt_write = nullptr;
 	sqlite3_stmt *m_stmt_list = nullptr;
 	sqlite3_stmt *m_stmt_delete = nullptr;
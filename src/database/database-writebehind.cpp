@@ -0,0 +1,307 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "database-writebehind.h"
+
+#include <algorithm>
+
+#include "exceptions.h"
+#include "log.h"
+#include "porting.h"
+#include "profiler.h"
+
+class WriteBehindThread : public Thread
+{
+public:
+	WriteBehindThread(WriteBehindMapDatabase *db) :
+		Thread("MapSave"),
+		m_db(db)
+	{}
+
+protected:
+	void *run()
+	{
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(m_db->m_queue_mutex);
+				m_db->m_queue_cv.wait(lock, [this] {
+					return m_db->m_stop || !m_db->m_queue.empty();
+				});
+				// Everything is written before stopping
+				if (m_db->m_queue.empty())
+					break;
+			}
+			if (!m_db->writeBatch())
+				sleep_ms(1000);
+		}
+		return nullptr;
+	}
+
+private:
+	WriteBehindMapDatabase *m_db;
+};
+
+WriteBehindMapDatabase::WriteBehindMapDatabase(MapDatabase *db,
+		const std::string &name, size_t max_queued_bytes, u32 max_batch) :
+	m_db(db),
+	m_name(name),
+	m_max_queued_bytes(max_queued_bytes),
+	m_max_batch(max_batch),
+	m_thread(new WriteBehindThread(this))
+{
+	m_thread->start();
+}
+
+WriteBehindMapDatabase::~WriteBehindMapDatabase()
+{
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		m_stop = true;
+	}
+	m_queue_cv.notify_all();
+	m_thread->wait();
+
+	infostream << "Map save " << m_name << ": " << m_stats.blocks_written
+		<< " blocks written in " << m_stats.transactions << " transactions, "
+		<< m_stats.blocks_coalesced << " coalesced" << std::endl;
+}
+
+bool WriteBehindMapDatabase::initialized() const
+{
+	return m_db->initialized();
+}
+
+bool WriteBehindMapDatabase::saveBlock(const v3s16 &pos, const std::string &data)
+{
+	std::unique_lock<std::mutex> lock(m_queue_mutex);
+
+	// Don't let the queue grow without bound if the database can't keep up
+	if (m_queued_bytes > m_max_queued_bytes) {
+		m_stats.backpressure_waits++;
+		m_written_cv.wait(lock, [this] {
+			return m_queued_bytes <= m_max_queued_bytes;
+		});
+	}
+
+	std::string *queued = m_queue.find(pos);
+	if (queued) {
+		m_queued_bytes -= queued->size();
+		m_stats.blocks_coalesced++;
+		*queued = data;
+	} else {
+		m_queue[pos] = data;
+	}
+	m_queued_bytes += data.size();
+	m_stats.blocks_queued++;
+
+	lock.unlock();
+	m_queue_cv.notify_one();
+	return true;
+}
+
+const std::string *WriteBehindMapDatabase::findUnwritten(const v3s16 &pos) const
+{
+	// The queue has the newer data
+	const std::string *data = m_queue.find(pos);
+	return data ? data : m_in_flight.find(pos);
+}
+
+void WriteBehindMapDatabase::loadBlock(const v3s16 &pos, std::string *block)
+{
+	// Blocks leave m_in_flight only once they are committed, so a block
+	// that is in neither map can be read from the database
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		const std::string *unwritten = findUnwritten(pos);
+		if (unwritten) {
+			*block = *unwritten;
+			return;
+		}
+	}
+	MutexAutoLock dblock(m_db_mutex);
+	m_db->loadBlock(pos, block);
+}
+
+void WriteBehindMapDatabase::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	std::vector<v3s16> to_load;
+	std::vector<size_t> to_load_i;
+	blocks->assign(pos.size(), "");
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		for (size_t i = 0; i < pos.size(); i++) {
+			const std::string *unwritten = findUnwritten(pos[i]);
+			if (unwritten) {
+				(*blocks)[i] = *unwritten;
+			} else {
+				to_load.push_back(pos[i]);
+				to_load_i.push_back(i);
+			}
+		}
+	}
+	if (to_load.empty())
+		return;
+
+	std::vector<std::string> loaded;
+	{
+		MutexAutoLock dblock(m_db_mutex);
+		m_db->loadBlocks(to_load, &loaded);
+	}
+	for (size_t i = 0; i < to_load.size(); i++)
+		(*blocks)[to_load_i[i]].swap(loaded[i]);
+}
+
+bool WriteBehindMapDatabase::deleteBlock(const v3s16 &pos)
+{
+	// Queued like a save, so it is never part of a transaction the thread
+	// has open and can't be overtaken by a write of older data
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		std::string *queued = m_queue.find(pos);
+		if (queued) {
+			m_queued_bytes -= queued->size();
+			queued->clear();
+		} else {
+			m_queue[pos] = "";
+		}
+	}
+	m_queue_cv.notify_one();
+	m_written_cv.notify_all();
+	return true;
+}
+
+void WriteBehindMapDatabase::listAllLoadableBlocks(std::vector<v3s16> &dst)
+{
+	flush();
+	MutexAutoLock dblock(m_db_mutex);
+	m_db->listAllLoadableBlocks(dst);
+}
+
+void WriteBehindMapDatabase::flush()
+{
+	std::unique_lock<std::mutex> lock(m_queue_mutex);
+	m_written_cv.wait(lock, [this] {
+		return m_queue.empty() && m_in_flight.size() == 0;
+	});
+}
+
+WriteBehindMapDatabase::Stats WriteBehindMapDatabase::getStats()
+{
+	MutexAutoLock lock(m_queue_mutex);
+	return m_stats;
+}
+
+size_t WriteBehindMapDatabase::getQueuedBytes()
+{
+	MutexAutoLock lock(m_queue_mutex);
+	return m_queued_bytes;
+}
+
+bool WriteBehindMapDatabase::writeBatch()
+{
+	std::vector<v3s16> batch;
+	bool stopping;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		batch.reserve(std::min<size_t>(m_queue.size(), m_max_batch));
+		for (auto &it : m_queue) {
+			if (batch.size() >= m_max_batch)
+				break;
+			batch.push_back(it.first);
+			m_in_flight[it.first] = std::move(it.second);
+		}
+		for (v3s16 pos : batch)
+			m_queue.erase(pos);
+		stopping = m_stop;
+	}
+	if (batch.empty())
+		return true;
+
+	u64 start = porting::getTimeUs();
+	u32 written = 0;
+	size_t bytes = 0;
+	bool ok = true;
+	try {
+		{
+			MutexAutoLock dblock(m_db_mutex);
+			m_db->beginSave();
+		}
+		for (v3s16 pos : batch) {
+			const std::string &data = *m_in_flight.find(pos);
+			MutexAutoLock dblock(m_db_mutex);
+			if (data.empty()) {
+				m_db->deleteBlock(pos);
+				continue;
+			}
+			m_db->saveBlock(pos, data);
+			written++;
+			bytes += data.size();
+		}
+		MutexAutoLock dblock(m_db_mutex);
+		m_db->endSave();
+	} catch (DatabaseException &e) {
+		errorstream << "Map save " << m_name << ": failed to write "
+			<< batch.size() << " blocks: " << e.what() << std::endl;
+		ok = false;
+		// A transaction left open would make every later one fail
+		try {
+			MutexAutoLock dblock(m_db_mutex);
+			m_db->rollbackSave();
+		} catch (DatabaseException &e) {
+			errorstream << "Map save " << m_name << ": failed to roll back: "
+				<< e.what() << std::endl;
+		}
+	}
+	u64 time_us = porting::getTimeUs() - start;
+
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		if (ok) {
+			m_stats.blocks_written += written;
+			m_stats.bytes_written += bytes;
+			m_stats.transactions++;
+			m_stats.write_time_us += time_us;
+		} else if (stopping) {
+			errorstream << "Map save " << m_name << ": giving up on "
+				<< m_in_flight.size() << " blocks" << std::endl;
+		}
+		for (auto &it : m_in_flight) {
+			// Try again later, unless the block was saved again meanwhile
+			if (!ok && !stopping && !m_queue.find(it.first))
+				m_queue[it.first] = std::move(it.second);
+			else
+				m_queued_bytes -= it.second.size();
+		}
+		m_in_flight.clear();
+	}
+	m_written_cv.notify_all();
+
+	if (ok)
+		reportStats(written, time_us);
+	return ok;
+}
+
+void WriteBehindMapDatabase::reportStats(u32 count, u64 time_us)
+{
+	const std::string prefix = "Map save " + m_name + ": ";
+	g_profiler->avg(prefix + "blocks per transaction", count);
+	g_profiler->avg(prefix + "transaction time [ms]", time_us / 1000.0f);
+	g_profiler->avg(prefix + "queued [KiB]", getQueuedBytes() / 1024.0f);
+}
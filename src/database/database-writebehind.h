@@ -0,0 +1,121 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "database.h"
+#include "threading/thread.h"
+#include "util/blockpos_map.h"
+
+class WriteBehindThread;
+
+/*
+	Wraps a MapDatabase and writes saved blocks from a thread of its own.
+
+	saveBlock() and deleteBlock() only queue the change; the thread writes
+	the queue in transactions of up to max_batch blocks. A deletion is
+	queued as empty data, which loads return just like the database does
+	for a missing block, so the wrapper behaves like the database it wraps.
+	Queued data is always written before the wrapper is destroyed.
+
+	The wrapped database is only ever used with m_db_mutex held, which
+	makes this class safe to use from several threads. The thread holds it
+	for single statements, not for whole transactions: the batch that is
+	being written stays readable in m_in_flight until it is committed, so
+	loads don't wait for the commit. Other threads only read from the
+	wrapped database, so nothing they do ends up in the thread's
+	transaction. A transaction that fails is rolled back and its blocks are
+	queued again.
+*/
+class WriteBehindMapDatabase : public MapDatabase
+{
+public:
+	struct Stats
+	{
+		u64 blocks_queued = 0;
+		// Queued blocks that were replaced before they got written
+		u64 blocks_coalesced = 0;
+		u64 blocks_written = 0;
+		u64 bytes_written = 0;
+		u64 transactions = 0;
+		u64 write_time_us = 0;
+		// Number of times saveBlock() had to wait for the queue to drain
+		u64 backpressure_waits = 0;
+	};
+
+	// Takes ownership of db. name is the backend name used in the profiler.
+	WriteBehindMapDatabase(MapDatabase *db, const std::string &name,
+		size_t max_queued_bytes, u32 max_batch = 256);
+	~WriteBehindMapDatabase();
+	DISABLE_CLASS_COPY(WriteBehindMapDatabase);
+
+	bool saveBlock(const v3s16 &pos, const std::string &data);
+	void loadBlock(const v3s16 &pos, std::string *block);
+	void loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> *blocks);
+	bool deleteBlock(const v3s16 &pos);
+	void listAllLoadableBlocks(std::vector<v3s16> &dst);
+
+	// The thread makes its own transactions
+	void beginSave() {}
+	void endSave() {}
+	bool initialized() const;
+
+	// Waits until everything queued so far is written
+	void flush();
+
+	Stats getStats();
+	size_t getQueuedBytes();
+
+private:
+	friend class WriteBehindThread;
+
+	// Data that is queued or being written, m_queue_mutex must be held
+	const std::string *findUnwritten(const v3s16 &pos) const;
+	// Writes one batch of queued blocks, returns false if it failed
+	bool writeBatch();
+	void reportStats(u32 count, u64 time_us);
+
+	std::unique_ptr<MapDatabase> m_db;
+	std::string m_name;
+	const size_t m_max_queued_bytes;
+	const u32 m_max_batch;
+	std::unique_ptr<WriteBehindThread> m_thread;
+
+	// Taken before m_queue_mutex when both are needed. Held for one call to
+	// m_db at a time.
+	std::mutex m_db_mutex;
+
+	std::mutex m_queue_mutex;
+	// Signalled when blocks are queued or the thread should stop
+	std::condition_variable m_queue_cv;
+	// Signalled when a batch was written
+	std::condition_variable m_written_cv;
+	// Empty data stands for a deleted block
+	BlockPosMap<std::string> m_queue;
+	size_t m_queued_bytes = 0;
+	// Blocks taken from the queue but not committed yet. Only the thread
+	// changes it, so it can read it without m_queue_mutex.
+	BlockPosMap<std::string> m_in_flight;
+	bool m_stop = false;
+	Stats m_stats;
+};
@@ -67,3 +67,13 @@ v3s16 MapDatabase::getIntegerAsBlock(s64 i)
 	return pos;
 }
 
+
+void MapDatabase::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	blocks->resize(pos.size());
+	for (size_t i = 0; i < pos.size(); i++) {
+		(*blocks)[i].clear();
+		loadBlock(pos[i], &(*blocks)[i]);
+	}
+}
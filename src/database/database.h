@@ -31,6 +31,9 @@ class Database
 public:
 	virtual void beginSave() = 0;
 	virtual void endSave() = 0;
+	// Discards the changes since beginSave() after a save failed. Databases
+	// without transactions have nothing to discard.
+	virtual void rollbackSave() {}
 	virtual bool initialized() const { return true; }
 };
 
@@ -41,6 +44,11 @@ class MapDatabase : public Database
 
 	virtual bool saveBlock(const v3s16 &pos, const std::string &data) = 0;
 	virtual void loadBlock(const v3s16 &pos, std::string *block) = 0;
+	// Loads several blocks at once. blocks is resized to pos.size(), with an
+	// empty string for every block that doesn't exist.
+	// Backends override this to fetch them in a single query.
+	virtual void loadBlocks(const std::vector<v3s16> &pos,
+		std::vector<std::string> *blocks);
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
 	static s64 getBlockAsInteger(const v3s16 &pos);
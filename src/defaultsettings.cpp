@@ -340,6 +340,8 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("strict_protocol_version_checking", "false");
 	settings->setDefault("player_transfer_distance", "0");
 	settings->setDefault("max_simultaneous_block_sends_per_client", "40");
+	settings->setDefault("block_send_cache_size", "64");
+	settings->setDefault("block_send_threads", "2");
 	settings->setDefault("time_send_interval", "5");
 
 	settings->setDefault("default_game", "minetest");
@@ -354,6 +356,8 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("disallow_empty_password", "false");
 	settings->setDefault("disable_anticheat", "false");
 	settings->setDefault("enable_rollback_recording", "false");
+	settings->setDefault("rollback_partition_days", "7");
+	settings->setDefault("rollback_retention_days", "0");
 #ifdef NDEBUG
 	settings->setDefault("deprecated_lua_api_handling", "legacy");
 #else
@@ -366,6 +370,7 @@ void set_default_settings(Settings *settings)
 
 	settings->setDefault("chat_message_format", "<@name> @message");
 	settings->setDefault("profiler_print_interval", "0");
+	settings->setDefault("profiler_trace_file", "");
 	settings->setDefault("active_object_send_range_blocks", "4");
 	settings->setDefault("active_block_range", "3");
 	//settings->setDefault("max_simultaneous_block_sends_per_client", "1");
@@ -379,8 +384,12 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("time_speed", "72");
 	settings->setDefault("world_start_time", "6125");
 	settings->setDefault("server_unload_unused_data_timeout", "29");
+	settings->setDefault("map_block_memory_limit", "0");
 	settings->setDefault("max_objects_per_block", "64");
 	settings->setDefault("server_map_save_interval", "5.3");
+	settings->setDefault("map_compression_zstd", "false");
+	settings->setDefault("map_save_async", "true");
+	settings->setDefault("map_save_queue_size", "64");
 	settings->setDefault("chat_message_max_size", "500");
 	settings->setDefault("chat_message_limit_per_10sec", "8.0");
 	settings->setDefault("chat_message_limit_trigger_kick", "50");
@@ -389,6 +398,8 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("dedicated_server_step", "0.09");
 	settings->setDefault("active_block_mgmt_interval", "2.0");
 	settings->setDefault("abm_interval", "1.0");
+	settings->setDefault("abm_threads", "0");
+	settings->setDefault("lbm_time_budget", "0");
 	settings->setDefault("nodetimer_interval", "0.2");
 	settings->setDefault("ignore_world_load_errors", "false");
 	settings->setDefault("remote_media", "");
@@ -398,6 +409,7 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("emergequeue_limit_diskonly", "64");
 	settings->setDefault("emergequeue_limit_generate", "64");
 	settings->setDefault("num_emerge_threads", "1");
+	settings->setDefault("noise_tile_cache_size", "32");
 	settings->setDefault("secure.enable_security", "true");
 	settings->setDefault("secure.trusted_mods", "");
 	settings->setDefault("secure.http_mods", "");
@@ -420,6 +432,7 @@ void set_default_settings(Settings *settings)
 	settings->setDefault("liquid_loop_max", "100000");
 	settings->setDefault("liquid_queue_purge_time", "0");
 	settings->setDefault("liquid_update", "1.0");
+	settings->setDefault("liquid_threads", "0");
 
 	// Mapgen
 	settings->setDefault("mg_name", "v7");
@@ -21,8 +21,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge.h"
 
+#include <cstdlib>
 #include <iostream>
 #include <queue>
+#include <vector>
 
 #include "util/container.h"
 #include "util/thread.h"
@@ -31,6 +33,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "config.h"
 #include "constants.h"
 #include "environment.h"
+#include "filesys.h"
 #include "log.h"
 #include "map.h"
 #include "mapblock.h"
@@ -39,13 +42,19 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapgen/mg_decoration.h"
 #include "mapgen/mg_schematic.h"
 #include "nodedef.h"
+#include "noise_tile_cache.h"
 #include "profiler.h"
+#include "scripting_emerge.h"
 #include "scripting_server.h"
 #include "server.h"
 #include "serverobject.h"
 #include "settings.h"
 #include "voxel.h"
 
+// Maximum number of queued blocks an emerge thread reads from the
+// database with a single query
+#define EMERGE_BATCH_SIZE 16
+
 class EmergeThread : public Thread {
 public:
 	bool enable_mapgen_debug_info;
@@ -75,13 +84,29 @@ class EmergeThread : public Thread {
 	Event m_queue_event;
 	std::queue<v3s16> m_block_queue;
 
-	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
-
-	EmergeAction getBlockOrStartGen(
-		const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *data);
+	bool popBlockEmerges(std::vector<v3s16> *pos,
+		std::vector<BlockEmergeData> *bedata);
+	// Reads and deserializes the blocks that are not in memory, mostly
+	// without the environment lock. The blocks in loaded are not part of the
+	// map yet.
+	void readBlocks(const std::vector<v3s16> &pos,
+		std::vector<std::string> *blobs, std::vector<bool> *have_blob,
+		std::vector<MapBlock *> *loaded);
+
+	// Takes ownership of loaded
+	EmergeAction getBlockOrStartGen(const v3s16 &pos, bool allow_gen,
+		const std::string *blob, MapBlock *loaded, MapBlock **block,
+		BlockMakeData *data);
 	MapBlock *finishGen(v3s16 pos, BlockMakeData *bmdata,
 		std::map<v3s16, MapBlock *> *modified_blocks);
 
+	// Lua environment of this thread for the mapgen scripts of mods, NULL
+	// if there are none. Only used by this thread.
+	EmergeScripting *m_script = nullptr;
+
+	void initScripting();
+	void runScripts(BlockMakeData *bmdata);
+
 	friend class EmergeManager;
 };
 
@@ -152,6 +177,9 @@ EmergeManager::EmergeManager(Server *server)
 	if (m_qlimit_generate < 1)
 		m_qlimit_generate = 1;
 
+	g_noise_tile_cache.setMaxBytes(
+		(size_t)g_settings->getU32("noise_tile_cache_size") * 1024 * 1024);
+
 	for (s16 i = 0; i < nthreads; i++)
 		m_threads.push_back(new EmergeThread(server, i));
 
@@ -181,6 +209,9 @@ EmergeManager::~EmergeManager()
 	delete oremgr;
 	delete decomgr;
 	delete schemmgr;
+
+	// The maps of this world are not needed anymore
+	g_noise_tile_cache.setMaxBytes(0);
 }
 
 
@@ -195,17 +226,25 @@ void EmergeManager::initMapgens(MapgenParams *params)
 }
 
 
+// Mapgen of the emerge thread running, set by the thread itself. Looking the
+// thread up in m_threads is not safe while stopThreads() joins them.
+static thread_local Mapgen *t_current_mapgen = nullptr;
+
 Mapgen *EmergeManager::getCurrentMapgen()
 {
-	if (!m_threads_active)
-		return nullptr;
+	return t_current_mapgen;
+}
 
-	for (u32 i = 0; i != m_threads.size(); i++) {
-		if (m_threads[i]->isCurrentThread())
-			return m_threads[i]->m_mapgen;
-	}
 
-	return nullptr;
+bool EmergeManager::addMapgenScript(const std::string &mod_name,
+	const std::string &path)
+{
+	// The threads load the scripts when they start
+	if (!m_mapgens.empty())
+		return false;
+
+	m_mapgen_scripts.emplace_back(mod_name, path);
+	return true;
 }
 
 
@@ -503,40 +542,113 @@ void EmergeThread::runCompletionCallbacks(const v3s16 &pos, EmergeAction action,
 }
 
 
-bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
+bool EmergeThread::popBlockEmerges(std::vector<v3s16> *pos,
+	std::vector<BlockEmergeData> *bedata)
 {
 	MutexAutoLock queuelock(m_emerge->m_queue_mutex);
 
-	if (m_block_queue.empty())
-		return false;
+	pos->clear();
+	bedata->clear();
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
+	/*
+		Queued blocks usually come in batches around a player, take them
+		all at once so that they can be read from the database together.
+		The queue order is kept, the batch ends at the first block that
+		is not next to the previous one.
+	*/
+	while (!m_block_queue.empty() && pos->size() < EMERGE_BATCH_SIZE) {
+		v3s16 p = m_block_queue.front();
+		if (!pos->empty()) {
+			v3s16 d = p - pos->back();
+			if (std::abs(d.X) > 1 || std::abs(d.Y) > 1 || std::abs(d.Z) > 1)
+				break;
+		}
+		m_block_queue.pop();
 
-	m_emerge->popBlockEmergeData(*pos, bedata);
+		BlockEmergeData data;
+		m_emerge->popBlockEmergeData(p, &data);
+		pos->push_back(p);
+		bedata->push_back(data);
+	}
 
-	return true;
+	return !pos->empty();
+}
+
+
+void EmergeThread::readBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blobs, std::vector<bool> *have_blob,
+	std::vector<MapBlock *> *loaded)
+{
+	blobs->assign(pos.size(), "");
+	have_blob->assign(pos.size(), false);
+	loaded->assign(pos.size(), nullptr);
+
+	// Blocks that are already in memory don't need to be read
+	std::vector<v3s16> to_read;
+	std::vector<size_t> to_read_i;
+	{
+		MutexAutoLock envlock(m_server->m_env_mutex);
+		for (size_t i = 0; i < pos.size(); i++) {
+			if (blockpos_over_max_limit(pos[i]))
+				continue;
+			MapBlock *block = m_map->getBlockNoCreateNoEx(pos[i]);
+			if (block && !block->isDummy())
+				continue;
+			m_map->startReadingBlock(pos[i]);
+			to_read.push_back(pos[i]);
+			to_read_i.push_back(i);
+		}
+	}
+	if (to_read.empty())
+		return;
+
+	// The map database and deserializing don't need the environment
+	std::vector<std::string> read;
+	m_map->readBlocks(to_read, &read);
+	for (size_t i = 0; i < to_read.size(); i++) {
+		size_t j = to_read_i[i];
+		(*blobs)[j].swap(read[i]);
+		(*have_blob)[j] = true;
+		(*loaded)[j] = m_map->deSerializeBlock(to_read[i], (*blobs)[j]);
+	}
+
+	g_profiler->avg(PROFILER_KEY("EmergeThread: blocks read per query"), to_read.size());
 }
 
 
-EmergeAction EmergeThread::getBlockOrStartGen(
-	const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *bmdata)
+EmergeAction EmergeThread::getBlockOrStartGen(const v3s16 &pos, bool allow_gen,
+	const std::string *blob, MapBlock *loaded, MapBlock **block,
+	BlockMakeData *bmdata)
 {
 	MutexAutoLock envlock(m_server->m_env_mutex);
 
+	// What was read is not used if the block was saved or generated since
+	if (blob && !m_map->finishReadingBlock(pos)) {
+		delete loaded;
+		loaded = nullptr;
+		blob = nullptr;
+	}
+
 	// 1). Attempt to fetch block from memory
 	*block = m_map->getBlockNoCreateNoEx(pos);
 	if (*block && !(*block)->isDummy()) {
+		delete loaded;
 		if ((*block)->isGenerated())
 			return EMERGE_FROM_MEMORY;
+	} else if (loaded && !*block) {
+		// 2). Insert the block loaded from disk
+		*block = m_map->insertLoadedBlock(loaded);
+		if ((*block)->isGenerated())
+			return EMERGE_FROM_DISK;
 	} else {
-		// 2). Attempt to load block from disk if it was not in the memory
-		*block = m_map->loadBlock(pos);
+		// 3). Attempt to load block from disk if it was not in the memory
+		delete loaded;
+		*block = blob ? m_map->loadBlock(pos, *blob) : m_map->loadBlock(pos);
 		if (*block && (*block)->isGenerated())
 			return EMERGE_FROM_DISK;
 	}
 
-	// 3). Attempt to start generation
+	// 4). Attempt to start generation
 	if (allow_gen && m_map->initBlockMake(pos, bmdata))
 		return EMERGE_GENERATED;
 
@@ -550,7 +662,7 @@ MapBlock *EmergeThread::finishGen(v3s16 pos, BlockMakeData *bmdata,
 {
 	MutexAutoLock envlock(m_server->m_env_mutex);
 	ScopeProfiler sp(g_profiler,
-		"EmergeThread: after Mapgen::makeChunk", SPT_AVG);
+		SCOPE_PROFILER_KEY("EmergeThread: after Mapgen::makeChunk"), SPT_AVG);
 
 	/*
 		Perform post-processing on blocks (invalidate lighting, queue liquid
@@ -612,45 +724,76 @@ void *EmergeThread::run()
 	m_emerge = m_server->m_emerge;
 	m_mapgen = m_emerge->m_mapgens[id];
 	enable_mapgen_debug_info = m_emerge->enable_mapgen_debug_info;
+	t_current_mapgen = m_mapgen;
+
+	initScripting();
+
+	std::vector<v3s16> batch;
+	std::vector<BlockEmergeData> batch_data;
+	std::vector<std::string> blobs;
+	std::vector<bool> have_blob;
+	std::vector<MapBlock *> loaded;
 
 	try {
 	while (!stopRequested()) {
-		std::map<v3s16, MapBlock *> modified_blocks;
-		BlockEmergeData bedata;
-		BlockMakeData bmdata;
-		EmergeAction action;
-		MapBlock *block;
-
-		if (!popBlockEmerge(&pos, &bedata)) {
+		if (!popBlockEmerges(&batch, &batch_data)) {
 			m_queue_event.wait();
 			continue;
 		}
 
-		if (blockpos_over_max_limit(pos))
-			continue;
-
-		bool allow_gen = bedata.flags & BLOCK_EMERGE_ALLOW_GEN;
-		EMERGE_DBG_OUT("pos=" PP(pos) " allow_gen=" << allow_gen);
-
-		action = getBlockOrStartGen(pos, allow_gen, &block, &bmdata);
-		if (action == EMERGE_GENERATED) {
-			{
-				ScopeProfiler sp(g_profiler,
-					"EmergeThread: Mapgen::makeChunk", SPT_AVG);
-
-				m_mapgen->makeChunk(&bmdata);
+		readBlocks(batch, &blobs, &have_blob, &loaded);
+
+		for (size_t i = 0; i < batch.size(); i++) {
+			std::map<v3s16, MapBlock *> modified_blocks;
+			const BlockEmergeData &bedata = batch_data[i];
+			BlockMakeData bmdata;
+			EmergeAction action;
+			MapBlock *block;
+
+			pos = batch[i];
+			if (blockpos_over_max_limit(pos))
+				continue;
+			MapBlock *loaded_block = loaded[i];
+			loaded[i] = nullptr;
+
+			bool allow_gen = bedata.flags & BLOCK_EMERGE_ALLOW_GEN;
+			EMERGE_DBG_OUT("pos=" PP(pos) " allow_gen=" << allow_gen);
+
+			// If the block got loaded or generated in the meantime, it is
+			// taken from memory and the data read before is not used
+			action = getBlockOrStartGen(pos, allow_gen,
+				have_blob[i] ? &blobs[i] : NULL, loaded_block, &block, &bmdata);
+			if (action == EMERGE_GENERATED) {
+				{
+					ScopeProfiler sp(g_profiler,
+						SCOPE_PROFILER_KEY("EmergeThread: Mapgen::makeChunk"), SPT_AVG);
+
+					m_mapgen->makeChunk(&bmdata);
+				}
+
+				u32 cache_hits, cache_misses;
+				g_noise_tile_cache.takeStats(&cache_hits, &cache_misses);
+				g_profiler->avg(PROFILER_KEY("EmergeThread: noise tile cache hits"),
+					cache_hits);
+				g_profiler->avg(PROFILER_KEY("EmergeThread: noise tile cache misses"),
+					cache_misses);
+
+				// Still without the environment lock, what the scripts
+				// changed in the VoxelManip is blitted back by finishGen
+				if (m_script)
+					runScripts(&bmdata);
+
+				block = finishGen(pos, &bmdata, &modified_blocks);
 			}
 
-			block = finishGen(pos, &bmdata, &modified_blocks);
-		}
-
-		runCompletionCallbacks(pos, action, bedata.callbacks);
+			runCompletionCallbacks(pos, action, bedata.callbacks);
 
-		if (block)
-			modified_blocks[pos] = block;
+			if (block)
+				modified_blocks[pos] = block;
 
-		if (!modified_blocks.empty())
-			m_server->SetBlocksNotSent(modified_blocks);
+			if (!modified_blocks.empty())
+				m_server->SetBlocksNotSent(modified_blocks);
+		}
 	}
 	} catch (VersionMismatchException &e) {
 		std::ostringstream err;
@@ -672,6 +815,54 @@ void *EmergeThread::run()
 		m_server->setAsyncFatalError(err.str());
 	}
 
+	// The Lua state belongs to this thread
+	delete m_script;
+	m_script = nullptr;
+	t_current_mapgen = nullptr;
+
 	END_DEBUG_EXCEPTION_HANDLER
 	return NULL;
 }
+
+
+void EmergeThread::initScripting()
+{
+	const auto &scripts = m_emerge->getMapgenScripts();
+	if (scripts.empty() || m_script)
+		return;
+
+	m_script = new EmergeScripting(m_server);
+	try {
+		m_script->loadMod(m_server->getBuiltinLuaPath() + DIR_DELIM "init.lua",
+			BUILTIN_MOD_NAME);
+		for (const auto &script : scripts)
+			m_script->loadMod(script.second, script.first);
+	} catch (const ModError &e) {
+		m_server->setAsyncFatalError("Lua: emerge thread: " +
+			std::string(e.what()));
+		// Keeps generating until the server shuts down
+		delete m_script;
+		m_script = nullptr;
+		return;
+	}
+
+	infostream << "EmergeThread " << id << ": loaded " << scripts.size()
+		<< " mapgen scripts" << std::endl;
+}
+
+
+void EmergeThread::runScripts(BlockMakeData *bmdata)
+{
+	ScopeProfiler sp(g_profiler,
+		SCOPE_PROFILER_KEY("EmergeThread: mapgen scripts"), SPT_AVG);
+
+	v3s16 minp = bmdata->blockpos_min * MAP_BLOCKSIZE;
+	v3s16 maxp = bmdata->blockpos_max * MAP_BLOCKSIZE +
+				 v3s16(1,1,1) * (MAP_BLOCKSIZE - 1);
+
+	try {
+		m_script->on_generated(minp, maxp, m_mapgen->blockseed);
+	} catch (LuaError &e) {
+		m_server->setAsyncFatalError("Lua: runScripts: " + std::string(e.what()));
+	}
+}
@@ -140,6 +140,14 @@ class EmergeManager {
 
 	Mapgen *getCurrentMapgen();
 
+	// Scripts run by every emerge thread in its own Lua environment.
+	// Returns false once the mapgens exist.
+	bool addMapgenScript(const std::string &mod_name, const std::string &path);
+	const std::vector<std::pair<std::string, std::string>> &getMapgenScripts()
+	{
+		return m_mapgen_scripts;
+	}
+
 	// Mapgen helpers methods
 	int getSpawnLevelAtPoint(v2s16 p);
 	int getGroundLevelAtPoint(v2s16 p);
@@ -151,6 +159,8 @@ class EmergeManager {
 	std::vector<Mapgen *> m_mapgens;
 	std::vector<EmergeThread *> m_threads;
 	bool m_threads_active = false;
+	// Mod name and path, only changed while mods are loaded
+	std::vector<std::pair<std::string, std::string>> m_mapgen_scripts;
 
 	std::mutex m_queue_mutex;
 	std::map<v3s16, BlockEmergeData> m_blocks_enqueued;
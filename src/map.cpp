@@ -44,7 +44,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "database/database.h"
 #include "database/database-dummy.h"
 #include "database/database-sqlite3.h"
+#include "database/database-writebehind.h"
 #include "script/scripting_server.h"
+#include "serverenvironment.h"
+#include "threading/worker_pool.h"
+#include "util/blockpos_map.h"
 #include <deque>
 #include <queue>
 #if USE_LEVELDB
@@ -124,12 +128,29 @@ MapSector * Map::getSectorNoGenerate(v2s16 p)
 
 MapBlock * Map::getBlockNoCreateNoEx(v3s16 p3d)
 {
-	v2s16 p2d(p3d.X, p3d.Z);
-	MapSector * sector = getSectorNoGenerate(p2d);
-	if(sector == NULL)
-		return NULL;
-	MapBlock *block = sector->getBlockNoCreateNoEx(p3d.Y);
-	return block;
+	MapBlock *cached = m_block_cache;
+	if (cached && cached->getPos() == p3d)
+		return cached;
+
+	MapBlock **block = m_blocks.find(p3d);
+	if (!block)
+		return nullptr;
+
+	// Cache the last result
+	m_block_cache = *block;
+	return *block;
+}
+
+void Map::indexBlock(MapBlock *block)
+{
+	m_blocks[block->getPos()] = block;
+}
+
+void Map::unindexBlock(MapBlock *block)
+{
+	if (block == m_block_cache)
+		m_block_cache = nullptr;
+	m_blocks.erase(block->getPos());
 }
 
 MapBlock * Map::getBlockNoCreate(v3s16 p3d)
@@ -323,7 +344,7 @@ struct TimeOrderedMapBlock {
 	Updates usage timers
 */
 void Map::timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
-		std::vector<v3s16> *unloaded_blocks)
+		std::vector<v3s16> *unloaded_blocks, const BlockPosSet *keep_loaded)
 {
 	bool save_before_unloading = (mapType() == MAPTYPE_SERVER);
 
@@ -407,6 +428,11 @@ void Map::timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
 
 			v3s16 p = block->getPos();
 
+			// Their usage timer is reset by the environment, but other
+			// blocks can be as recently used
+			if (keep_loaded && keep_loaded->contains(p))
+				continue;
+
 			// Save if modified
 			if (block->getModified() != MOD_STATE_CLEAN && save_before_unloading) {
 				modprofiler.add(block->getModifiedReasonString(), 1);
@@ -438,6 +464,8 @@ void Map::timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
 
 	if(deleted_blocks_count != 0)
 	{
+		MapBlock::trimPools();
+
 		PrintInfo(infostream); // ServerMap/ClientMap:
 		infostream<<"Unloaded "<<deleted_blocks_count
 				<<" blocks from memory";
@@ -504,8 +532,428 @@ void Map::transforming_liquid_add(v3s16 p) {
         m_transforming_liquid.push_back(p);
 }
 
+/*
+	What a queued node turns into, decided from the node and its neighbours
+*/
+struct LiquidUpdate {
+	v3s16 p;
+	MapNode old_node;
+	MapNode new_node;
+	LiquidType liquid_type;
+	// The node which will be placed there if liquid
+	// can't flow into this node.
+	content_t floodable_node;
+	bool changed;
+	// Viscosity kept the node from reaching its level yet
+	bool reflow;
+	NodeNeighbor flows[6]; // surrounding flowing liquid nodes
+	int num_flows;
+	NodeNeighbor airs[6]; // surrounding air
+	int num_airs;
+};
+
+/*
+	Decides on the new state of the node at p0, get_node(p) has to return
+	the node at p like Map::getNode() does.
+	Returns false if the node can't be changed by liquids at all.
+*/
+template <typename GetNode>
+static bool compute_liquid_update(const NodeDefManager *nodedef, v3s16 p0,
+		GetNode &&get_node, LiquidUpdate &u)
+{
+	u.p = p0;
+	u.old_node = get_node(p0);
+	u.changed = false;
+	u.reflow = false;
+	u.num_flows = 0;
+	u.num_airs = 0;
+
+	MapNode n0 = u.old_node;
+
+	/*
+		Collect information about current node
+	 */
+	s8 liquid_level = -1;
+	// The liquid node which will be placed there if
+	// the liquid flows into this node.
+	content_t liquid_kind = CONTENT_IGNORE;
+	content_t floodable_node = CONTENT_AIR;
+	const ContentFeatures &cf = nodedef->get(n0);
+	LiquidType liquid_type = cf.liquid_type;
+	switch (liquid_type) {
+		case LIQUID_SOURCE:
+			liquid_level = LIQUID_LEVEL_SOURCE;
+			liquid_kind = nodedef->getId(cf.liquid_alternative_flowing);
+			break;
+		case LIQUID_FLOWING:
+			liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
+			liquid_kind = n0.getContent();
+			break;
+		case LIQUID_NONE:
+			// if this node is 'floodable', it *could* be transformed
+			// into a liquid, otherwise, continue with the next node.
+			if (!cf.floodable)
+				return false;
+			floodable_node = n0.getContent();
+			liquid_kind = CONTENT_AIR;
+			break;
+	}
+	u.liquid_type = liquid_type;
+	u.floodable_node = floodable_node;
+
+	/*
+		Collect information about the environment
+	 */
+	const v3s16 *dirs = g_6dirs;
+	NodeNeighbor sources[6]; // surrounding sources
+	int num_sources = 0;
+	NodeNeighbor *flows = u.flows;
+	int &num_flows = u.num_flows;
+	NodeNeighbor *airs = u.airs;
+	int &num_airs = u.num_airs;
+	NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
+	int num_neutrals = 0;
+	bool flowing_down = false;
+	bool ignored_sources = false;
+	for (u16 i = 0; i < 6; i++) {
+		NeighborType nt = NEIGHBOR_SAME_LEVEL;
+		switch (i) {
+			case 1:
+				nt = NEIGHBOR_UPPER;
+				break;
+			case 4:
+				nt = NEIGHBOR_LOWER;
+				break;
+			default:
+				break;
+		}
+		v3s16 npos = p0 + dirs[i];
+		NodeNeighbor nb(get_node(npos), nt, npos);
+		const ContentFeatures &cfnb = nodedef->get(nb.n);
+		switch (nodedef->get(nb.n.getContent()).liquid_type) {
+			case LIQUID_NONE:
+				if (cfnb.floodable) {
+					airs[num_airs++] = nb;
+					// if the current node happens to be a flowing node, it will start to flow down here.
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				} else {
+					neutrals[num_neutrals++] = nb;
+					if (nb.n.getContent() == CONTENT_IGNORE) {
+						// If node below is ignore prevent water from
+						// spreading outwards and otherwise prevent from
+						// flowing away as ignore node might be the source
+						if (nb.t == NEIGHBOR_LOWER)
+							flowing_down = true;
+						else
+							ignored_sources = true;
+					}
+				}
+				break;
+			case LIQUID_SOURCE:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = nodedef->getId(cfnb.liquid_alternative_flowing);
+				if (nodedef->getId(cfnb.liquid_alternative_flowing) != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					// Do not count bottom source, it will screw things up
+					if(dirs[i].Y != -1)
+						sources[num_sources++] = nb;
+				}
+				break;
+			case LIQUID_FLOWING:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = nodedef->getId(cfnb.liquid_alternative_flowing);
+				if (nodedef->getId(cfnb.liquid_alternative_flowing) != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					flows[num_flows++] = nb;
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				}
+				break;
+		}
+	}
+
+	/*
+		decide on the type (and possibly level) of the current node
+	 */
+	content_t new_node_content;
+	s8 new_node_level = -1;
+	s8 max_node_level = -1;
+
+	u8 range = nodedef->get(liquid_kind).liquid_range;
+	if (range > LIQUID_LEVEL_MAX + 1)
+		range = LIQUID_LEVEL_MAX + 1;
+
+	if ((num_sources >= 2 && nodedef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
+		// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
+		// or the flowing alternative of the first of the surrounding sources (if it's air), so
+		// it's perfectly safe to use liquid_kind here to determine the new node content.
+		new_node_content = nodedef->getId(nodedef->get(liquid_kind).liquid_alternative_source);
+	} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
+		// liquid_kind is set properly, see above
+		max_node_level = new_node_level = LIQUID_LEVEL_MAX;
+		if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+	} else if (ignored_sources && liquid_level >= 0) {
+		// Maybe there are neighbouring sources that aren't loaded yet
+		// so prevent flowing away.
+		new_node_level = liquid_level;
+		new_node_content = liquid_kind;
+	} else {
+		// no surrounding sources, so get the maximum level that can flow into this node
+		for (u16 i = 0; i < num_flows; i++) {
+			u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
+			switch (flows[i].t) {
+				case NEIGHBOR_UPPER:
+					if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
+						max_node_level = LIQUID_LEVEL_MAX;
+						if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
+							max_node_level = nb_liquid_level + WATER_DROP_BOOST;
+					} else if (nb_liquid_level > max_node_level) {
+						max_node_level = nb_liquid_level;
+					}
+					break;
+				case NEIGHBOR_LOWER:
+					break;
+				case NEIGHBOR_SAME_LEVEL:
+					if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
+							nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
+						max_node_level = nb_liquid_level - 1;
+					break;
+			}
+		}
+
+		u8 viscosity = nodedef->get(liquid_kind).liquid_viscosity;
+		if (viscosity > 1 && max_node_level != liquid_level) {
+			// amount to gain, limited by viscosity
+			// must be at least 1 in absolute value
+			s8 level_inc = max_node_level - liquid_level;
+			if (level_inc < -viscosity || level_inc > viscosity)
+				new_node_level = liquid_level + level_inc/viscosity;
+			else if (level_inc < 0)
+				new_node_level = liquid_level - 1;
+			else if (level_inc > 0)
+				new_node_level = liquid_level + 1;
+			if (new_node_level != max_node_level)
+				u.reflow = true;
+		} else {
+			new_node_level = max_node_level;
+		}
+
+		if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+
+	}
+
+	/*
+		check if anything has changed. if not, just continue with the next node.
+	 */
+	if (new_node_content == n0.getContent() &&
+			(nodedef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
+			((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
+			((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
+			== flowing_down)))
+		return true;
+
+	/*
+		update the current node
+	 */
+	//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
+	if (nodedef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
+		// set level to last 3 bits, flowing down bit to 4th bit
+		n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
+	} else {
+		// set the liquid level and flow bit to 0
+		n0.param2 = ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
+	}
+
+	// change the node.
+	n0.setContent(new_node_content);
+
+	u.new_node = n0;
+	u.changed = true;
+	return true;
+}
+
+void Map::applyLiquidUpdate(const LiquidUpdate &u, ServerEnvironment *env,
+		std::deque<v3s16> &must_reflow,
+		std::vector<std::pair<v3s16, MapNode> > &changed_nodes,
+		std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	// if the current node is a water source the neighbor
+	// should be enqueded for transformation regardless of whether the
+	// current node changes or not.
+	if (u.liquid_type != LIQUID_NONE) {
+		for (int i = 0; i < u.num_airs; i++)
+			if (u.airs[i].t != NEIGHBOR_UPPER)
+				m_transforming_liquid.push_back(u.airs[i].p);
+	}
+
+	if (u.reflow)
+		must_reflow.push_back(u.p);
+
+	if (!u.changed)
+		return;
+
+	v3s16 p0 = u.p;
+	MapNode n00 = u.old_node;
+	MapNode n0 = u.new_node;
+
+	// on_flood() the node
+	if (u.floodable_node != CONTENT_AIR) {
+		if (env->getScriptIface()->node_on_flood(p0, n00, n0))
+			return;
+	}
+
+	// Ignore light (because calling voxalgo::update_lighting_nodes)
+	n0.setLight(LIGHTBANK_DAY, 0, m_nodedef);
+	n0.setLight(LIGHTBANK_NIGHT, 0, m_nodedef);
+
+	// Find out whether there is a suspect for this action
+	std::string suspect;
+	if (m_gamedef->rollback())
+		suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
+
+	if (m_gamedef->rollback() && !suspect.empty()) {
+		// Blame suspect
+		RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
+		// Get old node for rollback
+		RollbackNode rollback_oldnode(this, p0, m_gamedef);
+		// Set node
+		setNode(p0, n0);
+		// Report
+		RollbackNode rollback_newnode(this, p0, m_gamedef);
+		RollbackAction action;
+		action.setSetNode(p0, rollback_oldnode, rollback_newnode);
+		m_gamedef->rollback()->reportAction(action);
+	} else {
+		// Set node
+		setNode(p0, n0);
+	}
+
+	v3s16 blockpos = getNodeBlockPos(p0);
+	MapBlock *block = getBlockNoCreateNoEx(blockpos);
+	if (block != NULL) {
+		modified_blocks[blockpos] =  block;
+		changed_nodes.emplace_back(p0, n00);
+	}
+
+	/*
+		enqueue neighbors for update if neccessary
+	 */
+	switch (m_nodedef->get(n0.getContent()).liquid_type) {
+		case LIQUID_SOURCE:
+		case LIQUID_FLOWING:
+			// make sure source flows into all neighboring nodes
+			for (u16 i = 0; i < u.num_flows; i++)
+				if (u.flows[i].t != NEIGHBOR_UPPER)
+					m_transforming_liquid.push_back(u.flows[i].p);
+			for (u16 i = 0; i < u.num_airs; i++)
+				if (u.airs[i].t != NEIGHBOR_UPPER)
+					m_transforming_liquid.push_back(u.airs[i].p);
+			break;
+		case LIQUID_NONE:
+			// this flow has turned to air; neighboring flows might need to do the same
+			for (u16 i = 0; i < u.num_flows; i++)
+				m_transforming_liquid.push_back(u.flows[i].p);
+			break;
+	}
+}
+
+/*
+	Computes the updates of a batch of queued nodes on the worker threads,
+	reading the map only. The batch is split by mapblock; every node sees
+	the map as it was before the batch, so changes on the border of two
+	mapblocks reach the other side in the next step, no matter which thread
+	handled which mapblock. The updates are then applied in queue order on
+	the calling thread, which keeps the result deterministic.
+*/
+void Map::transformLiquidsParallel(const std::vector<v3s16> &batch,
+		WorkerPool *pool, ServerEnvironment *env,
+		std::deque<v3s16> &must_reflow,
+		std::vector<std::pair<v3s16, MapNode> > &changed_nodes,
+		std::map<v3s16, MapBlock*> &modified_blocks)
+{
+	struct Region {
+		v3s16 blockpos;
+		// Block and its neighbours, indexed by (x+1)*9 + (y+1)*3 + (z+1)
+		MapBlock *blocks[27];
+		// Indices into the batch
+		std::vector<u32> nodes;
+	};
+
+	std::vector<Region> regions;
+	BlockPosMap<u32> region_index;
+	for (u32 i = 0; i < batch.size(); i++) {
+		v3s16 blockpos = getNodeBlockPos(batch[i]);
+		u32 &index = region_index[blockpos];
+		if (index == 0) {
+			regions.emplace_back();
+			regions.back().blockpos = blockpos;
+			index = regions.size();
+		}
+		regions[index - 1].nodes.push_back(i);
+	}
+
+	for (Region &region : regions) {
+		v3s16 d;
+		for (d.X = -1; d.X <= 1; d.X++)
+		for (d.Y = -1; d.Y <= 1; d.Y++)
+		for (d.Z = -1; d.Z <= 1; d.Z++) {
+			region.blocks[(d.X + 1) * 9 + (d.Y + 1) * 3 + (d.Z + 1)] =
+				getBlockNoCreateNoEx(region.blockpos + d);
+		}
+	}
+
+	std::vector<LiquidUpdate> updates(batch.size());
+	// Not std::vector<bool>, the threads write to neighbouring elements
+	std::vector<u8> floodable(batch.size());
+	const NodeDefManager *nodedef = m_nodedef;
+
+	pool->run(regions.size(), [&] (size_t job, u16 worker) {
+		const Region &region = regions[job];
+		v3s16 origin = region.blockpos * MAP_BLOCKSIZE;
+		auto get_node = [&] (v3s16 p) -> MapNode {
+			v3s16 rel = p - origin;
+			// Offset of the block containing p, -1, 0 or 1 on each axis
+			v3s16 d(
+				(rel.X + MAP_BLOCKSIZE) / MAP_BLOCKSIZE - 1,
+				(rel.Y + MAP_BLOCKSIZE) / MAP_BLOCKSIZE - 1,
+				(rel.Z + MAP_BLOCKSIZE) / MAP_BLOCKSIZE - 1);
+			MapBlock *block = region.blocks[(d.X + 1) * 9 + (d.Y + 1) * 3 + (d.Z + 1)];
+			if (!block)
+				return {CONTENT_IGNORE};
+			bool is_valid;
+			return block->getNodeNoCheck(rel - d * MAP_BLOCKSIZE, &is_valid);
+		};
+		for (u32 i : region.nodes)
+			floodable[i] = compute_liquid_update(nodedef, batch[i], get_node,
+				updates[i]);
+	});
+
+	for (u32 i = 0; i < batch.size(); i++) {
+		if (!floodable[i])
+			continue;
+		const LiquidUpdate &u = updates[i];
+		// A node callback of an earlier update might have changed the node
+		if (u.changed && !(getNode(u.p) == u.old_node)) {
+			m_transforming_liquid.push_back(u.p);
+			continue;
+		}
+		applyLiquidUpdate(u, env, must_reflow, changed_nodes, modified_blocks);
+	}
+}
+
 void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
-		ServerEnvironment *env)
+		ServerEnvironment *env, WorkerPool *pool)
 {
 	u32 loopcount = 0;
 	u32 initial_size = m_transforming_liquid.size();
@@ -538,7 +986,23 @@ void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 	loop_max *= m_transforming_liquid_loop_count_multiplier;
 #endif
 
-	while (m_transforming_liquid.size() != 0)
+	TimeTaker timer("transformLiquids", nullptr, PRECISION_MICRO);
+	g_profiler->avg(PROFILER_KEY("Server: liquid queue length"), initial_size);
+
+	if (pool) {
+		std::vector<v3s16> batch;
+		batch.reserve(MYMIN(initial_size, loop_max));
+		while (batch.size() < initial_size && batch.size() < loop_max) {
+			batch.push_back(m_transforming_liquid.front());
+			m_transforming_liquid.pop_front();
+		}
+		loopcount = batch.size();
+
+		transformLiquidsParallel(batch, pool, env, must_reflow,
+			changed_nodes, modified_blocks);
+	}
+
+	while (!pool && m_transforming_liquid.size() != 0)
 	{
 		// This should be done here so that it is done when continue is used
 		if (loopcount >= initial_size || loopcount >= loop_max)
@@ -551,282 +1015,12 @@ void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 		v3s16 p0 = m_transforming_liquid.front();
 		m_transforming_liquid.pop_front();
 
-		MapNode n0 = getNode(p0);
-
-		/*
-			Collect information about current node
-		 */
-		s8 liquid_level = -1;
-		// The liquid node which will be placed there if
-		// the liquid flows into this node.
-		content_t liquid_kind = CONTENT_IGNORE;
-		// The node which will be placed there if liquid
-		// can't flow into this node.
-		content_t floodable_node = CONTENT_AIR;
-		const ContentFeatures &cf = m_nodedef->get(n0);
-		LiquidType liquid_type = cf.liquid_type;
-		switch (liquid_type) {
-			case LIQUID_SOURCE:
-				liquid_level = LIQUID_LEVEL_SOURCE;
-				liquid_kind = m_nodedef->getId(cf.liquid_alternative_flowing);
-				break;
-			case LIQUID_FLOWING:
-				liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
-				liquid_kind = n0.getContent();
-				break;
-			case LIQUID_NONE:
-				// if this node is 'floodable', it *could* be transformed
-				// into a liquid, otherwise, continue with the next node.
-				if (!cf.floodable)
-					continue;
-				floodable_node = n0.getContent();
-				liquid_kind = CONTENT_AIR;
-				break;
-		}
-
-		/*
-			Collect information about the environment
-		 */
-		const v3s16 *dirs = g_6dirs;
-		NodeNeighbor sources[6]; // surrounding sources
-		int num_sources = 0;
-		NodeNeighbor flows[6]; // surrounding flowing liquid nodes
-		int num_flows = 0;
-		NodeNeighbor airs[6]; // surrounding air
-		int num_airs = 0;
-		NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
-		int num_neutrals = 0;
-		bool flowing_down = false;
-		bool ignored_sources = false;
-		for (u16 i = 0; i < 6; i++) {
-			NeighborType nt = NEIGHBOR_SAME_LEVEL;
-			switch (i) {
-				case 1:
-					nt = NEIGHBOR_UPPER;
-					break;
-				case 4:
-					nt = NEIGHBOR_LOWER;
-					break;
-				default:
-					break;
-			}
-			v3s16 npos = p0 + dirs[i];
-			NodeNeighbor nb(getNode(npos), nt, npos);
-			const ContentFeatures &cfnb = m_nodedef->get(nb.n);
-			switch (m_nodedef->get(nb.n.getContent()).liquid_type) {
-				case LIQUID_NONE:
-					if (cfnb.floodable) {
-						airs[num_airs++] = nb;
-						// if the current node is a water source the neighbor
-						// should be enqueded for transformation regardless of whether the
-						// current node changes or not.
-						if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
-							m_transforming_liquid.push_back(npos);
-						// if the current node happens to be a flowing node, it will start to flow down here.
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					} else {
-						neutrals[num_neutrals++] = nb;
-						if (nb.n.getContent() == CONTENT_IGNORE) {
-							// If node below is ignore prevent water from
-							// spreading outwards and otherwise prevent from
-							// flowing away as ignore node might be the source
-							if (nb.t == NEIGHBOR_LOWER)
-								flowing_down = true;
-							else
-								ignored_sources = true;
-						}
-					}
-					break;
-				case LIQUID_SOURCE:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = m_nodedef->getId(cfnb.liquid_alternative_flowing);
-					if (m_nodedef->getId(cfnb.liquid_alternative_flowing) != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						// Do not count bottom source, it will screw things up
-						if(dirs[i].Y != -1)
-							sources[num_sources++] = nb;
-					}
-					break;
-				case LIQUID_FLOWING:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = m_nodedef->getId(cfnb.liquid_alternative_flowing);
-					if (m_nodedef->getId(cfnb.liquid_alternative_flowing) != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						flows[num_flows++] = nb;
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					}
-					break;
-			}
-		}
-
-		/*
-			decide on the type (and possibly level) of the current node
-		 */
-		content_t new_node_content;
-		s8 new_node_level = -1;
-		s8 max_node_level = -1;
-
-		u8 range = m_nodedef->get(liquid_kind).liquid_range;
-		if (range > LIQUID_LEVEL_MAX + 1)
-			range = LIQUID_LEVEL_MAX + 1;
-
-		if ((num_sources >= 2 && m_nodedef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
-			// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
-			// or the flowing alternative of the first of the surrounding sources (if it's air), so
-			// it's perfectly safe to use liquid_kind here to determine the new node content.
-			new_node_content = m_nodedef->getId(m_nodedef->get(liquid_kind).liquid_alternative_source);
-		} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
-			// liquid_kind is set properly, see above
-			max_node_level = new_node_level = LIQUID_LEVEL_MAX;
-			if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
-		} else if (ignored_sources && liquid_level >= 0) {
-			// Maybe there are neighbouring sources that aren't loaded yet
-			// so prevent flowing away.
-			new_node_level = liquid_level;
-			new_node_content = liquid_kind;
-		} else {
-			// no surrounding sources, so get the maximum level that can flow into this node
-			for (u16 i = 0; i < num_flows; i++) {
-				u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
-				switch (flows[i].t) {
-					case NEIGHBOR_UPPER:
-						if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
-							max_node_level = LIQUID_LEVEL_MAX;
-							if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
-								max_node_level = nb_liquid_level + WATER_DROP_BOOST;
-						} else if (nb_liquid_level > max_node_level) {
-							max_node_level = nb_liquid_level;
-						}
-						break;
-					case NEIGHBOR_LOWER:
-						break;
-					case NEIGHBOR_SAME_LEVEL:
-						if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
-								nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
-							max_node_level = nb_liquid_level - 1;
-						break;
-				}
-			}
-
-			u8 viscosity = m_nodedef->get(liquid_kind).liquid_viscosity;
-			if (viscosity > 1 && max_node_level != liquid_level) {
-				// amount to gain, limited by viscosity
-				// must be at least 1 in absolute value
-				s8 level_inc = max_node_level - liquid_level;
-				if (level_inc < -viscosity || level_inc > viscosity)
-					new_node_level = liquid_level + level_inc/viscosity;
-				else if (level_inc < 0)
-					new_node_level = liquid_level - 1;
-				else if (level_inc > 0)
-					new_node_level = liquid_level + 1;
-				if (new_node_level != max_node_level)
-					must_reflow.push_back(p0);
-			} else {
-				new_node_level = max_node_level;
-			}
-
-			if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
-
-		}
-
-		/*
-			check if anything has changed. if not, just continue with the next node.
-		 */
-		if (new_node_content == n0.getContent() &&
-				(m_nodedef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
-				((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
-				((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
-				== flowing_down)))
+		LiquidUpdate u;
+		if (!compute_liquid_update(m_nodedef, p0,
+				[this] (v3s16 p) { return getNode(p); }, u))
 			continue;
 
-
-		/*
-			update the current node
-		 */
-		MapNode n00 = n0;
-		//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
-		if (m_nodedef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
-			// set level to last 3 bits, flowing down bit to 4th bit
-			n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
-		} else {
-			// set the liquid level and flow bit to 0
-			n0.param2 = ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
-		}
-
-		// change the node.
-		n0.setContent(new_node_content);
-
-		// on_flood() the node
-		if (floodable_node != CONTENT_AIR) {
-			if (env->getScriptIface()->node_on_flood(p0, n00, n0))
-				continue;
-		}
-
-		// Ignore light (because calling voxalgo::update_lighting_nodes)
-		n0.setLight(LIGHTBANK_DAY, 0, m_nodedef);
-		n0.setLight(LIGHTBANK_NIGHT, 0, m_nodedef);
-
-		// Find out whether there is a suspect for this action
-		std::string suspect;
-		if (m_gamedef->rollback())
-			suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
-
-		if (m_gamedef->rollback() && !suspect.empty()) {
-			// Blame suspect
-			RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
-			// Get old node for rollback
-			RollbackNode rollback_oldnode(this, p0, m_gamedef);
-			// Set node
-			setNode(p0, n0);
-			// Report
-			RollbackNode rollback_newnode(this, p0, m_gamedef);
-			RollbackAction action;
-			action.setSetNode(p0, rollback_oldnode, rollback_newnode);
-			m_gamedef->rollback()->reportAction(action);
-		} else {
-			// Set node
-			setNode(p0, n0);
-		}
-
-		v3s16 blockpos = getNodeBlockPos(p0);
-		MapBlock *block = getBlockNoCreateNoEx(blockpos);
-		if (block != NULL) {
-			modified_blocks[blockpos] =  block;
-			changed_nodes.emplace_back(p0, n00);
-		}
-
-		/*
-			enqueue neighbors for update if neccessary
-		 */
-		switch (m_nodedef->get(n0.getContent()).liquid_type) {
-			case LIQUID_SOURCE:
-			case LIQUID_FLOWING:
-				// make sure source flows into all neighboring nodes
-				for (u16 i = 0; i < num_flows; i++)
-					if (flows[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(flows[i].p);
-				for (u16 i = 0; i < num_airs; i++)
-					if (airs[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(airs[i].p);
-				break;
-			case LIQUID_NONE:
-				// this flow has turned to air; neighboring flows might need to do the same
-				for (u16 i = 0; i < num_flows; i++)
-					m_transforming_liquid.push_back(flows[i].p);
-				break;
-		}
+		applyLiquidUpdate(u, env, must_reflow, changed_nodes, modified_blocks);
 	}
 	//infostream<<"Map::transformLiquids(): loopcount="<<loopcount<<std::endl;
 
@@ -835,6 +1029,13 @@ void Map::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 
 	voxalgo::update_lighting_nodes(this, changed_nodes, modified_blocks);
 
+	u64 time_us = timer.stop(true);
+	g_profiler->avg(PROFILER_KEY("Server: liquid nodes processed"), loopcount);
+	g_profiler->avg(PROFILER_KEY("Server: liquid nodes changed"), changed_nodes.size());
+	if (time_us > 0) {
+		g_profiler->avg(PROFILER_KEY("Server: liquid nodes processed per second"),
+			(float)loopcount * 1000000.0f / time_us);
+	}
 
 	/* ----------------------------------------------------------------------
 	 * Manage the queue so that it does not grow indefinately
@@ -961,6 +1162,7 @@ bool Map::setNodeMetadata(v3s16 p, NodeMetadata *meta)
 		return false;
 	}
 	block->m_node_metadata.set(p_rel, meta);
+	block->raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REPORT_META_CHANGE);
 	return true;
 }
 
@@ -976,6 +1178,7 @@ void Map::removeNodeMetadata(v3s16 p)
 		return;
 	}
 	block->m_node_metadata.remove(p_rel);
+	block->raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REPORT_META_CHANGE);
 }
 
 NodeTimer Map::getNodeTimer(v3s16 p)
@@ -993,7 +1196,7 @@ NodeTimer Map::getNodeTimer(v3s16 p)
 				<<std::endl;
 		return NodeTimer();
 	}
-	NodeTimer t = block->m_node_timers.get(p_rel);
+	NodeTimer t = block->getNodeTimer(p_rel);
 	NodeTimer nt(t.timeout, t.elapsed, p);
 	return nt;
 }
@@ -1015,7 +1218,7 @@ void Map::setNodeTimer(const NodeTimer &t)
 		return;
 	}
 	NodeTimer nt(t.timeout, t.elapsed, p_rel);
-	block->m_node_timers.set(nt);
+	block->setNodeTimer(nt);
 }
 
 void Map::removeNodeTimer(v3s16 p)
@@ -1029,7 +1232,7 @@ void Map::removeNodeTimer(v3s16 p)
 				<<std::endl;
 		return;
 	}
-	block->m_node_timers.remove(p_rel);
+	block->removeNodeTimer(p_rel);
 }
 
 bool Map::determineAdditionalOcclusionCheck(const v3s16 &pos_camera,
@@ -1197,6 +1400,15 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 	// Tell the EmergeManager about our MapSettingsManager
 	emerge->map_settings_mgr = &settings_mgr;
 
+	if (g_settings->getBool("map_compression_zstd")) {
+#if USE_ZSTD
+		m_save_version = SER_FMT_VER_ZSTD;
+#else
+		warningstream << "map_compression_zstd is set, but this build has "
+			"no zstd support. Saving blocks with zlib." << std::endl;
+#endif
+	}
+
 	/*
 		Try to load map; if not found, create a new one.
 	*/
@@ -1211,9 +1423,16 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 	}
 	std::string backend = conf.get("backend");
 	dbase = createDatabase(backend, savedir, conf);
+	if (backend != "dummy" && g_settings->getBool("map_save_async")) {
+		size_t queue_size = (size_t)g_settings->getU32("map_save_queue_size")
+			* 1024 * 1024;
+		dbase = new WriteBehindMapDatabase(dbase, backend, queue_size);
+		m_db_thread_safe = true;
+	}
 	if (conf.exists("readonly_backend")) {
 		std::string readonly_dir = savedir + DIR_DELIM + "readonly";
 		dbase_ro = createDatabase(conf.get("readonly_backend"), readonly_dir, conf);
+		m_db_thread_safe = false;
 	}
 	if (!conf.updateConfigFile(conf_path.c_str()))
 		errorstream << "ServerMap::ServerMap(): Failed to update world.mt!" << std::endl;
@@ -1355,6 +1574,9 @@ bool ServerMap::initBlockMake(v3s16 blockpos, BlockMakeData *data)
 	data->blockpos_requested = blockpos;
 	data->nodedef = m_nodedef;
 
+	// Blocks read from the database meanwhile would undo the generation
+	outdateBlockReads(VoxelArea(full_bpmin, full_bpmax));
+
 	/*
 		Create the whole area of this and the neighboring blocks
 	*/
@@ -1840,6 +2062,7 @@ void ServerMap::save(ModifiedState save_level)
 
 void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
+	auto lock = lockDatabase();
 	dbase->listAllLoadableBlocks(dst);
 	if (dbase_ro)
 		dbase_ro->listAllLoadableBlocks(dst);
@@ -1890,20 +2113,31 @@ MapDatabase *ServerMap::createDatabase(
 
 void ServerMap::beginSave()
 {
+	auto lock = lockDatabase();
 	dbase->beginSave();
 }
 
 void ServerMap::endSave()
 {
+	auto lock = lockDatabase();
 	dbase->endSave();
 }
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
-	return saveBlock(block, dbase);
+	outdateBlockReads(VoxelArea(block->getPos()));
+	auto lock = lockDatabase();
+	return saveBlock(block, dbase, m_save_version);
+}
+
+std::unique_lock<std::mutex> ServerMap::lockDatabase()
+{
+	if (m_db_thread_safe)
+		return std::unique_lock<std::mutex>();
+	return std::unique_lock<std::mutex>(m_db_mutex);
 }
 
-bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db)
+bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, u8 version)
 {
 	v3s16 p3d = block->getPos();
 
@@ -1914,9 +2148,6 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db)
 		return true;
 	}
 
-	// Format used for writing
-	u8 version = SER_FMT_VER_HIGHEST_WRITE;
-
 	/*
 		[0] u8 serialization version
 		[1] data
@@ -1933,7 +2164,7 @@ bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db)
 	return ret;
 }
 
-void ServerMap::loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load)
+void ServerMap::loadBlock(const std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load)
 {
 	try {
 		std::istringstream is(*blob, std::ios_base::binary);
@@ -1996,47 +2227,148 @@ void ServerMap::loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool
 
 MapBlock* ServerMap::loadBlock(v3s16 blockpos)
 {
-	bool created_new = (getBlockNoCreateNoEx(blockpos) == NULL);
+	std::string ret;
+	{
+		auto lock = lockDatabase();
+		dbase->loadBlock(blockpos, &ret);
+		if (ret.empty() && dbase_ro)
+			dbase_ro->loadBlock(blockpos, &ret);
+	}
 
-	v2s16 p2d(blockpos.X, blockpos.Z);
+	return loadBlock(blockpos, ret);
+}
 
-	std::string ret;
-	dbase->loadBlock(blockpos, &ret);
-	if (!ret.empty()) {
-		loadBlock(&ret, blockpos, createSector(p2d), false);
-	} else if (dbase_ro) {
-		dbase_ro->loadBlock(blockpos, &ret);
-		if (!ret.empty()) {
-			loadBlock(&ret, blockpos, createSector(p2d), false);
+void ServerMap::readBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blobs)
+{
+	auto lock = lockDatabase();
+	dbase->loadBlocks(pos, blobs);
+	if (!dbase_ro)
+		return;
+
+	// Look up the rest in the read-only database
+	std::vector<v3s16> missing;
+	std::vector<size_t> missing_i;
+	for (size_t i = 0; i < pos.size(); i++) {
+		if ((*blobs)[i].empty()) {
+			missing.push_back(pos[i]);
+			missing_i.push_back(i);
 		}
-	} else {
-		return NULL;
 	}
+	if (missing.empty())
+		return;
+
+	std::vector<std::string> ro_blobs;
+	dbase_ro->loadBlocks(missing, &ro_blobs);
+	for (size_t i = 0; i < missing.size(); i++)
+		(*blobs)[missing_i[i]].swap(ro_blobs[i]);
+}
+
+MapBlock *ServerMap::loadBlock(v3s16 blockpos, const std::string &blob)
+{
+	if (blob.empty())
+		return NULL;
+
+	bool created_new = (getBlockNoCreateNoEx(blockpos) == NULL);
+
+	v2s16 p2d(blockpos.X, blockpos.Z);
+	loadBlock(&blob, blockpos, createSector(p2d), false);
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
-	if (created_new && (block != NULL)) {
-		std::map<v3s16, MapBlock*> modified_blocks;
-		// Fix lighting if necessary
-		voxalgo::update_block_border_lighting(this, block, modified_blocks);
-		if (!modified_blocks.empty()) {
-			//Modified lighting, send event
-			MapEditEvent event;
-			event.type = MEET_OTHER;
-			std::map<v3s16, MapBlock *>::iterator it;
-			for (it = modified_blocks.begin();
-					it != modified_blocks.end(); ++it)
-				event.modified_blocks.insert(it->first);
-			dispatchEvent(event);
-		}
+	if (created_new && (block != NULL))
+		updateLoadedBlockLighting(block);
+	return block;
+}
+
+MapBlock *ServerMap::deSerializeBlock(v3s16 p, const std::string &blob)
+{
+	if (blob.empty())
+		return NULL;
+
+	MapBlock *block = new MapBlock(this, p, m_gamedef);
+	try {
+		std::istringstream is(blob, std::ios_base::binary);
+		u8 version = SER_FMT_VER_INVALID;
+		is.read((char*)&version, 1);
+		if (is.fail())
+			throw SerializationError("Failed to read MapBlock version");
+
+		// The node definitions must not change without the lock
+		block->deSerialize(is, version, true, false);
+	} catch (BaseException &e) {
+		delete block;
+		return NULL;
 	}
 	return block;
 }
 
-bool ServerMap::deleteBlock(v3s16 blockpos)
+MapBlock *ServerMap::insertLoadedBlock(MapBlock *block)
+{
+	v3s16 p = block->getPos();
+	MapSector *sector = createSector(v2s16(p.X, p.Z));
+	sector->insertBlock(block);
+
+	ReflowScan scanner(this, m_emerge->ndef);
+	scanner.scan(block, &m_transforming_liquid);
+
+	// We just loaded it from, so it's up-to-date.
+	block->resetModified();
+
+	updateLoadedBlockLighting(block);
+	return block;
+}
+
+void ServerMap::startReadingBlock(v3s16 p)
+{
+	m_block_reads[p].readers++;
+}
+
+bool ServerMap::finishReadingBlock(v3s16 p)
 {
-	if (!dbase->deleteBlock(blockpos))
+	auto it = m_block_reads.find(p);
+	if (it == m_block_reads.end())
 		return false;
 
+	bool outdated = it->second.outdated;
+	if (--it->second.readers == 0)
+		m_block_reads.erase(it);
+	return !outdated;
+}
+
+void ServerMap::outdateBlockReads(const VoxelArea &area)
+{
+	for (auto &it : m_block_reads) {
+		if (area.contains(it.first))
+			it.second.outdated = true;
+	}
+}
+
+void ServerMap::updateLoadedBlockLighting(MapBlock *block)
+{
+	std::map<v3s16, MapBlock*> modified_blocks;
+	// Fix lighting if necessary
+	voxalgo::update_block_border_lighting(this, block, modified_blocks);
+	if (!modified_blocks.empty()) {
+		//Modified lighting, send event
+		MapEditEvent event;
+		event.type = MEET_OTHER;
+		std::map<v3s16, MapBlock *>::iterator it;
+		for (it = modified_blocks.begin();
+				it != modified_blocks.end(); ++it)
+			event.modified_blocks.insert(it->first);
+		dispatchEvent(event);
+	}
+}
+
+bool ServerMap::deleteBlock(v3s16 blockpos)
+{
+	outdateBlockReads(VoxelArea(blockpos));
+	{
+		auto lock = lockDatabase();
+		if (!dbase->deleteBlock(blockpos))
+			return false;
+	}
+
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
 	if (block) {
 		v2s16 p2d(blockpos.X, blockpos.Z);
@@ -24,13 +24,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <set>
 #include <map>
 #include <list>
+#include <deque>
+#include <mutex>
 
 #include "irrlichttypes_bloated.h"
 #include "mapnode.h"
+#include "serialization.h"
 #include "constants.h"
 #include "voxel.h"
 #include "modifiedstate.h"
 #include "util/container.h"
+#include "util/blockpos_map.h"
 #include "nodetimer.h"
 #include "map_settings_manager.h"
 #include "debug.h"
@@ -47,6 +51,8 @@ class IRollbackManager;
 class EmergeManager;
 class ServerEnvironment;
 struct BlockMakeData;
+struct LiquidUpdate;
+class WorkerPool;
 
 /*
 	MapEditEvent
@@ -158,7 +164,8 @@ class Map /*: public NodeContainer*/
 
 	// Returns InvalidPositionException if not found
 	MapBlock * getBlockNoCreate(v3s16 p);
-	// Returns NULL if not found
+	// Returns NULL if not found. Like m_blocks itself, only to be used with the
+	// environment lock held or from the thread owning the map.
 	MapBlock * getBlockNoCreateNoEx(v3s16 p);
 
 	/* Server overrides */
@@ -211,9 +218,12 @@ class Map /*: public NodeContainer*/
 	/*
 		Updates usage timers and unloads unused blocks and sectors.
 		Saves modified blocks before unloading on MAPTYPE_SERVER.
+		Blocks in keep_loaded are not unloaded to stay below
+		max_loaded_blocks.
 	*/
 	void timerUpdate(float dtime, float unload_timeout, u32 max_loaded_blocks,
-			std::vector<v3s16> *unloaded_blocks=NULL);
+			std::vector<v3s16> *unloaded_blocks=NULL,
+			const BlockPosSet *keep_loaded=NULL);
 
 	/*
 		Unloads all blocks with a zero refCount().
@@ -229,8 +239,10 @@ class Map /*: public NodeContainer*/
 	// For debug printing. Prints "Map: ", "ServerMap: " or "ClientMap: "
 	virtual void PrintInfo(std::ostream &out);
 
+	// Runs one step of the liquid queue, on the worker threads of pool if
+	// it is not NULL. env may be NULL if no floodable nodes are involved.
 	void transformLiquids(std::map<v3s16, MapBlock*> & modified_blocks,
-			ServerEnvironment *env);
+			ServerEnvironment *env, WorkerPool *pool = NULL);
 
 	/*
 		Node metadata
@@ -280,6 +292,11 @@ class Map /*: public NodeContainer*/
 	bool isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes);
 protected:
 	friend class LuaVoxelManip;
+	friend class MapSector;
+
+	// Called by MapSector when it gains or loses a block
+	void indexBlock(MapBlock *block);
+	void unindexBlock(MapBlock *block);
 
 	std::ostream &m_dout; // A bit deprecated, could be removed
 
@@ -287,12 +304,20 @@ class Map /*: public NodeContainer*/
 
 	std::set<MapEventReceiver*> m_event_receivers;
 
+	// Columns of blocks, for iterating over them. Blocks are looked up in
+	// m_blocks.
 	std::map<v2s16, MapSector*> m_sectors;
 
 	// Be sure to set this to NULL when the cached sector is deleted
 	MapSector *m_sector_cache = nullptr;
 	v2s16 m_sector_cache_p;
 
+	// All blocks of the sectors by position, kept up to date by MapSector
+	BlockPosMap<MapBlock *> m_blocks;
+	// Last found block, cleared when it is removed from m_blocks. The position
+	// is taken from the block itself so there is no separate field to go stale.
+	MapBlock *m_block_cache = nullptr;
+
 	// Queued transforming water nodes
 	UniqueQueue<v3s16> m_transforming_liquid;
 
@@ -306,6 +331,16 @@ class Map /*: public NodeContainer*/
 		u32 needed_count);
 
 private:
+	void applyLiquidUpdate(const LiquidUpdate &u, ServerEnvironment *env,
+		std::deque<v3s16> &must_reflow,
+		std::vector<std::pair<v3s16, MapNode> > &changed_nodes,
+		std::map<v3s16, MapBlock*> &modified_blocks);
+	void transformLiquidsParallel(const std::vector<v3s16> &batch,
+		WorkerPool *pool, ServerEnvironment *env,
+		std::deque<v3s16> &must_reflow,
+		std::vector<std::pair<v3s16, MapNode> > &changed_nodes,
+		std::map<v3s16, MapBlock*> &modified_blocks);
+
 	f32 m_transforming_liquid_loop_count_multiplier = 1.0f;
 	u32 m_unprocessed_count = 0;
 	u64 m_inc_trending_up_start_time = 0; // milliseconds
@@ -397,10 +432,31 @@ class ServerMap : public Map
 	MapgenParams *getMapgenParams();
 
 	bool saveBlock(MapBlock *block);
-	static bool saveBlock(MapBlock *block, MapDatabase *db);
+	static bool saveBlock(MapBlock *block, MapDatabase *db,
+		u8 version = SER_FMT_VER_HIGHEST_WRITE);
 	MapBlock* loadBlock(v3s16 p);
+	// Loads a block from data read by readBlocks(); NULL if there is none
+	MapBlock *loadBlock(v3s16 p, const std::string &blob);
+	// Reads the data of several blocks from the database at once,
+	// an empty string for every block that is not stored.
+	// Can be called without the environment lock.
+	void readBlocks(const std::vector<v3s16> &pos, std::vector<std::string> *blobs);
+	// Deserializes data read by readBlocks() into a block that is not part
+	// of the map yet; can be called without the environment lock.
+	// Returns NULL if that fails, loadBlock() then reports the error or
+	// allocates ids for nodes that are not known yet.
+	MapBlock *deSerializeBlock(v3s16 p, const std::string &blob);
+	// Adds a block returned by deSerializeBlock() to the map, where there
+	// must not be a block yet
+	MapBlock *insertLoadedBlock(MapBlock *block);
+	// Call with the environment lock held before reading a block without
+	// it, and again before adding what was read to the map. The latter
+	// returns false if the block was saved, generated or deleted since,
+	// so what was read is outdated.
+	void startReadingBlock(v3s16 p);
+	bool finishReadingBlock(v3s16 p);
 	// Database version
-	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
+	void loadBlock(const std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
 
 	bool deleteBlock(v3s16 blockpos);
 
@@ -446,8 +502,29 @@ class ServerMap : public Map
 		This is reset to false when written on disk.
 	*/
 	bool m_map_metadata_changed = true;
+	// Serialization version blocks are saved with
+	u8 m_save_version = SER_FMT_VER_HIGHEST_WRITE;
 	MapDatabase *dbase = nullptr;
 	MapDatabase *dbase_ro = nullptr;
+
+	// Emerge threads read blocks without the environment lock; databases
+	// that are not wrapped by a WriteBehindMapDatabase are used with
+	// m_db_mutex held.
+	std::unique_lock<std::mutex> lockDatabase();
+	std::mutex m_db_mutex;
+	bool m_db_thread_safe = false;
+
+	// Fixes the lighting at the borders of a block that was just loaded
+	void updateLoadedBlockLighting(MapBlock *block);
+
+	struct BlockRead
+	{
+		u32 readers = 0;
+		bool outdated = false;
+	};
+	// Blocks read without the environment lock, guarded by it
+	std::map<v3s16, BlockRead> m_block_reads;
+	void outdateBlockReads(const VoxelArea &area);
 };
 
 
@@ -66,6 +66,8 @@ static const char *modified_reason_strings[] = {
 	MapBlock
 */
 
+std::atomic<u64> MapBlock::s_content_version_counter(0);
+
 MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 		m_parent(parent),
 		m_pos(pos),
@@ -78,6 +80,9 @@ MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy):
 
 MapBlock::~MapBlock()
 {
+	// Blocks are normally deactivated before they are deleted
+	clearNodeTimers();
+
 #ifndef SERVER
 	{
 		delete mesh;
@@ -85,7 +90,98 @@ MapBlock::~MapBlock()
 	}
 #endif
 
-	delete[] data;
+	freeNodes(data);
+}
+
+/*
+	Pools of blocks and node data
+
+	Never destroyed, blocks may be deleted late at shutdown.
+*/
+static FixedSizePool &block_pool()
+{
+	static FixedSizePool *pool = new FixedSizePool(sizeof(MapBlock), 256);
+	return *pool;
+}
+
+static FixedSizePool &node_pool()
+{
+	// 1 MiB slabs
+	static FixedSizePool *pool = new FixedSizePool(
+		MapBlock::nodecount * sizeof(MapNode), 64);
+	return *pool;
+}
+
+void *MapBlock::operator new(size_t size)
+{
+	if (size != sizeof(MapBlock))
+		return ::operator new(size);
+	return block_pool().allocate();
+}
+
+void MapBlock::operator delete(void *p, size_t size)
+{
+	if (size != sizeof(MapBlock))
+		::operator delete(p);
+	else
+		block_pool().deallocate(p);
+}
+
+size_t MapBlock::getPooledSize()
+{
+	return block_pool().getObjectSize() + node_pool().getObjectSize();
+}
+
+void MapBlock::getPoolStats(FixedSizePool::Stats &blocks, FixedSizePool::Stats &nodes)
+{
+	blocks = block_pool().getStats();
+	nodes = node_pool().getStats();
+}
+
+void MapBlock::trimPools()
+{
+	block_pool().trim();
+	node_pool().trim();
+}
+
+MapNode *MapBlock::allocateNodes()
+{
+	return static_cast<MapNode *>(node_pool().allocate());
+}
+
+void MapBlock::freeNodes(MapNode *nodes)
+{
+	node_pool().deallocate(nodes);
+}
+
+void MapBlock::clearNodeTimers()
+{
+	m_node_timers.clear();
+	if (m_timer_wheel) {
+		std::vector<NodeTimer> timers;
+		m_timer_wheel->takeBlockTimers(m_pos, timers);
+	}
+}
+
+void MapBlock::attachTimerWheel(NodeTimerWheel *wheel)
+{
+	if (m_timer_wheel)
+		return;
+	for (const NodeTimer &t : m_node_timers.getAll())
+		wheel->set(NodeTimer(t.timeout, t.elapsed, t.position + getPosRelative()));
+	m_node_timers.clear();
+	m_timer_wheel = wheel;
+}
+
+void MapBlock::detachTimerWheel()
+{
+	if (!m_timer_wheel)
+		return;
+	std::vector<NodeTimer> timers;
+	m_timer_wheel->takeBlockTimers(m_pos, timers);
+	m_timer_wheel = nullptr;
+	for (const NodeTimer &t : timers)
+		m_node_timers.set(NodeTimer(t.timeout, t.elapsed, t.position - getPosRelative()));
 }
 
 bool MapBlock::isValidPositionParent(v3s16 p)
@@ -152,6 +248,7 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	// Copy from VoxelManipulator to data
 	dst.copyTo(data, data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+	m_content_index.reset();
 }
 
 void MapBlock::actuallyUpdateDayNightDiff()
@@ -216,6 +313,7 @@ void MapBlock::expireDayNightDiff()
 	}
 
 	m_day_night_differs_expired = true;
+	m_content_version = nextContentVersion();
 }
 
 s16 MapBlock::getGroundLevel(v2s16 p2d)
@@ -294,7 +392,7 @@ static void getBlockNodeIdMapping(NameIdMapping *nimap, MapNode *nodes,
 // Unknown ones are added to nodedef.
 // Will not update itself to match id-name pairs in nodedef.
 static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
-		IGameDef *gamedef)
+		IGameDef *gamedef, bool allocate_ids)
 {
 	const NodeDefManager *nodedef = gamedef->ndef();
 	// This means the block contains incorrect ids, and we contain
@@ -303,6 +401,8 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 	// correct ids.
 	std::unordered_set<content_t> unnamed_contents;
 	std::unordered_set<std::string> unallocatable_contents;
+	// Each name is only looked up once, the lookups take a lock
+	std::unordered_map<content_t, content_t> resolved;
 
 	bool previous_exists = false;
 	content_t previous_local_id = CONTENT_IGNORE;
@@ -319,21 +419,30 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 			continue;
 		}
 
-		std::string name;
-		if (!nimap->getName(local_id, name)) {
-			unnamed_contents.insert(local_id);
-			previous_exists = false;
-			continue;
-		}
-
 		content_t global_id;
-		if (!nodedef->getId(name, global_id)) {
-			global_id = gamedef->allocateUnknownNodeId(name);
-			if (global_id == CONTENT_IGNORE) {
-				unallocatable_contents.insert(name);
+		auto it = resolved.find(local_id);
+		if (it != resolved.end()) {
+			global_id = it->second;
+		} else {
+			std::string name;
+			if (!nimap->getName(local_id, name)) {
+				unnamed_contents.insert(local_id);
 				previous_exists = false;
 				continue;
 			}
+
+			if (!nodedef->getId(name, global_id)) {
+				if (!allocate_ids)
+					throw SerializationError("correctBlockNodeIds(): unknown node \""
+						+ name + "\"");
+				global_id = gamedef->allocateUnknownNodeId(name);
+				if (global_id == CONTENT_IGNORE) {
+					unallocatable_contents.insert(name);
+					previous_exists = false;
+					continue;
+				}
+			}
+			resolved[local_id] = global_id;
 		}
 		nodes[i].setContent(global_id);
 
@@ -355,6 +464,18 @@ static void correctBlockNodeIds(const NameIdMapping *nimap, MapNode *nodes,
 	}
 }
 
+u8 MapBlock::getSerializationFlags()
+{
+	u8 flags = 0;
+	if (is_underground)
+		flags |= 0x01;
+	if (getDayNightDiff())
+		flags |= 0x02;
+	if (!m_generated)
+		flags |= 0x08;
+	return flags;
+}
+
 void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 {
 	if(!ser_ver_supported(version))
@@ -366,14 +487,7 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialisation version error");
 
 	// First byte
-	u8 flags = 0;
-	if(is_underground)
-		flags |= 0x01;
-	if(getDayNightDiff())
-		flags |= 0x02;
-	if (!m_generated)
-		flags |= 0x08;
-	writeU8(os, flags);
+	writeU8(os, getSerializationFlags());
 	if (version >= 27) {
 		writeU16(os, m_lighting_complete);
 	}
@@ -384,9 +498,8 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 	NameIdMapping nimap;
 	if(disk)
 	{
-		MapNode *tmp_nodes = new MapNode[nodecount];
-		for(u32 i=0; i<nodecount; i++)
-			tmp_nodes[i] = data[i];
+		MapNode *tmp_nodes = allocateNodes();
+		memcpy(tmp_nodes, data, nodecount * sizeof(MapNode));
 		getBlockNodeIdMapping(&nimap, tmp_nodes, m_gamedef->ndef());
 
 		u8 content_width = 2;
@@ -395,7 +508,7 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 		writeU8(os, params_width);
 		MapNode::serializeBulk(os, version, tmp_nodes, nodecount,
 				content_width, params_width, true);
-		delete[] tmp_nodes;
+		freeNodes(tmp_nodes);
 	}
 	else
 	{
@@ -412,16 +525,28 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 	*/
 	std::ostringstream oss(std::ios_base::binary);
 	m_node_metadata.serialize(oss, version, disk);
-	compressZlib(oss.str(), os);
+	compress(oss.str(), os, version);
 
 	/*
 		Data that goes to disk, but not the network
 	*/
 	if(disk)
 	{
+		// The timers of active blocks are in the timer wheel
+		NodeTimerList wheel_timers;
+		const NodeTimerList *node_timers = &m_node_timers;
+		if (m_timer_wheel) {
+			std::vector<NodeTimer> timers;
+			m_timer_wheel->getBlockTimers(m_pos, timers);
+			for (const NodeTimer &t : timers)
+				wheel_timers.insert(NodeTimer(t.timeout, t.elapsed,
+					t.position - getPosRelative()));
+			node_timers = &wheel_timers;
+		}
+
 		if(version <= 24){
 			// Node timers
-			m_node_timers.serialize(os, version);
+			node_timers->serialize(os, version);
 		}
 
 		// Static objects
@@ -435,7 +560,7 @@ void MapBlock::serialize(std::ostream &os, u8 version, bool disk)
 
 		if(version >= 25){
 			// Node timers
-			m_node_timers.serialize(os, version);
+			node_timers->serialize(os, version);
 		}
 	}
 }
@@ -449,7 +574,52 @@ void MapBlock::serializeNetworkSpecific(std::ostream &os)
 	writeU8(os, 2); // version
 }
 
-void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
+void MapBlock::makeNetworkSnapshot(MapBlockNetSnapshot &snap, u8 version)
+{
+	if (!ser_ver_supported(version))
+		throw VersionMismatchException("ERROR: MapBlock format not supported");
+
+	if (!data)
+		throw SerializationError("ERROR: Not writing dummy block.");
+
+	FATAL_ERROR_IF(version < SER_FMT_VER_LOWEST_WRITE, "Serialisation version error");
+
+	snap.pos = m_pos;
+	snap.content_version = m_content_version;
+	snap.version = version;
+	snap.flags = getSerializationFlags();
+	snap.lighting_complete = m_lighting_complete;
+
+	snap.nodes.reset(new MapNode[nodecount]);
+	memcpy(snap.nodes.get(), data, nodecount * sizeof(MapNode));
+
+	std::ostringstream oss(std::ios_base::binary);
+	m_node_metadata.serialize(oss, version, false);
+	snap.metadata = oss.str();
+}
+
+void MapBlock::serializeNetworkSnapshot(std::ostream &os,
+		const MapBlockNetSnapshot &snap)
+{
+	// Keep in sync with serialize() and serializeNetworkSpecific()
+	writeU8(os, snap.flags);
+	if (snap.version >= 27)
+		writeU16(os, snap.lighting_complete);
+
+	u8 content_width = 2;
+	u8 params_width = 2;
+	writeU8(os, content_width);
+	writeU8(os, params_width);
+	MapNode::serializeBulk(os, snap.version, snap.nodes.get(), nodecount,
+			content_width, params_width, true);
+
+	compress(snap.metadata, os, snap.version);
+
+	writeU8(os, 2); // network specific version
+}
+
+void MapBlock::deSerialize(std::istream &is, u8 version, bool disk,
+		bool allocate_ids)
 {
 	if(!ser_ver_supported(version))
 		throw VersionMismatchException("ERROR: MapBlock format not supported");
@@ -457,10 +627,12 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())<<std::endl);
 
 	m_day_night_differs_expired = false;
+	m_content_index.reset();
 
 	if(version <= 21)
 	{
-		deSerialize_pre22(is, version, disk);
+		deSerialize_pre22(is, version, disk, allocate_ids);
+		m_content_version = nextContentVersion();
 		return;
 	}
 
@@ -495,7 +667,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 	// Ignore errors
 	try {
 		std::ostringstream oss(std::ios_base::binary);
-		decompressZlib(is, oss);
+		decompress(is, oss, version);
 		std::istringstream iss(oss.str(), std::ios_base::binary);
 		if (version >= 23)
 			m_node_metadata.deSerialize(iss, m_gamedef->idef());
@@ -541,7 +713,7 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 				<<": NameIdMapping"<<std::endl);
 		NameIdMapping nimap;
 		nimap.deSerialize(is);
-		correctBlockNodeIds(&nimap, data, m_gamedef);
+		correctBlockNodeIds(&nimap, data, m_gamedef, allocate_ids);
 
 		if(version >= 25){
 			TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())
@@ -550,6 +722,8 @@ void MapBlock::deSerialize(std::istream &is, u8 version, bool disk)
 		}
 	}
 
+	m_content_version = nextContentVersion();
+
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())
 			<<": Done."<<std::endl);
 }
@@ -572,7 +746,8 @@ void MapBlock::deSerializeNetworkSpecific(std::istream &is)
 	Legacy serialization
 */
 
-void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
+void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk,
+		bool allocate_ids)
 {
 	// Initialize default flags
 	is_underground = false;
@@ -731,7 +906,7 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 		} else {
 			content_mapnode_get_name_id_mapping(&nimap);
 		}
-		correctBlockNodeIds(&nimap, data, m_gamedef);
+		correctBlockNodeIds(&nimap, data, m_gamedef, allocate_ids);
 	}
 
 
@@ -19,9 +19,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <set>
 #include "irr_v3d.h"
 #include "mapnode.h"
+#include "mapblock_contentindex.h"
 #include "exceptions.h"
 #include "constants.h"
 #include "staticobject.h"
@@ -29,6 +32,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodetimer.h"
 #include "modifiedstate.h"
 #include "util/numeric.h" // getContainerPos
+#include "util/fixed_pool.h"
 #include "settings.h"
 #include "mapgen/mapgen.h"
 
@@ -40,6 +44,23 @@ class VoxelManipulator;
 
 #define BLOCK_TIMESTAMP_UNDEFINED 0xffffffff
 
+/*
+	Copy of everything that makes up the network form of a MapBlock.
+	It is taken while the map is locked and can then be serialized and
+	compressed by another thread, see MapBlock::serializeNetworkSnapshot().
+*/
+struct MapBlockNetSnapshot
+{
+	v3s16 pos;
+	u64 content_version;
+	u8 version;
+	u8 flags;
+	u16 lighting_complete;
+	std::unique_ptr<MapNode[]> nodes;
+	// Serialized, but not yet compressed
+	std::string metadata;
+};
+
 ////
 //// MapBlock modified reason flags
 ////
@@ -76,6 +97,17 @@ class MapBlock
 	MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef, bool dummy=false);
 	~MapBlock();
 
+	// Blocks and their node data come from pools, as they are loaded and
+	// unloaded all the time
+	static void *operator new(size_t size);
+	static void operator delete(void *p, size_t size);
+
+	// Memory of a block and its node data, without metadata and objects
+	static size_t getPooledSize();
+	static void getPoolStats(FixedSizePool::Stats &blocks, FixedSizePool::Stats &nodes);
+	// Gives unused pool memory back to the system
+	static void trimPools();
+
 	/*virtual u16 nodeContainerId() const
 	{
 		return NODECONTAINER_ID_MAPBLOCK;
@@ -88,10 +120,11 @@ class MapBlock
 
 	void reallocate()
 	{
-		delete[] data;
-		data = new MapNode[nodecount];
+		if (!data)
+			data = allocateNodes();
 		for (u32 i = 0; i < nodecount; i++)
 			data[i] = MapNode(CONTENT_IGNORE);
+		m_content_index.reset();
 
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REALLOCATE);
 	}
@@ -115,7 +148,7 @@ class MapBlock
 			m_modified_reason |= reason;
 		}
 		if (mod == MOD_STATE_WRITE_NEEDED)
-			contents_cached = false;
+			m_content_version = nextContentVersion();
 	}
 
 	inline u32 getModified()
@@ -136,6 +169,14 @@ class MapBlock
 		m_modified_reason = 0;
 	}
 
+	// Changes whenever the serialized contents of the block may have changed.
+	// The values are unique across all blocks, so they remain valid as cache
+	// tags even if the block is unloaded and loaded again.
+	inline u64 getContentVersion() const
+	{
+		return m_content_version;
+	}
+
 	////
 	//// Flags
 	////
@@ -279,7 +320,7 @@ class MapBlock
 		if (!isValidPosition(x, y, z))
 			throw InvalidPositionException();
 
-		data[z * zstride + y * ystride + x] = n;
+		setNodeData(z * zstride + y * ystride + x, n);
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -327,7 +368,7 @@ class MapBlock
 		if (!data)
 			throw InvalidPositionException();
 
-		data[z * zstride + y * ystride + x] = n;
+		setNodeData(z * zstride + y * ystride + x, n);
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE_NO_CHECK);
 	}
 
@@ -455,25 +496,42 @@ class MapBlock
 	//// Node Timers
 	////
 
+	// Positions are relative to the block. While the block is active, its
+	// timers are kept in the timer wheel of the environment.
+
 	inline NodeTimer getNodeTimer(const v3s16 &p)
 	{
-		return m_node_timers.get(p);
+		if (!m_timer_wheel)
+			return m_node_timers.get(p);
+		NodeTimer t = m_timer_wheel->get(p + getPosRelative());
+		t.position = p;
+		return t;
 	}
 
 	inline void removeNodeTimer(const v3s16 &p)
 	{
-		m_node_timers.remove(p);
+		if (m_timer_wheel)
+			m_timer_wheel->remove(p + getPosRelative());
+		else
+			m_node_timers.remove(p);
 	}
 
 	inline void setNodeTimer(const NodeTimer &t)
 	{
-		m_node_timers.set(t);
+		if (m_timer_wheel)
+			m_timer_wheel->set(NodeTimer(t.timeout, t.elapsed,
+				t.position + getPosRelative()));
+		else
+			m_node_timers.set(t);
 	}
 
-	inline void clearNodeTimers()
-	{
-		m_node_timers.clear();
-	}
+	void clearNodeTimers();
+
+	// Moves the timers into the wheel, which runs them from then on
+	void attachTimerWheel(NodeTimerWheel *wheel);
+	// Moves the timers back into the block
+	void detachTimerWheel();
+	bool hasTimerWheel() const { return !!m_timer_wheel; }
 
 	////
 	//// Serialization
@@ -484,17 +542,42 @@ class MapBlock
 	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
 	void serialize(std::ostream &os, u8 version, bool disk);
 	// If disk == true: In addition to doing other things, will add
-	// unknown blocks from id-name mapping to wndef
-	void deSerialize(std::istream &is, u8 version, bool disk);
+	// unknown blocks from id-name mapping to wndef.
+	// If allocate_ids is false, nodes unknown to wndef throw a
+	// SerializationError instead, so that it is not modified.
+	void deSerialize(std::istream &is, u8 version, bool disk,
+			bool allocate_ids = true);
 
 	void serializeNetworkSpecific(std::ostream &os);
 	void deSerializeNetworkSpecific(std::istream &is);
+
+	// Precondition: version >= SER_FMT_VER_LOWEST_WRITE
+	void makeNetworkSnapshot(MapBlockNetSnapshot &snap, u8 version);
+	// Writes the same data as serialize(os, version, false) followed by
+	// serializeNetworkSpecific(os), without accessing the block itself
+	static void serializeNetworkSnapshot(std::ostream &os,
+			const MapBlockNetSnapshot &snap);
 private:
 	/*
 		Private methods
 	*/
 
-	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
+	u8 getSerializationFlags();
+
+	void deSerialize_pre22(std::istream &is, u8 version, bool disk,
+			bool allocate_ids);
+
+	static inline u64 nextContentVersion()
+	{
+		return ++s_content_version_counter;
+	}
+
+	inline void setNodeData(u32 i, const MapNode &n)
+	{
+		if (m_content_index)
+			m_content_index->update(i, data[i].getContent(), n.getContent());
+		data[i] = n;
+	}
 
 	/*
 		Used only internally, because changes can't be tracked
@@ -532,14 +615,23 @@ class MapBlock
 	static const u32 nodecount = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
 
 	//// ABM optimizations ////
-	// Cache of content types
-	std::unordered_set<content_t> contents;
-	// True if content types are cached
-	bool contents_cached = false;
-	// True if we never want to cache content types for this block
-	bool do_not_cache_contents = false;
+	// Positions of the nodes per content type. Built on first use and kept
+	// up to date by setNode*(), must not be called on dummy blocks.
+	const BlockContentIndex &getContentIndex()
+	{
+		if (!m_content_index)
+			m_content_index.reset(new BlockContentIndex(data, nodecount));
+		return *m_content_index;
+	}
+
+	bool hasContentIndex() const { return !!m_content_index; }
+	// Frees the memory of the index, e.g. when the block becomes inactive
+	void clearContentIndex() { m_content_index.reset(); }
 
 private:
+	static MapNode *allocateNodes();
+	static void freeNodes(MapNode *nodes);
+
 	/*
 		Private member variables
 	*/
@@ -564,6 +656,10 @@ class MapBlock
 		Dummy blocks are used for caching not-found-on-disk blocks.
 	*/
 	MapNode *data = nullptr;
+	std::unique_ptr<BlockContentIndex> m_content_index;
+
+	// Holds the node timers instead of m_node_timers if not nullptr
+	NodeTimerWheel *m_timer_wheel = nullptr;
 
 	/*
 		- On the server, this is used for telling whether the
@@ -573,6 +669,10 @@ class MapBlock
 	u32 m_modified = MOD_STATE_WRITE_NEEDED;
 	u32 m_modified_reason = MOD_REASON_INITIAL;
 
+	// See getContentVersion()
+	u64 m_content_version = 0;
+	static std::atomic<u64> s_content_version_counter;
+
 	/*
 		When propagating sunlight and the above block doesn't exist,
 		sunlight is assumed if this is false.
@@ -0,0 +1,37 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mapblock_contentindex.h"
+
+BlockContentIndex::BlockContentIndex(const MapNode *nodes, u32 nodecount) :
+	m_slots(nodecount)
+{
+	// Blocks usually consist of few contents in long runs
+	content_t prev_c = CONTENT_IGNORE;
+	std::vector<u16> *list = nullptr;
+	for (u32 i = 0; i < nodecount; i++) {
+		content_t c = nodes[i].getContent();
+		if (!list || c != prev_c) {
+			list = &m_lists[c];
+			prev_c = c;
+		}
+		m_slots[i] = list->size();
+		list->push_back(i);
+	}
+}
@@ -0,0 +1,122 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+#include "irr_v3d.h"
+#include "constants.h"
+#include "mapnode.h"
+
+/*
+	Lists the positions of the nodes of a MapBlock per content type.
+
+	Positions are node indices into the block data
+	(z * zstride + y * ystride + x). Each list is unordered; a node is moved
+	between lists in O(1) when its content changes.
+*/
+class BlockContentIndex
+{
+public:
+	typedef std::unordered_map<content_t, std::vector<u16>> Lists;
+
+	BlockContentIndex(const MapNode *nodes, u32 nodecount);
+
+	// Updates the index after the content of node i changed
+	void update(u16 i, content_t old_c, content_t new_c)
+	{
+		if (old_c != new_c) {
+			remove(i, old_c);
+			add(i, new_c);
+		}
+	}
+
+	const Lists &getLists() const { return m_lists; }
+
+	// Returns nullptr if there are no nodes of this content
+	const std::vector<u16> *get(content_t c) const
+	{
+		auto it = m_lists.find(c);
+		return it == m_lists.end() ? nullptr : &it->second;
+	}
+
+	static v3s16 indexToPos(u16 i)
+	{
+		return v3s16(i % MAP_BLOCKSIZE, (i / MAP_BLOCKSIZE) % MAP_BLOCKSIZE,
+			i / (MAP_BLOCKSIZE * MAP_BLOCKSIZE));
+	}
+
+	/*
+		Picks every entry of list independently with a probability of
+		1 / chance and appends it to out, just like rolling
+		'rand() % chance == 0' for each of them.
+		The gaps between picked entries are drawn from the geometric
+		distribution, so this costs O(number of picks) random numbers.
+		rand() has to return uniformly distributed u32 values.
+	*/
+	template <typename Rand>
+	static void sample(const std::vector<u16> &list, u32 chance, Rand &&rand,
+		std::vector<u16> &out)
+	{
+		if (chance <= 1) {
+			out.insert(out.end(), list.begin(), list.end());
+			return;
+		}
+
+		const double log_q = std::log1p(-1.0 / chance);
+		const size_t size = list.size();
+		size_t i = 0;
+		while (true) {
+			// Uniform in (0, 1]
+			double u = (rand() + 1.0) / 4294967296.0;
+			double gap = std::floor(std::log(u) / log_q);
+			if (gap >= size - i)
+				break;
+			i += (size_t)gap;
+			out.push_back(list[i]);
+			i++;
+		}
+	}
+
+private:
+	void add(u16 i, content_t c)
+	{
+		std::vector<u16> &list = m_lists[c];
+		m_slots[i] = list.size();
+		list.push_back(i);
+	}
+
+	void remove(u16 i, content_t c)
+	{
+		std::vector<u16> &list = m_lists[c];
+		u16 slot = m_slots[i];
+		u16 last = list.back();
+		list[slot] = last;
+		m_slots[last] = slot;
+		list.pop_back();
+		if (list.empty())
+			m_lists.erase(c);
+	}
+
+	Lists m_lists;
+	// Index of each node within its list
+	std::vector<u16> m_slots;
+};
@@ -19,14 +19,20 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "mg_biome.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
 #include "mg_decoration.h"
 #include "emerge.h"
 #include "server.h"
 #include "nodedef.h"
 #include "map.h" //for MMVManip
+#include "log.h"
 #include "util/numeric.h"
 #include "porting.h"
 #include "settings.h"
+#include "threading/mutex_auto_lock.h"
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -89,6 +95,29 @@ void BiomeManager::clear()
 		delete (Biome *)m_objects[i];
 
 	m_objects.resize(1);
+
+	MutexAutoLock lock(m_index_mutex);
+	m_index.reset();
+}
+
+
+std::shared_ptr<const BiomeIndex> BiomeManager::getIndex()
+{
+	MutexAutoLock lock(m_index_mutex);
+	if (!m_index || m_index->getBiomeCount() != getNumObjects()) {
+		std::vector<Biome *> biomes;
+		for (size_t i = 0; i < getNumObjects(); i++)
+			biomes.push_back((Biome *)getRaw(i));
+
+		u64 t = porting::getTimeMs();
+		std::shared_ptr<BiomeIndex> index = std::make_shared<BiomeIndex>();
+		index->build(biomes);
+		infostream << "BiomeManager: indexed " << biomes.size() << " biomes in "
+			<< porting::getTimeMs() - t << "ms, " << index->getBytes()
+			<< " bytes" << std::endl;
+		m_index = index;
+	}
+	return m_index;
 }
 
 
@@ -153,6 +182,252 @@ Biome *BiomeManager::getBiomeFromNoiseOriginal(float heat, float humidity, v3s16
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+
+void BiomeClosest::check(Biome *b, float heat, float humidity, v3s16 pos)
+{
+	if (!b ||
+			pos.Y < b->min_pos.Y || pos.Y > b->max_pos.Y + b->vertical_blend ||
+			pos.X < b->min_pos.X || pos.X > b->max_pos.X ||
+			pos.Z < b->min_pos.Z || pos.Z > b->max_pos.Z)
+		return;
+
+	float d_heat = heat - b->heat_point;
+	float d_humidity = humidity - b->humidity_point;
+	float d = (d_heat * d_heat) + (d_humidity * d_humidity);
+
+	if (pos.Y <= b->max_pos.Y) { // Within y limits of biome b
+		if (d < dist) {
+			dist = d;
+			biome = b;
+		}
+	} else if (d < dist_blend) { // Blend area above biome b
+		dist_blend = d;
+		biome_blend = b;
+	}
+}
+
+
+// std::isfinite() is optimized out with -ffast-math
+static inline bool float_is_finite(float f)
+{
+	u32 bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return (bits & 0x7f800000) != 0x7f800000;
+}
+
+
+// Whether the biome applies at every X and Z a mapchunk can be generated at
+static inline bool biome_covers_xz(const Biome *b)
+{
+	return b->min_pos.X <= -MAX_MAP_GENERATION_LIMIT &&
+		b->max_pos.X >= MAX_MAP_GENERATION_LIMIT &&
+		b->min_pos.Z <= -MAX_MAP_GENERATION_LIMIT &&
+		b->max_pos.Z >= MAX_MAP_GENERATION_LIMIT;
+}
+
+
+void BiomeIndex::build(const std::vector<Biome *> &biomes, size_t max_bytes)
+{
+	m_biomes = biomes;
+	m_range_min_y.clear();
+	m_range_grids.clear();
+	m_grids.clear();
+	m_bytes = 0;
+
+	// Not indexed, getBiomeCount() tells to use the linear search
+	if (m_biomes.size() > U16_MAX) {
+		m_biomes.clear();
+		return;
+	}
+
+	std::vector<u16> indices;
+	for (size_t i = 1; i < m_biomes.size(); i++) {
+		if (m_biomes[i])
+			indices.push_back(i);
+	}
+	if (indices.empty())
+		return;
+
+	// The grid spans the biome points, with as much room around them as they
+	// span, where nearly all of the heat and humidity values are
+	float heat_min = FLT_MAX, heat_max = -FLT_MAX;
+	float humidity_min = FLT_MAX, humidity_max = -FLT_MAX;
+	for (u16 i : indices) {
+		heat_min = std::fmin(heat_min, m_biomes[i]->heat_point);
+		heat_max = std::fmax(heat_max, m_biomes[i]->heat_point);
+		humidity_min = std::fmin(humidity_min, m_biomes[i]->humidity_point);
+		humidity_max = std::fmax(humidity_max, m_biomes[i]->humidity_point);
+	}
+	double span = std::fmax(std::fmax(heat_max - heat_min,
+		humidity_max - humidity_min), 1.0);
+	m_grid_size = rangelim(2 * (u32)std::ceil(std::sqrt(indices.size())), 4, 32);
+	m_cell_size = span * 3 / m_grid_size;
+	m_heat_min = heat_min - span;
+	m_humidity_min = humidity_min - span;
+
+	// The same biomes apply between two of these
+	std::vector<s32> limits;
+	for (u16 i : indices) {
+		const Biome *b = m_biomes[i];
+		limits.push_back(b->min_pos.Y);
+		limits.push_back(b->max_pos.Y + 1);
+		limits.push_back(b->max_pos.Y + b->vertical_blend + 1);
+	}
+	std::sort(limits.begin(), limits.end());
+	limits.erase(std::unique(limits.begin(), limits.end()), limits.end());
+
+	// Too many of them are merged, as evenly as the limits allow
+	const size_t merge = (limits.size() + MAX_RANGES - 1) / MAX_RANGES;
+	for (size_t i = 0; i < limits.size(); i += merge)
+		m_range_min_y.push_back(limits[i]);
+	m_range_grids.assign(m_range_min_y.size(), U32_MAX);
+
+	// Ranges closest to the surface first, where most lookups are
+	std::vector<size_t> order(m_range_min_y.size());
+	for (size_t r = 0; r < order.size(); r++)
+		order[r] = r;
+	auto range_max_y = [this] (size_t r) -> s32 {
+		return r + 1 < m_range_min_y.size() ? m_range_min_y[r + 1] - 1 : S32_MAX;
+	};
+	auto distance = [&] (size_t r) -> s64 {
+		return std::max<s64>(0, std::max<s64>(m_range_min_y[r], -(s64)range_max_y(r)));
+	};
+	std::stable_sort(order.begin(), order.end(), [&] (size_t a, size_t b) {
+		return distance(a) < distance(b);
+	});
+
+	// Ranges with the same biomes share their grids
+	typedef std::vector<u16> Biomes;
+	std::map<std::vector<Biomes>, u32> built;
+	for (size_t r : order) {
+		s32 y0 = m_range_min_y[r];
+		s32 y1 = range_max_y(r);
+		// Applying somewhere in the range and in all of it, within the Y
+		// limits and blending
+		std::vector<Biomes> range_biomes(4);
+		for (u16 i : indices) {
+			const Biome *b = m_biomes[i];
+			s32 blend_y0 = b->max_pos.Y + 1;
+			s32 blend_y1 = b->max_pos.Y + b->vertical_blend;
+			if (y0 <= b->max_pos.Y && y1 >= b->min_pos.Y)
+				range_biomes[0].push_back(i);
+			if (y0 >= b->min_pos.Y && y1 <= b->max_pos.Y)
+				range_biomes[1].push_back(i);
+			if (y0 <= blend_y1 && y1 >= blend_y0)
+				range_biomes[2].push_back(i);
+			if (y0 >= blend_y0 && y1 <= blend_y1)
+				range_biomes[3].push_back(i);
+		}
+
+		auto it = built.find(range_biomes);
+		if (it == built.end()) {
+			Grid within, blend;
+			buildGrid(within, range_biomes[0], range_biomes[1]);
+			buildGrid(blend, range_biomes[2], range_biomes[3]);
+			size_t bytes = (within.cells.size() + blend.cells.size()) * sizeof(u32) +
+				(within.candidates.size() + blend.candidates.size()) * sizeof(u16);
+			if (m_bytes + bytes > max_bytes)
+				continue;
+			m_bytes += bytes;
+
+			u32 id = m_grids.size();
+			m_grids.push_back(std::move(within));
+			m_grids.push_back(std::move(blend));
+			it = built.emplace(range_biomes, id).first;
+		}
+		m_range_grids[r] = it->second;
+	}
+}
+
+
+void BiomeIndex::buildGrid(Grid &grid, const std::vector<u16> &biomes,
+	const std::vector<u16> &covering)
+{
+	const u32 size = m_grid_size;
+	// Cells are a bit larger than where find() looks them up, for the
+	// rounding of the lookup
+	const double margin = m_cell_size * 0.01;
+
+	grid.cells.assign(size * size + 1, 0);
+	grid.candidates.clear();
+	for (u32 y = 0; y != size; y++)
+	for (u32 x = 0; x != size; x++) {
+		double heat0 = x == 0 ? -INFINITY :
+			m_heat_min + x * m_cell_size - margin;
+		double heat1 = x == size - 1 ? INFINITY :
+			m_heat_min + (x + 1) * m_cell_size + margin;
+		double humidity0 = y == 0 ? -INFINITY :
+			m_humidity_min + y * m_cell_size - margin;
+		double humidity1 = y == size - 1 ? INFINITY :
+			m_humidity_min + (y + 1) * m_cell_size + margin;
+
+		// Squared distance to the closest biome anywhere in the cell is at
+		// most the one to the farthest corner of a biome that always applies
+		double bound = INFINITY;
+		for (u16 i : covering) {
+			const Biome *b = m_biomes[i];
+			if (!biome_covers_xz(b))
+				continue;
+			double dh = std::fmax(b->heat_point - heat0, heat1 - b->heat_point);
+			double du = std::fmax(b->humidity_point - humidity0,
+				humidity1 - b->humidity_point);
+			bound = std::fmin(bound, dh * dh + du * du);
+		}
+
+		// Biomes farther than that everywhere in the cell are never the
+		// closest. The margin makes up for the rounding of the float
+		// distances compared by BiomeClosest::check().
+		for (u16 i : biomes) {
+			const Biome *b = m_biomes[i];
+			double dh = std::fmax(0.0, std::fmax(heat0 - b->heat_point,
+				b->heat_point - heat1));
+			double du = std::fmax(0.0, std::fmax(humidity0 - b->humidity_point,
+				b->humidity_point - humidity1));
+			if (dh * dh + du * du <= bound * (1.0 + 1e-5))
+				grid.candidates.push_back(i);
+		}
+		grid.cells[y * size + x + 1] = grid.candidates.size();
+	}
+}
+
+
+bool BiomeIndex::find(float heat, float humidity, v3s16 pos,
+	BiomeClosest &closest) const
+{
+	if (!float_is_finite(heat) || !float_is_finite(humidity) ||
+			pos.X < -MAX_MAP_GENERATION_LIMIT || pos.X > MAX_MAP_GENERATION_LIMIT ||
+			pos.Z < -MAX_MAP_GENERATION_LIMIT || pos.Z > MAX_MAP_GENERATION_LIMIT)
+		return false;
+
+	// No biome below the lowest one
+	if (m_range_min_y.empty() || pos.Y < m_range_min_y[0])
+		return true;
+
+	size_t range = std::upper_bound(m_range_min_y.begin(), m_range_min_y.end(),
+		(s32)pos.Y) - m_range_min_y.begin() - 1;
+	u32 grids = m_range_grids[range];
+	// Left out to stay within the memory limit
+	if (grids == U32_MAX)
+		return false;
+
+	double max_cell = m_grid_size - 1;
+	u32 x = std::fmin(std::fmax(
+		std::floor((heat - m_heat_min) / m_cell_size), 0.0), max_cell);
+	u32 y = std::fmin(std::fmax(
+		std::floor((humidity - m_humidity_min) / m_cell_size), 0.0), max_cell);
+	u32 cell = y * m_grid_size + x;
+
+	// Within the Y limits, then blending
+	for (u32 g = 0; g != 2; g++) {
+		const Grid &grid = m_grids[grids + g];
+		for (u32 i = grid.cells[cell]; i != grid.cells[cell + 1]; i++)
+			closest.check(m_biomes[grid.candidates[i]], heat, humidity, pos);
+	}
+	return true;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void BiomeParamsOriginal::readParams(const Settings *settings)
@@ -194,6 +469,8 @@ BiomeGenOriginal::BiomeGenOriginal(BiomeManager *biomemgr,
 	heatmap  = noise_heat->result;
 	humidmap = noise_humidity->result;
 
+	m_index = m_bmgr->getIndex();
+
 	biomemap = new biome_t[m_csize.X * m_csize.Z];
 	// Initialise with the ID of 'BIOME_NONE' so that cavegen can get the
 	// fallback biome when biome generation (which calculates the biomemap IDs)
@@ -277,32 +554,12 @@ Biome *BiomeGenOriginal::getBiomeAtIndex(size_t index, v3s16 pos) const
 
 Biome *BiomeGenOriginal::calcBiomeFromNoise(float heat, float humidity, v3s16 pos) const
 {
-	Biome *biome_closest = nullptr;
-	Biome *biome_closest_blend = nullptr;
-	float dist_min = FLT_MAX;
-	float dist_min_blend = FLT_MAX;
-
-	for (size_t i = 1; i < m_bmgr->getNumObjects(); i++) {
-		Biome *b = (Biome *)m_bmgr->getRaw(i);
-		if (!b ||
-				pos.Y < b->min_pos.Y || pos.Y > b->max_pos.Y + b->vertical_blend ||
-				pos.X < b->min_pos.X || pos.X > b->max_pos.X ||
-				pos.Z < b->min_pos.Z || pos.Z > b->max_pos.Z)
-			continue;
-
-		float d_heat = heat - b->heat_point;
-		float d_humidity = humidity - b->humidity_point;
-		float dist = (d_heat * d_heat) + (d_humidity * d_humidity);
-
-		if (pos.Y <= b->max_pos.Y) { // Within y limits of biome b
-			if (dist < dist_min) {
-				dist_min = dist;
-				biome_closest = b;
-			}
-		} else if (dist < dist_min_blend) { // Blend area above biome b
-			dist_min_blend = dist;
-			biome_closest_blend = b;
-		}
+	BiomeClosest closest;
+	// Biomes registered after the mapgen was created are not indexed
+	if (m_index->getBiomeCount() != m_bmgr->getNumObjects() ||
+			!m_index->find(heat, humidity, pos, closest)) {
+		for (size_t i = 1; i < m_bmgr->getNumObjects(); i++)
+			closest.check((Biome *)m_bmgr->getRaw(i), heat, humidity, pos);
 	}
 
 	// Carefully tune pseudorandom seed variation to avoid single node dither
@@ -310,12 +567,12 @@ Biome *BiomeGenOriginal::calcBiomeFromNoise(float heat, float humidity, v3s16 po
 	// blend.
 	mysrand(pos.Y + (heat + humidity) * 0.9f);
 
-	if (biome_closest_blend && dist_min_blend <= dist_min &&
-			myrand_range(0, biome_closest_blend->vertical_blend) >=
-			pos.Y - biome_closest_blend->max_pos.Y)
-		return biome_closest_blend;
+	if (closest.biome_blend && closest.dist_blend <= closest.dist &&
+			myrand_range(0, closest.biome_blend->vertical_blend) >=
+			pos.Y - closest.biome_blend->max_pos.Y)
+		return closest.biome_blend;
 
-	return (biome_closest) ? biome_closest : (Biome *)m_bmgr->getRaw(BIOME_NONE);	
+	return (closest.biome) ? closest.biome : (Biome *)m_bmgr->getRaw(BIOME_NONE);
 }
 
 
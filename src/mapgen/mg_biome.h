@@ -20,6 +20,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <cfloat>
+#include <memory>
+#include <mutex>
 #include "objdef.h"
 #include "nodedef.h"
 #include "noise.h"
@@ -72,6 +75,85 @@ class Biome : public ObjDef, public NodeResolver {
 };
 
 
+////
+//// BiomeIndex
+////
+
+// Biomes closest to a heat and humidity point, as found by the linear search
+// of BiomeGenOriginal::calcBiomeFromNoise()
+struct BiomeClosest {
+	// Within the Y limits of the biome
+	Biome *biome = nullptr;
+	float dist = FLT_MAX;
+	// In the vertical blend area above the biome
+	Biome *biome_blend = nullptr;
+	float dist_blend = FLT_MAX;
+
+	void check(Biome *b, float heat, float humidity, v3s16 pos);
+};
+
+/*
+	Spatial index of the biomes over heat and humidity
+
+	The Y axis is split at the limits of the biomes into at most
+	MAX_RANGES ranges. For every distinct set of biomes, a grid over heat
+	and humidity lists the biomes that may be the closest in each cell; the
+	others are farther than a biome that applies in the whole range without
+	X and Z limits, everywhere in the cell. The candidates are checked in
+	the order of the biome indices, so that the results are exactly the
+	ones of the linear search.
+
+	With many different Y limits, neighbouring ranges are merged and their
+	grids list the biomes of all of them. Ranges whose grids would exceed
+	the memory limit are left to the linear search, the ones closest to
+	Y = 0 are indexed first.
+*/
+class BiomeIndex {
+public:
+	static const u32 MAX_RANGES = 64;
+
+	// biomes: by biome index, the first one (BIOME_NONE) and NULL ones are
+	// never returned. max_bytes limits the size of the grids.
+	void build(const std::vector<Biome *> &biomes,
+		size_t max_bytes = 8 * 1024 * 1024);
+
+	// Count of biomes the index was built with
+	size_t getBiomeCount() const { return m_biomes.size(); }
+	// Size of the grids
+	size_t getBytes() const { return m_bytes; }
+
+	// Returns false for the points the index does not cover, which need the
+	// linear search
+	bool find(float heat, float humidity, v3s16 pos, BiomeClosest &closest) const;
+
+private:
+	struct Grid {
+		// Candidates of cell i: candidates[cells[i]] to candidates[cells[i + 1]]
+		std::vector<u32> cells;
+		std::vector<u16> candidates;
+	};
+
+	// biomes: the ones that apply somewhere in the range, covering: the ones
+	// that apply in all of it
+	void buildGrid(Grid &grid, const std::vector<u16> &biomes,
+		const std::vector<u16> &covering);
+
+	std::vector<Biome *> m_biomes;
+	// Lower Y limit of each range, the biomes of range i are in
+	// m_grids[m_range_grids[i]] and the ones blending into it in
+	// m_grids[m_range_grids[i] + 1], or U32_MAX if it is not indexed
+	std::vector<s32> m_range_min_y;
+	std::vector<u32> m_range_grids;
+	std::vector<Grid> m_grids;
+	size_t m_bytes = 0;
+
+	// Grid extent over heat and humidity, the outer cells extend to infinity
+	double m_heat_min = 0.0;
+	double m_humidity_min = 0.0;
+	double m_cell_size = 1.0;
+	u32 m_grid_size = 0;
+};
+
 ////
 //// BiomeGen
 ////
@@ -174,6 +256,8 @@ class BiomeGenOriginal : public BiomeGen {
 
 private:
 	BiomeParamsOriginal *m_params;
+	// Of the biomes registered when the mapgen is created
+	std::shared_ptr<const BiomeIndex> m_index;
 
 	Noise *noise_heat;
 	Noise *noise_humidity;
@@ -231,7 +315,15 @@ class BiomeManager : public ObjDefManager {
 		NoiseParams &np_humidity_blend, u64 seed);
 	Biome *getBiomeFromNoiseOriginal(float heat, float humidity, v3s16 pos);
 
+	// Index of the registered biomes, shared by the biome generators. Built
+	// by the first one, after the mods registered their biomes, and again
+	// if biomes were added or cleared since.
+	std::shared_ptr<const BiomeIndex> getIndex();
+
 private:
 	Server *m_server;
 
+	std::mutex m_index_mutex;
+	std::shared_ptr<const BiomeIndex> m_index;
+
 };
@@ -304,7 +304,8 @@ bool Schematic::deserializeFromMts(std::istream *is,
 	delete []schemdata;
 	schemdata = new MapNode[nodecount];
 
-	MapNode::deSerializeBulk(ss, SER_FMT_VER_HIGHEST_READ, schemdata,
+	// Schematics are always written with zlib, see serializeToMts()
+	MapNode::deSerializeBulk(ss, SER_FMT_VER_HIGHEST_WRITE, schemdata,
 		nodecount, 2, 2, true);
 
 	// Fix probability values for nodes that were ignore; removed in v2
@@ -737,7 +737,7 @@ void MapNode::serializeBulk(std::ostream &os, int version,
 	*/
 
 	if (compressed)
-		compressZlib(databuf, databuf_size, os);
+		compress(databuf, databuf_size, os, version);
 	else
 		os.write((const char*) &databuf[0], databuf_size);
 
@@ -763,7 +763,7 @@ void MapNode::deSerializeBulk(std::istream &is, int version,
 	if(compressed)
 	{
 		std::ostringstream os(std::ios_base::binary);
-		decompressZlib(is, os);
+		decompress(is, os, version);
 		std::string s = os.str();
 		if(s.size() != len)
 			throw SerializationError("deSerializeBulkNodes: "
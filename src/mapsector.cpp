@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mapsector.h"
 #include "exceptions.h"
+#include "map.h"
 #include "mapblock.h"
 #include "serialization.h"
 
@@ -36,11 +37,9 @@ MapSector::~MapSector()
 
 void MapSector::deleteBlocks()
 {
-	// Clear cache
-	m_block_cache = nullptr;
-
 	// Delete all
 	for (auto &block : m_blocks) {
+		m_parent->unindexBlock(block.second);
 		delete block.second;
 	}
 
@@ -48,33 +47,15 @@ void MapSector::deleteBlocks()
 	m_blocks.clear();
 }
 
-MapBlock * MapSector::getBlockBuffered(s16 y)
-{
-	MapBlock *block;
-
-	if (m_block_cache && y == m_block_cache_y) {
-		return m_block_cache;
-	}
-
-	// If block doesn't exist, return NULL
-	std::unordered_map<s16, MapBlock*>::const_iterator n = m_blocks.find(y);
-	block = (n != m_blocks.end() ? n->second : nullptr);
-
-	// Cache the last result
-	m_block_cache_y = y;
-	m_block_cache = block;
-
-	return block;
-}
-
 MapBlock * MapSector::getBlockNoCreateNoEx(s16 y)
 {
-	return getBlockBuffered(y);
+	auto n = m_blocks.find(y);
+	return n != m_blocks.end() ? n->second : nullptr;
 }
 
 MapBlock * MapSector::createBlankBlockNoInsert(s16 y)
 {
-	assert(getBlockBuffered(y) == NULL);	// Pre-condition
+	assert(getBlockNoCreateNoEx(y) == NULL);	// Pre-condition
 
 	v3s16 blockpos_map(m_pos.X, y, m_pos.Y);
 
@@ -88,6 +69,7 @@ MapBlock * MapSector::createBlankBlock(s16 y)
 	MapBlock *block = createBlankBlockNoInsert(y);
 
 	m_blocks[y] = block;
+	m_parent->indexBlock(block);
 
 	return block;
 }
@@ -96,7 +78,7 @@ void MapSector::insertBlock(MapBlock *block)
 {
 	s16 block_y = block->getPos().Y;
 
-	MapBlock *block2 = getBlockBuffered(block_y);
+	MapBlock *block2 = getBlockNoCreateNoEx(block_y);
 	if (block2) {
 		throw AlreadyExistsException("Block already exists");
 	}
@@ -106,16 +88,15 @@ void MapSector::insertBlock(MapBlock *block)
 
 	// Insert into container
 	m_blocks[block_y] = block;
+	m_parent->indexBlock(block);
 }
 
 void MapSector::deleteBlock(MapBlock *block)
 {
 	s16 block_y = block->getPos().Y;
 
-	// Clear from cache
-	m_block_cache = nullptr;
-
-	// Remove from container
+	// Remove from containers
+	m_parent->unindexBlock(block);
 	m_blocks.erase(block_y);
 
 	// Delete
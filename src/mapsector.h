@@ -31,6 +31,9 @@ class IGameDef;
 
 /*
 	This is an Y-wise stack of MapBlocks.
+
+	The Map looks blocks up in its own index, which the sector keeps up to
+	date. Sectors are used to iterate over the blocks column by column.
 */
 
 #define MAPSECTOR_SERVER 0
@@ -72,15 +75,4 @@ class MapSector
 	v2s16 m_pos;
 
 	IGameDef *m_gamedef;
-
-	// Last-used block is cached here for quicker access.
-	// Be sure to set this to nullptr when the cached block is deleted
-	MapBlock *m_block_cache = nullptr;
-	s16 m_block_cache_y;
-
-	/*
-		Private methods
-	*/
-	MapBlock *getBlockBuffered(s16 y);
-
 };
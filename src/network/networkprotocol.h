@@ -709,7 +709,7 @@ enum ToServerCommand
 		Sent first after connected.
 
 		u8 serialisation version (=SER_FMT_VER_HIGHEST_READ)
-		u16 supported network compression modes
+		u16 supported network compression modes (NetProtoCompressionMode flags)
 		u16 minimum supported network protocol version
 		u16 maximum supported network protocol version
 		std::string player name
@@ -951,6 +951,8 @@ enum AccessDeniedCode {
 
 enum NetProtoCompressionMode {
 	NETPROTO_COMPRESSION_NONE = 0,
+	// Map blocks are compressed with zstd (serialization version 29)
+	NETPROTO_COMPRESSION_ZSTD = 0x01,
 };
 
 const static std::string accessDeniedStrings[SERVER_ACCESSDENIED_MAX] = {
@@ -102,6 +102,9 @@ void Server::handleCommand_Init(NetworkPacket* pkt)
 			>> max_net_proto_version >> playerName;
 
 	u8 our_max = SER_FMT_VER_HIGHEST_READ;
+	// Blocks are only sent with zstd if the client asks for it
+	if (!(supp_compr_modes & NETPROTO_COMPRESSION_ZSTD))
+		our_max = std::min<u8>(our_max, SER_FMT_VER_ZSTD - 1);
 	// Use the highest version supported by both
 	u8 depl_serial_v = std::min(client_max, our_max);
 	// If it's lower than the lowest supported, give up.
@@ -267,7 +270,8 @@ void Server::handleCommand_Init(NetworkPacket* pkt)
 	NetworkPacket resp_pkt(TOCLIENT_HELLO, 1 + 4
 		+ legacyPlayerNameCasing.size(), pkt->getPeerId());
 
-	u16 depl_compress_mode = NETPROTO_COMPRESSION_NONE;
+	u16 depl_compress_mode = depl_serial_v >= SER_FMT_VER_ZSTD ?
+		NETPROTO_COMPRESSION_ZSTD : NETPROTO_COMPRESSION_NONE;
 	resp_pkt << depl_serial_v << depl_compress_mode << net_proto_version
 		<< auth_mechs << legacyPlayerNameCasing;
 
@@ -37,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "debug.h"
 #include "gamedef.h"
 #include "mapnode.h"
+#include "threading/mutex_auto_lock.h"
 #include <fstream> // Used in applyTextureOverrides()
 #include <algorithm>
 #include <cmath>
@@ -909,6 +910,30 @@ void ContentFeatures::updateTextures(ITextureSource *tsrc, IShaderSource *shdsrc
 }
 #endif
 
+/*
+	ContentFilter
+*/
+
+ContentFilter::ContentFilter(std::vector<content_t> ids) :
+	m_ids(std::move(ids))
+{
+	std::sort(m_ids.begin(), m_ids.end());
+	m_ids.erase(std::unique(m_ids.begin(), m_ids.end()), m_ids.end());
+	if (m_ids.empty())
+		return;
+
+	m_bits.resize((m_ids.back() >> 6) + 1, 0);
+	for (content_t c : m_ids)
+		m_bits[c >> 6] |= 1ULL << (c & 63);
+
+	m_rank.resize(m_bits.size());
+	u32 rank = 0;
+	for (size_t i = 0; i < m_bits.size(); i++) {
+		m_rank[i] = rank;
+		rank += std::bitset<64>(m_bits[i]).count();
+	}
+}
+
 /*
 	NodeDefManager
 */
@@ -939,13 +964,17 @@ void NodeDefManager::clear()
 {
 	m_content_features.clear();
 	m_name_id_mapping.clear();
-	m_name_id_mapping_with_aliases.clear();
+	{
+		MutexAutoLock lock(m_name_id_mutex);
+		m_name_id_mapping_with_aliases.clear();
+	}
 	m_group_to_items.clear();
 	m_next_id = 0;
 	m_selection_box_union.reset(0,0,0);
 	m_selection_box_int_union.reset(0,0,0);
 
 	resetNodeResolveState();
+	clearFilterCache();
 
 	u32 initial_length = 0;
 	initial_length = MYMAX(initial_length, CONTENT_UNKNOWN + 1);
@@ -1006,6 +1035,7 @@ void NodeDefManager::clear()
 
 bool NodeDefManager::getId(const std::string &name, content_t &result) const
 {
+	MutexAutoLock lock(m_name_id_mutex);
 	std::unordered_map<std::string, content_t>::const_iterator
 		i = m_name_id_mapping_with_aliases.find(name);
 	if(i == m_name_id_mapping_with_aliases.end())
@@ -1048,6 +1078,40 @@ bool NodeDefManager::getIds(const std::string &name,
 }
 
 
+std::shared_ptr<const ContentFilter> NodeDefManager::getFilter(
+		const std::vector<std::string> &names) const
+{
+	std::string key;
+	for (const std::string &name : names) {
+		key.append(name);
+		key.push_back('\n');
+	}
+
+	MutexAutoLock lock(m_filter_cache_mutex);
+	auto it = m_filter_cache.find(key);
+	if (it != m_filter_cache.end())
+		return it->second;
+
+	std::vector<content_t> ids;
+	for (const std::string &name : names)
+		getIds(name, ids);
+	auto filter = std::make_shared<const ContentFilter>(std::move(ids));
+
+	// Names built at runtime could make the cache grow without bound
+	if (m_filter_cache.size() >= 1024)
+		m_filter_cache.clear();
+	m_filter_cache[key] = filter;
+	return filter;
+}
+
+
+void NodeDefManager::clearFilterCache()
+{
+	MutexAutoLock lock(m_filter_cache_mutex);
+	m_filter_cache.clear();
+}
+
+
 const ContentFeatures& NodeDefManager::get(const std::string &name) const
 {
 	content_t id = CONTENT_UNKNOWN;
@@ -1259,6 +1323,7 @@ content_t NodeDefManager::set(const std::string &name, const ContentFeatures &de
 		const std::string &group_name = group.first;
 		m_group_to_items[group_name].push_back(id);
 	}
+	clearFilterCache();
 
 	return id;
 }
@@ -1282,10 +1347,12 @@ void NodeDefManager::removeNode(const std::string &name)
 	content_t id = CONTENT_IGNORE;
 	if (m_name_id_mapping.getId(name, id)) {
 		m_name_id_mapping.eraseName(name);
+		MutexAutoLock lock(m_name_id_mutex);
 		m_name_id_mapping_with_aliases.erase(name);
 	}
 
 	eraseIdFromGroups(id);
+	clearFilterCache();
 }
 
 
@@ -1293,15 +1360,19 @@ void NodeDefManager::updateAliases(IItemDefManager *idef)
 {
 	std::set<std::string> all;
 	idef->getAll(all);
-	m_name_id_mapping_with_aliases.clear();
+	std::unordered_map<std::string, content_t> with_aliases;
 	for (const std::string &name : all) {
 		const std::string &convert_to = idef->getAlias(name);
 		content_t id;
 		if (m_name_id_mapping.getId(convert_to, id)) {
-			m_name_id_mapping_with_aliases.insert(
-				std::make_pair(name, id));
+			with_aliases.insert(std::make_pair(name, id));
 		}
 	}
+	{
+		MutexAutoLock lock(m_name_id_mutex);
+		m_name_id_mapping_with_aliases.swap(with_aliases);
+	}
+	clearFilterCache();
 }
 
 void NodeDefManager::applyTextureOverrides(const std::string &override_filepath)
@@ -1469,7 +1540,11 @@ void NodeDefManager::deSerialize(std::istream &is)
 void NodeDefManager::addNameIdMapping(content_t i, std::string name)
 {
 	m_name_id_mapping.set(i, name);
-	m_name_id_mapping_with_aliases.insert(std::make_pair(name, i));
+	{
+		MutexAutoLock lock(m_name_id_mutex);
+		m_name_id_mapping_with_aliases.insert(std::make_pair(name, i));
+	}
+	clearFilterCache();
 }
 
 
@@ -20,9 +20,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "irrlichttypes_bloated.h"
+#include <bitset>
 #include <string>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 #include "mapnode.h"
 #include "nameidmapping.h"
 #ifndef SERVER
@@ -439,6 +444,48 @@ struct ContentFeatures
 #endif
 };
 
+/*!
+ * @brief A set of content IDs, stored as a bitset over all content IDs.
+ *
+ * @details Made by \ref NodeDefManager::getFilter() from node names and
+ * "group:" names, which caches the filters so that resolving the same
+ * names again costs a single lookup.
+ */
+class ContentFilter {
+public:
+	ContentFilter() = default;
+	explicit ContentFilter(std::vector<content_t> ids);
+
+	inline bool contains(content_t c) const
+	{
+		size_t word = c >> 6;
+		return word < m_bits.size() && ((m_bits[word] >> (c & 63)) & 1);
+	}
+
+	bool empty() const { return m_ids.empty(); }
+	size_t size() const { return m_ids.size(); }
+
+	//! The contained IDs in ascending order.
+	const std::vector<content_t> &getIds() const { return m_ids; }
+
+	/*!
+	 * Returns the position of a contained ID in \ref getIds().
+	 * @param c a content ID that is contained in the filter
+	 */
+	inline u32 indexOf(content_t c) const
+	{
+		size_t word = c >> 6;
+		u64 below = m_bits[word] & ((1ULL << (c & 63)) - 1);
+		return m_rank[word] + std::bitset<64>(below).count();
+	}
+
+private:
+	std::vector<u64> m_bits;
+	//! Number of IDs in the words before each word of \ref m_bits
+	std::vector<u32> m_rank;
+	std::vector<content_t> m_ids;
+};
+
 /*!
  * @brief This class is for getting the actual properties of nodes from their
  * content ID.
@@ -496,6 +543,7 @@ class NodeDefManager {
 	 * @param[out] result will contain the content ID if found, otherwise
 	 * remains unchanged
 	 * @return true if the ID was found, false otherwise
+	 * Can be called while another thread allocates IDs.
 	 */
 	bool getId(const std::string &name, content_t &result) const;
 
@@ -516,6 +564,20 @@ class NodeDefManager {
 	 */
 	bool getIds(const std::string &name, std::vector<content_t> &result) const;
 
+	/*!
+	 * Returns the filter of the content IDs of the given node names and
+	 * node group names, like \ref getIds() for each of them.
+	 * Filters are cached by their names until the node definitions change;
+	 * callers may keep the returned filter as long as they like.
+	 * @param names node names or node group names
+	 */
+	std::shared_ptr<const ContentFilter> getFilter(
+			const std::vector<std::string> &names) const;
+	std::shared_ptr<const ContentFilter> getFilter(const std::string &name) const
+	{
+		return getFilter(std::vector<std::string>{name});
+	}
+
 	/*!
 	 * Returns the smallest box in integer node coordinates that
 	 * contains all nodes' selection boxes. The returned box might be larger
@@ -682,6 +744,9 @@ class NodeDefManager {
 	 */
 	void fixSelectionBoxIntUnion();
 
+	//! Forgets the cached filters, called when IDs or groups change.
+	void clearFilterCache();
+
 	//! Features indexed by ID.
 	std::vector<ContentFeatures> m_content_features;
 
@@ -691,10 +756,17 @@ class NodeDefManager {
 	/*!
 	 * Like @ref m_name_id_mapping, but maps only from names to IDs, and
 	 * includes aliases too. Updated by \ref updateAliases().
+	 * Guarded by \ref m_name_id_mutex.
 	 * Note: Not serialized.
 	 */
 	std::unordered_map<std::string, content_t> m_name_id_mapping_with_aliases;
 
+	/*!
+	 * Emerge threads look up IDs while they deserialize blocks without the
+	 * environment lock, which \ref allocateDummy() is called with.
+	 */
+	mutable std::mutex m_name_id_mutex;
+
 	/*!
 	 * A mapping from group names to a vector of content types that belong
 	 * to it. Necessary for a direct lookup in \ref getIds().
@@ -731,6 +803,11 @@ class NodeDefManager {
 	 * Even constant NodeDefManager instances can register listeners.
 	 */
 	mutable std::vector<NodeResolver *> m_pending_resolve_callbacks;
+
+	//! Filters made by \ref getFilter(), by their names joined with newlines.
+	mutable std::unordered_map<std::string,
+			std::shared_ptr<const ContentFilter>> m_filter_cache;
+	mutable std::mutex m_filter_cache_mutex;
 };
 
 NodeDefManager *createNodeDefManager();
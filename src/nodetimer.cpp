@@ -21,6 +21,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "log.h"
 #include "serialization.h"
 #include "util/serialize.h"
+#include "util/numeric.h"
 #include "constants.h" // MAP_BLOCKSIZE
 
 /*
@@ -148,3 +149,220 @@ std::vector<NodeTimer> NodeTimerList::step(float dtime)
 		m_next_trigger_time = m_timers.begin()->first;
 	return elapsed_timers;
 }
+
+std::vector<NodeTimer> NodeTimerList::getAll() const
+{
+	std::vector<NodeTimer> timers;
+	timers.reserve(m_timers.size());
+	for (const auto &timer : m_timers) {
+		NodeTimer t = timer.second;
+		t.elapsed = t.timeout - (f32)(timer.first - m_time);
+		timers.push_back(t);
+	}
+	return timers;
+}
+
+/*
+	NodeTimerWheel
+*/
+
+NodeTimerWheel::NodeTimerWheel(double tick_length) :
+	m_tick_length(tick_length)
+{
+	for (u32 &slot : m_slots)
+		slot = NONE;
+}
+
+NodeTimer NodeTimerWheel::get(v3s16 p) const
+{
+	const u32 *i = m_by_pos.find(p);
+	if (!i)
+		return NodeTimer();
+	return getTimer(m_entries[*i]);
+}
+
+void NodeTimerWheel::set(const NodeTimer &timer)
+{
+	remove(timer.position);
+
+	u32 i = allocEntry();
+	Entry &e = m_entries[i];
+	e.timer = timer;
+	e.trigger_time = m_time + (double)(timer.timeout - timer.elapsed);
+	link(i);
+	m_by_pos[timer.position] = i;
+	linkBlock(i, getContainerPos(timer.position, MAP_BLOCKSIZE));
+}
+
+void NodeTimerWheel::remove(v3s16 p)
+{
+	const u32 *i = m_by_pos.find(p);
+	if (i)
+		erase(*i);
+}
+
+std::vector<NodeTimer> NodeTimerWheel::step(float dtime)
+{
+	std::vector<NodeTimer> elapsed_timers;
+	m_time += dtime;
+	const u64 last_tick = tickOf(m_time);
+
+	while (m_tick <= last_tick) {
+		// Entering a new slot of a level moves the entries of the next
+		// coarser level that fall into it down
+		if (m_cascaded_tick != m_tick) {
+			m_cascaded_tick = m_tick;
+			for (u32 level = 1; level < LEVELS; level++) {
+				if ((m_tick >> (SLOT_BITS * (level - 1))) & (SLOTS - 1))
+					break;
+				cascade(level);
+			}
+		}
+
+		// The last tick is only partly over, it is visited again next time
+		bool partial = m_tick == last_tick;
+		u32 i = m_slots[m_tick & (SLOTS - 1)];
+		while (i != NONE) {
+			Entry &e = m_entries[i];
+			u32 next = e.next;
+			if (!partial || e.trigger_time <= m_time) {
+				NodeTimer t = e.timer;
+				t.elapsed = t.timeout + (f32)(m_time - e.trigger_time);
+				elapsed_timers.push_back(t);
+				erase(i);
+			}
+			i = next;
+		}
+		if (partial)
+			break;
+		m_tick++;
+	}
+	return elapsed_timers;
+}
+
+void NodeTimerWheel::getBlockTimers(v3s16 blockpos,
+	std::vector<NodeTimer> &timers) const
+{
+	const u32 *head = m_by_block.find(blockpos);
+	if (!head)
+		return;
+	for (u32 i = *head; i != NONE; i = m_entries[i].block_next)
+		timers.push_back(getTimer(m_entries[i]));
+}
+
+void NodeTimerWheel::takeBlockTimers(v3s16 blockpos,
+	std::vector<NodeTimer> &timers)
+{
+	const u32 *head = m_by_block.find(blockpos);
+	if (!head)
+		return;
+	u32 i = *head;
+	while (i != NONE) {
+		u32 next = m_entries[i].block_next;
+		timers.push_back(getTimer(m_entries[i]));
+		erase(i);
+		i = next;
+	}
+}
+
+u32 NodeTimerWheel::allocEntry()
+{
+	if (m_free == NONE) {
+		m_entries.emplace_back();
+		return m_entries.size() - 1;
+	}
+	u32 i = m_free;
+	m_free = m_entries[i].next;
+	return i;
+}
+
+void NodeTimerWheel::link(u32 i)
+{
+	Entry &e = m_entries[i];
+	u64 tick = tickOf(e.trigger_time);
+	u32 slot;
+	if (tick < m_tick) {
+		// Already due, handled with the current tick
+		slot = m_tick & (SLOTS - 1);
+	} else {
+		u64 delta = tick - m_tick;
+		u32 level = 0;
+		while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1))))
+			level++;
+		// Beyond the range of the wheel, it is put back in when it gets near
+		if (delta >= (1ULL << (SLOT_BITS * LEVELS)))
+			tick = m_tick + (1ULL << (SLOT_BITS * LEVELS)) - 1;
+		slot = level * SLOTS + ((tick >> (SLOT_BITS * level)) & (SLOTS - 1));
+	}
+
+	e.slot = slot;
+	e.prev = NONE;
+	e.next = m_slots[slot];
+	if (e.next != NONE)
+		m_entries[e.next].prev = i;
+	m_slots[slot] = i;
+}
+
+void NodeTimerWheel::unlink(u32 i)
+{
+	Entry &e = m_entries[i];
+	if (e.prev != NONE)
+		m_entries[e.prev].next = e.next;
+	else
+		m_slots[e.slot] = e.next;
+	if (e.next != NONE)
+		m_entries[e.next].prev = e.prev;
+}
+
+void NodeTimerWheel::linkBlock(u32 i, v3s16 blockpos)
+{
+	Entry &e = m_entries[i];
+	e.block_prev = NONE;
+	const u32 *head = m_by_block.find(blockpos);
+	e.block_next = head ? *head : NONE;
+	if (e.block_next != NONE)
+		m_entries[e.block_next].block_prev = i;
+	m_by_block[blockpos] = i;
+}
+
+void NodeTimerWheel::unlinkBlock(u32 i, v3s16 blockpos)
+{
+	Entry &e = m_entries[i];
+	if (e.block_prev != NONE)
+		m_entries[e.block_prev].block_next = e.block_next;
+	else if (e.block_next != NONE)
+		m_by_block[blockpos] = e.block_next;
+	else
+		m_by_block.erase(blockpos);
+	if (e.block_next != NONE)
+		m_entries[e.block_next].block_prev = e.block_prev;
+}
+
+void NodeTimerWheel::erase(u32 i)
+{
+	v3s16 p = m_entries[i].timer.position;
+	unlink(i);
+	unlinkBlock(i, getContainerPos(p, MAP_BLOCKSIZE));
+	m_by_pos.erase(p);
+	m_entries[i].next = m_free;
+	m_free = i;
+}
+
+void NodeTimerWheel::cascade(u32 level)
+{
+	u32 slot = level * SLOTS + ((m_tick >> (SLOT_BITS * level)) & (SLOTS - 1));
+	u32 i = m_slots[slot];
+	m_slots[slot] = NONE;
+	while (i != NONE) {
+		u32 next = m_entries[i].next;
+		link(i);
+		i = next;
+	}
+}
+
+NodeTimer NodeTimerWheel::getTimer(const Entry &e) const
+{
+	NodeTimer t = e.timer;
+	t.elapsed = t.timeout - (f32)(e.trigger_time - m_time);
+	return t;
+}
@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "irr_v3d.h"
+#include "util/basic_macros.h"
+#include "util/blockpos_map.h"
 #include <iostream>
 #include <map>
 #include <vector>
@@ -120,9 +122,91 @@ class NodeTimerList
 	// Move forward in time, returns elapsed timers
 	std::vector<NodeTimer> step(float dtime);
 
+	bool empty() const { return m_timers.empty(); }
+	// Returns all timers with their current elapsed time
+	std::vector<NodeTimer> getAll() const;
+
 private:
 	std::multimap<double, NodeTimer> m_timers;
 	std::map<v3s16, std::multimap<double, NodeTimer>::iterator> m_iterators;
 	double m_next_trigger_time = -1.0;
 	double m_time = 0.0;
 };
+
+/*
+	Timers of the nodes of all active blocks, kept on a hierarchical timer
+	wheel. Setting and removing a timer takes constant time, and stepping
+	only visits the timers that are due, plus the ones that move down to a
+	finer level of the wheel once their time gets near.
+
+	Positions are absolute node positions. The timers of a block are moved
+	in when it is activated and taken out again when it is deactivated.
+*/
+
+class NodeTimerWheel
+{
+public:
+	// Timers due within the same tick are kept in the same slot
+	NodeTimerWheel(double tick_length = 0.05);
+	~NodeTimerWheel() = default;
+	DISABLE_CLASS_COPY(NodeTimerWheel);
+
+	// Returns a timer with a timeout of 0 if there is none at p
+	NodeTimer get(v3s16 p) const;
+	// Deletes old timer and sets a new one
+	void set(const NodeTimer &timer);
+	void remove(v3s16 p);
+
+	// Move forward in time, returns elapsed timers
+	std::vector<NodeTimer> step(float dtime);
+
+	// Appends the timers of the block with their current elapsed time
+	void getBlockTimers(v3s16 blockpos, std::vector<NodeTimer> &timers) const;
+	// Like getBlockTimers(), and deletes the timers
+	void takeBlockTimers(v3s16 blockpos, std::vector<NodeTimer> &timers);
+
+	size_t size() const { return m_by_pos.size(); }
+
+private:
+	static const u32 SLOT_BITS = 6;
+	static const u32 SLOTS = 1 << SLOT_BITS;
+	static const u32 LEVELS = 5;
+	static const u32 NONE = U32_MAX;
+
+	struct Entry
+	{
+		NodeTimer timer;
+		double trigger_time;
+		// Neighbours within the slot and within the block
+		u32 prev, next;
+		u32 block_prev, block_next;
+		u32 slot;
+	};
+
+	u64 tickOf(double time) const { return (u64)(time / m_tick_length); }
+
+	u32 allocEntry();
+	void link(u32 i);
+	void unlink(u32 i);
+	void linkBlock(u32 i, v3s16 blockpos);
+	void unlinkBlock(u32 i, v3s16 blockpos);
+	// Deletes an entry that is linked everywhere
+	void erase(u32 i);
+	// Moves the entries of a slot of a coarser level down
+	void cascade(u32 level);
+	NodeTimer getTimer(const Entry &e) const;
+
+	double m_tick_length;
+	double m_time = 0.0;
+	// Next tick to be processed completely
+	u64 m_tick = 0;
+	// Tick at which the slots were last cascaded
+	u64 m_cascaded_tick = U64_MAX;
+
+	std::vector<Entry> m_entries;
+	u32 m_free = NONE;
+	u32 m_slots[LEVELS * SLOTS];
+	BlockPosMap<u32> m_by_pos;
+	// First entry of each block
+	BlockPosMap<u32> m_by_block;
+};
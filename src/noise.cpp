@@ -31,11 +31,7 @@
 #include "util/numeric.h"
 #include "util/string.h"
 #include "exceptions.h"
-
-#define NOISE_MAGIC_X    1619
-#define NOISE_MAGIC_Y    31337
-#define NOISE_MAGIC_Z    52591
-#define NOISE_MAGIC_SEED 1013
+#include "noise_tile_cache.h"
 
 typedef float (*Interp2dFxn)(
 		float v00, float v10, float v01, float v11,
@@ -435,6 +431,8 @@ Noise::Noise(NoiseParams *np_, s32 seed, u32 sx, u32 sy, u32 sz)
 	this->sy   = sy;
 	this->sz   = sz;
 
+	setSimd(noise_simd_best());
+	m_tile_cache = &g_noise_tile_cache;
 	allocBuffers();
 }
 
@@ -445,6 +443,8 @@ Noise::~Noise()
 	delete[] persist_buf;
 	delete[] noise_buf;
 	delete[] result;
+	delete[] m_simd_buf;
+	delete[] m_column_idx;
 }
 
 
@@ -463,12 +463,17 @@ void Noise::allocBuffers()
 	delete[] gradient_buf;
 	delete[] persist_buf;
 	delete[] result;
+	delete[] m_simd_buf;
+	delete[] m_column_idx;
 
 	try {
 		size_t bufsize = sx * sy * sz;
 		this->persist_buf  = NULL;
 		this->gradient_buf = new float[bufsize];
 		this->result       = new float[bufsize];
+		// The column weights and up to 7 rows, see gradientMap3DSimd()
+		m_simd_buf   = new float[sx * 8];
+		m_column_idx = new u32[sx];
 	} catch (std::bad_alloc &e) {
 		throw InvalidNoiseParamsException();
 	}
@@ -501,6 +506,13 @@ void Noise::setOctaves(int octaves)
 }
 
 
+void Noise::setSimd(NoiseSimd simd)
+{
+	m_kernels = noise_simd_kernels(simd);
+	m_simd = m_kernels ? simd : NOISE_SIMD_NONE;
+}
+
+
 void Noise::resizeNoiseBuf(bool is3d)
 {
 	//maximum possible spread value factor
@@ -557,6 +569,11 @@ void Noise::gradientMap2D(
 	u32 nlx, nly;
 	s32 x0, y0;
 
+	if (m_kernels) {
+		gradientMap2DSimd(x, y, step_x, step_y, seed);
+		return;
+	}
+
 	bool eased = np.flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
 	Interp2dFxn interpolate = eased ?
 		biLinearInterpolation : biLinearInterpolationNoEase;
@@ -623,6 +640,11 @@ void Noise::gradientMap3D(
 	u32 nlx, nly, nlz;
 	s32 x0, y0, z0;
 
+	if (m_kernels) {
+		gradientMap3DSimd(x, y, z, step_x, step_y, step_z, seed);
+		return;
+	}
+
 	Interp3dFxn interpolate = (np.flags & NOISE_FLAG_EASED) ?
 		triLinearInterpolation : triLinearInterpolationNoEase;
 
@@ -702,11 +724,182 @@ void Noise::gradientMap3D(
 #undef idx
 
 
+/*
+ * The SIMD versions compute the lattice a row at a time, then interpolate
+ * whole rows: the values along X are interpolated once for every band of rows
+ * between two lattice rows, and only the interpolation along Y (and Z) is left
+ * for each row.  The operations on every value are the same as the ones of the
+ * scalar code, in the same order, so that the results are bit-identical.
+ */
+void Noise::initColumns(float u, float step_x, bool eased)
+{
+	// The same steps as in the scalar loops
+	float *tcol = m_simd_buf;
+	u32 noisex = 0;
+	for (u32 i = 0; i != sx; i++) {
+		tcol[i] = eased ? easeCurve(u) : u;
+		m_column_idx[i] = noisex;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
+}
+
+
+// Interpolation of a lattice row along X, at every column
+static inline void lerp_row(const NoiseKernels *kernels, float *out, float *tmp,
+	const float *lattice, const u32 *column_idx, const float *tcol, u32 sx)
+{
+	for (u32 i = 0; i != sx; i++) {
+		out[i] = lattice[column_idx[i]];
+		tmp[i] = lattice[column_idx[i] + 1];
+	}
+	kernels->lerp(out, out, tmp, tcol, sx);
+}
+
+
+void Noise::gradientMap2DSimd(
+		float x, float y,
+		float step_x, float step_y,
+		s32 seed)
+{
+	bool eased = np.flags & (NOISE_FLAG_DEFAULTS | NOISE_FLAG_EASED);
+
+	s32 x0 = std::floor(x);
+	s32 y0 = std::floor(y);
+	float u = x - (float)x0;
+	float v = y - (float)y0;
+
+	u32 nlx = (u32)(u + sx * step_x) + 2;
+	u32 nly = (u32)(v + sy * step_y) + 2;
+	for (u32 j = 0; j != nly; j++)
+		m_kernels->lattice2d(&noise_buf[j * nlx], nlx, x0, y0 + j, seed);
+
+	initColumns(u, step_x, eased);
+	const float *tcol = m_simd_buf;
+	float *row0 = m_simd_buf + sx;
+	float *row1 = m_simd_buf + sx * 2;
+	float *tmp  = m_simd_buf + sx * 3;
+
+	u32 noisey = 0;
+	bool band_done = false;
+	for (u32 j = 0; j != sy; j++) {
+		if (!band_done) {
+			lerp_row(m_kernels, row0, tmp, &noise_buf[noisey * nlx],
+				m_column_idx, tcol, sx);
+			lerp_row(m_kernels, row1, tmp, &noise_buf[(noisey + 1) * nlx],
+				m_column_idx, tcol, sx);
+			band_done = true;
+		}
+
+		float ty = eased ? easeCurve(v) : v;
+		m_kernels->lerpUniform(&gradient_buf[j * sx], row0, row1, ty, sx);
+
+		v += step_y;
+		if (v >= 1.0) {
+			v -= 1.0;
+			noisey++;
+			band_done = false;
+		}
+	}
+}
+
+
+void Noise::gradientMap3DSimd(
+		float x, float y, float z,
+		float step_x, float step_y, float step_z,
+		s32 seed)
+{
+	bool eased = np.flags & NOISE_FLAG_EASED;
+
+	s32 x0 = std::floor(x);
+	s32 y0 = std::floor(y);
+	s32 z0 = std::floor(z);
+	float u = x - (float)x0;
+	float orig_v = y - (float)y0;
+	float w = z - (float)z0;
+
+	u32 nlx = (u32)(u + sx * step_x) + 2;
+	u32 nly = (u32)(orig_v + sy * step_y) + 2;
+	u32 nlz = (u32)(w + sz * step_z) + 2;
+	for (u32 k = 0; k != nlz; k++)
+	for (u32 j = 0; j != nly; j++) {
+		m_kernels->lattice3d(&noise_buf[(k * nly + j) * nlx], nlx,
+			x0, y0 + j, z0 + k, seed);
+	}
+
+	initColumns(u, step_x, eased);
+	const float *tcol = m_simd_buf;
+	// Lattice rows interpolated along X: y and z, y + 1 and z, y and z + 1,
+	// y + 1 and z + 1
+	float *a0  = m_simd_buf + sx;
+	float *a1  = m_simd_buf + sx * 2;
+	float *b0  = m_simd_buf + sx * 3;
+	float *b1  = m_simd_buf + sx * 4;
+	float *tmp = m_simd_buf + sx * 5;
+	// Interpolated along Y
+	float *ua  = m_simd_buf + sx * 6;
+	float *ub  = m_simd_buf + sx * 7;
+
+	u32 index = 0;
+	u32 noisez = 0;
+	for (u32 k = 0; k != sz; k++) {
+		float tz = eased ? easeCurve(w) : w;
+		float v = orig_v;
+		u32 noisey = 0;
+		bool band_done = false;
+		for (u32 j = 0; j != sy; j++) {
+			if (!band_done) {
+				const float *l0 = &noise_buf[(noisez * nly + noisey) * nlx];
+				const float *l1 = &noise_buf[((noisez + 1) * nly + noisey) * nlx];
+				lerp_row(m_kernels, a0, tmp, l0, m_column_idx, tcol, sx);
+				lerp_row(m_kernels, a1, tmp, l0 + nlx, m_column_idx, tcol, sx);
+				lerp_row(m_kernels, b0, tmp, l1, m_column_idx, tcol, sx);
+				lerp_row(m_kernels, b1, tmp, l1 + nlx, m_column_idx, tcol, sx);
+				band_done = true;
+			}
+
+			float ty = eased ? easeCurve(v) : v;
+			m_kernels->lerpUniform(ua, a0, a1, ty, sx);
+			m_kernels->lerpUniform(ub, b0, b1, ty, sx);
+			m_kernels->lerpUniform(&gradient_buf[index], ua, ub, tz, sx);
+			index += sx;
+
+			v += step_y;
+			if (v >= 1.0) {
+				v -= 1.0;
+				noisey++;
+				band_done = false;
+			}
+		}
+
+		w += step_z;
+		if (w >= 1.0) {
+			w -= 1.0;
+			noisez++;
+		}
+	}
+}
+
+
 float *Noise::perlinMap2D(float x, float y, float *persistence_map)
 {
 	float f = 1.0, g = 1.0;
 	size_t bufsize = sx * sy;
 
+	NoiseTileCache::Key key;
+	bool use_cache = m_tile_cache && m_tile_cache->isEnabled();
+	if (use_cache) {
+		key = NoiseTileCache::Key(np, seed, x, y, sx, sy, persistence_map);
+		if (NoiseTileCache::Data tile = m_tile_cache->get(key)) {
+			memcpy(result, tile->data(), sizeof(float) * bufsize);
+			return result;
+		}
+	}
+
 	x /= np.spread.X;
 	y /= np.spread.Y;
 
@@ -731,10 +924,17 @@ float *Noise::perlinMap2D(float x, float y, float *persistence_map)
 	}
 
 	if (std::fabs(np.offset - 0.f) > 0.00001 || std::fabs(np.scale - 1.f) > 0.00001) {
-		for (size_t i = 0; i != bufsize; i++)
-			result[i] = result[i] * np.scale + np.offset;
+		if (m_kernels) {
+			m_kernels->scaleOffset(result, np.scale, np.offset, bufsize);
+		} else {
+			for (size_t i = 0; i != bufsize; i++)
+				result[i] = result[i] * np.scale + np.offset;
+		}
 	}
 
+	if (use_cache)
+		m_tile_cache->set(key, result, bufsize);
+
 	return result;
 }
 
@@ -769,8 +969,12 @@ float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map)
 	}
 
 	if (std::fabs(np.offset - 0.f) > 0.00001 || std::fabs(np.scale - 1.f) > 0.00001) {
-		for (size_t i = 0; i != bufsize; i++)
-			result[i] = result[i] * np.scale + np.offset;
+		if (m_kernels) {
+			m_kernels->scaleOffset(result, np.scale, np.offset, bufsize);
+		} else {
+			for (size_t i = 0; i != bufsize; i++)
+				result[i] = result[i] * np.scale + np.offset;
+		}
 	}
 
 	return result;
@@ -780,6 +984,17 @@ float *Noise::perlinMap3D(float x, float y, float z, float *persistence_map)
 void Noise::updateResults(float g, float *gmap,
 	const float *persistence_map, size_t bufsize)
 {
+	if (m_kernels) {
+		bool absvalue = np.flags & NOISE_FLAG_ABSVALUE;
+		if (persistence_map) {
+			m_kernels->accumulateMap(result, gmap, gradient_buf,
+				persistence_map, absvalue, bufsize);
+		} else {
+			m_kernels->accumulate(result, gradient_buf, g, absvalue, bufsize);
+		}
+		return;
+	}
+
 	// This looks very ugly, but it is 50-70% faster than having
 	// conditional statements inside the loop
 	if (np.flags & NOISE_FLAG_ABSVALUE) {
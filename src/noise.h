@@ -27,8 +27,11 @@
 
 #include "irr_v3d.h"
 #include "exceptions.h"
+#include "noise_simd.h"
 #include "util/string.h"
 
+class NoiseTileCache;
+
 extern FlagDesc flagdesc_noiseparams[];
 
 // Note: this class is not polymorphic so that its high level of
@@ -146,6 +149,15 @@ class Noise {
 	void setSpreadFactor(v3f spread);
 	void setOctaves(int octaves);
 
+	// noise_simd_best() by default. The results are the same with all of
+	// them, NOISE_SIMD_NONE runs the scalar code.
+	void setSimd(NoiseSimd simd);
+	NoiseSimd getSimd() const { return m_simd; }
+
+	// Cache of the results of perlinMap2D(), g_noise_tile_cache by default.
+	// NULL to always compute them.
+	void setTileCache(NoiseTileCache *cache) { m_tile_cache = cache; }
+
 	void gradientMap2D(
 		float x, float y,
 		float step_x, float step_y,
@@ -183,6 +195,25 @@ class Noise {
 	void updateResults(float g, float *gmap, const float *persistence_map,
 			size_t bufsize);
 
+	// Vectorized gradientMap2D() and gradientMap3D()
+	void gradientMap2DSimd(
+		float x, float y,
+		float step_x, float step_y,
+		s32 seed);
+	void gradientMap3DSimd(
+		float x, float y, float z,
+		float step_x, float step_y, float step_z,
+		s32 seed);
+	void initColumns(float u, float step_x, bool eased);
+
+	NoiseSimd m_simd;
+	const NoiseKernels *m_kernels;
+	// Interpolation weights of the columns and the rows being interpolated
+	float *m_simd_buf = nullptr;
+	// Lattice column of every column
+	u32 *m_column_idx = nullptr;
+
+	NoiseTileCache *m_tile_cache;
 };
 
 float NoisePerlin2D(NoiseParams *np, float x, float y, s32 seed);
@@ -207,6 +238,11 @@ inline float NoisePerlin3D_PO(NoiseParams *np, float x, float xoff,
 		seed);
 }
 
+#define NOISE_MAGIC_X    1619
+#define NOISE_MAGIC_Y    31337
+#define NOISE_MAGIC_Z    52591
+#define NOISE_MAGIC_SEED 1013
+
 // Return value: -1 ... 1
 float noise2d(int x, int y, s32 seed);
 float noise3d(int x, int y, int z, s32 seed);
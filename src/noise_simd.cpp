@@ -0,0 +1,400 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "noise_simd.h"
+#include <cmath>
+#include "noise.h"
+
+/*
+	Only x86-64 has kernels: SSE2 is always there, AVX2 is checked for at
+	runtime. 32-bit x86 may compute the scalar code with x87 precision, and
+	compilers contract the scalar code into FMA on ARM by default, so the
+	results would not be the same there.
+*/
+#if defined(__x86_64__) || defined(_M_X64)
+	#define NOISE_SIMD_HAVE_SSE2 1
+	#include <emmintrin.h>
+	#if defined(__GNUC__) || defined(__clang__)
+		// Only these functions are built for AVX2, without FMA
+		#define NOISE_SIMD_HAVE_AVX2 1
+		#define NOISE_SIMD_AVX2_FUNC __attribute__((target("avx2")))
+		#include <immintrin.h>
+	#endif
+#endif
+
+// Hash of a lattice point, the part of noise2d() and noise3d() after the
+// coordinates are mixed in
+static inline float lattice_value(u32 n)
+{
+	n &= 0x7fffffff;
+	n = (n >> 13) ^ n;
+	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
+	return 1.f - (float)(int)n / 0x40000000;
+}
+
+static inline u32 lattice_base2d(s32 y, s32 seed)
+{
+	// Unsigned, the scalar code relies on the signed overflow wrapping
+	return NOISE_MAGIC_Y * (u32)y + NOISE_MAGIC_SEED * (u32)seed;
+}
+
+static inline u32 lattice_base3d(s32 y, s32 z, s32 seed)
+{
+	return NOISE_MAGIC_Y * (u32)y + NOISE_MAGIC_Z * (u32)z +
+		NOISE_MAGIC_SEED * (u32)seed;
+}
+
+#ifdef NOISE_SIMD_HAVE_SSE2
+
+////
+//// SSE2
+////
+
+// SSE2 has no 32-bit multiplication keeping the low halves
+static inline __m128i mullo_epi32_sse2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static void lattice_sse2(float *out, u32 count, s32 x0, u32 base)
+{
+	const __m128i mask = _mm_set1_epi32(0x7fffffff);
+	const __m128i c1 = _mm_set1_epi32(60493);
+	const __m128i c2 = _mm_set1_epi32(19990303);
+	const __m128i c3 = _mm_set1_epi32(1376312589);
+	const __m128i step = _mm_set1_epi32(4 * NOISE_MAGIC_X);
+	// Dividing by a power of two is the same as multiplying by its inverse
+	const __m128 scale = _mm_set1_ps(1.f / 0x40000000);
+	const __m128 one = _mm_set1_ps(1.f);
+
+	__m128i h = _mm_add_epi32(
+		_mm_set1_epi32((int)(NOISE_MAGIC_X * (u32)x0 + base)),
+		_mm_setr_epi32(0, NOISE_MAGIC_X, 2 * NOISE_MAGIC_X, 3 * NOISE_MAGIC_X));
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i n = _mm_and_si128(h, mask);
+		n = _mm_xor_si128(_mm_srli_epi32(n, 13), n);
+		__m128i t = _mm_add_epi32(
+			mullo_epi32_sse2(mullo_epi32_sse2(n, n), c1), c2);
+		n = _mm_and_si128(_mm_add_epi32(mullo_epi32_sse2(n, t), c3), mask);
+		__m128 f = _mm_mul_ps(_mm_cvtepi32_ps(n), scale);
+		_mm_storeu_ps(out + i, _mm_sub_ps(one, f));
+		h = _mm_add_epi32(h, step);
+	}
+	for (; i < count; i++)
+		out[i] = lattice_value(NOISE_MAGIC_X * (u32)(x0 + i) + base);
+}
+
+static void lattice2d_sse2(float *out, u32 count, s32 x0, s32 y, s32 seed)
+{
+	lattice_sse2(out, count, x0, lattice_base2d(y, seed));
+}
+
+static void lattice3d_sse2(float *out, u32 count, s32 x0, s32 y, s32 z, s32 seed)
+{
+	lattice_sse2(out, count, x0, lattice_base3d(y, z, seed));
+}
+
+static void lerp_sse2(float *out, const float *a, const float *b,
+	const float *t, u32 count)
+{
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 va = _mm_loadu_ps(a + i);
+		__m128 d = _mm_sub_ps(_mm_loadu_ps(b + i), va);
+		_mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(d, _mm_loadu_ps(t + i))));
+	}
+	for (; i < count; i++)
+		out[i] = a[i] + (b[i] - a[i]) * t[i];
+}
+
+static void lerp_uniform_sse2(float *out, const float *a, const float *b,
+	float t, u32 count)
+{
+	const __m128 vt = _mm_set1_ps(t);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 va = _mm_loadu_ps(a + i);
+		__m128 d = _mm_sub_ps(_mm_loadu_ps(b + i), va);
+		_mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(d, vt)));
+	}
+	for (; i < count; i++)
+		out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+static void accumulate_sse2(float *result, const float *gradient, float g,
+	bool absvalue, u32 count)
+{
+	const __m128 vg = _mm_set1_ps(g);
+	// Clears the sign bit for the absolute value
+	const __m128 absmask = _mm_castsi128_ps(
+		_mm_set1_epi32(absvalue ? 0x7fffffff : -1));
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 v = _mm_and_ps(_mm_loadu_ps(gradient + i), absmask);
+		_mm_storeu_ps(result + i,
+			_mm_add_ps(_mm_loadu_ps(result + i), _mm_mul_ps(vg, v)));
+	}
+	for (; i < count; i++)
+		result[i] += g * (absvalue ? std::fabs(gradient[i]) : gradient[i]);
+}
+
+static void accumulate_map_sse2(float *result, float *gmap,
+	const float *gradient, const float *persistence, bool absvalue, u32 count)
+{
+	const __m128 absmask = _mm_castsi128_ps(
+		_mm_set1_epi32(absvalue ? 0x7fffffff : -1));
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 vg = _mm_loadu_ps(gmap + i);
+		__m128 v = _mm_and_ps(_mm_loadu_ps(gradient + i), absmask);
+		_mm_storeu_ps(result + i,
+			_mm_add_ps(_mm_loadu_ps(result + i), _mm_mul_ps(vg, v)));
+		_mm_storeu_ps(gmap + i, _mm_mul_ps(vg, _mm_loadu_ps(persistence + i)));
+	}
+	for (; i < count; i++) {
+		result[i] += gmap[i] * (absvalue ? std::fabs(gradient[i]) : gradient[i]);
+		gmap[i] *= persistence[i];
+	}
+}
+
+static void scale_offset_sse2(float *result, float scale, float offset, u32 count)
+{
+	const __m128 vs = _mm_set1_ps(scale);
+	const __m128 vo = _mm_set1_ps(offset);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_ps(result + i,
+			_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(result + i), vs), vo));
+	}
+	for (; i < count; i++)
+		result[i] = result[i] * scale + offset;
+}
+
+static const NoiseKernels kernels_sse2 = {
+	lattice2d_sse2,
+	lattice3d_sse2,
+	lerp_sse2,
+	lerp_uniform_sse2,
+	accumulate_sse2,
+	accumulate_map_sse2,
+	scale_offset_sse2,
+};
+
+#endif
+
+#ifdef NOISE_SIMD_HAVE_AVX2
+
+////
+//// AVX2
+////
+
+NOISE_SIMD_AVX2_FUNC
+static void lattice_avx2(float *out, u32 count, s32 x0, u32 base)
+{
+	const __m256i mask = _mm256_set1_epi32(0x7fffffff);
+	const __m256i c1 = _mm256_set1_epi32(60493);
+	const __m256i c2 = _mm256_set1_epi32(19990303);
+	const __m256i c3 = _mm256_set1_epi32(1376312589);
+	const __m256i step = _mm256_set1_epi32(8 * NOISE_MAGIC_X);
+	const __m256 scale = _mm256_set1_ps(1.f / 0x40000000);
+	const __m256 one = _mm256_set1_ps(1.f);
+
+	__m256i h = _mm256_add_epi32(
+		_mm256_set1_epi32((int)(NOISE_MAGIC_X * (u32)x0 + base)),
+		_mm256_setr_epi32(0, NOISE_MAGIC_X, 2 * NOISE_MAGIC_X,
+			3 * NOISE_MAGIC_X, 4 * NOISE_MAGIC_X, 5 * NOISE_MAGIC_X,
+			6 * NOISE_MAGIC_X, 7 * NOISE_MAGIC_X));
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i n = _mm256_and_si256(h, mask);
+		n = _mm256_xor_si256(_mm256_srli_epi32(n, 13), n);
+		__m256i t = _mm256_add_epi32(
+			_mm256_mullo_epi32(_mm256_mullo_epi32(n, n), c1), c2);
+		n = _mm256_and_si256(_mm256_add_epi32(_mm256_mullo_epi32(n, t), c3), mask);
+		__m256 f = _mm256_mul_ps(_mm256_cvtepi32_ps(n), scale);
+		_mm256_storeu_ps(out + i, _mm256_sub_ps(one, f));
+		h = _mm256_add_epi32(h, step);
+	}
+	for (; i < count; i++)
+		out[i] = lattice_value(NOISE_MAGIC_X * (u32)(x0 + i) + base);
+}
+
+static void lattice2d_avx2(float *out, u32 count, s32 x0, s32 y, s32 seed)
+{
+	lattice_avx2(out, count, x0, lattice_base2d(y, seed));
+}
+
+static void lattice3d_avx2(float *out, u32 count, s32 x0, s32 y, s32 z, s32 seed)
+{
+	lattice_avx2(out, count, x0, lattice_base3d(y, z, seed));
+}
+
+NOISE_SIMD_AVX2_FUNC
+static void lerp_avx2(float *out, const float *a, const float *b,
+	const float *t, u32 count)
+{
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 va = _mm256_loadu_ps(a + i);
+		__m256 d = _mm256_sub_ps(_mm256_loadu_ps(b + i), va);
+		_mm256_storeu_ps(out + i,
+			_mm256_add_ps(va, _mm256_mul_ps(d, _mm256_loadu_ps(t + i))));
+	}
+	for (; i < count; i++)
+		out[i] = a[i] + (b[i] - a[i]) * t[i];
+}
+
+NOISE_SIMD_AVX2_FUNC
+static void lerp_uniform_avx2(float *out, const float *a, const float *b,
+	float t, u32 count)
+{
+	const __m256 vt = _mm256_set1_ps(t);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 va = _mm256_loadu_ps(a + i);
+		__m256 d = _mm256_sub_ps(_mm256_loadu_ps(b + i), va);
+		_mm256_storeu_ps(out + i, _mm256_add_ps(va, _mm256_mul_ps(d, vt)));
+	}
+	for (; i < count; i++)
+		out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+NOISE_SIMD_AVX2_FUNC
+static void accumulate_avx2(float *result, const float *gradient, float g,
+	bool absvalue, u32 count)
+{
+	const __m256 vg = _mm256_set1_ps(g);
+	const __m256 absmask = _mm256_castsi256_ps(
+		_mm256_set1_epi32(absvalue ? 0x7fffffff : -1));
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 v = _mm256_and_ps(_mm256_loadu_ps(gradient + i), absmask);
+		_mm256_storeu_ps(result + i,
+			_mm256_add_ps(_mm256_loadu_ps(result + i), _mm256_mul_ps(vg, v)));
+	}
+	for (; i < count; i++)
+		result[i] += g * (absvalue ? std::fabs(gradient[i]) : gradient[i]);
+}
+
+NOISE_SIMD_AVX2_FUNC
+static void accumulate_map_avx2(float *result, float *gmap,
+	const float *gradient, const float *persistence, bool absvalue, u32 count)
+{
+	const __m256 absmask = _mm256_castsi256_ps(
+		_mm256_set1_epi32(absvalue ? 0x7fffffff : -1));
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 vg = _mm256_loadu_ps(gmap + i);
+		__m256 v = _mm256_and_ps(_mm256_loadu_ps(gradient + i), absmask);
+		_mm256_storeu_ps(result + i,
+			_mm256_add_ps(_mm256_loadu_ps(result + i), _mm256_mul_ps(vg, v)));
+		_mm256_storeu_ps(gmap + i,
+			_mm256_mul_ps(vg, _mm256_loadu_ps(persistence + i)));
+	}
+	for (; i < count; i++) {
+		result[i] += gmap[i] * (absvalue ? std::fabs(gradient[i]) : gradient[i]);
+		gmap[i] *= persistence[i];
+	}
+}
+
+NOISE_SIMD_AVX2_FUNC
+static void scale_offset_avx2(float *result, float scale, float offset, u32 count)
+{
+	const __m256 vs = _mm256_set1_ps(scale);
+	const __m256 vo = _mm256_set1_ps(offset);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		_mm256_storeu_ps(result + i,
+			_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(result + i), vs), vo));
+	}
+	for (; i < count; i++)
+		result[i] = result[i] * scale + offset;
+}
+
+static const NoiseKernels kernels_avx2 = {
+	lattice2d_avx2,
+	lattice3d_avx2,
+	lerp_avx2,
+	lerp_uniform_avx2,
+	accumulate_avx2,
+	accumulate_map_avx2,
+	scale_offset_avx2,
+};
+
+#endif
+
+////
+//// Selection
+////
+
+static NoiseSimd detect_simd()
+{
+#if defined(NOISE_SIMD_HAVE_AVX2)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return NOISE_SIMD_AVX2;
+#endif
+#if defined(NOISE_SIMD_HAVE_SSE2)
+	return NOISE_SIMD_SSE2;
+#else
+	return NOISE_SIMD_NONE;
+#endif
+}
+
+NoiseSimd noise_simd_best()
+{
+	static const NoiseSimd best = detect_simd();
+	return best;
+}
+
+const char *noise_simd_name(NoiseSimd simd)
+{
+	switch (simd) {
+	case NOISE_SIMD_SSE2:
+		return "sse2";
+	case NOISE_SIMD_AVX2:
+		return "avx2";
+	default:
+		return "none";
+	}
+}
+
+const NoiseKernels *noise_simd_kernels(NoiseSimd simd)
+{
+	if (simd > noise_simd_best())
+		return nullptr;
+
+	switch (simd) {
+#ifdef NOISE_SIMD_HAVE_SSE2
+	case NOISE_SIMD_SSE2:
+		return &kernels_sse2;
+#endif
+#ifdef NOISE_SIMD_HAVE_AVX2
+	case NOISE_SIMD_AVX2:
+		return &kernels_avx2;
+#endif
+	default:
+		return nullptr;
+	}
+}
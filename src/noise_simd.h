@@ -0,0 +1,65 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+
+// Instruction sets the noise maps can be computed with
+enum NoiseSimd : u8 {
+	NOISE_SIMD_NONE,
+	NOISE_SIMD_SSE2,
+	NOISE_SIMD_AVX2,
+};
+
+/*
+	Vectorized loops of Noise::perlinMap2D() and perlinMap3D()
+
+	Every kernel does the same float operations in the same order as the
+	scalar code does for each element, so that the results are bit-identical
+	to it. The compiler must not contract them (no FMA), which is the default
+	for x86-64 builds.
+*/
+struct NoiseKernels
+{
+	// out[i] = noise2d(x0 + i, y, seed)
+	void (*lattice2d)(float *out, u32 count, s32 x0, s32 y, s32 seed);
+	// out[i] = noise3d(x0 + i, y, z, seed)
+	void (*lattice3d)(float *out, u32 count, s32 x0, s32 y, s32 z, s32 seed);
+	// out[i] = a[i] + (b[i] - a[i]) * t[i], out may be a
+	void (*lerp)(float *out, const float *a, const float *b, const float *t,
+		u32 count);
+	// out[i] = a[i] + (b[i] - a[i]) * t, out may be a
+	void (*lerpUniform)(float *out, const float *a, const float *b, float t,
+		u32 count);
+	// result[i] += g * gradient[i], with the absolute value if absvalue
+	void (*accumulate)(float *result, const float *gradient, float g,
+		bool absvalue, u32 count);
+	// result[i] += gmap[i] * gradient[i], gmap[i] *= persistence[i]
+	void (*accumulateMap)(float *result, float *gmap, const float *gradient,
+		const float *persistence, bool absvalue, u32 count);
+	// result[i] = result[i] * scale + offset
+	void (*scaleOffset)(float *result, float scale, float offset, u32 count);
+};
+
+// Best instruction set of this CPU that the build has kernels for
+NoiseSimd noise_simd_best();
+const char *noise_simd_name(NoiseSimd simd);
+// NULL for NOISE_SIMD_NONE and the sets above noise_simd_best()
+const NoiseKernels *noise_simd_kernels(NoiseSimd simd);
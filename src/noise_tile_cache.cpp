@@ -0,0 +1,191 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "noise_tile_cache.h"
+#include <cstring>
+#include "threading/mutex_auto_lock.h"
+
+NoiseTileCache g_noise_tile_cache(0);
+
+static inline u32 float_bits(float f)
+{
+	u32 bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+static inline u64 hash_mix(u64 h, u64 v)
+{
+	h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	return h;
+}
+
+// FNV-1a over whole words, in four independent lanes so that it is not
+// much slower than reading the map
+static u64 hash_floats(const float *values, size_t count)
+{
+	const u64 prime = 0x100000001b3ULL;
+	u64 lanes[4] = {
+		0xcbf29ce484222325ULL, 0x84222325cbf29ce4ULL,
+		0x2325cbf29ce48422ULL, 0xce484222325cbf29ULL,
+	};
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		for (size_t l = 0; l != 4; l++)
+			lanes[l] = (lanes[l] ^ float_bits(values[i + l])) * prime;
+	}
+	for (; i < count; i++)
+		lanes[0] = (lanes[0] ^ float_bits(values[i])) * prime;
+
+	u64 h = count;
+	for (u64 lane : lanes)
+		h = hash_mix(h, lane);
+	// 0 means no persistence map
+	return h ? h : 1;
+}
+
+NoiseTileCache::Key::Key(const NoiseParams &np_, s32 seed_, float x_, float y_,
+		u32 sx_, u32 sy_, const float *persistence_map) :
+	np(np_), seed(seed_), x(x_), y(y_), sx(sx_), sy(sy_)
+{
+	if (persistence_map)
+		persistence_hash = hash_floats(persistence_map, (size_t)sx * sy);
+
+	u64 h = persistence_hash;
+	h = hash_mix(h, float_bits(np.offset));
+	h = hash_mix(h, float_bits(np.scale));
+	h = hash_mix(h, float_bits(np.spread.X));
+	h = hash_mix(h, float_bits(np.spread.Y));
+	h = hash_mix(h, float_bits(np.spread.Z));
+	h = hash_mix(h, (u32)np.seed);
+	h = hash_mix(h, np.octaves);
+	h = hash_mix(h, float_bits(np.persist));
+	h = hash_mix(h, float_bits(np.lacunarity));
+	h = hash_mix(h, np.flags);
+	h = hash_mix(h, (u32)seed);
+	h = hash_mix(h, float_bits(x));
+	h = hash_mix(h, float_bits(y));
+	h = hash_mix(h, ((u64)sx << 32) | sy);
+	hash = h;
+}
+
+bool NoiseTileCache::Key::operator==(const Key &other) const
+{
+	// The bits, for -0.0 and 0.0 to be different positions like the
+	// results may be
+	return hash == other.hash &&
+		persistence_hash == other.persistence_hash &&
+		float_bits(x) == float_bits(other.x) &&
+		float_bits(y) == float_bits(other.y) &&
+		sx == other.sx && sy == other.sy && seed == other.seed &&
+		float_bits(np.offset) == float_bits(other.np.offset) &&
+		float_bits(np.scale) == float_bits(other.np.scale) &&
+		float_bits(np.spread.X) == float_bits(other.np.spread.X) &&
+		float_bits(np.spread.Y) == float_bits(other.np.spread.Y) &&
+		float_bits(np.spread.Z) == float_bits(other.np.spread.Z) &&
+		np.seed == other.np.seed && np.octaves == other.np.octaves &&
+		float_bits(np.persist) == float_bits(other.np.persist) &&
+		float_bits(np.lacunarity) == float_bits(other.np.lacunarity) &&
+		np.flags == other.np.flags;
+}
+
+NoiseTileCache::Data NoiseTileCache::get(const Key &key)
+{
+	MutexAutoLock lock(m_mutex);
+
+	auto it = m_entries.find(key);
+	if (it == m_entries.end()) {
+		m_misses++;
+		return nullptr;
+	}
+
+	m_lru.splice(m_lru.begin(), m_lru, it->second.lru_it);
+	m_hits++;
+	return it->second.data;
+}
+
+void NoiseTileCache::set(const Key &key, const float *values, size_t count)
+{
+	size_t bytes = count * sizeof(float);
+	if (bytes > m_max_bytes.load(std::memory_order_relaxed))
+		return;
+
+	// Copied before taking the lock
+	Data shared = std::make_shared<const std::vector<float>>(values, values + count);
+
+	MutexAutoLock lock(m_mutex);
+
+	auto it = m_entries.find(key);
+	if (it != m_entries.end())
+		eraseEntry(it);
+
+	m_lru.push_front(key);
+	m_entries[key] = Entry{shared, m_lru.begin()};
+	m_bytes += bytes;
+	evict();
+}
+
+void NoiseTileCache::clear()
+{
+	MutexAutoLock lock(m_mutex);
+	m_entries.clear();
+	m_lru.clear();
+	m_bytes = 0;
+}
+
+void NoiseTileCache::setMaxBytes(size_t max_bytes)
+{
+	MutexAutoLock lock(m_mutex);
+	m_max_bytes = max_bytes;
+	evict();
+}
+
+size_t NoiseTileCache::getSize() const
+{
+	MutexAutoLock lock(m_mutex);
+	return m_entries.size();
+}
+
+size_t NoiseTileCache::getBytes() const
+{
+	MutexAutoLock lock(m_mutex);
+	return m_bytes;
+}
+
+void NoiseTileCache::takeStats(u32 *hits, u32 *misses)
+{
+	MutexAutoLock lock(m_mutex);
+	*hits = m_hits;
+	*misses = m_misses;
+	m_hits = 0;
+	m_misses = 0;
+}
+
+void NoiseTileCache::eraseEntry(EntryMap::iterator it)
+{
+	m_bytes -= it->second.data->size() * sizeof(float);
+	m_lru.erase(it->second.lru_it);
+	m_entries.erase(it);
+}
+
+void NoiseTileCache::evict()
+{
+	while (m_bytes > m_max_bytes && !m_lru.empty())
+		eraseEntry(m_entries.find(m_lru.back()));
+}
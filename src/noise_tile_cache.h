@@ -0,0 +1,118 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "noise.h"
+#include "util/basic_macros.h"
+
+/*
+	Cache of 2D noise maps (Noise::perlinMap2D() results)
+
+	The mapgens compute the same 2D maps for all the mapchunks of a column,
+	and Lua code often asks for the maps of the same area again. Entries are
+	keyed by everything the result depends on: the noise parameters, the
+	seed, the position and size of the map and the persistence map, if any.
+	The cache is bounded by the total size of the stored maps and evicts the
+	least recently used entries first.
+
+	All methods are thread-safe.
+*/
+class NoiseTileCache
+{
+public:
+	typedef std::shared_ptr<const std::vector<float>> Data;
+
+	struct Key
+	{
+		Key() = default;
+		Key(const NoiseParams &np, s32 seed, float x, float y, u32 sx, u32 sy,
+			const float *persistence_map);
+
+		bool operator==(const Key &other) const;
+
+		NoiseParams np;
+		s32 seed = 0;
+		float x = 0.0f;
+		float y = 0.0f;
+		u32 sx = 0;
+		u32 sy = 0;
+		// Hash of the persistence map, 0 without one
+		u64 persistence_hash = 0;
+		u64 hash = 0;
+	};
+
+	NoiseTileCache(size_t max_bytes) : m_max_bytes(max_bytes) {}
+	DISABLE_CLASS_COPY(NoiseTileCache);
+
+	// Whether anything can be cached, checked before building keys
+	bool isEnabled() const { return m_max_bytes.load(std::memory_order_relaxed) != 0; }
+
+	// Returns the cached map or nullptr
+	Data get(const Key &key);
+	// Stores a copy of the map, replacing any previous entry for the key
+	void set(const Key &key, const float *values, size_t count);
+
+	void clear();
+	void setMaxBytes(size_t max_bytes);
+
+	size_t getSize() const;
+	size_t getBytes() const;
+	// Returns hit and miss counts since the last call and resets them
+	void takeStats(u32 *hits, u32 *misses);
+
+private:
+	struct KeyHash
+	{
+		size_t operator()(const Key &key) const { return key.hash; }
+	};
+
+	struct Entry
+	{
+		Data data;
+		std::list<Key>::iterator lru_it;
+	};
+
+	typedef std::unordered_map<Key, Entry, KeyHash> EntryMap;
+
+	void eraseEntry(EntryMap::iterator it);
+	void evict();
+
+	mutable std::mutex m_mutex;
+	EntryMap m_entries;
+	// Most recently used key at the front
+	std::list<Key> m_lru;
+	size_t m_bytes = 0;
+	std::atomic<size_t> m_max_bytes;
+
+	u32 m_hits = 0;
+	u32 m_misses = 0;
+};
+
+/*
+	Used by all Noise objects unless set otherwise. Disabled until the server
+	sets its size from the 'noise_tile_cache_size' setting.
+*/
+extern NoiseTileCache g_noise_tile_cache;
@@ -23,9 +23,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 /******************************************************************************/
 
 #include "pathfinder.h"
+#include <queue>
 #include "serverenvironment.h"
 #include "server.h"
 #include "nodedef.h"
+#include "mapblock.h"
+#include "profiler.h"
+#include "debug.h"
 
 //#define PATHFINDER_DEBUG
 //#define PATHFINDER_CALC_TIME
@@ -159,9 +163,10 @@ class MapGridNodeContainer : public GridNodeContainer {
 	virtual ~MapGridNodeContainer() = default;
 
 	MapGridNodeContainer(Pathfinder *pathf);
+	/** references are invalidated by accessing a node not seen before */
 	virtual PathGridnode &access(v3s16 p);
 private:
-	std::map<v3s16, PathGridnode> m_nodes;
+	BlockPosMap<PathGridnode> m_nodes;
 };
 
 /** class doing pathfinding */
@@ -177,7 +182,7 @@ class Pathfinder {
 
 	/**
 	 * path evaluation function
-	 * @param env environment to look for path
+	 * @param grid snapshot of the area to look for path
 	 * @param source origin of path
 	 * @param destination end position of path
 	 * @param searchdistance maximum number of nodes to look in each direction
@@ -185,7 +190,7 @@ class Pathfinder {
 	 * @param max_drop maximum number of blocks a path may drop
 	 * @param algo Algorithm to use for finding a path
 	 */
-	std::vector<v3s16> getPath(ServerEnvironment *env,
+	std::vector<v3s16> getPath(const NavigationGrid &grid,
 			v3s16 source,
 			v3s16 destination,
 			unsigned int searchdistance,
@@ -254,14 +259,6 @@ class Pathfinder {
 	 */
 	int           getXZManhattanDist(v3s16 pos);
 
-	/**
-	 * get best direction based uppon heuristics
-	 * @param directions list of unchecked directions
-	 * @param g_pos mapnode to start from
-	 * @return direction to check
-	 */
-	v3s16         getDirHeuristic(std::vector<v3s16> &directions, PathGridnode &g_pos);
-
 	/**
 	 * build internal data representation of search area
 	 * @return true/false if costmap creation was successfull
@@ -277,24 +274,13 @@ class Pathfinder {
 	PathCost     calcCost(v3s16 pos, v3s16 dir);
 
 	/**
-	 * recursive update whole search areas total cost information
-	 * @param ipos position to check next
-	 * @param srcdir positionc checked last time
-	 * @param total_cost cost of moving to ipos
-	 * @param level current recursion depth
-	 * @return true/false path to destination has been found
-	 */
-	bool          updateAllCosts(v3s16 ipos, v3s16 srcdir, int current_cost, int level);
-
-	/**
-	 * recursive try to find a patrh to destionation
-	 * @param ipos position to check next
-	 * @param srcdir positionc checked last time
-	 * @param total_cost cost of moving to ipos
-	 * @param level current recursion depth
+	 * update total cost information from the start position until the
+	 * target is reached, using a binary heap of open positions
+	 * @param start_index index position of the start
+	 * @param use_heuristic true for A*, false for Dijkstra
 	 * @return true/false path to destination has been found
 	 */
-	bool          updateCostHeuristic(v3s16 ipos, v3s16 srcdir, int current_cost, int level);
+	bool          updateCosts(v3s16 start_index, bool use_heuristic);
 
 	/**
 	 * recursive build a vector containing all nodes from source to destination
@@ -313,7 +299,6 @@ class Pathfinder {
 	int m_searchdistance = 0;         /**< max distance to search in each direction */
 	int m_maxdrop = 0;                /**< maximum number of blocks a path may drop */
 	int m_maxjump = 0;                /**< maximum number of blocks a path may jump */
-	int m_min_target_distance = 0;    /**< current smalest path to target           */
 
 	bool m_prefetch = true;              /**< prefetch cost data                       */
 
@@ -327,7 +312,7 @@ class Pathfinder {
 	friend class GridNodeContainer;
 	GridNodeContainer *m_nodes_container = nullptr;
 
-	ServerEnvironment *m_env = 0;     /**< minetest environment pointer             */
+	const NavigationGrid *m_grid = nullptr; /**< walkability of the search area     */
 
 #ifdef PATHFINDER_DEBUG
 
@@ -389,12 +374,230 @@ std::vector<v3s16> get_path(ServerEnvironment* env,
 							unsigned int max_jump,
 							unsigned int max_drop,
 							PathAlgorithm algo)
+{
+	PathRequest req = {source, destination, searchdistance, max_jump,
+		max_drop, algo};
+	std::shared_ptr<NavigationGrid> grid =
+		get_path_grid(env->getNavigationCache(), req);
+
+	return get_path(*grid, req);
+}
+
+/******************************************************************************/
+std::vector<v3s16> get_path(const NavigationGrid &grid, const PathRequest &req)
 {
 	Pathfinder searchclass;
 
-	return searchclass.getPath(env,
-				source, destination,
-				searchdistance, max_jump, max_drop, algo);
+	return searchclass.getPath(grid,
+				req.source, req.destination,
+				req.searchdistance, req.max_jump, req.max_drop, req.algo);
+}
+
+/******************************************************************************/
+std::shared_ptr<NavigationGrid> get_path_grid(NavigationCache *cache,
+		const PathRequest &req)
+{
+	// Same limits as Pathfinder::getPath, plus the nodes below them
+	s16 d = req.searchdistance;
+	v3s16 minp(MYMIN(req.source.X, req.destination.X) - d,
+		MYMIN(req.source.Y, req.destination.Y) - d - 1,
+		MYMIN(req.source.Z, req.destination.Z) - d);
+	v3s16 maxp(MYMAX(req.source.X, req.destination.X) + d,
+		MYMAX(req.source.Y, req.destination.Y) + d,
+		MYMAX(req.source.Z, req.destination.Z) + d);
+
+	return cache->getGrid(minp, maxp);
+}
+
+/******************************************************************************/
+NavigationGrid::NavigationGrid(v3s16 blockpos_min, v3s16 blockpos_max) :
+	m_blockpos_min(blockpos_min),
+	m_blocks_size(blockpos_max - blockpos_min + v3s16(1, 1, 1))
+{
+	m_blocks.resize((size_t)m_blocks_size.X * m_blocks_size.Y * m_blocks_size.Z);
+}
+
+/******************************************************************************/
+void NavigationGrid::setBlock(v3s16 blockpos, std::shared_ptr<const NavBlock> block)
+{
+	v3s16 rel = blockpos - m_blockpos_min;
+	m_blocks[((size_t)rel.Z * m_blocks_size.Y + rel.Y) * m_blocks_size.X + rel.X] =
+		std::move(block);
+}
+
+/******************************************************************************/
+NavNode NavigationGrid::get(v3s16 p) const
+{
+	v3s16 rel = getNodeBlockPos(p) - m_blockpos_min;
+	if (rel.X < 0 || rel.Y < 0 || rel.Z < 0 || rel.X >= m_blocks_size.X ||
+			rel.Y >= m_blocks_size.Y || rel.Z >= m_blocks_size.Z)
+		return NAV_IGNORE;
+
+	const NavBlock *block = m_blocks[
+		((size_t)rel.Z * m_blocks_size.Y + rel.Y) * m_blocks_size.X + rel.X].get();
+	if (!block)
+		return NAV_IGNORE;
+
+	v3s16 rp = p - getNodeBlockPos(p) * MAP_BLOCKSIZE;
+	size_t i = rp.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + rp.Y * MAP_BLOCKSIZE + rp.X;
+	if (block->ignore[i])
+		return NAV_IGNORE;
+	return block->walkable[i] ? NAV_WALKABLE : NAV_OPEN;
+}
+
+/******************************************************************************/
+NavigationCache::NavigationCache(ServerMap *map, const NodeDefManager *ndef) :
+	m_map(map),
+	m_ndef(ndef)
+{
+	m_map->addEventReceiver(this);
+}
+
+/******************************************************************************/
+NavigationCache::~NavigationCache()
+{
+	m_map->removeEventReceiver(this);
+}
+
+/******************************************************************************/
+void NavigationCache::onMapEditEvent(const MapEditEvent &event)
+{
+	switch (event.type) {
+	case MEET_ADDNODE:
+	case MEET_REMOVENODE:
+	case MEET_SWAPNODE:
+		m_blocks.erase(getNodeBlockPos(event.p));
+		break;
+	case MEET_BLOCK_NODE_METADATA_CHANGED:
+		// Metadata doesn't change walkability
+		break;
+	case MEET_OTHER:
+		for (const v3s16 &p : event.modified_blocks)
+			m_blocks.erase(p);
+		break;
+	}
+}
+
+/******************************************************************************/
+void NavigationCache::onBlocksUnloaded(const std::vector<v3s16> &blockpos)
+{
+	for (const v3s16 &p : blockpos)
+		m_blocks.erase(p);
+}
+
+/******************************************************************************/
+std::shared_ptr<const NavBlock> NavigationCache::getBlock(v3s16 blockpos)
+{
+	MapBlock *block = m_map->getBlockNoCreateNoEx(blockpos);
+	if (!block || block->isDummy()) {
+		// Not worth keeping, it would have to be checked again anyway
+		m_blocks.erase(blockpos);
+		return nullptr;
+	}
+
+	// Changes that come without a map edit event, e.g. by loading or
+	// generating the block, are caught by the content version
+	std::shared_ptr<const NavBlock> *cached = m_blocks.find(blockpos);
+	if (cached && (*cached)->content_version == block->getContentVersion())
+		return *cached;
+
+	std::shared_ptr<NavBlock> nav = std::make_shared<NavBlock>();
+	nav->content_version = block->getContentVersion();
+	const MapNode *data = block->getData();
+	for (u32 i = 0; i < MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE; i++) {
+		content_t c = data[i].getContent();
+		if (c == CONTENT_IGNORE)
+			nav->ignore[i] = true;
+		else if (m_ndef->get(c).walkable)
+			nav->walkable[i] = true;
+	}
+
+	m_blocks[blockpos] = nav;
+	return nav;
+}
+
+/******************************************************************************/
+std::shared_ptr<NavigationGrid> NavigationCache::getGrid(v3s16 minp, v3s16 maxp)
+{
+	v3s16 bpmin = getNodeBlockPos(minp);
+	v3s16 bpmax = getNodeBlockPos(maxp);
+	std::shared_ptr<NavigationGrid> grid =
+		std::make_shared<NavigationGrid>(bpmin, bpmax);
+
+	v3s16 bp;
+	for (bp.Z = bpmin.Z; bp.Z <= bpmax.Z; bp.Z++)
+	for (bp.Y = bpmin.Y; bp.Y <= bpmax.Y; bp.Y++)
+	for (bp.X = bpmin.X; bp.X <= bpmax.X; bp.X++)
+		grid->setBlock(bp, getBlock(bp));
+
+	g_profiler->avg(PROFILER_KEY("Pathfinder: cached blocks"), m_blocks.size());
+	return grid;
+}
+
+/******************************************************************************/
+AsyncPathfinder::AsyncPathfinder() :
+	Thread("Pathfinder")
+{
+}
+
+/******************************************************************************/
+AsyncPathfinder::~AsyncPathfinder()
+{
+	stop();
+	wait();
+}
+
+/******************************************************************************/
+u32 AsyncPathfinder::request(const PathRequest &req,
+		std::shared_ptr<NavigationGrid> grid)
+{
+	if (!isRunning())
+		start();
+
+	Job job;
+	job.handle = m_next_handle++;
+	// Handle 0 marks an empty job
+	if (m_next_handle == 0)
+		m_next_handle = 1;
+	job.req = req;
+	job.grid = std::move(grid);
+	m_jobs.push_back(job);
+	return job.handle;
+}
+
+/******************************************************************************/
+bool AsyncPathfinder::getResult(u32 handle, std::vector<v3s16> *path)
+{
+	MutexAutoLock lock(m_results_mutex);
+	auto it = m_results.find(handle);
+	if (it == m_results.end())
+		return false;
+
+	path->swap(it->second);
+	m_results.erase(it);
+	return true;
+}
+
+/******************************************************************************/
+void *AsyncPathfinder::run()
+{
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	while (!stopRequested()) {
+		// Wake up regularly to check whether the thread should stop
+		Job job = m_jobs.pop_frontNoEx(100);
+		if (job.handle == 0)
+			continue;
+
+		std::vector<v3s16> path = get_path(*job.grid, job.req);
+
+		MutexAutoLock lock(m_results_mutex);
+		m_results[job.handle].swap(path);
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	return nullptr;
 }
 
 /******************************************************************************/
@@ -493,20 +696,19 @@ void PathGridnode::setCost(v3s16 dir, const PathCost &cost)
 
 void GridNodeContainer::initNode(v3s16 ipos, PathGridnode *p_node)
 {
-	const NodeDefManager *ndef = m_pathf->m_env->getGameDef()->ndef();
 	PathGridnode &elem = *p_node;
 
 	v3s16 realpos = m_pathf->getRealPos(ipos);
 
-	MapNode current = m_pathf->m_env->getMap().getNode(realpos);
-	MapNode below   = m_pathf->m_env->getMap().getNode(realpos + v3s16(0, -1, 0));
+	NavNode current = m_pathf->m_grid->get(realpos);
+	NavNode below   = m_pathf->m_grid->get(realpos + v3s16(0, -1, 0));
 
 
-	if ((current.param0 == CONTENT_IGNORE) ||
-			(below.param0 == CONTENT_IGNORE)) {
+	if ((current == NAV_IGNORE) ||
+			(below == NAV_IGNORE)) {
 		DEBUG_OUT("Pathfinder: " << PP(realpos) <<
 			" current or below is invalid element" << std::endl);
-		if (current.param0 == CONTENT_IGNORE) {
+		if (current == NAV_IGNORE) {
 			elem.type = 'i';
 			DEBUG_OUT(PP(ipos) << ": " << 'i' << std::endl);
 		}
@@ -514,10 +716,10 @@ void GridNodeContainer::initNode(v3s16 ipos, PathGridnode *p_node)
 	}
 
 	//don't add anything if it isn't an air node
-	if (ndef->get(current).walkable || !ndef->get(below).walkable) {
+	if (current == NAV_WALKABLE || below != NAV_WALKABLE) {
 			DEBUG_OUT("Pathfinder: " << PP(realpos)
 				<< " not on surface" << std::endl);
-			if (ndef->get(current).walkable) {
+			if (current == NAV_WALKABLE) {
 				elem.type = 's';
 				DEBUG_OUT(PP(ipos) << ": " << 's' << std::endl);
 			} else {
@@ -570,9 +772,9 @@ MapGridNodeContainer::MapGridNodeContainer(Pathfinder *pathf)
 
 PathGridnode &MapGridNodeContainer::access(v3s16 p)
 {
-	std::map<v3s16, PathGridnode>::iterator it = m_nodes.find(p);
-	if (it != m_nodes.end()) {
-		return it->second;
+	PathGridnode *node = m_nodes.find(p);
+	if (node) {
+		return *node;
 	}
 	PathGridnode &n = m_nodes[p];
 	initNode(p, &n);
@@ -582,7 +784,7 @@ PathGridnode &MapGridNodeContainer::access(v3s16 p)
 
 
 /******************************************************************************/
-std::vector<v3s16> Pathfinder::getPath(ServerEnvironment *env,
+std::vector<v3s16> Pathfinder::getPath(const NavigationGrid &grid,
 							v3s16 source,
 							v3s16 destination,
 							unsigned int searchdistance,
@@ -596,19 +798,12 @@ std::vector<v3s16> Pathfinder::getPath(ServerEnvironment *env,
 #endif
 	std::vector<v3s16> retval;
 
-	//check parameters
-	if (env == 0) {
-		ERROR_TARGET << "missing environment pointer" << std::endl;
-		return retval;
-	}
-
 	m_searchdistance = searchdistance;
-	m_env = env;
+	m_grid = &grid;
 	m_maxjump = max_jump;
 	m_maxdrop = max_drop;
 	m_start       = source;
 	m_destination = destination;
-	m_min_target_distance = -1;
 	m_prefetch = true;
 
 	if (algo == PA_PLAIN_NP) {
@@ -654,23 +849,23 @@ std::vector<v3s16> Pathfinder::getPath(ServerEnvironment *env,
 	v3s16 StartIndex  = getIndexPos(source);
 	v3s16 EndIndex    = getIndexPos(destination);
 
-	PathGridnode &startpos = getIndexElement(StartIndex);
+	// Accessing a node may invalidate references to others
 	PathGridnode &endpos   = getIndexElement(EndIndex);
-
-	if (!startpos.valid) {
-		VERBOSE_TARGET << "invalid startpos" <<
-				"Index: " << PP(StartIndex) <<
-				"Realpos: " << PP(getRealPos(StartIndex)) << std::endl;
-		return retval;
-	}
 	if (!endpos.valid) {
 		VERBOSE_TARGET << "invalid stoppos" <<
 				"Index: " << PP(EndIndex) <<
 				"Realpos: " << PP(getRealPos(EndIndex)) << std::endl;
 		return retval;
 	}
-
 	endpos.target      = true;
+
+	PathGridnode &startpos = getIndexElement(StartIndex);
+	if (!startpos.valid) {
+		VERBOSE_TARGET << "invalid startpos" <<
+				"Index: " << PP(StartIndex) <<
+				"Realpos: " << PP(getRealPos(StartIndex)) << std::endl;
+		return retval;
+	}
 	startpos.source    = true;
 	startpos.totalcost = 0;
 
@@ -678,11 +873,11 @@ std::vector<v3s16> Pathfinder::getPath(ServerEnvironment *env,
 
 	switch (algo) {
 		case PA_DIJKSTRA:
-			update_cost_retval = updateAllCosts(StartIndex, v3s16(0, 0, 0), 0, 0);
+			update_cost_retval = updateCosts(StartIndex, false);
 			break;
 		case PA_PLAIN_NP:
 		case PA_PLAIN:
-			update_cost_retval = updateCostHeuristic(StartIndex, v3s16(0, 0, 0), 0, 0);
+			update_cost_retval = updateCosts(StartIndex, true);
 			break;
 		default:
 			ERROR_TARGET << "missing PathAlgorithm"<< std::endl;
@@ -755,7 +950,6 @@ v3s16 Pathfinder::getRealPos(v3s16 ipos)
 /******************************************************************************/
 PathCost Pathfinder::calcCost(v3s16 pos, v3s16 dir)
 {
-	const NodeDefManager *ndef = m_env->getGameDef()->ndef();
 	PathCost retval;
 
 	retval.updated = true;
@@ -769,27 +963,26 @@ PathCost Pathfinder::calcCost(v3s16 pos, v3s16 dir)
 		return retval;
 	}
 
-	MapNode node_at_pos2 = m_env->getMap().getNode(pos2);
+	NavNode node_at_pos2 = m_grid->get(pos2);
 
 	//did we get information about node?
-	if (node_at_pos2.param0 == CONTENT_IGNORE ) {
+	if (node_at_pos2 == NAV_IGNORE) {
 			VERBOSE_TARGET << "Pathfinder: (1) area at pos: "
 					<< PP(pos2) << " not loaded";
 			return retval;
 	}
 
-	if (!ndef->get(node_at_pos2).walkable) {
-		MapNode node_below_pos2 =
-			m_env->getMap().getNode(pos2 + v3s16(0, -1, 0));
+	if (node_at_pos2 != NAV_WALKABLE) {
+		NavNode node_below_pos2 = m_grid->get(pos2 + v3s16(0, -1, 0));
 
 		//did we get information about node?
-		if (node_below_pos2.param0 == CONTENT_IGNORE ) {
+		if (node_below_pos2 == NAV_IGNORE) {
 				VERBOSE_TARGET << "Pathfinder: (2) area at pos: "
 					<< PP((pos2 + v3s16(0, -1, 0))) << " not loaded";
 				return retval;
 		}
 
-		if (ndef->get(node_below_pos2).walkable) {
+		if (node_below_pos2 == NAV_WALKABLE) {
 			retval.valid = true;
 			retval.value = 1;
 			retval.direction = 0;
@@ -798,19 +991,17 @@ PathCost Pathfinder::calcCost(v3s16 pos, v3s16 dir)
 		}
 		else {
 			v3s16 testpos = pos2 - v3s16(0, -1, 0);
-			MapNode node_at_pos = m_env->getMap().getNode(testpos);
+			NavNode node_at_pos = m_grid->get(testpos);
 
-			while ((node_at_pos.param0 != CONTENT_IGNORE) &&
-					(!ndef->get(node_at_pos).walkable) &&
+			while ((node_at_pos == NAV_OPEN) &&
 					(testpos.Y > m_limits.MinEdge.Y)) {
 				testpos += v3s16(0, -1, 0);
-				node_at_pos = m_env->getMap().getNode(testpos);
+				node_at_pos = m_grid->get(testpos);
 			}
 
 			//did we find surface?
 			if ((testpos.Y >= m_limits.MinEdge.Y) &&
-					(node_at_pos.param0 != CONTENT_IGNORE) &&
-					(ndef->get(node_at_pos).walkable)) {
+					(node_at_pos == NAV_WALKABLE)) {
 				if ((pos2.Y - testpos.Y - 1) <= m_maxdrop) {
 					retval.valid = true;
 					retval.value = 2;
@@ -832,18 +1023,17 @@ PathCost Pathfinder::calcCost(v3s16 pos, v3s16 dir)
 	}
 	else {
 		v3s16 testpos = pos2;
-		MapNode node_at_pos = m_env->getMap().getNode(testpos);
+		NavNode node_at_pos = m_grid->get(testpos);
 
-		while ((node_at_pos.param0 != CONTENT_IGNORE) &&
-				(ndef->get(node_at_pos).walkable) &&
+		while ((node_at_pos == NAV_WALKABLE) &&
 				(testpos.Y < m_limits.MaxEdge.Y)) {
 			testpos += v3s16(0, 1, 0);
-			node_at_pos = m_env->getMap().getNode(testpos);
+			node_at_pos = m_grid->get(testpos);
 		}
 
 		//did we find surface?
 		if ((testpos.Y <= m_limits.MaxEdge.Y) &&
-				(!ndef->get(node_at_pos).walkable)) {
+				(node_at_pos != NAV_WALKABLE)) {
 
 			if (testpos.Y - pos2.Y <= m_maxjump) {
 				retval.valid = true;
@@ -908,93 +1098,6 @@ v3s16 Pathfinder::invert(v3s16 pos)
 	return retval;
 }
 
-/******************************************************************************/
-bool Pathfinder::updateAllCosts(v3s16 ipos,
-								v3s16 srcdir,
-								int current_cost,
-								int level)
-{
-	PathGridnode &g_pos = getIndexElement(ipos);
-	g_pos.totalcost = current_cost;
-	g_pos.sourcedir = srcdir;
-
-	level ++;
-
-	//check if target has been found
-	if (g_pos.target) {
-		m_min_target_distance = current_cost;
-		DEBUG_OUT(LVL " Pathfinder: target found!" << std::endl);
-		return true;
-	}
-
-	bool retval = false;
-
-	std::vector<v3s16> directions;
-
-	directions.emplace_back(1,0, 0);
-	directions.emplace_back(-1,0, 0);
-	directions.emplace_back(0,0, 1);
-	directions.emplace_back(0,0,-1);
-
-	for (v3s16 &direction : directions) {
-		if (direction != srcdir) {
-			PathCost cost = g_pos.getCost(direction);
-
-			if (cost.valid) {
-				direction.Y = cost.direction;
-
-				v3s16 ipos2 = ipos + direction;
-
-				if (!isValidIndex(ipos2)) {
-					DEBUG_OUT(LVL " Pathfinder: " << PP(ipos2) <<
-						" out of range, max=" << PP(m_limits.MaxEdge) << std::endl);
-					continue;
-				}
-
-				PathGridnode &g_pos2 = getIndexElement(ipos2);
-
-				if (!g_pos2.valid) {
-					VERBOSE_TARGET << LVL "Pathfinder: no data for new position: "
-												<< PP(ipos2) << std::endl;
-					continue;
-				}
-
-				assert(cost.value > 0);
-
-				int new_cost = current_cost + cost.value;
-
-				// check if there already is a smaller path
-				if ((m_min_target_distance > 0) &&
-						(m_min_target_distance < new_cost)) {
-					return false;
-				}
-
-				if ((g_pos2.totalcost < 0) ||
-						(g_pos2.totalcost > new_cost)) {
-					DEBUG_OUT(LVL "Pathfinder: updating path at: "<<
-							PP(ipos2) << " from: " << g_pos2.totalcost << " to "<<
-							new_cost << std::endl);
-					if (updateAllCosts(ipos2, invert(direction),
-											new_cost, level)) {
-						retval = true;
-						}
-					}
-				else {
-					DEBUG_OUT(LVL "Pathfinder:"
-							" already found shorter path to: "
-							<< PP(ipos2) << std::endl);
-				}
-			}
-			else {
-				DEBUG_OUT(LVL "Pathfinder:"
-						" not moving to invalid direction: "
-						<< PP(directions[i]) << std::endl);
-			}
-		}
-	}
-	return retval;
-}
-
 /******************************************************************************/
 int Pathfinder::getXZManhattanDist(v3s16 pos)
 {
@@ -1007,158 +1110,103 @@ int Pathfinder::getXZManhattanDist(v3s16 pos)
 }
 
 /******************************************************************************/
-v3s16 Pathfinder::getDirHeuristic(std::vector<v3s16> &directions, PathGridnode &g_pos)
+bool Pathfinder::updateCosts(v3s16 start_index, bool use_heuristic)
 {
-	int   minscore = -1;
-	v3s16 retdir   = v3s16(0, 0, 0);
-	v3s16 srcpos = g_pos.pos;
-	DEBUG_OUT("Pathfinder: remaining dirs at beginning:"
-				<< directions.size() << std::endl);
+	struct OpenNode {
+		int estimate;   /**< cost so far plus estimated remaining cost */
+		int cost;       /**< cost so far                               */
+		v3s16 ipos;
+
+		// std::priority_queue puts the greatest element on top
+		bool operator< (const OpenNode &other) const
+		{
+			if (estimate != other.estimate)
+				return estimate > other.estimate;
+			// prefer nodes closer to the target
+			return cost < other.cost;
+		}
+	};
 
-	for (v3s16 &direction : directions) {
+	const v3s16 directions[4] = {
+		v3s16(1, 0, 0), v3s16(-1, 0, 0), v3s16(0, 0, 1), v3s16(0, 0, -1)
+	};
 
-		v3s16 pos1 = v3s16(srcpos.X + direction.X, 0, srcpos.Z+ direction.Z);
+	std::priority_queue<OpenNode> open;
+	int start_estimate = use_heuristic ?
+		getXZManhattanDist(getRealPos(start_index)) : 0;
+	open.push({start_estimate, 0, start_index});
 
-		int cur_manhattan = getXZManhattanDist(pos1);
-		PathCost cost    = g_pos.getCost(direction);
+	while (!open.empty()) {
+		OpenNode current = open.top();
+		open.pop();
 
-		if (!cost.updated) {
-			cost = calcCost(g_pos.pos, direction);
-			g_pos.setCost(direction, cost);
-		}
+		PathCost costs[4];
+		{
+			PathGridnode &g_pos = getIndexElement(current.ipos);
 
-		if (cost.valid) {
-			int score = cost.value + cur_manhattan;
+			// a cheaper way to this node has been found meanwhile
+			if (current.cost > g_pos.totalcost)
+				continue;
 
-			if ((minscore < 0)|| (score < minscore)) {
-				minscore = score;
-				retdir = direction;
+			if (g_pos.target) {
+				DEBUG_OUT("Pathfinder: target found!" << std::endl);
+				return true;
 			}
-		}
-	}
 
-	if (retdir != v3s16(0, 0, 0)) {
-		for (std::vector<v3s16>::iterator iter = directions.begin();
-					iter != directions.end();
-					++iter) {
-			if(*iter == retdir) {
-				DEBUG_OUT("Pathfinder: removing return direction" << std::endl);
-				directions.erase(iter);
-				break;
+			for (int i = 0; i < 4; i++) {
+				costs[i] = g_pos.getCost(directions[i]);
+				if (!costs[i].updated) {
+					costs[i] = calcCost(g_pos.pos, directions[i]);
+					g_pos.setCost(directions[i], costs[i]);
+				}
 			}
 		}
-	}
-	else {
-		DEBUG_OUT("Pathfinder: didn't find any valid direction clearing"
-					<< std::endl);
-		directions.clear();
-	}
-	DEBUG_OUT("Pathfinder: remaining dirs at end:" << directions.size()
-				<< std::endl);
-	return retdir;
-}
-
-/******************************************************************************/
-bool Pathfinder::updateCostHeuristic(	v3s16 ipos,
-										v3s16 srcdir,
-										int current_cost,
-										int level)
-{
-
-	PathGridnode &g_pos = getIndexElement(ipos);
-	g_pos.totalcost = current_cost;
-	g_pos.sourcedir = srcdir;
-
-	level ++;
-
-	//check if target has been found
-	if (g_pos.target) {
-		m_min_target_distance = current_cost;
-		DEBUG_OUT(LVL " Pathfinder: target found!" << std::endl);
-		return true;
-	}
 
-	bool retval = false;
-
-	std::vector<v3s16> directions;
-
-	directions.emplace_back(1, 0,  0);
-	directions.emplace_back(-1, 0,  0);
-	directions.emplace_back(0, 0,  1);
-	directions.emplace_back(0, 0, -1);
-
-	v3s16 direction = getDirHeuristic(directions, g_pos);
-
-	while (direction != v3s16(0, 0, 0) && (!retval)) {
-
-		if (direction != srcdir) {
-			PathCost cost = g_pos.getCost(direction);
+		for (int i = 0; i < 4; i++) {
+			if (!costs[i].valid) {
+				DEBUG_OUT("Pathfinder: not moving to invalid direction: "
+						<< PP(directions[i]) << std::endl);
+				continue;
+			}
 
-			if (cost.valid) {
-				direction.Y = cost.direction;
+			v3s16 direction = directions[i];
+			direction.Y = costs[i].direction;
+			v3s16 ipos2 = current.ipos + direction;
 
-				v3s16 ipos2 = ipos + direction;
+			if (!isValidIndex(ipos2)) {
+				DEBUG_OUT("Pathfinder: " << PP(ipos2) <<
+					" out of range, max=" << PP(m_limits.MaxEdge) << std::endl);
+				continue;
+			}
 
-				if (!isValidIndex(ipos2)) {
-					DEBUG_OUT(LVL " Pathfinder: " << PP(ipos2) <<
-						" out of range, max=" << PP(m_limits.MaxEdge) << std::endl);
-					direction = getDirHeuristic(directions, g_pos);
-					continue;
-				}
+			PathGridnode &g_pos2 = getIndexElement(ipos2);
 
-				PathGridnode &g_pos2 = getIndexElement(ipos2);
+			if (!g_pos2.valid) {
+				VERBOSE_TARGET << "Pathfinder: no data for new position: "
+											<< PP(ipos2) << std::endl;
+				continue;
+			}
 
-				if (!g_pos2.valid) {
-					VERBOSE_TARGET << LVL "Pathfinder: no data for new position: "
-												<< PP(ipos2) << std::endl;
-					direction = getDirHeuristic(directions, g_pos);
-					continue;
-				}
+			assert(costs[i].value > 0);
 
-				assert(cost.value > 0);
+			int new_cost = current.cost + costs[i].value;
 
-				int new_cost = current_cost + cost.value;
+			if ((g_pos2.totalcost >= 0) && (g_pos2.totalcost <= new_cost)) {
+				DEBUG_OUT("Pathfinder: already found shorter path to: "
+						<< PP(ipos2) << std::endl);
+				continue;
+			}
 
-				// check if there already is a smaller path
-				if ((m_min_target_distance > 0) &&
-						(m_min_target_distance < new_cost)) {
-					DEBUG_OUT(LVL "Pathfinder:"
-							" already longer than best already found path "
-							<< PP(ipos2) << std::endl);
-					return false;
-				}
+			g_pos2.totalcost = new_cost;
+			g_pos2.sourcedir = invert(direction);
 
-				if ((g_pos2.totalcost < 0) ||
-						(g_pos2.totalcost > new_cost)) {
-					DEBUG_OUT(LVL "Pathfinder: updating path at: "<<
-							PP(ipos2) << " from: " << g_pos2.totalcost << " to "<<
-							new_cost << " srcdir=" <<
-							PP(invert(direction))<< std::endl);
-					if (updateCostHeuristic(ipos2, invert(direction),
-											new_cost, level)) {
-						retval = true;
-						}
-					}
-				else {
-					DEBUG_OUT(LVL "Pathfinder:"
-							" already found shorter path to: "
-							<< PP(ipos2) << std::endl);
-				}
-			}
-			else {
-				DEBUG_OUT(LVL "Pathfinder:"
-						" not moving to invalid direction: "
-						<< PP(direction) << std::endl);
-			}
-		}
-		else {
-			DEBUG_OUT(LVL "Pathfinder:"
-							" skipping srcdir: "
-							<< PP(direction) << std::endl);
+			int estimate = new_cost;
+			if (use_heuristic)
+				estimate += getXZManhattanDist(getRealPos(ipos2));
+			open.push({estimate, new_cost, ipos2});
 		}
-		direction = getDirHeuristic(directions, g_pos);
 	}
-	return retval;
+	return false;
 }
 
 /******************************************************************************/
@@ -22,14 +22,23 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 /******************************************************************************/
 /* Includes                                                                   */
 /******************************************************************************/
-#include <vector>
+#include <bitset>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "irr_v3d.h"
+#include "map.h"
+#include "threading/thread.h"
+#include "util/blockpos_map.h"
+#include "util/container.h"
 
 /******************************************************************************/
 /* Forward declarations                                                       */
 /******************************************************************************/
 
+class NodeDefManager;
 class ServerEnvironment;
+class ServerMap;
 
 /******************************************************************************/
 /* Typedefs and macros                                                        */
@@ -49,10 +58,123 @@ typedef enum {
 	PA_PLAIN_NP          /**< A* algorithm without prefetching of map data */
 } PathAlgorithm;
 
+/** What the pathfinder knows about a node */
+typedef enum {
+	NAV_IGNORE,            /**< node is not loaded                           */
+	NAV_OPEN,              /**< node can be walked through                   */
+	NAV_WALKABLE           /**< node can be walked on                        */
+} NavNode;
+
+/** walkability of all nodes of a map block */
+struct NavBlock {
+	u64 content_version;                    /**< MapBlock::getContentVersion() */
+	std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> walkable;
+	std::bitset<MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE> ignore;
+};
+
+/**
+ * Immutable snapshot of the walkability of an area, safe to read from any
+ * thread.
+ */
+class NavigationGrid {
+public:
+	NavigationGrid(v3s16 blockpos_min, v3s16 blockpos_max);
+
+	NavNode get(v3s16 p) const;
+
+	void setBlock(v3s16 blockpos, std::shared_ptr<const NavBlock> block);
+
+private:
+	v3s16 m_blockpos_min;
+	v3s16 m_blocks_size;
+	/** nullptr for blocks that are not loaded */
+	std::vector<std::shared_ptr<const NavBlock>> m_blocks;
+};
+
+/**
+ * Walkability of the loaded map, kept across path searches.
+ * Blocks are dropped on map edit events and when they are unloaded, and
+ * rebuilt when their content version changed. Only used from the server
+ * thread.
+ */
+class NavigationCache : public MapEventReceiver {
+public:
+	NavigationCache(ServerMap *map, const NodeDefManager *ndef);
+	~NavigationCache();
+
+	/** returns a snapshot of the nodes from minp to maxp */
+	std::shared_ptr<NavigationGrid> getGrid(v3s16 minp, v3s16 maxp);
+
+	void onMapEditEvent(const MapEditEvent &event);
+	/** drops the blocks the map unloaded */
+	void onBlocksUnloaded(const std::vector<v3s16> &blockpos);
+
+	size_t size() const { return m_blocks.size(); }
+
+private:
+	std::shared_ptr<const NavBlock> getBlock(v3s16 blockpos);
+
+	ServerMap *m_map;
+	const NodeDefManager *m_ndef;
+	BlockPosMap<std::shared_ptr<const NavBlock>> m_blocks;
+};
+
+/** parameters of a path search */
+struct PathRequest {
+	v3s16 source;
+	v3s16 destination;
+	unsigned int searchdistance;
+	unsigned int max_jump;
+	unsigned int max_drop;
+	PathAlgorithm algo;
+};
+
+/**
+ * Runs path searches on a thread of its own.
+ * The search area is taken from the NavigationCache when the request is
+ * made, results are picked up by handle.
+ */
+class AsyncPathfinder : public Thread {
+public:
+	AsyncPathfinder();
+	~AsyncPathfinder();
+
+	/** returns a handle to get the result with */
+	u32 request(const PathRequest &req, std::shared_ptr<NavigationGrid> grid);
+
+	/**
+	 * returns true and removes the result if the search has finished,
+	 * an empty path means there is none
+	 */
+	bool getResult(u32 handle, std::vector<v3s16> *path);
+
+protected:
+	void *run();
+
+private:
+	struct Job {
+		u32 handle = 0;
+		PathRequest req;
+		std::shared_ptr<NavigationGrid> grid;
+	};
+
+	MutexedQueue<Job> m_jobs;
+	std::mutex m_results_mutex;
+	std::map<u32, std::vector<v3s16>> m_results;
+	u32 m_next_handle = 1;
+};
+
 /******************************************************************************/
 /* declarations                                                               */
 /******************************************************************************/
 
+/** runs a path search on a snapshot of the search area */
+std::vector<v3s16> get_path(const NavigationGrid &grid, const PathRequest &req);
+
+/** returns the snapshot of the map that a path search needs */
+std::shared_ptr<NavigationGrid> get_path_grid(NavigationCache *cache,
+		const PathRequest &req);
+
 /** c wrapper function to use from scriptapi */
 std::vector<v3s16> get_path(ServerEnvironment *env,
 							v3s16 source,
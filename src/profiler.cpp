@@ -18,7 +18,182 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "profiler.h"
+#include <unordered_map>
+#include "log.h"
 #include "porting.h"
+#include "util/serialize.h"
+
+/*
+	Interned profiler keys
+*/
+
+namespace {
+
+struct KeyRegistry
+{
+	KeyRegistry()
+	{
+		// Where keys beyond the limit end up
+		names.emplace_back("Profiler: too many keys");
+		count = 1;
+	}
+
+	std::mutex mutex;
+	std::vector<std::string> names;
+	std::unordered_map<std::string, u16> ids;
+	std::atomic<u16> count;
+};
+
+KeyRegistry &key_registry()
+{
+	static KeyRegistry registry;
+	return registry;
+}
+
+// The profilers that exist, so that exiting threads only give their
+// buffers back to those
+struct LiveProfilers
+{
+	std::mutex mutex;
+	std::unordered_map<u64, Profiler *> profilers;
+};
+
+LiveProfilers &live_profilers()
+{
+	static LiveProfilers live;
+	return live;
+}
+
+enum SlotMode : u8 {
+	SLOT_UNUSED,
+	SLOT_ADD,
+	SLOT_AVG,
+};
+
+}
+
+ProfilerKey::ProfilerKey(const std::string &name)
+{
+	KeyRegistry &registry = key_registry();
+	MutexAutoLock lock(registry.mutex);
+	auto it = registry.ids.find(name);
+	if (it != registry.ids.end()) {
+		m_id = it->second;
+		return;
+	}
+	if (registry.names.size() >= PROFILER_MAX_KEYS) {
+		warningstream << "Profiler: More than " << PROFILER_MAX_KEYS
+			<< " keys, not recording \"" << name << "\" by itself" << std::endl;
+		m_id = 0;
+		return;
+	}
+	m_id = registry.names.size();
+	registry.names.push_back(name);
+	registry.ids[name] = m_id;
+	registry.count = registry.names.size();
+}
+
+std::string ProfilerKey::getName() const
+{
+	return getName(m_id);
+}
+
+std::string ProfilerKey::getName(u16 id)
+{
+	KeyRegistry &registry = key_registry();
+	MutexAutoLock lock(registry.mutex);
+	return id < registry.names.size() ? registry.names[id] : "";
+}
+
+u16 ProfilerKey::getCount()
+{
+	return key_registry().count.load();
+}
+
+/*
+	Per-thread buffer of a profiler
+
+	Only the owning thread writes to it. The atomics let the profiler read
+	it at any time without locks on the recording side.
+*/
+
+struct Profiler::ThreadBuffer
+{
+	struct Slot
+	{
+		std::atomic<double> value{0.0};
+		std::atomic<u32> count{0};
+		std::atomic<u8> mode{SLOT_UNUSED};
+	};
+
+	struct TreeSlot
+	{
+		std::atomic<double> ms{0.0};
+		std::atomic<u32> count{0};
+	};
+
+	struct TraceEvent
+	{
+		u16 key;
+		u64 start_us;
+		u32 duration_us;
+	};
+
+	ThreadBuffer(u32 tid) : tid(tid) {}
+
+	const u32 tid;
+
+	Slot slots[PROFILER_MAX_KEYS];
+	// What was merged so far, guarded by the profiler's m_mutex
+	double merged_value[PROFILER_MAX_KEYS] = {};
+	u32 merged_count[PROFILER_MAX_KEYS] = {};
+
+	TreeSlot tree[PROFILER_MAX_TREE_NODES];
+	// Tree nodes of the open scopes and the children looked up so far,
+	// only used by the owning thread
+	std::vector<u32> scope_stack;
+	std::unordered_map<u64, u32> tree_cache;
+
+	// trace holds trace_count events of the trace with this epoch
+	std::atomic<u32> trace_epoch{0};
+	std::atomic<u32> trace_count{0};
+	std::vector<TraceEvent> trace;
+};
+
+/*
+	Buffers of the current thread, given back to their profilers when the
+	thread exits
+*/
+
+struct Profiler::ThreadBuffers
+{
+	struct Cached
+	{
+		u64 instance_id;
+		ThreadBuffer *buffer;
+	};
+
+	~ThreadBuffers()
+	{
+		LiveProfilers &live = live_profilers();
+		MutexAutoLock lock(live.mutex);
+		for (const Cached &cached : buffers) {
+			auto it = live.profilers.find(cached.instance_id);
+			if (it != live.profilers.end())
+				it->second->releaseThreadBuffer(cached.buffer);
+		}
+	}
+
+	std::vector<Cached> buffers;
+};
+
+template <typename T>
+static inline void atomic_add(std::atomic<T> &a, T value,
+	std::memory_order order = std::memory_order_relaxed)
+{
+	// Single writer, so no read-modify-write is needed
+	a.store(a.load(std::memory_order_relaxed) + value, order);
+}
 
 static Profiler main_profiler;
 Profiler *g_profiler = &main_profiler;
@@ -32,8 +207,26 @@ ScopeProfiler::ScopeProfiler(
 		m_timer = new TimeTaker(m_name, nullptr, PRECISION_MILLI);
 }
 
+ScopeProfiler::ScopeProfiler(
+		Profiler *profiler, const ProfilerKey &key, ScopeProfilerType type) :
+		m_profiler(profiler),
+		m_type(type),
+		m_key(&key)
+{
+	if (m_profiler) {
+		m_buffer = m_profiler->enterScope(key);
+		m_start_us = porting::getTimeUs();
+	}
+}
+
 ScopeProfiler::~ScopeProfiler()
 {
+	if (m_buffer) {
+		m_profiler->leaveScope(m_buffer, *m_key, m_type, m_start_us,
+			porting::getTimeUs() - m_start_us);
+		return;
+	}
+
 	if (!m_timer)
 		return;
 
@@ -55,14 +248,37 @@ ScopeProfiler::~ScopeProfiler()
 	delete m_timer;
 }
 
-Profiler::Profiler()
+static std::atomic<u64> next_profiler_id(1);
+
+Profiler::Profiler() :
+	m_instance_id(next_profiler_id++),
+	m_tracing(false),
+	m_trace_epoch(0)
 {
 	m_start_time = porting::getTimeMs();
+	// The root of the call tree, which also gets scopes beyond the limit
+	m_tree_nodes.emplace_back(0, 0);
+
+	LiveProfilers &live = live_profilers();
+	MutexAutoLock lock(live.mutex);
+	live.profilers[m_instance_id] = this;
+}
+
+Profiler::~Profiler()
+{
+	LiveProfilers &live = live_profilers();
+	MutexAutoLock lock(live.mutex);
+	live.profilers.erase(m_instance_id);
 }
 
 void Profiler::add(const std::string &name, float value)
 {
 	MutexAutoLock lock(m_mutex);
+	addLocked(name, value);
+}
+
+void Profiler::addLocked(const std::string &name, float value)
+{
 	{
 		/* No average shall have been used; mark add used as -2 */
 		std::map<std::string, int>::iterator n = m_avgcounts.find(name);
@@ -86,25 +302,125 @@ void Profiler::add(const std::string &name, float value)
 void Profiler::avg(const std::string &name, float value)
 {
 	MutexAutoLock lock(m_mutex);
-	int &count = m_avgcounts[name];
+	avgLocked(name, value, 1);
+}
+
+void Profiler::avgLocked(const std::string &name, float value, u32 count)
+{
+	int &avgcount = m_avgcounts[name];
 
-	assert(count != -2);
-	count = MYMAX(count, 0) + 1;
+	assert(avgcount != -2);
+	avgcount = MYMAX(avgcount, 0) + count;
 	m_data[name] += value;
 }
 
+void Profiler::record(ThreadBuffer *buffer, u16 id, float value, u8 mode)
+{
+	ThreadBuffer::Slot &slot = buffer->slots[id];
+	if (slot.mode.load(std::memory_order_relaxed) != mode)
+		slot.mode.store(mode, std::memory_order_relaxed);
+	atomic_add(slot.value, (double)value);
+	// Publishes the value and mode along with the count
+	atomic_add(slot.count, (u32)1, std::memory_order_release);
+}
+
+void Profiler::add(const ProfilerKey &key, float value)
+{
+	record(getThreadBuffer(), key.getId(), value, SLOT_ADD);
+}
+
+void Profiler::avg(const ProfilerKey &key, float value)
+{
+	record(getThreadBuffer(), key.getId(), value, SLOT_AVG);
+}
+
+Profiler::ThreadBuffer *Profiler::getThreadBuffer()
+{
+	// Nearly always g_profiler
+	static thread_local ThreadBuffers::Cached t_last = {0, nullptr};
+	static thread_local ThreadBuffers t_buffers;
+
+	if (t_last.instance_id == m_instance_id)
+		return t_last.buffer;
+	for (const ThreadBuffers::Cached &cached : t_buffers.buffers) {
+		if (cached.instance_id == m_instance_id) {
+			t_last = cached;
+			return cached.buffer;
+		}
+	}
+
+	ThreadBuffer *buffer;
+	{
+		MutexAutoLock lock(m_mutex);
+		if (!m_free_buffers.empty()) {
+			buffer = m_free_buffers.back();
+			m_free_buffers.pop_back();
+		} else {
+			m_buffers.emplace_back(new ThreadBuffer(m_buffers.size() + 1));
+			buffer = m_buffers.back().get();
+		}
+	}
+	t_last = {m_instance_id, buffer};
+	t_buffers.buffers.push_back(t_last);
+	return buffer;
+}
+
+void Profiler::releaseThreadBuffer(ThreadBuffer *buffer)
+{
+	// What it recorded stays in it until it is merged
+	MutexAutoLock lock(m_mutex);
+	buffer->scope_stack.clear();
+	m_free_buffers.push_back(buffer);
+}
+
+void Profiler::mergeThreadBuffers()
+{
+	if (m_buffers.empty())
+		return;
+
+	const u16 key_count = ProfilerKey::getCount();
+	for (std::unique_ptr<ThreadBuffer> &buffer : m_buffers) {
+		for (u16 id = 0; id < key_count; id++) {
+			ThreadBuffer::Slot &slot = buffer->slots[id];
+			// The value and mode are stored before the count, so they
+			// never lag behind it
+			u32 count = slot.count.load(std::memory_order_acquire);
+			if (count == buffer->merged_count[id])
+				continue;
+			double value = slot.value.load(std::memory_order_relaxed);
+
+			float delta = value - buffer->merged_value[id];
+			u32 delta_count = count - buffer->merged_count[id];
+			buffer->merged_value[id] = value;
+			buffer->merged_count[id] = count;
+
+			const std::string name = ProfilerKey::getName(id);
+			if (slot.mode.load(std::memory_order_relaxed) == SLOT_AVG)
+				avgLocked(name, delta, delta_count);
+			else
+				addLocked(name, delta);
+		}
+	}
+}
+
 void Profiler::clear()
 {
 	MutexAutoLock lock(m_mutex);
+	mergeThreadBuffers();
 	for (auto &it : m_data) {
 		it.second = 0;
 	}
 	m_avgcounts.clear();
 	m_start_time = porting::getTimeMs();
+
+	sumTree(m_tree_base_ms, m_tree_base_count);
 }
 
-float Profiler::getValue(const std::string &name) const
+float Profiler::getValue(const std::string &name)
 {
+	MutexAutoLock lock(m_mutex);
+	mergeThreadBuffers();
+
 	auto numerator = m_data.find(name);
 	if (numerator == m_data.end())
 		return 0.f;
@@ -118,7 +434,14 @@ float Profiler::getValue(const std::string &name) const
 	return numerator->second;
 }
 
-int Profiler::getAvgCount(const std::string &name) const
+int Profiler::getAvgCount(const std::string &name)
+{
+	MutexAutoLock lock(m_mutex);
+	mergeThreadBuffers();
+	return getAvgCountLocked(name);
+}
+
+int Profiler::getAvgCountLocked(const std::string &name) const
 {
 	auto n = m_avgcounts.find(name);
 
@@ -163,6 +486,7 @@ int Profiler::print(std::ostream &o, u32 page, u32 pagecount)
 void Profiler::getPage(GraphValues &o, u32 page, u32 pagecount)
 {
 	MutexAutoLock lock(m_mutex);
+	mergeThreadBuffers();
 
 	u32 minindex, maxindex;
 	paging(m_data.size(), page, pagecount, minindex, maxindex);
@@ -177,6 +501,192 @@ void Profiler::getPage(GraphValues &o, u32 page, u32 pagecount)
 			continue;
 		}
 
-		o[i.first] = i.second / getAvgCount(i.first);
+		o[i.first] = i.second / getAvgCountLocked(i.first);
+	}
+}
+
+/*
+	Call tree
+*/
+
+u32 Profiler::getTreeChild(ThreadBuffer *buffer, u32 parent, u16 key)
+{
+	const u64 cache_key = ((u64)parent << 16) | key;
+	auto cached = buffer->tree_cache.find(cache_key);
+	if (cached != buffer->tree_cache.end())
+		return cached->second;
+
+	u32 node;
+	{
+		MutexAutoLock lock(m_mutex);
+		auto it = m_tree_lookup.find(std::make_pair(parent, key));
+		if (it != m_tree_lookup.end()) {
+			node = it->second;
+		} else if (m_tree_nodes.size() < PROFILER_MAX_TREE_NODES) {
+			node = m_tree_nodes.size();
+			m_tree_nodes.emplace_back(parent, key);
+			m_tree_lookup[std::make_pair(parent, key)] = node;
+		} else {
+			node = 0;
+		}
+	}
+	buffer->tree_cache[cache_key] = node;
+	return node;
+}
+
+Profiler::ThreadBuffer *Profiler::enterScope(const ProfilerKey &key)
+{
+	ThreadBuffer *buffer = getThreadBuffer();
+	u32 parent = buffer->scope_stack.empty() ? 0 : buffer->scope_stack.back();
+	buffer->scope_stack.push_back(getTreeChild(buffer, parent, key.getId()));
+	return buffer;
+}
+
+void Profiler::leaveScope(ThreadBuffer *buffer, const ProfilerKey &key,
+	ScopeProfilerType type, u64 start_us, u64 duration_us)
+{
+	u32 node = buffer->scope_stack.back();
+	buffer->scope_stack.pop_back();
+	ThreadBuffer::TreeSlot &tree = buffer->tree[node];
+	atomic_add(tree.ms, duration_us / 1000.0);
+	atomic_add(tree.count, (u32)1);
+
+	// Recorded like by named scope profilers
+	float duration = duration_us / 1000000.0f;
+	switch (type) {
+	case SPT_ADD:
+		record(buffer, key.getId(), duration, SLOT_ADD);
+		break;
+	case SPT_AVG:
+		record(buffer, key.getId(), duration, SLOT_AVG);
+		break;
+	case SPT_GRAPH_ADD:
+		graphAdd(key.getName(), duration);
+		break;
+	}
+
+	if (!isTracing())
+		return;
+
+	const u32 epoch = m_trace_epoch.load(std::memory_order_acquire);
+	if (buffer->trace_epoch.load(std::memory_order_relaxed) != epoch) {
+		if (buffer->trace.empty())
+			buffer->trace.resize(PROFILER_TRACE_EVENTS);
+		buffer->trace_count.store(0, std::memory_order_relaxed);
+		buffer->trace_epoch.store(epoch, std::memory_order_release);
+	}
+	u32 count = buffer->trace_count.load(std::memory_order_relaxed);
+	if (count < PROFILER_TRACE_EVENTS) {
+		buffer->trace[count] = {key.getId(), start_us, (u32)duration_us};
+		buffer->trace_count.store(count + 1, std::memory_order_release);
+	}
+}
+
+void Profiler::sumTree(std::vector<double> &ms, std::vector<u32> &count)
+{
+	ms.assign(m_tree_nodes.size(), 0.0);
+	count.assign(m_tree_nodes.size(), 0);
+	for (std::unique_ptr<ThreadBuffer> &buffer : m_buffers) {
+		for (size_t i = 0; i < m_tree_nodes.size(); i++) {
+			ms[i] += buffer->tree[i].ms.load(std::memory_order_relaxed);
+			count[i] += buffer->tree[i].count.load(std::memory_order_relaxed);
+		}
+	}
+}
+
+std::vector<Profiler::TreeNode> Profiler::getTree()
+{
+	MutexAutoLock lock(m_mutex);
+
+	std::vector<double> ms;
+	std::vector<u32> count;
+	sumTree(ms, count);
+	for (size_t i = 0; i < m_tree_base_ms.size(); i++) {
+		ms[i] -= m_tree_base_ms[i];
+		count[i] -= m_tree_base_count[i];
+	}
+
+	std::vector<std::vector<u32>> children(m_tree_nodes.size());
+	for (u32 i = 1; i < m_tree_nodes.size(); i++)
+		children[m_tree_nodes[i].first].push_back(i);
+
+	std::vector<TreeNode> result;
+	// Node and depth
+	std::vector<std::pair<u32, u32>> stack;
+	for (auto it = children[0].rbegin(); it != children[0].rend(); ++it)
+		stack.emplace_back(*it, 0);
+	while (!stack.empty()) {
+		u32 node = stack.back().first;
+		u32 depth = stack.back().second;
+		stack.pop_back();
+		if (count[node] > 0) {
+			result.push_back({ProfilerKey::getName(m_tree_nodes[node].second),
+				depth, ms[node], count[node]});
+		}
+		for (auto it = children[node].rbegin(); it != children[node].rend(); ++it)
+			stack.emplace_back(*it, depth + 1);
+	}
+	return result;
+}
+
+void Profiler::printTree(std::ostream &o)
+{
+	char num_buf[50];
+	for (const TreeNode &node : getTree()) {
+		std::string line = std::string(2 + node.depth * 2, ' ') + node.name + " ";
+		for (s32 j = line.size(); j < 56; j++)
+			line += (j & 1) ? '.' : ' ';
+		porting::mt_snprintf(num_buf, sizeof(num_buf), " % 6ux % 10.3f ms",
+				node.count, node.total_ms);
+		o << line << num_buf << std::endl;
+	}
+}
+
+/*
+	Chrome trace events
+*/
+
+void Profiler::startTrace()
+{
+	MutexAutoLock lock(m_mutex);
+	m_trace_start_us = porting::getTimeUs();
+	m_trace_epoch++;
+	m_tracing = true;
+}
+
+void Profiler::stopTrace()
+{
+	m_tracing = false;
+}
+
+void Profiler::writeTrace(std::ostream &o)
+{
+	MutexAutoLock lock(m_mutex);
+	const u32 epoch = m_trace_epoch.load();
+
+	std::vector<std::string> names;
+	o << "{\"traceEvents\":[";
+	bool first = true;
+	for (std::unique_ptr<ThreadBuffer> &buffer : m_buffers) {
+		if (buffer->trace_epoch.load(std::memory_order_acquire) != epoch)
+			continue;
+		u32 count = buffer->trace_count.load(std::memory_order_acquire);
+		for (u32 i = 0; i < count; i++) {
+			const ThreadBuffer::TraceEvent &event = buffer->trace[i];
+			// Scope entered before the trace started
+			if (event.start_us < m_trace_start_us)
+				continue;
+			if (event.key >= names.size()) {
+				for (u16 id = names.size(); id <= event.key; id++)
+					names.push_back(serializeJsonString(ProfilerKey::getName(id)));
+			}
+			o << (first ? "\n" : ",\n")
+				<< "{\"name\":" << names[event.key]
+				<< ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+				<< ",\"ts\":" << event.start_us - m_trace_start_us
+				<< ",\"dur\":" << event.duration_us << "}";
+			first = false;
+		}
 	}
+	o << "\n],\"displayTimeUnit\":\"ms\"}" << std::endl;
 }
@@ -20,36 +20,109 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "irrlichttypes.h"
+#include <atomic>
 #include <cassert>
+#include <memory>
 #include <string>
 #include <map>
 #include <ostream>
+#include <vector>
 
 #include "threading/mutex_auto_lock.h"
 #include "util/timetaker.h"
+#include "util/basic_macros.h"
 #include "util/numeric.h"      // paging()
 
 // Global profiler
 class Profiler;
 extern Profiler *g_profiler;
 
+// Limits of the per-thread buffers of the profiler
+#define PROFILER_MAX_KEYS 1024
+#define PROFILER_MAX_TREE_NODES 4096
+#define PROFILER_TRACE_EVENTS 65536
+
+/*
+	Name of a profiler value, interned once so that recording the value
+	needs neither string operations nor locks. Keys of the same name share
+	their id. Make them with PROFILER_KEY, which creates one per call site.
+*/
+class ProfilerKey
+{
+public:
+	explicit ProfilerKey(const std::string &name);
+
+	u16 getId() const { return m_id; }
+	std::string getName() const;
+
+	static std::string getName(u16 id);
+	// Number of keys interned so far
+	static u16 getCount();
+
+private:
+	u16 m_id;
+};
+
+// name has to be a string literal
+#define PROFILER_KEY(name) \
+	([]() -> const ProfilerKey & { static const ProfilerKey key(name); return key; }())
+
+// Key of a ScopeProfiler; the unit is appended like for named ones
+#define SCOPE_PROFILER_KEY(name) PROFILER_KEY(name " [ms]")
+
+enum ScopeProfilerType{
+	SPT_ADD,
+	SPT_AVG,
+	SPT_GRAPH_ADD
+};
+
 /*
 	Time profiler
+
+	Values recorded by key go to a buffer of the recording thread, which is
+	merged into the named values whenever those are read. Scopes recorded by
+	key form a call tree per thread, and can be traced to a file in the
+	Chrome trace event format. The buffer of a thread that exits is reused
+	by the next thread that records something.
 */
 
 class Profiler
 {
 public:
 	Profiler();
+	~Profiler();
+	DISABLE_CLASS_COPY(Profiler);
 
 	void add(const std::string &name, float value);
 	void avg(const std::string &name, float value);
+	void add(const ProfilerKey &key, float value);
+	void avg(const ProfilerKey &key, float value);
 	void clear();
 
-	float getValue(const std::string &name) const;
-	int getAvgCount(const std::string &name) const;
+	float getValue(const std::string &name);
+	int getAvgCount(const std::string &name);
 	u64 getElapsedMs() const;
 
+	// Total time and count of a scope per call path since the last clear()
+	struct TreeNode
+	{
+		std::string name;
+		u32 depth;
+		double total_ms;
+		u32 count;
+	};
+	// Depth first, children in the order they were first entered
+	std::vector<TreeNode> getTree();
+	void printTree(std::ostream &o);
+
+	// Trace events are recorded from start until stop, up to
+	// PROFILER_TRACE_EVENTS per thread
+	void startTrace();
+	void stopTrace();
+	bool isTracing() const { return m_tracing.load(std::memory_order_relaxed); }
+	// Writes the events of the last trace as Chrome trace event JSON
+	void writeTrace(std::ostream &o);
+
 	typedef std::map<std::string, float> GraphValues;
 
 	// Returns the line count
@@ -77,22 +150,55 @@ class Profiler
 	void remove(const std::string& name)
 	{
 		MutexAutoLock lock(m_mutex);
+		mergeThreadBuffers();
 		m_avgcounts.erase(name);
 		m_data.erase(name);
 	}
 
 private:
+	friend class ScopeProfiler;
+	struct ThreadBuffer;
+	struct ThreadBuffers;
+
+	ThreadBuffer *getThreadBuffer();
+	// Called when the thread using the buffer exits
+	void releaseThreadBuffer(ThreadBuffer *buffer);
+	// Needs m_mutex
+	void mergeThreadBuffers();
+	int getAvgCountLocked(const std::string &name) const;
+	void addLocked(const std::string &name, float value);
+	void avgLocked(const std::string &name, float value, u32 count);
+	static void record(ThreadBuffer *buffer, u16 id, float value, u8 mode);
+	// Totals of the tree nodes over all threads, needs m_mutex
+	void sumTree(std::vector<double> &ms, std::vector<u32> &count);
+	u32 getTreeChild(ThreadBuffer *buffer, u32 parent, u16 key);
+
+	// ScopeProfiler with a key
+	ThreadBuffer *enterScope(const ProfilerKey &key);
+	void leaveScope(ThreadBuffer *buffer, const ProfilerKey &key,
+		ScopeProfilerType type, u64 start_us, u64 duration_us);
+
 	std::mutex m_mutex;
 	std::map<std::string, float> m_data;
 	std::map<std::string, int> m_avgcounts;
 	std::map<std::string, float> m_graphvalues;
 	u64 m_start_time;
-};
 
-enum ScopeProfilerType{
-	SPT_ADD,
-	SPT_AVG,
-	SPT_GRAPH_ADD
+	// Tells the buffers of different profilers apart
+	const u64 m_instance_id;
+	std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+	// Buffers of threads that exited, guarded by m_mutex
+	std::vector<ThreadBuffer *> m_free_buffers;
+	// The call tree; node 0 is the root. Guarded by m_mutex.
+	std::vector<std::pair<u32, u16>> m_tree_nodes;
+	std::map<std::pair<u32, u16>, u32> m_tree_lookup;
+	// Totals per node when the profiler was last cleared
+	std::vector<double> m_tree_base_ms;
+	std::vector<u32> m_tree_base_count;
+
+	std::atomic<bool> m_tracing;
+	std::atomic<u32> m_trace_epoch;
+	u64 m_trace_start_us = 0;
 };
 
 class ScopeProfiler
@@ -100,10 +206,17 @@ class ScopeProfiler
 public:
 	ScopeProfiler(Profiler *profiler, const std::string &name,
 			ScopeProfilerType type = SPT_ADD);
+	// Also recorded in the call tree and trace, key from SCOPE_PROFILER_KEY
+	ScopeProfiler(Profiler *profiler, const ProfilerKey &key,
+			ScopeProfilerType type = SPT_ADD);
 	~ScopeProfiler();
 private:
 	Profiler *m_profiler = nullptr;
 	std::string m_name;
 	TimeTaker *m_timer = nullptr;
 	enum ScopeProfilerType m_type;
+
+	const ProfilerKey *m_key = nullptr;
+	Profiler::ThreadBuffer *m_buffer = nullptr;
+	u64 m_start_us = 0;
 };
@@ -18,9 +18,14 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "rollback.h"
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <list>
 #include <sstream>
+#include "constants.h"
+#include "database/database.h"
+#include "exceptions.h"
 #include "log.h"
 #include "mapnode.h"
 #include "gamedef.h"
@@ -31,9 +36,23 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "inventorymanager.h" // deserializing InventoryLocations
 #include "sqlite3.h"
 #include "filesys.h"
+#include "threading/mutex_auto_lock.h"
+#include "threading/thread.h"
 
 #define POINTS_PER_NODE (16.0)
 
+// Range queries covering up to this many map blocks look up each block
+#define MAX_RANGE_QUERY_BLOCKS 64
+
+// Columns of the action tables, in the order registerRow binds them
+#define ACTION_COLUMNS \
+	"	`actor`, `timestamp`, `type`,\n" \
+	"	`list`, `index`, `add`, `stackNode`, `stackQuantity`, `nodeMeta`,\n" \
+	"	`x`, `y`, `z`,\n" \
+	"	`oldNode`, `oldParam1`, `oldParam2`, `oldMeta`,\n" \
+	"	`newNode`, `newParam1`, `newParam2`, `newMeta`,\n" \
+	"	`guessedActor`"
+
 #define SQLRES(f, good) \
 	if ((f) != (good)) {\
 		throw FileNotGoodException(std::string("RollbackManager: " \
@@ -63,14 +82,14 @@ class ItemStackRow : public ItemStack {
 };
 
 struct ActionRow {
-	int          id;
+	int          id = 0;
 	int          actor;
 	time_t       timestamp;
 	int          type;
 	std::string  location, list;
 	int          index, add;
 	ItemStackRow stack;
-	int          nodeMeta;
+	int          nodeMeta = 0;
 	int          x, y, z;
 	int          oldNode;
 	int          oldParam1, oldParam2;
@@ -88,10 +107,56 @@ struct Entity {
 };
 
 
+// Newest first, in insertion order for actions of the same second
+static bool newer_first(const ActionRow &a, const ActionRow &b)
+{
+	if (a.timestamp != b.timestamp)
+		return a.timestamp > b.timestamp;
+	return a.id > b.id;
+}
+
+
+class RollbackWriteThread : public Thread
+{
+public:
+	RollbackWriteThread(RollbackManager *rollback) :
+		Thread("RollbackWrite"),
+		m_rollback(rollback)
+	{}
+
+protected:
+	void *run()
+	{
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(m_rollback->m_queue_mutex);
+				// Wake up now and then to drop expired partitions
+				m_rollback->m_queue_cv.wait_for(lock, std::chrono::minutes(1), [this] {
+					return m_rollback->m_stop || !m_rollback->m_write_queue.empty();
+				});
+				// Everything is written before stopping
+				if (m_rollback->m_stop && m_rollback->m_write_queue.empty())
+					break;
+			}
+			if (!m_rollback->writeQueued()) {
+				MutexAutoLock lock(m_rollback->m_db_mutex);
+				m_rollback->dropExpiredPartitions(time(0));
+			}
+		}
+		return nullptr;
+	}
+
+private:
+	RollbackManager *m_rollback;
+};
+
+
 
 RollbackManager::RollbackManager(const std::string & world_path,
-		IGameDef * gamedef_) :
-	gamedef(gamedef_)
+		IGameDef * gamedef_, u32 partition_days, u32 retention_days) :
+	gamedef(gamedef_),
+	partition_seconds((time_t)std::max<u32>(partition_days, 1) * 24 * 3600),
+	retention_seconds((time_t)retention_days * 24 * 3600)
 {
 	verbosestream << "RollbackManager::RollbackManager(" << world_path
 		<< ")" << std::endl;
@@ -109,18 +174,26 @@ RollbackManager::RollbackManager(const std::string & world_path,
 		migrate(txt_filename);
 		fs::DeleteSingleFileOrEmptyDirectory(migrating_flag);
 	}
+
+	dropExpiredPartitions(time(0));
+
+	m_thread.reset(new RollbackWriteThread(this));
+	m_thread->start();
 }
 
 
 RollbackManager::~RollbackManager()
 {
 	flush();
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		m_stop = true;
+	}
+	m_queue_cv.notify_all();
+	m_thread->wait();
 
-	FINALIZE_STATEMENT(stmt_insert);
-	FINALIZE_STATEMENT(stmt_replace);
-	FINALIZE_STATEMENT(stmt_select);
-	FINALIZE_STATEMENT(stmt_select_range);
-	FINALIZE_STATEMENT(stmt_select_withActor);
+	for (Partition &partition : partitions)
+		finalizeStatements(partition);
 	FINALIZE_STATEMENT(stmt_knownActor_select);
 	FINALIZE_STATEMENT(stmt_knownActor_insert);
 	FINALIZE_STATEMENT(stmt_knownNode_select);
@@ -220,36 +293,7 @@ bool RollbackManager::createTables()
 		"CREATE TABLE IF NOT EXISTS `node` (\n"
 		"	`id` INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,\n"
 		"	`name` TEXT NOT NULL\n"
-		");\n"
-		"CREATE TABLE IF NOT EXISTS `action` (\n"
-		"	`id` INTEGER PRIMARY KEY AUTOINCREMENT,\n"
-		"	`actor` INTEGER NOT NULL,\n"
-		"	`timestamp` TIMESTAMP NOT NULL,\n"
-		"	`type` INTEGER NOT NULL,\n"
-		"	`list` TEXT,\n"
-		"	`index` INTEGER,\n"
-		"	`add` INTEGER,\n"
-		"	`stackNode` INTEGER,\n"
-		"	`stackQuantity` INTEGER,\n"
-		"	`nodeMeta` INTEGER,\n"
-		"	`x` INT,\n"
-		"	`y` INT,\n"
-		"	`z` INT,\n"
-		"	`oldNode` INTEGER,\n"
-		"	`oldParam1` INTEGER,\n"
-		"	`oldParam2` INTEGER,\n"
-		"	`oldMeta` TEXT,\n"
-		"	`newNode` INTEGER,\n"
-		"	`newParam1` INTEGER,\n"
-		"	`newParam2` INTEGER,\n"
-		"	`newMeta` TEXT,\n"
-		"	`guessedActor` INTEGER,\n"
-		"	FOREIGN KEY (`actor`) REFERENCES `actor`(`id`),\n"
-		"	FOREIGN KEY (`stackNode`) REFERENCES `node`(`id`),\n"
-		"	FOREIGN KEY (`oldNode`)   REFERENCES `node`(`id`),\n"
-		"	FOREIGN KEY (`newNode`)   REFERENCES `node`(`id`)\n"
-		");\n"
-		"CREATE INDEX IF NOT EXISTS `actionIndex` ON `action`(`x`,`y`,`z`,`timestamp`,`actor`);\n",
+		");\n",
 		NULL, NULL, NULL));
 	verbosestream << "SQL Rollback: SQLite3 database structure was created" << std::endl;
 
@@ -269,89 +313,6 @@ bool RollbackManager::initDatabase()
 		createTables();
 	}
 
-	SQLOK(sqlite3_prepare_v2(db,
-		"INSERT INTO `action` (\n"
-		"	`actor`, `timestamp`, `type`,\n"
-		"	`list`, `index`, `add`, `stackNode`, `stackQuantity`, `nodeMeta`,\n"
-		"	`x`, `y`, `z`,\n"
-		"	`oldNode`, `oldParam1`, `oldParam2`, `oldMeta`,\n"
-		"	`newNode`, `newParam1`, `newParam2`, `newMeta`,\n"
-		"	`guessedActor`\n"
-		") VALUES (\n"
-		"	?, ?, ?,\n"
-		"	?, ?, ?, ?, ?, ?,\n"
-		"	?, ?, ?,\n"
-		"	?, ?, ?, ?,\n"
-		"	?, ?, ?, ?,\n"
-		"	?"
-		");",
-		-1, &stmt_insert, NULL));
-
-	SQLOK(sqlite3_prepare_v2(db,
-		"REPLACE INTO `action` (\n"
-		"	`actor`, `timestamp`, `type`,\n"
-		"	`list`, `index`, `add`, `stackNode`, `stackQuantity`, `nodeMeta`,\n"
-		"	`x`, `y`, `z`,\n"
-		"	`oldNode`, `oldParam1`, `oldParam2`, `oldMeta`,\n"
-		"	`newNode`, `newParam1`, `newParam2`, `newMeta`,\n"
-		"	`guessedActor`, `id`\n"
-		") VALUES (\n"
-		"	?, ?, ?,\n"
-		"	?, ?, ?, ?, ?, ?,\n"
-		"	?, ?, ?,\n"
-		"	?, ?, ?, ?,\n"
-		"	?, ?, ?, ?,\n"
-		"	?, ?\n"
-		");",
-		-1, &stmt_replace, NULL));
-
-	SQLOK(sqlite3_prepare_v2(db,
-		"SELECT\n"
-		"	`actor`, `timestamp`, `type`,\n"
-		"	`list`, `index`, `add`, `stackNode`, `stackQuantity`, `nodemeta`,\n"
-		"	`x`, `y`, `z`,\n"
-		"	`oldNode`, `oldParam1`, `oldParam2`, `oldMeta`,\n"
-		"	`newNode`, `newParam1`, `newParam2`, `newMeta`,\n"
-		"	`guessedActor`\n"
-		" FROM `action`\n"
-		" WHERE `timestamp` >= ?\n"
-		" ORDER BY `timestamp` DESC, `id` DESC",
-		-1, &stmt_select, NULL));
-
-	SQLOK(sqlite3_prepare_v2(db,
-		"SELECT\n"
-		"	`actor`, `timestamp`, `type`,\n"
-		"	`list`, `index`, `add`, `stackNode`, `stackQuantity`, `nodemeta`,\n"
-		"	`x`, `y`, `z`,\n"
-		"	`oldNode`, `oldParam1`, `oldParam2`, `oldMeta`,\n"
-		"	`newNode`, `newParam1`, `newParam2`, `newMeta`,\n"
-		"	`guessedActor`\n"
-		"FROM `action`\n"
-		"WHERE `timestamp` >= ?\n"
-		"	AND `x` IS NOT NULL\n"
-		"	AND `y` IS NOT NULL\n"
-		"	AND `z` IS NOT NULL\n"
-		"	AND `x` BETWEEN ? AND ?\n"
-		"	AND `y` BETWEEN ? AND ?\n"
-		"	AND `z` BETWEEN ? AND ?\n"
-		"ORDER BY `timestamp` DESC, `id` DESC\n"
-		"LIMIT 0,?",
-		-1, &stmt_select_range, NULL));
-
-	SQLOK(sqlite3_prepare_v2(db,
-		"SELECT\n"
-		"	`actor`, `timestamp`, `type`,\n"
-		"	`list`, `index`, `add`, `stackNode`, `stackQuantity`, `nodemeta`,\n"
-		"	`x`, `y`, `z`,\n"
-		"	`oldNode`, `oldParam1`, `oldParam2`, `oldMeta`,\n"
-		"	`newNode`, `newParam1`, `newParam2`, `newMeta`,\n"
-		"	`guessedActor`\n"
-		"FROM `action`\n"
-		"WHERE `timestamp` >= ?\n"
-		"	AND `actor` = ?\n"
-		"ORDER BY `timestamp` DESC, `id` DESC\n",
-		-1, &stmt_select_withActor, NULL));
-
 	SQLOK(sqlite3_prepare_v2(db, "SELECT `id`, `name` FROM `actor`",
 			-1, &stmt_knownActor_select, NULL));
 
@@ -382,15 +343,245 @@ bool RollbackManager::initDatabase()
 	}
 	SQLOK(sqlite3_reset(stmt_knownNode_select));
 
+	// Find the partitions and the table of older versions
+	sqlite3_stmt *stmt_tables;
+	SQLOK(sqlite3_prepare_v2(db,
+		"SELECT `name` FROM `sqlite_master` WHERE `type` = 'table'",
+		-1, &stmt_tables, NULL));
+	while (sqlite3_step(stmt_tables) == SQLITE_ROW) {
+		std::string name = reinterpret_cast<const char *>(
+			sqlite3_column_text(stmt_tables, 0));
+		if (name == "action") {
+			Partition legacy;
+			legacy.start = 0;
+			legacy.table = name;
+			legacy.legacy = true;
+			partitions.push_back(legacy);
+		} else if (str_starts_with(name, "action_") && is_number(name.substr(7))) {
+			Partition partition;
+			partition.start = std::stoll(name.substr(7));
+			partition.table = name;
+			partitions.push_back(partition);
+		}
+	}
+	SQLOK(sqlite3_finalize(stmt_tables));
+
+	std::sort(partitions.begin(), partitions.end(),
+		[] (const Partition &a, const Partition &b) {
+			// The legacy table comes first
+			if (a.legacy != b.legacy)
+				return a.legacy;
+			return a.start < b.start;
+		});
+
+	for (Partition &partition : partitions) {
+		if (partition.legacy) {
+			// Revert queries filter by actor
+			SQLOK(sqlite3_exec(db,
+				"CREATE INDEX IF NOT EXISTS `actionActorIndex`"
+				" ON `action`(`actor`,`timestamp`)",
+				NULL, NULL, NULL));
+		}
+		prepareStatements(partition);
+	}
+
+	verbosestream << "SQL prepared statements setup correctly" << std::endl;
+
 	return needs_create;
 }
 
 
-bool RollbackManager::registerRow(const ActionRow & row)
+void RollbackManager::prepareStatements(Partition &partition)
 {
-	sqlite3_stmt * stmt_do = (row.id) ? stmt_replace : stmt_insert;
+	const std::string table = "`" + partition.table + "`";
+	const std::string select = "SELECT\n" ACTION_COLUMNS ", `id`\nFROM " + table + "\n";
+
+	// Nothing is written to the legacy table anymore
+	if (!partition.legacy) {
+		SQLOK(sqlite3_prepare_v2(db, ("INSERT INTO " + table + " (\n"
+			ACTION_COLUMNS ", `block`\n"
+			") VALUES (\n"
+			"	?, ?, ?,\n"
+			"	?, ?, ?, ?, ?, ?,\n"
+			"	?, ?, ?,\n"
+			"	?, ?, ?, ?,\n"
+			"	?, ?, ?, ?,\n"
+			"	?, ?\n"
+			");").c_str(),
+			-1, &partition.stmt_insert, NULL));
+
+		SQLOK(sqlite3_prepare_v2(db, (select +
+			"WHERE `block` = ?9\n"
+			"	AND `timestamp` >= ?1\n"
+			"	AND `x` BETWEEN ?2 AND ?3\n"
+			"	AND `y` BETWEEN ?4 AND ?5\n"
+			"	AND `z` BETWEEN ?6 AND ?7\n"
+			"ORDER BY `timestamp` DESC, `id` DESC\n"
+			"LIMIT 0,?8").c_str(),
+			-1, &partition.stmt_select_block, NULL));
+	}
+
+	SQLOK(sqlite3_prepare_v2(db, (select +
+		"WHERE `timestamp` >= ?\n"
+		"ORDER BY `timestamp` DESC, `id` DESC").c_str(),
+		-1, &partition.stmt_select, NULL));
+
+	SQLOK(sqlite3_prepare_v2(db, (select +
+		"WHERE `timestamp` >= ?\n"
+		"	AND `x` IS NOT NULL\n"
+		"	AND `y` IS NOT NULL\n"
+		"	AND `z` IS NOT NULL\n"
+		"	AND `x` BETWEEN ? AND ?\n"
+		"	AND `y` BETWEEN ? AND ?\n"
+		"	AND `z` BETWEEN ? AND ?\n"
+		"ORDER BY `timestamp` DESC, `id` DESC\n"
+		"LIMIT 0,?").c_str(),
+		-1, &partition.stmt_select_range, NULL));
+
+	SQLOK(sqlite3_prepare_v2(db, (select +
+		"WHERE `timestamp` >= ?\n"
+		"	AND `actor` = ?\n"
+		"ORDER BY `timestamp` DESC, `id` DESC").c_str(),
+		-1, &partition.stmt_select_withActor, NULL));
+}
+
+
+void RollbackManager::finalizeStatements(Partition &partition)
+{
+	FINALIZE_STATEMENT(partition.stmt_insert);
+	FINALIZE_STATEMENT(partition.stmt_select);
+	FINALIZE_STATEMENT(partition.stmt_select_range);
+	FINALIZE_STATEMENT(partition.stmt_select_block);
+	FINALIZE_STATEMENT(partition.stmt_select_withActor);
+}
+
+
+RollbackManager::Partition &RollbackManager::createPartition(time_t start)
+{
+	Partition partition;
+	partition.start = start;
+	partition.table = "action_" + i64tos(start);
+
+	const std::string table = "`" + partition.table + "`";
+	SQLOK(sqlite3_exec(db, ("CREATE TABLE IF NOT EXISTS " + table + " (\n"
+		"	`id` INTEGER PRIMARY KEY AUTOINCREMENT,\n"
+		"	`actor` INTEGER NOT NULL,\n"
+		"	`timestamp` TIMESTAMP NOT NULL,\n"
+		"	`type` INTEGER NOT NULL,\n"
+		"	`list` TEXT,\n"
+		"	`index` INTEGER,\n"
+		"	`add` INTEGER,\n"
+		"	`stackNode` INTEGER,\n"
+		"	`stackQuantity` INTEGER,\n"
+		"	`nodeMeta` INTEGER,\n"
+		"	`x` INT,\n"
+		"	`y` INT,\n"
+		"	`z` INT,\n"
+		"	`oldNode` INTEGER,\n"
+		"	`oldParam1` INTEGER,\n"
+		"	`oldParam2` INTEGER,\n"
+		"	`oldMeta` TEXT,\n"
+		"	`newNode` INTEGER,\n"
+		"	`newParam1` INTEGER,\n"
+		"	`newParam2` INTEGER,\n"
+		"	`newMeta` TEXT,\n"
+		"	`guessedActor` INTEGER,\n"
+		"	`block` INTEGER,\n"
+		"	FOREIGN KEY (`actor`) REFERENCES `actor`(`id`),\n"
+		"	FOREIGN KEY (`stackNode`) REFERENCES `node`(`id`),\n"
+		"	FOREIGN KEY (`oldNode`)   REFERENCES `node`(`id`),\n"
+		"	FOREIGN KEY (`newNode`)   REFERENCES `node`(`id`)\n"
+		");\n"
+		"CREATE INDEX IF NOT EXISTS `" + partition.table + "_block`"
+		" ON " + table + "(`block`,`timestamp`);\n"
+		"CREATE INDEX IF NOT EXISTS `" + partition.table + "_actor`"
+		" ON " + table + "(`actor`,`timestamp`);\n").c_str(),
+		NULL, NULL, NULL));
+	prepareStatements(partition);
+
+	verbosestream << "RollbackManager: Created partition "
+		<< partition.table << std::endl;
+
+	auto it = std::upper_bound(partitions.begin(), partitions.end(), start,
+		[] (time_t t, const Partition &p) { return !p.legacy && t < p.start; });
+	return *partitions.insert(it, partition);
+}
+
+
+RollbackManager::Partition &RollbackManager::getPartitionFor(time_t t)
+{
+	const time_t start = t - t % partition_seconds;
+	for (auto it = partitions.rbegin(); it != partitions.rend() && !it->legacy; ++it) {
+		if (it->start > t)
+			continue;
+		// Partitions made with a different length are kept as they are
+		if (t < it->start + partition_seconds || start <= it->start)
+			return *it;
+		break;
+	}
+	return createPartition(start);
+}
+
+
+std::vector<RollbackManager::Partition *> RollbackManager::getPartitionsSince(
+		time_t first_time)
+{
+	std::vector<Partition *> result;
+	for (size_t i = partitions.size(); i-- > 0;) {
+		Partition &partition = partitions[i];
+		// Actions of older versions can't be told apart by time
+		if (partition.legacy || i + 1 == partitions.size() ||
+				partitions[i + 1].start > first_time)
+			result.push_back(&partition);
+	}
+	return result;
+}
+
+
+void RollbackManager::dropExpiredPartitions(time_t now)
+{
+	if (retention_seconds == 0)
+		return;
+
+	const time_t cutoff = now - retention_seconds;
+	for (size_t i = 0; i < partitions.size();) {
+		Partition &partition = partitions[i];
+		time_t end = i + 1 < partitions.size() ? partitions[i + 1].start :
+			partition.start + partition_seconds;
+		if (partition.legacy || end > cutoff) {
+			i++;
+			continue;
+		}
+
+		finalizeStatements(partition);
+		SQLOK(sqlite3_exec(db, ("DROP TABLE `" + partition.table + "`").c_str(),
+			NULL, NULL, NULL));
+		infostream << "RollbackManager: Dropped expired partition "
+			<< partition.table << std::endl;
+		partitions.erase(partitions.begin() + i);
+	}
+}
+
+
+std::vector<time_t> RollbackManager::getPartitionStarts()
+{
+	MutexAutoLock lock(m_db_mutex);
+	std::vector<time_t> starts;
+	for (const Partition &partition : partitions) {
+		if (!partition.legacy)
+			starts.push_back(partition.start);
+	}
+	return starts;
+}
+
+
+bool RollbackManager::registerRow(Partition &partition, const ActionRow & row)
+{
+	sqlite3_stmt * stmt_do = partition.stmt_insert;
 
 	bool nodeMeta = false;
+	bool hasPos = false;
+	v3s16 pos;
 
 	SQLOK(sqlite3_bind_int  (stmt_do, 1, row.actor));
 	SQLOK(sqlite3_bind_int64(stmt_do, 2, row.timestamp));
@@ -416,9 +607,11 @@ bool RollbackManager::registerRow(const ActionRow & row)
 			p2 = loc.find(',', p1);
 			std::string y = loc.substr(p1, p2 - p1);
 			std::string z = loc.substr(p2 + 1);
-			SQLOK(sqlite3_bind_int(stmt_do, 10, atoi(x.c_str())));
-			SQLOK(sqlite3_bind_int(stmt_do, 11, atoi(y.c_str())));
-			SQLOK(sqlite3_bind_int(stmt_do, 12, atoi(z.c_str())));
+			hasPos = true;
+			pos = v3s16(atoi(x.c_str()), atoi(y.c_str()), atoi(z.c_str()));
+			SQLOK(sqlite3_bind_int(stmt_do, 10, pos.X));
+			SQLOK(sqlite3_bind_int(stmt_do, 11, pos.Y));
+			SQLOK(sqlite3_bind_int(stmt_do, 12, pos.Z));
 		}
 	} else {
 		SQLOK(sqlite3_bind_null(stmt_do, 4));
@@ -430,6 +623,8 @@ bool RollbackManager::registerRow(const ActionRow & row)
 	}
 
 	if (row.type == RollbackAction::TYPE_SET_NODE) {
+		hasPos = true;
+		pos = v3s16(row.x, row.y, row.z);
 		SQLOK(sqlite3_bind_int (stmt_do, 10, row.x));
 		SQLOK(sqlite3_bind_int (stmt_do, 11, row.y));
 		SQLOK(sqlite3_bind_int (stmt_do, 12, row.z));
@@ -459,8 +654,11 @@ bool RollbackManager::registerRow(const ActionRow & row)
 		SQLOK(sqlite3_bind_null(stmt_do, 21));
 	}
 
-	if (row.id) {
-		SQLOK(sqlite3_bind_int(stmt_do, 22, row.id));
+	if (hasPos) {
+		SQLOK(sqlite3_bind_int64(stmt_do, 22,
+			MapDatabase::getBlockAsInteger(getContainerPos(pos, MAP_BLOCKSIZE))));
+	} else {
+		SQLOK(sqlite3_bind_null(stmt_do, 22));
 	}
 
 	int written = sqlite3_step(stmt_do);
@@ -471,7 +669,7 @@ bool RollbackManager::registerRow(const ActionRow & row)
 }
 
 
-const std::list<ActionRow> RollbackManager::actionRowsFromSelect(sqlite3_stmt* stmt)
+std::list<ActionRow> RollbackManager::actionRowsFromSelect(sqlite3_stmt* stmt)
 {
 	std::list<ActionRow> rows;
 	const unsigned char * text;
@@ -517,6 +715,8 @@ const std::list<ActionRow> RollbackManager::actionRowsFromSelect(sqlite3_stmt* s
 			row.guessed   = sqlite3_column_int(stmt, 20);
 		}
 
+		row.id = sqlite3_column_int(stmt, 21);
+
 		if (row.nodeMeta) {
 			row.location = "nodemeta:";
 			row.location += itos(row.x);
@@ -621,35 +821,86 @@ const std::list<RollbackAction> RollbackManager::rollbackActionsFromActionRows(
 
 const std::list<ActionRow> RollbackManager::getRowsSince(time_t firstTime, const std::string & actor)
 {
-	sqlite3_stmt *stmt_stmt = actor.empty() ? stmt_select : stmt_select_withActor;
-	sqlite3_bind_int64(stmt_stmt, 1, firstTime);
+	const int actor_id = actor.empty() ? 0 : getActorId(actor);
+	std::list<ActionRow> rows;
+
+	for (Partition *partition : getPartitionsSince(firstTime)) {
+		sqlite3_stmt *stmt_stmt = actor.empty() ?
+			partition->stmt_select : partition->stmt_select_withActor;
+		SQLOK(sqlite3_bind_int64(stmt_stmt, 1, firstTime));
+
+		if (!actor.empty()) {
+			SQLOK(sqlite3_bind_int(stmt_stmt, 2, actor_id));
+		}
 
-	if (!actor.empty()) {
-		sqlite3_bind_int(stmt_stmt, 2, getActorId(actor));
+		rows.splice(rows.end(), actionRowsFromSelect(stmt_stmt));
 	}
 
-	const std::list<ActionRow> & rows = actionRowsFromSelect(stmt_stmt);
-	sqlite3_reset(stmt_stmt);
+	// Partitions overlap in time if the clock was turned back.
+	// The sort is stable, so newer partitions stay first on ties.
+	rows.sort([] (const ActionRow &a, const ActionRow &b) {
+		return a.timestamp > b.timestamp;
+	});
 
 	return rows;
 }
 
 
+static void bind_range(sqlite3_stmt *stmt, time_t start_time, v3s16 p,
+		int range, int limit)
+{
+	sqlite3_bind_int64(stmt, 1, start_time);
+	sqlite3_bind_int  (stmt, 2, static_cast<int>(p.X - range));
+	sqlite3_bind_int  (stmt, 3, static_cast<int>(p.X + range));
+	sqlite3_bind_int  (stmt, 4, static_cast<int>(p.Y - range));
+	sqlite3_bind_int  (stmt, 5, static_cast<int>(p.Y + range));
+	sqlite3_bind_int  (stmt, 6, static_cast<int>(p.Z - range));
+	sqlite3_bind_int  (stmt, 7, static_cast<int>(p.Z + range));
+	sqlite3_bind_int  (stmt, 8, limit);
+}
+
+
 const std::list<ActionRow> RollbackManager::getRowsSince_range(
 		time_t start_time, v3s16 p, int range, int limit)
 {
+	auto block_of = [] (int n) {
+		return getContainerPos((s16)rangelim(n, -32768, 32767), MAP_BLOCKSIZE);
+	};
+	const v3s16 bpmin(block_of(p.X - range), block_of(p.Y - range),
+		block_of(p.Z - range));
+	const v3s16 bpmax(block_of(p.X + range), block_of(p.Y + range),
+		block_of(p.Z + range));
+	const s64 block_count = (s64)(bpmax.X - bpmin.X + 1) *
+		(bpmax.Y - bpmin.Y + 1) * (bpmax.Z - bpmin.Z + 1);
 
-	sqlite3_bind_int64(stmt_select_range, 1, start_time);
-	sqlite3_bind_int  (stmt_select_range, 2, static_cast<int>(p.X - range));
-	sqlite3_bind_int  (stmt_select_range, 3, static_cast<int>(p.X + range));
-	sqlite3_bind_int  (stmt_select_range, 4, static_cast<int>(p.Y - range));
-	sqlite3_bind_int  (stmt_select_range, 5, static_cast<int>(p.Y + range));
-	sqlite3_bind_int  (stmt_select_range, 6, static_cast<int>(p.Z - range));
-	sqlite3_bind_int  (stmt_select_range, 7, static_cast<int>(p.Z + range));
-	sqlite3_bind_int  (stmt_select_range, 8, limit);
+	std::list<ActionRow> rows;
+	for (Partition *partition : getPartitionsSince(start_time)) {
+		if (partition->legacy || block_count > MAX_RANGE_QUERY_BLOCKS) {
+			bind_range(partition->stmt_select_range, start_time, p, range, limit);
+			rows.splice(rows.end(), actionRowsFromSelect(partition->stmt_select_range));
+			continue;
+		}
+
+		std::list<ActionRow> partition_rows;
+		sqlite3_stmt *stmt = partition->stmt_select_block;
+		v3s16 bp;
+		for (bp.Z = bpmin.Z; bp.Z <= bpmax.Z; bp.Z++)
+		for (bp.Y = bpmin.Y; bp.Y <= bpmax.Y; bp.Y++)
+		for (bp.X = bpmin.X; bp.X <= bpmax.X; bp.X++) {
+			bind_range(stmt, start_time, p, range, limit);
+			SQLOK(sqlite3_bind_int64(stmt, 9, MapDatabase::getBlockAsInteger(bp)));
+			partition_rows.splice(partition_rows.end(), actionRowsFromSelect(stmt));
+		}
+		// Merge the blocks, the ids are unique within a partition
+		partition_rows.sort(newer_first);
+		rows.splice(rows.end(), partition_rows);
+	}
 
-	const std::list<ActionRow> & rows = actionRowsFromSelect(stmt_select_range);
-	sqlite3_reset(stmt_select_range);
+	rows.sort([] (const ActionRow &a, const ActionRow &b) {
+		return a.timestamp > b.timestamp;
+	});
+	if (limit >= 0 && rows.size() > (size_t)limit)
+		rows.resize(limit);
 
 	return rows;
 }
@@ -766,7 +1017,7 @@ void RollbackManager::migrate(const std::string & file_path)
 			continue;
 		}
 
-		registerRow(row);
+		registerRow(getPartitionFor(row.timestamp), row);
 		++i;
 
 		if (time(0) - t >= 1) {
@@ -911,22 +1162,98 @@ std::string RollbackManager::getSuspect(v3s16 p, float nearness_shortcut,
 
 void RollbackManager::flush()
 {
-	sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+	if (action_todisk_buffer.empty())
+		return;
 
-	std::list<RollbackAction>::const_iterator iter;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		m_write_queue.emplace_back();
+		m_write_queue.back().swap(action_todisk_buffer);
+	}
+	m_queue_cv.notify_one();
+}
 
-	for (iter  = action_todisk_buffer.begin();
-			iter != action_todisk_buffer.end();
-			++iter) {
-		if (iter->actor.empty()) {
-			continue;
-		}
 
-		registerRow(actionRowFromRollbackAction(*iter));
+void RollbackManager::waitForWrites()
+{
+	flush();
+	std::unique_lock<std::mutex> lock(m_queue_mutex);
+	m_written_cv.wait(lock, [this] {
+		return m_write_queue.empty() && !m_writing;
+	});
+}
+
+
+bool RollbackManager::writeQueued()
+{
+	std::list<RollbackAction> actions;
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		if (m_write_queue.empty())
+			return false;
+		for (std::list<RollbackAction> &batch : m_write_queue)
+			actions.splice(actions.end(), batch);
+		m_write_queue.clear();
+		m_writing = true;
 	}
 
-	sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
-	action_todisk_buffer.clear();
+	{
+		MutexAutoLock lock(m_db_mutex);
+		// The actors, nodes and partitions the transaction adds are
+		// forgotten again if it is rolled back
+		const size_t known_actors = knownActors.size();
+		const size_t known_nodes = knownNodes.size();
+		std::vector<std::string> tables;
+		for (const Partition &partition : partitions)
+			tables.push_back(partition.table);
+
+		// Everything queued so far goes into a single transaction
+		try {
+			SQLOK(sqlite3_exec(db, "BEGIN", NULL, NULL, NULL));
+			u32 failed = 0;
+			for (const RollbackAction &action : actions) {
+				if (action.actor.empty()) {
+					continue;
+				}
+
+				ActionRow row = actionRowFromRollbackAction(action);
+				if (!registerRow(getPartitionFor(row.timestamp), row))
+					failed++;
+			}
+			SQLOK(sqlite3_exec(db, "COMMIT", NULL, NULL, NULL));
+			if (failed > 0) {
+				errorstream << "RollbackManager: Failed to write " << failed
+					<< " of " << actions.size() << " actions" << std::endl;
+			}
+		} catch (FileNotGoodException &e) {
+			errorstream << "RollbackManager: Failed to write "
+				<< actions.size() << " actions: " << e.what() << std::endl;
+			sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+
+			sqlite3_reset(stmt_knownActor_insert);
+			sqlite3_reset(stmt_knownNode_insert);
+			knownActors.resize(known_actors);
+			knownNodes.resize(known_nodes);
+			for (size_t i = partitions.size(); i-- > 0;) {
+				Partition &partition = partitions[i];
+				if (std::find(tables.begin(), tables.end(), partition.table) !=
+						tables.end()) {
+					sqlite3_reset(partition.stmt_insert);
+					continue;
+				}
+				// Its table was created in the transaction
+				finalizeStatements(partition);
+				partitions.erase(partitions.begin() + i);
+			}
+		}
+	}
+
+	{
+		MutexAutoLock lock(m_queue_mutex);
+		m_writing = false;
+	}
+	m_written_cv.notify_all();
+	return true;
 }
 
 
@@ -943,17 +1270,19 @@ void RollbackManager::addAction(const RollbackAction & action)
 
 std::list<RollbackAction> RollbackManager::getEntriesSince(time_t first_time)
 {
-	flush();
+	waitForWrites();
+	MutexAutoLock lock(m_db_mutex);
 	return getActionsSince(first_time);
 }
 
 std::list<RollbackAction> RollbackManager::getNodeActors(v3s16 pos, int range,
 		time_t seconds, int limit)
 {
-	flush();
+	waitForWrites();
 	time_t cur_time = time(0);
 	time_t first_time = cur_time - seconds;
 
+	MutexAutoLock lock(m_db_mutex);
 	return getActionsSince_range(first_time, pos, range, limit);
 }
 
@@ -964,8 +1293,9 @@ std::list<RollbackAction> RollbackManager::getRevertActions(
 	time_t cur_time = time(0);
 	time_t first_time = cur_time - seconds;
 
-	flush();
+	waitForWrites();
 
+	MutexAutoLock lock(m_db_mutex);
 	return getActionsSince(first_time, actor_filter);
 }
 
@@ -19,6 +19,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <memory>
+#include <mutex>
 #include <string>
 #include "irr_v3d.h"
 #include "rollback_interface.h"
@@ -27,14 +32,27 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "sqlite3.h"
 
 class IGameDef;
+class RollbackWriteThread;
 
 struct ActionRow;
 struct Entity;
 
+/*
+	Stores actions in rollback.sqlite, one table per partition_days long
+	period (`action_<start time>`), so queries only touch the periods they
+	ask for and old periods can be dropped as a whole once they are older
+	than retention_days (0 keeps them forever). Each table is indexed by
+	map block and by actor. The `action` table of older worlds is still
+	read, but not written to anymore.
+
+	Reported actions are written in batches by a thread of its own.
+	Queries wait for everything reported before them to be written.
+*/
 class RollbackManager: public IRollbackManager
 {
 public:
-	RollbackManager(const std::string & world_path, IGameDef * gamedef);
+	RollbackManager(const std::string & world_path, IGameDef * gamedef,
+			u32 partition_days = 7, u32 retention_days = 0);
 	~RollbackManager();
 
 	void reportAction(const RollbackAction & action_);
@@ -43,6 +61,7 @@ class RollbackManager: public IRollbackManager
 	void setActor(const std::string & actor, bool is_guess);
 	std::string getSuspect(v3s16 p, float nearness_shortcut,
 			float min_nearness);
+	// Hands the buffered actions to the writer thread
 	void flush();
 
 	void addAction(const RollbackAction & action);
@@ -52,7 +71,29 @@ class RollbackManager: public IRollbackManager
 	std::list<RollbackAction> getRevertActions(
 			const std::string & actor_filter, time_t seconds);
 
+	// Waits until everything flushed so far is written
+	void waitForWrites();
+
+	// Start times of the partition tables, oldest first
+	std::vector<time_t> getPartitionStarts();
+
 private:
+	friend class RollbackWriteThread;
+
+	// A table holding the actions from start until the next partition starts
+	struct Partition
+	{
+		time_t start;
+		std::string table;
+		// The `action` table of older versions, which has no `block` column
+		bool legacy = false;
+		sqlite3_stmt *stmt_insert = nullptr;
+		sqlite3_stmt *stmt_select = nullptr;
+		sqlite3_stmt *stmt_select_range = nullptr;
+		sqlite3_stmt *stmt_select_block = nullptr;
+		sqlite3_stmt *stmt_select_withActor = nullptr;
+	};
+
 	void registerNewActor(const int id, const std::string & name);
 	void registerNewNode(const int id, const std::string & name);
 	int getActorId(const std::string & name);
@@ -61,8 +102,17 @@ class RollbackManager: public IRollbackManager
 	const char * getNodeName(const int id);
 	bool createTables();
 	bool initDatabase();
-	bool registerRow(const ActionRow & row);
-	const std::list<ActionRow> actionRowsFromSelect(sqlite3_stmt * stmt);
+	void prepareStatements(Partition &partition);
+	void finalizeStatements(Partition &partition);
+	Partition &createPartition(time_t start);
+	Partition &getPartitionFor(time_t t);
+	// Returns the partitions that may hold actions since first_time, newest first
+	std::vector<Partition *> getPartitionsSince(time_t first_time);
+	void dropExpiredPartitions(time_t now);
+	// Writes the queued actions, returns false if there were none
+	bool writeQueued();
+	bool registerRow(Partition &partition, const ActionRow & row);
+	std::list<ActionRow> actionRowsFromSelect(sqlite3_stmt * stmt);
 	ActionRow actionRowFromRollbackAction(const RollbackAction & action);
 	const std::list<RollbackAction> rollbackActionsFromActionRows(
 			const std::list<ActionRow> & rows);
@@ -87,13 +137,15 @@ class RollbackManager: public IRollbackManager
 	std::list<RollbackAction> action_todisk_buffer;
 	std::list<RollbackAction> action_latest_buffer;
 
+	const time_t partition_seconds;
+	const time_t retention_seconds;
+
+	// Guards the database, the partitions and the known actors and nodes
+	std::mutex m_db_mutex;
 	std::string database_path;
 	sqlite3 * db;
-	sqlite3_stmt * stmt_insert;
-	sqlite3_stmt * stmt_replace;
-	sqlite3_stmt * stmt_select;
-	sqlite3_stmt * stmt_select_range;
-	sqlite3_stmt * stmt_select_withActor;
+	// Oldest first
+	std::vector<Partition> partitions;
 	sqlite3_stmt * stmt_knownActor_select;
 	sqlite3_stmt * stmt_knownActor_insert;
 	sqlite3_stmt * stmt_knownNode_select;
@@ -101,4 +153,14 @@ class RollbackManager: public IRollbackManager
 
 	std::vector<Entity> knownActors;
 	std::vector<Entity> knownNodes;
+
+	std::mutex m_queue_mutex;
+	// Signalled when actions are queued or the thread should stop
+	std::condition_variable m_queue_cv;
+	// Signalled when queued actions were written
+	std::condition_variable m_written_cv;
+	std::deque<std::list<RollbackAction>> m_write_queue;
+	bool m_writing = false;
+	bool m_stop = false;
+	std::unique_ptr<RollbackWriteThread> m_thread;
 };
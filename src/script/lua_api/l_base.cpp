@@ -131,7 +131,7 @@ int ModApiBase::l_deprecated_function(lua_State *L)
 	}
 
 	u64 end_time = porting::getTimeUs();
-	g_profiler->avg("l_deprecated_function", end_time - start_time);
+	g_profiler->avg(PROFILER_KEY("l_deprecated_function"), end_time - start_time);
 
 	return it->second.func(L);
 }
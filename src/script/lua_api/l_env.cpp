@@ -662,17 +662,9 @@ int ModApiEnvMod::l_get_player_by_name(lua_State *L)
 	return 1;
 }
 
-// get_objects_inside_radius(pos, radius)
-int ModApiEnvMod::l_get_objects_inside_radius(lua_State *L)
+void ModApiEnvMod::pushObjectList(lua_State *L, ScriptApiBase *script,
+		ServerEnvironment *env, const std::vector<u16> &ids)
 {
-	GET_ENV_PTR;
-
-	// Do it
-	v3f pos = checkFloatPos(L, 1);
-	float radius = readParam<float>(L, 2) * BS;
-	std::vector<u16> ids;
-	env->getObjectsInsideRadius(ids, pos, radius);
-	ScriptApiBase *script = getScriptApiBase(L);
 	lua_createtable(L, ids.size(), 0);
 	std::vector<u16>::const_iterator iter = ids.begin();
 	for(u32 i = 0; iter != ids.end(); ++iter) {
@@ -683,6 +675,32 @@ int ModApiEnvMod::l_get_objects_inside_radius(lua_State *L)
 			lua_rawseti(L, -2, ++i);
 		}
 	}
+}
+
+// get_objects_inside_radius(pos, radius)
+int ModApiEnvMod::l_get_objects_inside_radius(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	// Do it
+	v3f pos = checkFloatPos(L, 1);
+	float radius = readParam<float>(L, 2) * BS;
+	std::vector<u16> ids;
+	env->getObjectsInsideRadius(ids, pos, radius);
+	pushObjectList(L, getScriptApiBase(L), env, ids);
+	return 1;
+}
+
+// get_objects_in_area(minp, maxp)
+int ModApiEnvMod::l_get_objects_in_area(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	aabb3f box(checkFloatPos(L, 1), checkFloatPos(L, 2));
+	box.repair();
+	std::vector<u16> ids;
+	env->getObjectsInArea(ids, box);
+	pushObjectList(L, getScriptApiBase(L), env, ids);
 	return 1;
 }
 
@@ -742,6 +760,29 @@ int ModApiEnvMod::l_get_gametime(lua_State *L)
 }
 
 
+/*
+	Reads a node name or a list of node names and "group:" names,
+	as taken by the find_node* functions.
+*/
+static std::shared_ptr<const ContentFilter> read_content_filter(lua_State *L,
+	int index, const NodeDefManager *ndef)
+{
+	std::vector<std::string> names;
+	if (lua_istable(L, index)) {
+		lua_pushnil(L);
+		while (lua_next(L, index) != 0) {
+			// key at index -2 and value at index -1
+			luaL_checktype(L, -1, LUA_TSTRING);
+			names.emplace_back(lua_tostring(L, -1));
+			// removes value, keeps key for next iteration
+			lua_pop(L, 1);
+		}
+	} else if (lua_isstring(L, index)) {
+		names.emplace_back(lua_tostring(L, index));
+	}
+	return ndef->getFilter(names);
+}
+
 // find_node_near(pos, radius, nodenames, search_center) -> pos or nil
 // nodenames: eg. {"ignore", "group:tree"} or "default:dirt"
 int ModApiEnvMod::l_find_node_near(lua_State *L)
@@ -754,19 +795,7 @@ int ModApiEnvMod::l_find_node_near(lua_State *L)
 	const NodeDefManager *ndef = getGameDef(L)->ndef();
 	v3s16 pos = read_v3s16(L, 1);
 	int radius = luaL_checkinteger(L, 2);
-	std::vector<content_t> filter;
-	if (lua_istable(L, 3)) {
-		lua_pushnil(L);
-		while (lua_next(L, 3) != 0) {
-			// key at index -2 and value at index -1
-			luaL_checktype(L, -1, LUA_TSTRING);
-			ndef->getIds(readParam<std::string>(L, -1), filter);
-			// removes value, keeps key for next iteration
-			lua_pop(L, 1);
-		}
-	} else if (lua_isstring(L, 3)) {
-		ndef->getIds(readParam<std::string>(L, 3), filter);
-	}
+	std::shared_ptr<const ContentFilter> filter = read_content_filter(L, 3, ndef);
 
 	int start_radius = (lua_isboolean(L, 4) && readParam<bool>(L, 4)) ? 0 : 1;
 
@@ -781,7 +810,7 @@ int ModApiEnvMod::l_find_node_near(lua_State *L)
 		for (const v3s16 &i : list) {
 			v3s16 p = pos + i;
 			content_t c = env->getMap().getNode(p).getContent();
-			if (CONTAINS(filter, c)) {
+			if (filter->contains(c)) {
 				push_v3s16(L, p);
 				return 1;
 			}
@@ -790,7 +819,82 @@ int ModApiEnvMod::l_find_node_near(lua_State *L)
 	return 0;
 }
 
-// find_nodes_in_area(minp, maxp, nodenames) -> list of positions
+/*
+	Calls found(p, filter.indexOf(c)) for every node from minp to maxp whose
+	content c is in the filter, block by block. Blocks whose content index
+	is cached are only searched for the filtered contents, and skipped if
+	they have none of them.
+	Within a block the nodes are found in the order of the block data.
+*/
+template <typename F>
+static void find_nodes_blockwise(Map *map, v3s16 minp, v3s16 maxp,
+	const ContentFilter &filter, F &&found)
+{
+	auto filter_index = [&filter] (content_t c) -> int {
+		return filter.contains(c) ? (int)filter.indexOf(c) : -1;
+	};
+	const int ignore_index = filter_index(CONTENT_IGNORE);
+
+	std::vector<u16> indices;
+	v3s16 bpmin = getNodeBlockPos(minp);
+	v3s16 bpmax = getNodeBlockPos(maxp);
+	v3s16 bp;
+	for (bp.X = bpmin.X; bp.X <= bpmax.X; bp.X++)
+	for (bp.Y = bpmin.Y; bp.Y <= bpmax.Y; bp.Y++)
+	for (bp.Z = bpmin.Z; bp.Z <= bpmax.Z; bp.Z++) {
+		v3s16 origin = bp * MAP_BLOCKSIZE;
+		// Part of the block within the area, relative to the block
+		v3s16 rmin(MYMAX(minp.X - origin.X, 0), MYMAX(minp.Y - origin.Y, 0),
+			MYMAX(minp.Z - origin.Z, 0));
+		v3s16 rmax(MYMIN(maxp.X - origin.X, MAP_BLOCKSIZE - 1),
+			MYMIN(maxp.Y - origin.Y, MAP_BLOCKSIZE - 1),
+			MYMIN(maxp.Z - origin.Z, MAP_BLOCKSIZE - 1));
+		v3s16 rp;
+
+		MapBlock *block = map->getBlockNoCreateNoEx(bp);
+		if (!block || block->isDummy()) {
+			// Same as Map::getNode() for unloaded blocks
+			if (ignore_index < 0)
+				continue;
+			for (rp.Z = rmin.Z; rp.Z <= rmax.Z; rp.Z++)
+			for (rp.Y = rmin.Y; rp.Y <= rmax.Y; rp.Y++)
+			for (rp.X = rmin.X; rp.X <= rmax.X; rp.X++)
+				found(origin + rp, ignore_index);
+			continue;
+		}
+
+		const MapNode *data = block->getData();
+		if (block->hasContentIndex()) {
+			const BlockContentIndex &index = block->getContentIndex();
+			indices.clear();
+			for (content_t c : filter.getIds()) {
+				const std::vector<u16> *list = index.get(c);
+				if (list)
+					indices.insert(indices.end(), list->begin(), list->end());
+			}
+			std::sort(indices.begin(), indices.end());
+			for (u16 i : indices) {
+				rp = BlockContentIndex::indexToPos(i);
+				if (rp.X >= rmin.X && rp.Y >= rmin.Y && rp.Z >= rmin.Z &&
+						rp.X <= rmax.X && rp.Y <= rmax.Y && rp.Z <= rmax.Z)
+					found(origin + rp, filter.indexOf(data[i].getContent()));
+			}
+			continue;
+		}
+
+		for (rp.Z = rmin.Z; rp.Z <= rmax.Z; rp.Z++)
+		for (rp.Y = rmin.Y; rp.Y <= rmax.Y; rp.Y++) {
+			u32 i = rp.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + rp.Y * MAP_BLOCKSIZE + rmin.X;
+			for (rp.X = rmin.X; rp.X <= rmax.X; rp.X++, i++) {
+				int f = filter_index(data[i].getContent());
+				if (f >= 0)
+					found(origin + rp, f);
+			}
+		}
+	}
+}
+
+// find_nodes_in_area(minp, maxp, nodenames, [grouped])
 // nodenames: eg. {"ignore", "group:tree"} or "default:dirt"
 int ModApiEnvMod::l_find_nodes_in_area(lua_State *L)
 {
@@ -818,40 +922,44 @@ int ModApiEnvMod::l_find_nodes_in_area(lua_State *L)
 		return 0;
 	}
 
-	std::vector<content_t> filter;
-	if (lua_istable(L, 3)) {
-		lua_pushnil(L);
-		while (lua_next(L, 3) != 0) {
-			// key at index -2 and value at index -1
-			luaL_checktype(L, -1, LUA_TSTRING);
-			ndef->getIds(readParam<std::string>(L, -1), filter);
-			// removes value, keeps key for next iteration
-			lua_pop(L, 1);
+	std::shared_ptr<const ContentFilter> content_filter =
+		read_content_filter(L, 3, ndef);
+	const std::vector<content_t> &filter = content_filter->getIds();
+
+	bool grouped = lua_isboolean(L, 4) && readParam<bool>(L, 4);
+
+	Map *map = &env->getMap();
+
+	if (grouped) {
+		std::vector<std::vector<v3s16>> found(filter.size());
+		find_nodes_blockwise(map, minp, maxp, *content_filter,
+			[&found] (v3s16 p, int f) { found[f].push_back(p); });
+
+		lua_createtable(L, 0, filter.size());
+		for (u32 f = 0; f < filter.size(); f++) {
+			if (found[f].empty())
+				continue;
+			lua_createtable(L, found[f].size(), 0);
+			for (u32 i = 0; i < found[f].size(); i++) {
+				push_v3s16(L, found[f][i]);
+				lua_rawseti(L, -2, i + 1);
+			}
+			lua_setfield(L, -2, ndef->get(filter[f]).name.c_str());
 		}
-	} else if (lua_isstring(L, 3)) {
-		ndef->getIds(readParam<std::string>(L, 3), filter);
+		return 1;
 	}
 
-	std::vector<u32> individual_count;
-	individual_count.resize(filter.size());
+	std::vector<u32> individual_count(filter.size());
 
 	lua_newtable(L);
 	u64 i = 0;
-	for (s16 x = minp.X; x <= maxp.X; x++)
-	for (s16 y = minp.Y; y <= maxp.Y; y++)
-	for (s16 z = minp.Z; z <= maxp.Z; z++) {
-		v3s16 p(x, y, z);
-		content_t c = env->getMap().getNode(p).getContent();
-
-		std::vector<content_t>::iterator it = std::find(filter.begin(), filter.end(), c);
-		if (it != filter.end()) {
+	find_nodes_blockwise(map, minp, maxp, *content_filter,
+		[&] (v3s16 p, int f) {
 			push_v3s16(L, p);
 			lua_rawseti(L, -2, ++i);
+			individual_count[f]++;
+		});
 
-			u32 filt_index = it - filter.begin();
-			individual_count[filt_index]++;
-		}
-	}
 	lua_newtable(L);
 	for (u32 i = 0; i < filter.size(); i++) {
 		lua_pushnumber(L, individual_count[i]);
@@ -895,20 +1003,7 @@ int ModApiEnvMod::l_find_nodes_in_area_under_air(lua_State *L)
 		return 0;
 	}
 
-	std::vector<content_t> filter;
-
-	if (lua_istable(L, 3)) {
-		lua_pushnil(L);
-		while (lua_next(L, 3) != 0) {
-			// key at index -2 and value at index -1
-			luaL_checktype(L, -1, LUA_TSTRING);
-			ndef->getIds(readParam<std::string>(L, -1), filter);
-			// removes value, keeps key for next iteration
-			lua_pop(L, 1);
-		}
-	} else if (lua_isstring(L, 3)) {
-		ndef->getIds(readParam<std::string>(L, 3), filter);
-	}
+	std::shared_ptr<const ContentFilter> filter = read_content_filter(L, 3, ndef);
 
 	lua_newtable(L);
 	u64 i = 0;
@@ -921,7 +1016,7 @@ int ModApiEnvMod::l_find_nodes_in_area_under_air(lua_State *L)
 			v3s16 psurf(x, y + 1, z);
 			content_t csurf = env->getMap().getNode(psurf).getContent();
 			if (c != CONTENT_AIR && csurf == CONTENT_AIR &&
-					CONTAINS(filter, c)) {
+					filter->contains(c)) {
 				push_v3s16(L, v3s16(x, y, z));
 				lua_rawseti(L, -2, ++i);
 			}
@@ -1169,45 +1264,94 @@ int ModApiEnvMod::l_delete_area(lua_State *L)
 
 // find_path(pos1, pos2, searchdistance,
 //     max_jump, max_drop, algorithm) -> table containing path
-int ModApiEnvMod::l_find_path(lua_State *L)
+static PathRequest read_path_request(lua_State *L)
 {
-	GET_ENV_PTR;
-
-	v3s16 pos1                  = read_v3s16(L, 1);
-	v3s16 pos2                  = read_v3s16(L, 2);
-	unsigned int searchdistance = luaL_checkint(L, 3);
-	unsigned int max_jump       = luaL_checkint(L, 4);
-	unsigned int max_drop       = luaL_checkint(L, 5);
-	PathAlgorithm algo          = PA_PLAIN_NP;
+	PathRequest req;
+	req.source         = read_v3s16(L, 1);
+	req.destination    = read_v3s16(L, 2);
+	req.searchdistance = luaL_checkint(L, 3);
+	req.max_jump       = luaL_checkint(L, 4);
+	req.max_drop       = luaL_checkint(L, 5);
+	req.algo           = PA_PLAIN_NP;
 	if (!lua_isnil(L, 6)) {
 		std::string algorithm = luaL_checkstring(L,6);
 
 		if (algorithm == "A*")
-			algo = PA_PLAIN;
+			req.algo = PA_PLAIN;
 
 		if (algorithm == "Dijkstra")
-			algo = PA_DIJKSTRA;
+			req.algo = PA_DIJKSTRA;
 	}
+	return req;
+}
 
-	std::vector<v3s16> path = get_path(env, pos1, pos2,
-		searchdistance, max_jump, max_drop, algo);
+static void push_path(lua_State *L, const std::vector<v3s16> &path)
+{
+	lua_newtable(L);
+	int top = lua_gettop(L);
+	unsigned int index = 1;
+	for (const v3s16 &i : path) {
+		lua_pushnumber(L,index);
+		push_v3s16(L, i);
+		lua_settable(L, top);
+		index++;
+	}
+}
+
+int ModApiEnvMod::l_find_path(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	PathRequest req = read_path_request(L);
+
+	std::vector<v3s16> path = get_path(env, req.source, req.destination,
+		req.searchdistance, req.max_jump, req.max_drop, req.algo);
 
 	if (!path.empty()) {
-		lua_newtable(L);
-		int top = lua_gettop(L);
-		unsigned int index = 1;
-		for (const v3s16 &i : path) {
-			lua_pushnumber(L,index);
-			push_v3s16(L, i);
-			lua_settable(L, top);
-			index++;
-		}
+		push_path(L, path);
 		return 1;
 	}
 
 	return 0;
 }
 
+// find_path_async(pos1, pos2, searchdistance,
+//     max_jump, max_drop, algorithm) -> handle
+int ModApiEnvMod::l_find_path_async(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	PathRequest req = read_path_request(L);
+
+	// The map is only read here, the search runs on the pathfinder thread
+	std::shared_ptr<NavigationGrid> grid =
+		get_path_grid(env->getNavigationCache(), req);
+
+	lua_pushinteger(L, env->getAsyncPathfinder()->request(req, grid));
+	return 1;
+}
+
+// find_path_async_get(handle) -> completed, path or nil
+int ModApiEnvMod::l_find_path_async_get(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	u32 handle = luaL_checkinteger(L, 1);
+
+	std::vector<v3s16> path;
+	if (!env->getAsyncPathfinder()->getResult(handle, &path)) {
+		lua_pushboolean(L, false);
+		return 1;
+	}
+
+	lua_pushboolean(L, true);
+	if (path.empty())
+		lua_pushnil(L);
+	else
+		push_path(L, path);
+	return 2;
+}
+
 // spawn_tree(pos, treedef)
 int ModApiEnvMod::l_spawn_tree(lua_State *L)
 {
@@ -1321,6 +1465,7 @@ void ModApiEnvMod::Initialize(lua_State *L, int top)
 	API_FCT(get_node_timer);
 	API_FCT(get_player_by_name);
 	API_FCT(get_objects_inside_radius);
+	API_FCT(get_objects_in_area);
 	API_FCT(set_timeofday);
 	API_FCT(get_timeofday);
 	API_FCT(get_gametime);
@@ -1338,6 +1483,8 @@ void ModApiEnvMod::Initialize(lua_State *L, int top)
 	API_FCT(clear_objects);
 	API_FCT(spawn_tree);
 	API_FCT(find_path);
+	API_FCT(find_path_async);
+	API_FCT(find_path_async_get);
 	API_FCT(line_of_sight);
 	API_FCT(raycast);
 	API_FCT(transforming_liquid_add);
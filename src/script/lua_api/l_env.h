@@ -107,6 +107,13 @@ class ModApiEnvMod : public ModApiBase {
 	// get_objects_inside_radius(pos, radius)
 	static int l_get_objects_inside_radius(lua_State *L);
 
+	// get_objects_in_area(minp, maxp)
+	static int l_get_objects_in_area(lua_State *L);
+
+	// Pushes a list of ObjectRefs for the objects that are not gone
+	static void pushObjectList(lua_State *L, ScriptApiBase *script,
+			ServerEnvironment *env, const std::vector<u16> &ids);
+
 	// set_timeofday(val)
 	// val = 0...1
 	static int l_set_timeofday(lua_State *L);
@@ -124,7 +131,7 @@ class ModApiEnvMod : public ModApiBase {
 	// nodenames: eg. {"ignore", "group:tree"} or "default:dirt"
 	static int l_find_node_near(lua_State *L);
 
-	// find_nodes_in_area(minp, maxp, nodenames) -> list of positions
+	// find_nodes_in_area(minp, maxp, nodenames, [grouped])
 	// nodenames: eg. {"ignore", "group:tree"} or "default:dirt"
 	static int l_find_nodes_in_area(lua_State *L);
 
@@ -173,6 +180,13 @@ class ModApiEnvMod : public ModApiBase {
 	//     max_jump, max_drop, algorithm) -> table containing path
 	static int l_find_path(lua_State *L);
 
+	// find_path_async(pos1, pos2, searchdistance,
+	//     max_jump, max_drop, algorithm) -> handle
+	static int l_find_path_async(lua_State *L);
+
+	// find_path_async_get(handle) -> completed, path or nil
+	static int l_find_path_async_get(lua_State *L);
+
 	// transforming_liquid_add(pos)
 	static int l_transforming_liquid_add(lua_State *L);
 
@@ -148,4 +148,5 @@ class ModApiItemMod : public ModApiBase {
 	static int l_get_name_from_content_id(lua_State *L);
 public:
 	static void Initialize(lua_State *L, int top);
+	static void InitializeEmerge(lua_State *L, int top);
 };
@@ -1831,6 +1831,27 @@ int ModApiMapgen::l_read_schematic(lua_State *L)
 	return 1;
 }
 
+// register_mapgen_script(path)
+int ModApiMapgen::l_register_mapgen_script(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	std::string path = luaL_checkstring(L, 1);
+	CHECK_SECURE_PATH(L, path.c_str(), false);
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, CUSTOM_RIDX_CURRENT_MOD_NAME);
+	if (!lua_isstring(L, -1))
+		throw LuaError("register_mapgen_script: no mod is being loaded");
+	std::string mod_name = readParam<std::string>(L, -1);
+	lua_pop(L, 1);
+
+	EmergeManager *emerge = getServer(L)->getEmergeManager();
+	if (!emerge->addMapgenScript(mod_name, path))
+		throw LuaError("register_mapgen_script: only allowed at load time");
+
+	return 0;
+}
+
 
 void ModApiMapgen::Initialize(lua_State *L, int top)
 {
@@ -1871,4 +1892,24 @@ void ModApiMapgen::Initialize(lua_State *L, int top)
 	API_FCT(place_schematic_on_vmanip);
 	API_FCT(serialize_schematic);
 	API_FCT(read_schematic);
+	API_FCT(register_mapgen_script);
+}
+
+void ModApiMapgen::InitializeEmerge(lua_State *L, int top)
+{
+	API_FCT(get_biome_id);
+	API_FCT(get_biome_name);
+	API_FCT(get_heat);
+	API_FCT(get_humidity);
+	API_FCT(get_biome_data);
+	API_FCT(get_mapgen_object);
+
+	API_FCT(get_mapgen_setting);
+	API_FCT(get_mapgen_setting_noiseparams);
+	API_FCT(get_noiseparams);
+	API_FCT(get_gen_notify);
+	API_FCT(get_decoration_id);
+
+	API_FCT(generate_ores);
+	API_FCT(generate_decorations);
 }
@@ -134,8 +134,13 @@ class ModApiMapgen : public ModApiBase
 	// read_schematic(schematic, options={...})
 	static int l_read_schematic(lua_State *L);
 
+	// register_mapgen_script(path)
+	static int l_register_mapgen_script(lua_State *L);
+
 public:
 	static void Initialize(lua_State *L, int top);
+	// Functions of the Lua environments of the emerge threads
+	static void InitializeEmerge(lua_State *L, int top);
 
 	static struct EnumString es_BiomeTerrainType[];
 	static struct EnumString es_DecorationType[];
@@ -43,6 +43,10 @@ int LuaVoxelManip::l_read_from_map(lua_State *L)
 {
 	MAP_LOCK_REQUIRED;
 
+	// The map is not locked in the emerge threads
+	if (!getEnv(L))
+		return 0;
+
 	LuaVoxelManip *o = checkobject(L, 1);
 	MMVManip *vm = o->vm;
 
@@ -373,6 +377,29 @@ int LuaVoxelManip::l_get_emerged_area(lua_State *L)
 	return 2;
 }
 
+// get_buffer(self, [field]) -> VoxelBuffer
+// field: "content" (default), "param1" or "param2"
+int LuaVoxelManip::l_get_buffer(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelManip *o = checkobject(L, 1);
+
+	LuaVoxelBuffer::Field field = LuaVoxelBuffer::FIELD_CONTENT;
+	if (!lua_isnoneornil(L, 2)) {
+		std::string name = luaL_checkstring(L, 2);
+		if (name == "param1")
+			field = LuaVoxelBuffer::FIELD_PARAM1;
+		else if (name == "param2")
+			field = LuaVoxelBuffer::FIELD_PARAM2;
+		else if (name != "content")
+			throw LuaError("VoxelManip:get_buffer: unknown field " + name);
+	}
+
+	LuaVoxelBuffer::create(L, 1, o->vm, field);
+	return 1;
+}
+
 LuaVoxelManip::LuaVoxelManip(MMVManip *mmvm, bool is_mg_vm) :
 	is_mapgen_vm(is_mg_vm),
 	vm(mmvm)
@@ -475,5 +502,271 @@ const luaL_Reg LuaVoxelManip::methods[] = {
 	luamethod(LuaVoxelManip, set_param2_data),
 	luamethod(LuaVoxelManip, was_modified),
 	luamethod(LuaVoxelManip, get_emerged_area),
+	luamethod(LuaVoxelManip, get_buffer),
+	{0,0}
+};
+
+/*
+  LuaVoxelBuffer
+ */
+
+LuaVoxelBuffer::LuaVoxelBuffer(int vm_ref, MMVManip *vm, Field field) :
+	m_vm_ref(vm_ref),
+	m_vm(vm),
+	m_field(field)
+{
+}
+
+// garbage collector
+int LuaVoxelBuffer::gc_object(lua_State *L)
+{
+	LuaVoxelBuffer *o = *(LuaVoxelBuffer **)(lua_touserdata(L, 1));
+	luaL_unref(L, LUA_REGISTRYINDEX, o->m_vm_ref);
+	delete o;
+
+	return 0;
+}
+
+u32 LuaVoxelBuffer::checkIndex(lua_State *L, int narg) const
+{
+	// The VoxelManip can be re-read in between, so check every time
+	lua_Integer i = luaL_checkinteger(L, narg);
+	if (i < 1 || i > m_vm->m_area.getVolume())
+		luaL_argerror(L, narg, "index out of range");
+	return i - 1;
+}
+
+u16 LuaVoxelBuffer::get(u32 i) const
+{
+	const MapNode &n = m_vm->m_data[i];
+	switch (m_field) {
+	case FIELD_CONTENT:
+		return n.getContent();
+	case FIELD_PARAM1:
+		return n.param1;
+	default:
+		return n.param2;
+	}
+}
+
+void LuaVoxelBuffer::set(u32 i, u16 value)
+{
+	MapNode &n = m_vm->m_data[i];
+	switch (m_field) {
+	case FIELD_CONTENT:
+		n.setContent(value);
+		break;
+	case FIELD_PARAM1:
+		n.param1 = value;
+		break;
+	default:
+		n.param2 = value;
+		break;
+	}
+}
+
+template <typename F>
+void LuaVoxelBuffer::forEach(lua_State *L, int narg, F &&func)
+{
+	const VoxelArea &area = m_vm->m_area;
+	if (lua_isnoneornil(L, narg)) {
+		u32 volume = area.getVolume();
+		for (u32 i = 0; i != volume; i++)
+			func(i);
+		return;
+	}
+
+	v3s16 pmin = check_v3s16(L, narg);
+	v3s16 pmax = check_v3s16(L, narg + 1);
+	sortBoxVerticies(pmin, pmax);
+	pmin.X = MYMAX(pmin.X, area.MinEdge.X);
+	pmin.Y = MYMAX(pmin.Y, area.MinEdge.Y);
+	pmin.Z = MYMAX(pmin.Z, area.MinEdge.Z);
+	pmax.X = MYMIN(pmax.X, area.MaxEdge.X);
+	pmax.Y = MYMIN(pmax.Y, area.MaxEdge.Y);
+	pmax.Z = MYMIN(pmax.Z, area.MaxEdge.Z);
+
+	for (s16 z = pmin.Z; z <= pmax.Z; z++)
+	for (s16 y = pmin.Y; y <= pmax.Y; y++) {
+		u32 i = area.index(pmin.X, y, z);
+		for (s16 x = pmin.X; x <= pmax.X; x++, i++)
+			func(i);
+	}
+}
+
+// __index(self, key): buffer[i] or a method
+int LuaVoxelBuffer::l_index(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	if (lua_type(L, 2) == LUA_TNUMBER) {
+		LuaVoxelBuffer *o = checkobject(L, 1);
+		lua_pushinteger(L, o->get(o->checkIndex(L, 2)));
+		return 1;
+	}
+
+	lua_pushvalue(L, 2);
+	lua_rawget(L, lua_upvalueindex(1));
+	return 1;
+}
+
+// __newindex(self, i, value): buffer[i] = value
+int LuaVoxelBuffer::l_newindex(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+	o->set(o->checkIndex(L, 2), luaL_checkinteger(L, 3));
+	return 0;
+}
+
+// get(self, i) -> value
+int LuaVoxelBuffer::l_get(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+	lua_pushinteger(L, o->get(o->checkIndex(L, 2)));
+	return 1;
+}
+
+// set(self, i, value)
+int LuaVoxelBuffer::l_set(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+	o->set(o->checkIndex(L, 2), luaL_checkinteger(L, 3));
+	return 0;
+}
+
+// size(self) -> number of nodes
+int LuaVoxelBuffer::l_size(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+	lua_pushinteger(L, o->m_vm->m_area.getVolume());
+	return 1;
+}
+
+// fill(self, value, [pmin, pmax])
+int LuaVoxelBuffer::l_fill(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+	u16 value = luaL_checkinteger(L, 2);
+
+	o->forEach(L, 3, [o, value] (u32 i) { o->set(i, value); });
+	return 0;
+}
+
+// replace(self, from, to, [pmin, pmax]) -> number of replaced nodes
+int LuaVoxelBuffer::l_replace(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+	u16 from = luaL_checkinteger(L, 2);
+	u16 to = luaL_checkinteger(L, 3);
+
+	u32 count = 0;
+	o->forEach(L, 4, [o, from, to, &count] (u32 i) {
+		if (o->get(i) == from) {
+			o->set(i, to);
+			count++;
+		}
+	});
+
+	lua_pushinteger(L, count);
+	return 1;
+}
+
+// count(self, value, [pmin, pmax]) -> number of nodes
+int LuaVoxelBuffer::l_count(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	LuaVoxelBuffer *o = checkobject(L, 1);
+	u16 value = luaL_checkinteger(L, 2);
+
+	u32 count = 0;
+	o->forEach(L, 3, [o, value, &count] (u32 i) {
+		count += o->get(i) == value;
+	});
+
+	lua_pushinteger(L, count);
+	return 1;
+}
+
+void LuaVoxelBuffer::create(lua_State *L, int vm_index, MMVManip *vm,
+	Field field)
+{
+	lua_pushvalue(L, vm_index);
+	int vm_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	LuaVoxelBuffer *o = new LuaVoxelBuffer(vm_ref, vm, field);
+	*(void **)(lua_newuserdata(L, sizeof(void *))) = o;
+	luaL_getmetatable(L, className);
+	lua_setmetatable(L, -2);
+}
+
+LuaVoxelBuffer *LuaVoxelBuffer::checkobject(lua_State *L, int narg)
+{
+	NO_MAP_LOCK_REQUIRED;
+
+	luaL_checktype(L, narg, LUA_TUSERDATA);
+
+	void *ud = luaL_checkudata(L, narg, className);
+	if (!ud)
+		luaL_typerror(L, narg, className);
+
+	return *(LuaVoxelBuffer **)ud;  // unbox pointer
+}
+
+void LuaVoxelBuffer::Register(lua_State *L)
+{
+	lua_newtable(L);
+	int methodtable = lua_gettop(L);
+	luaL_newmetatable(L, className);
+	int metatable = lua_gettop(L);
+
+	lua_pushliteral(L, "__metatable");
+	lua_pushvalue(L, methodtable);
+	lua_settable(L, metatable);  // hide metatable from Lua getmetatable()
+
+	// Indices are looked up before the methods
+	lua_pushliteral(L, "__index");
+	lua_pushvalue(L, methodtable);
+	lua_pushcclosure(L, l_index, 1);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__newindex");
+	lua_pushcfunction(L, l_newindex);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__len");
+	lua_pushcfunction(L, l_size);
+	lua_settable(L, metatable);
+
+	lua_pushliteral(L, "__gc");
+	lua_pushcfunction(L, gc_object);
+	lua_settable(L, metatable);
+
+	lua_pop(L, 1);  // drop metatable
+
+	luaL_openlib(L, 0, methods, 0);  // fill methodtable
+	lua_pop(L, 1);  // drop methodtable
+}
+
+const char LuaVoxelBuffer::className[] = "VoxelBuffer";
+const luaL_Reg LuaVoxelBuffer::methods[] = {
+	luamethod(LuaVoxelBuffer, get),
+	luamethod(LuaVoxelBuffer, set),
+	luamethod(LuaVoxelBuffer, size),
+	luamethod(LuaVoxelBuffer, fill),
+	luamethod(LuaVoxelBuffer, replace),
+	luamethod(LuaVoxelBuffer, count),
 	{0,0}
 };
@@ -63,6 +63,8 @@ class LuaVoxelManip : public ModApiBase
 	static int l_was_modified(lua_State *L);
 	static int l_get_emerged_area(lua_State *L);
 
+	static int l_get_buffer(lua_State *L);
+
 public:
 	MMVManip *vm = nullptr;
 
@@ -79,3 +81,62 @@ class LuaVoxelManip : public ModApiBase
 
 	static void Register(lua_State *L);
 };
+
+/*
+  VoxelBuffer
+
+  One field of the node data of a VoxelManip, read and written in place.
+  Indices are the same as those of the VoxelManip:get_*data() tables.
+ */
+class LuaVoxelBuffer : public ModApiBase
+{
+public:
+	enum Field {
+		FIELD_CONTENT,
+		FIELD_PARAM1,
+		FIELD_PARAM2,
+	};
+
+private:
+	// Registry reference that keeps the VoxelManip alive
+	int m_vm_ref;
+	MMVManip *m_vm;
+	Field m_field;
+
+	static const char className[];
+	static const luaL_Reg methods[];
+
+	static int gc_object(lua_State *L);
+
+	static int l_index(lua_State *L);
+	static int l_newindex(lua_State *L);
+
+	static int l_get(lua_State *L);
+	static int l_set(lua_State *L);
+	static int l_size(lua_State *L);
+
+	static int l_fill(lua_State *L);
+	static int l_replace(lua_State *L);
+	static int l_count(lua_State *L);
+
+	u32 checkIndex(lua_State *L, int narg) const;
+	u16 get(u32 i) const;
+	void set(u32 i, u16 value);
+
+	// Calls func(i) for each index of the VoxelManip, or of the area given
+	// at narg and narg + 1
+	template <typename F>
+	void forEach(lua_State *L, int narg, F &&func);
+
+public:
+	LuaVoxelBuffer(int vm_ref, MMVManip *vm, Field field);
+	~LuaVoxelBuffer() = default;
+
+	// Creates a LuaVoxelBuffer of the VoxelManip at vm_index and leaves
+	// it on top of stack
+	static void create(lua_State *L, int vm_index, MMVManip *vm, Field field);
+
+	static LuaVoxelBuffer *checkobject(lua_State *L, int narg);
+
+	static void Register(lua_State *L);
+};
@@ -0,0 +1,53 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+#include "cpp_api/s_base.h"
+#include "cpp_api/s_security.h"
+#include "irr_v3d.h"
+
+/*****************************************************************************/
+/* Scripting <-> Emerge Thread Interface                                     */
+/*****************************************************************************/
+
+/*
+	Lua environment of one emerge thread, for the scripts mods register with
+	core.register_mapgen_script().
+
+	The scripts run while the environment is not locked, so they only get
+	what is safe to use from any emerge thread: the mapgen objects of the
+	thread, node ids, noise, biome data and settings. There is no access
+	to the map or to the server environment.
+*/
+class EmergeScripting:
+		virtual public ScriptApiBase,
+		public ScriptApiSecurity
+{
+public:
+	EmergeScripting(Server *server);
+
+	// use ScriptApiBase::loadMod() to load the builtin and the mod scripts
+
+	// Runs the on_generated callbacks of this environment on the mapgen
+	// objects of the current thread
+	void on_generated(v3s16 minp, v3s16 maxp, u32 blockseed);
+
+private:
+	void InitializeModApi(lua_State *L, int top);
+};
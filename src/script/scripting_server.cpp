@@ -98,6 +98,7 @@ void ServerScripting::InitializeModApi(lua_State *L, int top)
 	LuaRaycast::Register(L);
 	LuaSecureRandom::Register(L);
 	LuaVoxelManip::Register(L);
+	LuaVoxelBuffer::Register(L);
 	NodeMetaRef::Register(L);
 	NodeTimerRef::Register(L);
 	ObjectRef::Register(L);
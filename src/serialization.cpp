@@ -22,6 +22,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/serialize.h"
 
 #include "zlib.h"
+#if USE_ZSTD
+#include <memory>
+#include <zstd.h>
+#endif
 
 /* report a zlib or i/o error */
 void zerr(int ret)
@@ -183,27 +187,96 @@ void decompressZlib(std::istream &is, std::ostream &os)
 	inflateEnd(&z);
 }
 
-void compress(const SharedBuffer<u8> &data, std::ostream &os, u8 version)
+#if USE_ZSTD
+void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level)
+{
+	std::string output(ZSTD_compressBound(data_size), '\0');
+	size_t ret = ZSTD_compress(&output[0], output.size(), data, data_size, level);
+	if (ZSTD_isError(ret)) {
+		throw SerializationError(std::string("compressZstd: ") +
+			ZSTD_getErrorName(ret));
+	}
+	os.write(output.c_str(), ret);
+}
+
+void compressZstd(const std::string &data, std::ostream &os, int level)
+{
+	compressZstd((const u8 *)data.c_str(), data.size(), os, level);
+}
+
+void decompressZstd(std::istream &is, std::ostream &os)
+{
+	std::unique_ptr<ZSTD_DStream, size_t (*)(ZSTD_DStream *)> stream(
+		ZSTD_createDStream(), ZSTD_freeDStream);
+	if (!stream)
+		throw SerializationError("decompressZstd: ZSTD_createDStream failed");
+	ZSTD_initDStream(stream.get());
+
+	const size_t bufsize = 16384;
+	char input_buffer[bufsize];
+	char output_buffer[bufsize];
+	ZSTD_inBuffer input = {input_buffer, 0, 0};
+
+	// Decompress a single frame, which may be followed by other data
+	for (;;) {
+		if (input.pos == input.size) {
+			is.read(input_buffer, bufsize);
+			input.size = is.gcount();
+			input.pos = 0;
+		}
+
+		ZSTD_outBuffer output = {output_buffer, bufsize, 0};
+		size_t ret = ZSTD_decompressStream(stream.get(), &output, &input);
+		if (ZSTD_isError(ret)) {
+			throw SerializationError(std::string("decompressZstd: ") +
+				ZSTD_getErrorName(ret));
+		}
+		if (output.pos)
+			os.write(output_buffer, output.pos);
+		if (ret == 0)
+			break;
+		if (input.size == 0 && output.pos == 0)
+			throw SerializationError("decompressZstd: stream ended halfway");
+	}
+
+	// Unget all the data that belongs to whatever follows
+	is.clear(); // Just in case EOF is set
+	for (size_t i = input.pos; i < input.size; i++) {
+		is.unget();
+		if (is.fail() || is.bad())
+			throw SerializationError("decompressZstd: unget failed");
+	}
+}
+#endif
+
+void compress(const u8 *data, u32 size, std::ostream &os, u8 version)
 {
+#if USE_ZSTD
+	if (version >= SER_FMT_VER_ZSTD) {
+		compressZstd(data, size, os);
+		return;
+	}
+#endif
+
 	if(version >= 11)
 	{
-		compressZlib(*data ,data.getSize(), os);
+		compressZlib(data, size, os);
 		return;
 	}
 
-	if(data.getSize() == 0)
+	if(size == 0)
 		return;
 
 	// Write length (u32)
 
 	u8 tmp[4];
-	writeU32(tmp, data.getSize());
+	writeU32(tmp, size);
 	os.write((char*)tmp, 4);
 
 	// We will be writing 8-bit pairs of more_count and byte
 	u8 more_count = 0;
 	u8 current_byte = data[0];
-	for(u32 i=1; i<data.getSize(); i++)
+	for(u32 i=1; i<size; i++)
 	{
 		if(
 			data[i] != current_byte
@@ -226,8 +299,25 @@ void compress(const SharedBuffer<u8> &data, std::ostream &os, u8 version)
 	os.write((char*)&current_byte, 1);
 }
 
+void compress(const SharedBuffer<u8> &data, std::ostream &os, u8 version)
+{
+	compress(*data, data.getSize(), os, version);
+}
+
+void compress(const std::string &data, std::ostream &os, u8 version)
+{
+	compress((const u8 *)data.c_str(), data.size(), os, version);
+}
+
 void decompress(std::istream &is, std::ostream &os, u8 version)
 {
+#if USE_ZSTD
+	if (version >= SER_FMT_VER_ZSTD) {
+		decompressZstd(is, os);
+		return;
+	}
+#endif
+
 	if(version >= 11)
 	{
 		decompressZlib(is, os);
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "irrlichttypes.h"
+#include "config.h"
 #include "exceptions.h"
 #include <iostream>
 #include "util/pointer.h"
@@ -63,11 +64,19 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 	26: Never written; read the same as 25
 	27: Added light spreading flags to blocks
 	28: Added "private" flag to NodeMetadata
+	29: Node data and metadata compressed with zstd instead of zlib
+	    (only supported when built with zstd)
 */
 // This represents an uninitialized or invalid format
 #define SER_FMT_VER_INVALID 255
+// First version using zstd compression
+#define SER_FMT_VER_ZSTD 29
 // Highest supported serialization version
+#if USE_ZSTD
+#define SER_FMT_VER_HIGHEST_READ 29
+#else
 #define SER_FMT_VER_HIGHEST_READ 28
+#endif
 // Saved on disk version
 #define SER_FMT_VER_HIGHEST_WRITE 28
 // Lowest supported serialization version
@@ -89,7 +98,15 @@ void compressZlib(const u8 *data, size_t data_size, std::ostream &os, int level
 void compressZlib(const std::string &data, std::ostream &os, int level = -1);
 void decompressZlib(std::istream &is, std::ostream &os);
 
-// These choose between zlib and a self-made one according to version
+#if USE_ZSTD
+// level 0 selects the zstd default
+void compressZstd(const u8 *data, size_t data_size, std::ostream &os, int level = 0);
+void compressZstd(const std::string &data, std::ostream &os, int level = 0);
+void decompressZstd(std::istream &is, std::ostream &os);
+#endif
+
+// These choose between zstd, zlib and a self-made one according to version
+void compress(const u8 *data, u32 size, std::ostream &os, u8 version);
 void compress(const SharedBuffer<u8> &data, std::ostream &os, u8 version);
-//void compress(const std::string &data, std::ostream &os, u8 version);
+void compress(const std::string &data, std::ostream &os, u8 version);
 void decompress(std::istream &is, std::ostream &os, u8 version);
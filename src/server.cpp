@@ -18,6 +18,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include "server.h"
+#include <fstream>
 #include <iostream>
 #include <queue>
 #include <algorithm>
@@ -54,10 +55,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "serverlist.h"
 #include "util/string.h"
 #include "rollback.h"
+#include "pathfinder.h"
 #include "util/serialize.h"
 #include "util/thread.h"
 #include "defaultsettings.h"
 #include "server/mods.h"
+#include "server/block_send_pool.h"
 #include "util/base64.h"
 #include "util/sha1.h"
 #include "util/hex.h"
@@ -231,6 +234,7 @@ Server::Server(
 	m_thread(new ServerThread(this)),
 	m_uptime(0),
 	m_clients(m_con),
+	m_block_send_cache((size_t)g_settings->getU32("block_send_cache_size") * 1024 * 1024),
 	m_admin_chat(iface),
 	m_modchannel_mgr(new ModChannelMgr())
 {
@@ -297,6 +301,20 @@ Server::~Server()
 		delete m_thread;
 	}
 
+	if (g_profiler->isTracing()) {
+		g_profiler->stopTrace();
+		const std::string trace_file = g_settings->get("profiler_trace_file");
+		std::ofstream os(trace_file.c_str(), std::ios::binary);
+		if (os.good()) {
+			g_profiler->writeTrace(os);
+			actionstream << "Server: Profiler trace written to "
+				<< trace_file << std::endl;
+		} else {
+			errorstream << "Server: Failed to write profiler trace to "
+				<< trace_file << std::endl;
+		}
+	}
+
 	// Delete things in the reverse order of creation
 	delete m_emerge;
 	delete m_env;
@@ -401,7 +419,9 @@ void Server::init()
 
 	if (g_settings->getBool("enable_rollback_recording")) {
 		// Create rollback manager
-		m_rollback = new RollbackManager(m_path_world, this);
+		m_rollback = new RollbackManager(m_path_world, this,
+			g_settings->getU32("rollback_partition_days"),
+			g_settings->getU32("rollback_retention_days"));
 	}
 
 	// Give environment reference to scripting api
@@ -416,6 +436,12 @@ void Server::init()
 	m_max_chatmessage_length = g_settings->getU16("chat_message_max_size");
 	m_csm_restriction_flags = g_settings->getU64("csm_restriction_flags");
 	m_csm_restriction_noderange = g_settings->getU32("csm_restriction_noderange");
+
+	u16 block_send_threads = g_settings->getU16("block_send_threads");
+	if (block_send_threads > 0) {
+		m_block_send_pool = std::unique_ptr<BlockSendPool>(new BlockSendPool(
+				this, &m_block_send_cache, block_send_threads));
+	}
 }
 
 void Server::start()
@@ -430,7 +456,13 @@ void Server::start()
 	m_con->SetTimeoutMs(30);
 	m_con->Serve(m_bind_addr);
 
-	// Start thread
+	// Trace the whole run, written when the server shuts down
+	if (!g_settings->get("profiler_trace_file").empty())
+		g_profiler->startTrace();
+
+	// Start threads
+	if (m_block_send_pool)
+		m_block_send_pool->start();
 	m_thread->start();
 
 	// ASCII art for the win!
@@ -457,6 +489,9 @@ void Server::stop()
 	m_thread->wait();
 	//m_emergethread.stop();
 
+	if (m_block_send_pool)
+		m_block_send_pool->stop();
+
 	infostream<<"Server: Threads stopped"<<std::endl;
 }
 
@@ -498,7 +533,7 @@ void Server::AsyncRunStep(bool initial_step)
 	if((dtime < 0.001) && !initial_step)
 		return;
 
-	ScopeProfiler sp(g_profiler, "Server::AsyncRunStep()", SPT_AVG);
+	ScopeProfiler sp(g_profiler, SCOPE_PROFILER_KEY("Server::AsyncRunStep()"), SPT_AVG);
 
 	{
 		MutexAutoLock lock1(m_step_dtime_mutex);
@@ -552,10 +587,35 @@ void Server::AsyncRunStep(bool initial_step)
 	{
 		MutexAutoLock lock(m_env_mutex);
 		// Run Map's timers and unload unused data
-		ScopeProfiler sp(g_profiler, "Server: map timer and unload");
+		ScopeProfiler sp(g_profiler, SCOPE_PROFILER_KEY("Server: map timer and unload"));
+		// Unload the least recently used blocks above the memory limit,
+		// never the active ones, which would lose their node timers
+		const BlockPosSet &active_blocks = m_env->getActiveBlocks();
+		u32 max_loaded_blocks = U32_MAX;
+		u64 memory_limit = g_settings->getU64("map_block_memory_limit");
+		if (memory_limit > 0) {
+			max_loaded_blocks = MYMIN(memory_limit * 1024 * 1024 /
+				MapBlock::getPooledSize(), (u64)U32_MAX);
+			// With room for the blocks around them that are sent to clients
+			u64 min_blocks = (u64)active_blocks.size() * 5 / 4 + 64;
+			if (max_loaded_blocks < min_blocks)
+				max_loaded_blocks = MYMIN(min_blocks, (u64)U32_MAX);
+		}
+		std::vector<v3s16> unloaded_blocks;
 		m_env->getMap().timerUpdate(map_timer_and_unload_dtime,
 			g_settings->getFloat("server_unload_unused_data_timeout"),
-			U32_MAX);
+			max_loaded_blocks, &unloaded_blocks, &active_blocks);
+		m_env->getNavigationCache()->onBlocksUnloaded(unloaded_blocks);
+
+		FixedSizePool::Stats blocks, nodes;
+		MapBlock::getPoolStats(blocks, nodes);
+		// Shared with the client in singleplayer
+		g_profiler->avg(PROFILER_KEY("MapBlock pools: blocks in use [#]"),
+			blocks.objects_used);
+		g_profiler->avg(PROFILER_KEY("MapBlock pools: node data free [#]"),
+			nodes.objects_free);
+		g_profiler->avg(PROFILER_KEY("MapBlock pools: reserved [MB]"),
+			(blocks.reserved_bytes + nodes.reserved_bytes) / (1024.0f * 1024.0f));
 	}
 
 	/*
@@ -586,10 +646,11 @@ void Server::AsyncRunStep(bool initial_step)
 
 		MutexAutoLock lock(m_env_mutex);
 
-		ScopeProfiler sp(g_profiler, "Server: liquid transform");
+		ScopeProfiler sp(g_profiler, SCOPE_PROFILER_KEY("Server: liquid transform"));
 
 		std::map<v3s16, MapBlock*> modified_blocks;
-		m_env->getMap().transformLiquids(modified_blocks, m_env);
+		m_env->getMap().transformLiquids(modified_blocks, m_env,
+			m_env->getLiquidPool());
 
 		/*
 			Set the modified blocks unsent for all the clients
@@ -633,7 +694,8 @@ void Server::AsyncRunStep(bool initial_step)
 
 		m_clients.lock();
 		const RemoteClientMap &clients = m_clients.getClientList();
-		ScopeProfiler sp(g_profiler, "Server: update objects within range");
+		ScopeProfiler sp(g_profiler,
+			SCOPE_PROFILER_KEY("Server: update objects within range"));
 
 		for (const auto &client_it : clients) {
 			RemoteClient *client = client_it.second;
@@ -672,7 +734,7 @@ void Server::AsyncRunStep(bool initial_step)
 	*/
 	{
 		MutexAutoLock envlock(m_env_mutex);
-		ScopeProfiler sp(g_profiler, "Server: send SAO messages");
+		ScopeProfiler sp(g_profiler, SCOPE_PROFILER_KEY("Server: send SAO messages"));
 
 		// Key = object id
 		// Value = data sent by object
@@ -896,7 +958,7 @@ void Server::AsyncRunStep(bool initial_step)
 			counter = 0.0;
 			MutexAutoLock lock(m_env_mutex);
 
-			ScopeProfiler sp(g_profiler, "Server: map saving (sum)");
+			ScopeProfiler sp(g_profiler, SCOPE_PROFILER_KEY("Server: map saving (sum)"));
 
 			// Save ban file
 			if (m_banmanager->isModified()) {
@@ -1049,7 +1111,8 @@ void Server::ProcessData(NetworkPacket *pkt)
 	// Environment is locked first.
 	MutexAutoLock envlock(m_env_mutex);
 
-	ScopeProfiler sp(g_profiler, "Server: Process network packet (sum)");
+	ScopeProfiler sp(g_profiler,
+		SCOPE_PROFILER_KEY("Server: Process network packet (sum)"));
 	u32 peer_id = pkt->getPeerId();
 
 	try {
@@ -2175,9 +2238,10 @@ void Server::sendRemoveNode(v3s16 p, std::unordered_set<u16> *far_players,
 		RemotePlayer *player = m_env->getPlayer(client_id);
 		PlayerSAO *sao = player ? player->getPlayerSAO() : nullptr;
 
-		// If player is far away, only set modified blocks not sent
-		if (!client->isBlockSent(block_pos) || (sao &&
-				sao->getBasePosition().getDistanceFrom(p_f) > maxd)) {
+		// If player is far away or the block is still on its way to them,
+		// only set modified blocks not sent
+		if (!client->isBlockSent(block_pos) || isBlockSending(block_pos, client_id) ||
+				(sao && sao->getBasePosition().getDistanceFrom(p_f) > maxd)) {
 			if (far_players)
 				far_players->emplace(client_id);
 			else
@@ -2214,9 +2278,10 @@ void Server::sendAddNode(v3s16 p, MapNode n, std::unordered_set<u16> *far_player
 		RemotePlayer *player = m_env->getPlayer(client_id);
 		PlayerSAO *sao = player ? player->getPlayerSAO() : nullptr;
 
-		// If player is far away, only set modified blocks not sent
-		if (!client->isBlockSent(block_pos) || (sao &&
-				sao->getBasePosition().getDistanceFrom(p_f) > maxd)) {
+		// If player is far away or the block is still on its way to them,
+		// only set modified blocks not sent
+		if (!client->isBlockSent(block_pos) || isBlockSending(block_pos, client_id) ||
+				(sao && sao->getBasePosition().getDistanceFrom(p_f) > maxd)) {
 			if (far_players)
 				far_players->emplace(client_id);
 			else
@@ -2254,8 +2319,8 @@ void Server::sendMetadataChanged(const std::list<v3s16> &meta_updates, float far
 				continue;
 
 			v3s16 block_pos = getNodeBlockPos(pos);
-			if (!client->isBlockSent(block_pos) || (player &&
-					player_pos.getDistanceFrom(intToFloat(pos, BS)) > maxd)) {
+			if (!client->isBlockSent(block_pos) || isBlockSending(block_pos, i) ||
+					(player && player_pos.getDistanceFrom(intToFloat(pos, BS)) > maxd)) {
 				client->SetBlockNotSent(block_pos);
 				continue;
 			}
@@ -2286,18 +2351,38 @@ void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
 		u16 net_proto_version)
 {
 	/*
-		Create a packet with the block in the right format
+		Create a packet with the block in the right format.
+		Apart from the serialization version the data is the same for every
+		client, so it is only serialized and compressed once per block change.
 	*/
+	const v3s16 blockpos = block->getPos();
+	const u64 content_version = block->getContentVersion();
 
-	std::ostringstream os(std::ios_base::binary);
-	block->serialize(os, ver, false);
-	block->serializeNetworkSpecific(os);
-	std::string s = os.str();
+	SerializedBlockCache::Data s = m_block_send_cache.get(blockpos, ver,
+			content_version);
+	if (!s) {
+		std::ostringstream os(std::ios_base::binary);
+		block->serialize(os, ver, false);
+		block->serializeNetworkSpecific(os);
+		s = m_block_send_cache.set(blockpos, ver, content_version, os.str());
+	}
 
-	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + 2 + s.size(), peer_id);
+	SendBlockData(peer_id, blockpos, *s);
+}
 
-	pkt << block->getPos();
-	pkt.putRawString(s.c_str(), s.size());
+bool Server::isBlockSending(v3s16 blockpos, session_t peer_id)
+{
+	// The snapshot on its way would overwrite changes sent on their own
+	return m_block_send_pool && m_block_send_pool->isSending(blockpos, peer_id);
+}
+
+void Server::SendBlockData(session_t peer_id, v3s16 blockpos,
+		const std::string &data)
+{
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + 2 + data.size(), peer_id);
+
+	pkt << blockpos;
+	pkt.putRawString(data.c_str(), data.size());
 	Send(&pkt);
 }
 
@@ -2311,7 +2396,8 @@ void Server::SendBlocks(float dtime)
 	u32 total_sending = 0;
 
 	{
-		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
+		ScopeProfiler sp2(g_profiler,
+			SCOPE_PROFILER_KEY("Server::SendBlocks(): Collect list"));
 
 		std::vector<session_t> clients = m_clients.getClientIDs();
 
@@ -2340,9 +2426,14 @@ void Server::SendBlocks(float dtime)
 	u32 max_blocks_to_send = (m_env->getPlayerCount() + g_settings->getU32("max_users")) *
 		g_settings->getU32("max_simultaneous_block_sends_per_client") / 4 + 1;
 
-	ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send to clients");
+	ScopeProfiler sp(g_profiler,
+		SCOPE_PROFILER_KEY("Server::SendBlocks(): Send to clients"));
 	Map &map = m_env->getMap();
 
+	// Blocks to be serialized by the send threads, by position and
+	// serialization version so that each of them is only serialized once
+	std::map<std::pair<v3s16, u8>, BlockSendJob *> jobs;
+
 	for (const PrioritySortedBlockTransfer &block_to_send : queue) {
 		if (total_sending >= max_blocks_to_send)
 			break;
@@ -2356,13 +2447,42 @@ void Server::SendBlocks(float dtime)
 		if (!client)
 			continue;
 
-		SendBlockNoLock(block_to_send.peer_id, block, client->serialization_version,
-				client->net_proto_version);
+		const u8 ser_ver = client->serialization_version;
+		if (!m_block_send_pool) {
+			SendBlockNoLock(block_to_send.peer_id, block, ser_ver,
+					client->net_proto_version);
+		} else if (SerializedBlockCache::Data cached = m_block_send_cache.get(
+				block_to_send.pos, ser_ver, block->getContentVersion())) {
+			// Older data that is still being sent must not follow it
+			m_block_send_pool->cancel(block_to_send.pos, block_to_send.peer_id);
+			SendBlockData(block_to_send.peer_id, block_to_send.pos, *cached);
+		} else {
+			BlockSendJob *&job = jobs[std::make_pair(block_to_send.pos, ser_ver)];
+			if (!job) {
+				job = new BlockSendJob();
+				block->makeNetworkSnapshot(job->snapshot, ser_ver);
+			}
+			job->peer_ids.push_back(block_to_send.peer_id);
+		}
 
 		client->SentBlock(block_to_send.pos);
 		total_sending++;
 	}
 	m_clients.unlock();
+
+	for (const auto &job : jobs)
+		m_block_send_pool->enqueue(job.second);
+
+	if (m_block_send_pool) {
+		g_profiler->avg(PROFILER_KEY("Server::SendBlocks(): jobs queued"), jobs.size());
+		g_profiler->avg(PROFILER_KEY("Server::SendBlocks(): job queue size"),
+				m_block_send_pool->getQueueSize());
+	}
+
+	u32 cache_hits, cache_misses;
+	m_block_send_cache.takeStats(&cache_hits, &cache_misses);
+	g_profiler->avg(PROFILER_KEY("Server::SendBlocks(): cache hits"), cache_hits);
+	g_profiler->avg(PROFILER_KEY("Server::SendBlocks(): cache misses"), cache_misses);
 }
 
 bool Server::SendBlock(session_t peer_id, const v3s16 &blockpos)
@@ -3778,6 +3898,8 @@ void dedicated_server_loop(Server &server, bool &kill)
 			{
 				infostream<<"Profiler:"<<std::endl;
 				g_profiler->print(infostream);
+				infostream << "Profiler call tree:" << std::endl;
+				g_profiler->printTree(infostream);
 				g_profiler->clear();
 			}
 		}
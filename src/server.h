@@ -34,6 +34,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/thread.h"
 #include "util/basic_macros.h"
 #include "serverenvironment.h"
+#include "server/serialized_block_cache.h"
 #include "clientiface.h"
 #include "chatmessage.h"
 #include <string>
@@ -63,6 +64,7 @@ struct SimpleSoundSpec;
 struct CloudParams;
 class ServerThread;
 class ServerModManager;
+class BlockSendPool;
 
 enum ClientDeletionReason {
 	CDR_LEAVE,
@@ -176,6 +178,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void Send(NetworkPacket *pkt);
 	void Send(session_t peer_id, NetworkPacket *pkt);
 
+	// Sends already serialized block data, can be called from any thread
+	void SendBlockData(session_t peer_id, v3s16 blockpos, const std::string &data);
+
 	// Helper for handleCommand_PlayerPos and handleCommand_Interact
 	void process_PlayerPos(RemotePlayer *player, PlayerSAO *playersao,
 		NetworkPacket *pkt);
@@ -433,6 +438,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 	void sendMetadataChanged(const std::list<v3s16> &meta_updates,
 			float far_d_nodes = 100);
+	// Whether the block is still on its way to the peer
+	bool isBlockSending(v3s16 blockpos, session_t peer_id);
 
 	// Environment and Connection must be locked when called
 	void SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver, u16 net_proto_version);
@@ -599,6 +606,13 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	*/
 	ClientInterface m_clients;
 
+	/*
+		Network form of recently sent blocks, shared by all clients
+	*/
+	SerializedBlockCache m_block_send_cache;
+	// Serializes blocks that are not cached, nullptr if disabled
+	std::unique_ptr<BlockSendPool> m_block_send_pool;
+
 	/*
 		Peer change queue.
 		Queues stuff from peerAdded() and deletingPeer() to
@@ -17,6 +17,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <algorithm>
+#include <cmath>
 #include <log.h>
 #include "mapblock.h"
 #include "profiler.h"
@@ -25,6 +27,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 namespace server
 {
 
+// Edge length of the spatial index cells
+static const f32 INDEX_CELL_SIZE = MAP_BLOCKSIZE * BS;
+
 void ActiveObjectMgr::clear(const std::function<bool(ServerActiveObject *, u16)> &cb)
 {
 	std::vector<u16> objects_to_remove;
@@ -35,16 +40,19 @@ void ActiveObjectMgr::clear(const std::function<bool(ServerActiveObject *, u16)>
 		}
 	}
 
-	// Remove references from m_active_objects
+	// Remove references from m_active_objects.
+	// The objects may already be deleted at this point.
 	for (u16 i : objects_to_remove) {
 		m_active_objects.erase(i);
+		removeFromIndex(i);
 	}
 }
 
 void ActiveObjectMgr::step(
 		float dtime, const std::function<void(ServerActiveObject *)> &f)
 {
-	g_profiler->avg("ActiveObjectMgr: SAO count [#]", m_active_objects.size());
+	g_profiler->avg(PROFILER_KEY("ActiveObjectMgr: SAO count [#]"),
+		m_active_objects.size());
 	for (auto &ao_it : m_active_objects) {
 		f(ao_it.second);
 	}
@@ -88,6 +96,7 @@ bool ActiveObjectMgr::registerObject(ServerActiveObject *obj)
 	}
 
 	m_active_objects[obj->getId()] = obj;
+	addToIndex(obj);
 
 	verbosestream << "Server::ActiveObjectMgr::addActiveObjectRaw(): "
 			<< "Added id=" << obj->getId() << "; there are now "
@@ -107,22 +116,49 @@ void ActiveObjectMgr::removeObject(u16 id)
 	}
 
 	m_active_objects.erase(id);
+	removeFromIndex(id);
 	delete obj;
 }
 
+void ActiveObjectMgr::updateObjectPosition(ServerActiveObject *obj)
+{
+	auto it = m_index.find(obj->getId());
+	// The object may have been removed from the manager but not deleted
+	if (it == m_index.end() || it->second.obj != obj)
+		return;
+
+	v3s16 cell = getCell(obj->getBasePosition());
+	if (cell == it->second.cell)
+		return;
+
+	removeFromCell(it->second.cell, obj->getId());
+	m_cells[getCellKey(cell)].push_back(obj->getId());
+	it->second.cell = cell;
+}
+
 // clang-format on
 void ActiveObjectMgr::getObjectsInsideRadius(
 		const v3f &pos, float radius, std::vector<u16> &result)
 {
 	float r2 = radius * radius;
-	for (auto &activeObject : m_active_objects) {
-		ServerActiveObject *obj = activeObject.second;
-		u16 id = activeObject.first;
+	auto cb = [&] (u16 id, ServerActiveObject *obj) {
 		const v3f &objectpos = obj->getBasePosition();
 		if (objectpos.getDistanceFromSQ(pos) > r2)
-			continue;
+			return;
 		result.push_back(id);
-	}
+	};
+
+	forEachObjectInCells(getCell(pos - radius), getCell(pos + radius), cb);
+}
+
+void ActiveObjectMgr::getObjectsInArea(const aabb3f &box, std::vector<u16> &result)
+{
+	auto cb = [&] (u16 id, ServerActiveObject *obj) {
+		if (box.isPointInside(obj->getBasePosition()))
+			result.push_back(id);
+	};
+
+	forEachObjectInCells(getCell(box.MinEdge), getCell(box.MaxEdge), cb);
 }
 
 void ActiveObjectMgr::getAddedActiveObjectsAroundPos(const v3f &player_pos, f32 radius,
@@ -130,37 +166,143 @@ void ActiveObjectMgr::getAddedActiveObjectsAroundPos(const v3f &player_pos, f32
 		std::queue<u16> &added_objects)
 {
 	/*
-		Go through the object list,
+		Go through the objects near the player and all players,
 		- discard removed/deactivated objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
-	for (auto &ao_it : m_active_objects) {
-		u16 id = ao_it.first;
-
-		// Get object
-		ServerActiveObject *object = ao_it.second;
+	auto cb = [&] (u16 id, ServerActiveObject *object) {
 		if (!object)
-			continue;
+			return;
 
 		if (object->isGone())
-			continue;
+			return;
 
 		f32 distance_f = object->getBasePosition().getDistanceFrom(player_pos);
 		if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
 			// Discard if too far
 			if (distance_f > player_radius && player_radius != 0)
-				continue;
+				return;
 		} else if (distance_f > radius)
-			continue;
+			return;
 
 		// Discard if already on current_objects
 		auto n = current_objects.find(id);
 		if (n != current_objects.end())
-			continue;
+			return;
 		// Add to added_objects
 		added_objects.push(id);
+	};
+
+	// Players are handled below, as their range may be unlimited
+	auto cb_non_player = [&] (u16 id, ServerActiveObject *object) {
+		if (!m_index[id].is_player)
+			cb(id, object);
+	};
+
+	forEachObjectInCells(getCell(player_pos - radius),
+			getCell(player_pos + radius), cb_non_player);
+
+	for (u16 id : m_player_ids)
+		cb(id, getActiveObject(id));
+}
+
+v3s16 ActiveObjectMgr::getCell(const v3f &pos)
+{
+	// Clamp, as objects may move beyond the map generation limit
+	return v3s16(
+		(s16)rangelim(std::floor(pos.X / INDEX_CELL_SIZE), S16_MIN, S16_MAX),
+		(s16)rangelim(std::floor(pos.Y / INDEX_CELL_SIZE), S16_MIN, S16_MAX),
+		(s16)rangelim(std::floor(pos.Z / INDEX_CELL_SIZE), S16_MIN, S16_MAX));
+}
+
+u64 ActiveObjectMgr::getCellKey(const v3s16 &cell)
+{
+	return (u64)(u16)cell.X |
+		((u64)(u16)cell.Y << 16) |
+		((u64)(u16)cell.Z << 32);
+}
+
+v3s16 ActiveObjectMgr::getCellFromKey(u64 key)
+{
+	return v3s16((s16)(key & 0xFFFF), (s16)((key >> 16) & 0xFFFF),
+		(s16)((key >> 32) & 0xFFFF));
+}
+
+void ActiveObjectMgr::addToIndex(ServerActiveObject *obj)
+{
+	IndexEntry entry;
+	entry.obj = obj;
+	entry.cell = getCell(obj->getBasePosition());
+	entry.is_player = obj->getType() == ACTIVEOBJECT_TYPE_PLAYER;
+
+	m_index[obj->getId()] = entry;
+	m_cells[getCellKey(entry.cell)].push_back(obj->getId());
+	if (entry.is_player)
+		m_player_ids.push_back(obj->getId());
+
+	obj->m_object_mgr = this;
+}
+
+void ActiveObjectMgr::removeFromIndex(u16 id)
+{
+	auto it = m_index.find(id);
+	if (it == m_index.end())
+		return;
+
+	removeFromCell(it->second.cell, id);
+	if (it->second.is_player) {
+		m_player_ids.erase(std::find(m_player_ids.begin(), m_player_ids.end(), id));
+	}
+	m_index.erase(it);
+}
+
+void ActiveObjectMgr::removeFromCell(const v3s16 &cell, u16 id)
+{
+	auto it = m_cells.find(getCellKey(cell));
+	if (it == m_cells.end())
+		return;
+
+	std::vector<u16> &ids = it->second;
+	auto id_it = std::find(ids.begin(), ids.end(), id);
+	if (id_it != ids.end()) {
+		*id_it = ids.back();
+		ids.pop_back();
+	}
+	if (ids.empty())
+		m_cells.erase(it);
+}
+
+template <typename F>
+void ActiveObjectMgr::forEachObjectInCells(const v3s16 &minp, const v3s16 &maxp, F f)
+{
+	u64 cell_count = (u64)(maxp.X - minp.X + 1) * (maxp.Y - minp.Y + 1) *
+			(maxp.Z - minp.Z + 1);
+
+	// Large areas: go through the occupied cells instead
+	if (cell_count > m_cells.size()) {
+		for (auto &it : m_cells) {
+			v3s16 cell = getCellFromKey(it.first);
+			if (cell.X < minp.X || cell.Y < minp.Y || cell.Z < minp.Z ||
+					cell.X > maxp.X || cell.Y > maxp.Y || cell.Z > maxp.Z)
+				continue;
+
+			for (u16 id : it.second)
+				f(id, m_index[id].obj);
+		}
+		return;
+	}
+
+	for (s32 z = minp.Z; z <= maxp.Z; z++)
+	for (s32 y = minp.Y; y <= maxp.Y; y++)
+	for (s32 x = minp.X; x <= maxp.X; x++) {
+		auto it = m_cells.find(getCellKey(v3s16(x, y, z)));
+		if (it == m_cells.end())
+			continue;
+
+		for (u16 id : it->second)
+			f(id, m_index[id].obj);
 	}
 }
 
@@ -20,6 +20,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <functional>
+#include <unordered_map>
 #include <vector>
 #include "../activeobjectmgr.h"
 #include "serverobject.h"
@@ -35,11 +36,44 @@ class ActiveObjectMgr : public ::ActiveObjectMgr<ServerActiveObject>
 	bool registerObject(ServerActiveObject *obj) override;
 	void removeObject(u16 id) override;
 
+	// Called by ServerActiveObject::setBasePosition()
+	void updateObjectPosition(ServerActiveObject *obj);
+
 	void getObjectsInsideRadius(
 			const v3f &pos, float radius, std::vector<u16> &result);
+	void getObjectsInArea(const aabb3f &box, std::vector<u16> &result);
 
 	void getAddedActiveObjectsAroundPos(const v3f &player_pos, f32 radius,
 			f32 player_radius, std::set<u16> &current_objects,
 			std::queue<u16> &added_objects);
+
+private:
+	/*
+		Spatial index: a uniform grid with cells the size of a mapblock,
+		so that lookups only have to visit the objects near the searched
+		area. Kept up to date by updateObjectPosition().
+	*/
+	struct IndexEntry
+	{
+		ServerActiveObject *obj;
+		v3s16 cell;
+		bool is_player;
+	};
+
+	static v3s16 getCell(const v3f &pos);
+	static u64 getCellKey(const v3s16 &cell);
+	static v3s16 getCellFromKey(u64 key);
+
+	void addToIndex(ServerActiveObject *obj);
+	void removeFromIndex(u16 id);
+	void removeFromCell(const v3s16 &cell, u16 id);
+
+	// Calls f(id, obj) for every object in the cells from minp to maxp
+	template <typename F>
+	void forEachObjectInCells(const v3s16 &minp, const v3s16 &maxp, F f);
+
+	std::unordered_map<u16, IndexEntry> m_index;
+	std::unordered_map<u64, std::vector<u16>> m_cells;
+	std::vector<u16> m_player_ids;
 };
 } // namespace server
@@ -0,0 +1,165 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "block_send_pool.h"
+#include <sstream>
+#include "debug.h"
+#include "log.h"
+#include "server.h"
+#include "threading/mutex_auto_lock.h"
+#include "server/serialized_block_cache.h"
+
+class BlockSendThread : public Thread
+{
+public:
+	BlockSendThread(BlockSendPool *pool, int id) :
+		Thread("BlockSend" + std::to_string(id)),
+		m_pool(pool)
+	{}
+
+	void *run();
+
+private:
+	BlockSendPool *m_pool;
+};
+
+void *BlockSendThread::run()
+{
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	while (!stopRequested()) {
+		// Wake up regularly to check whether the thread should stop
+		BlockSendJob *job = m_pool->m_queue.pop_frontNoEx(100);
+		if (!job)
+			continue;
+
+		try {
+			m_pool->processJob(job);
+		} catch (SerializationError &e) {
+			errorstream << "BlockSendThread: failed to serialize block "
+				<< PP(job->snapshot.pos) << ": " << e.what() << std::endl;
+			m_pool->forgetJob(job);
+		}
+		delete job;
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	return nullptr;
+}
+
+BlockSendPool::BlockSendPool(Server *server, SerializedBlockCache *cache,
+		u16 thread_count) :
+	m_server(server),
+	m_cache(cache)
+{
+	for (u16 i = 0; i < thread_count; i++)
+		m_threads.push_back(new BlockSendThread(this, i));
+}
+
+BlockSendPool::~BlockSendPool()
+{
+	stop();
+
+	for (BlockSendThread *thread : m_threads)
+		delete thread;
+}
+
+void BlockSendPool::start()
+{
+	if (m_threads_active)
+		return;
+
+	for (BlockSendThread *thread : m_threads)
+		thread->start();
+
+	m_threads_active = true;
+}
+
+void BlockSendPool::stop()
+{
+	if (m_threads_active) {
+		// Request thread stop in parallel
+		for (BlockSendThread *thread : m_threads)
+			thread->stop();
+
+		for (BlockSendThread *thread : m_threads)
+			thread->wait();
+
+		m_threads_active = false;
+	}
+
+	while (!m_queue.empty())
+		delete m_queue.pop_frontNoEx(0);
+
+	MutexAutoLock lock(m_sending_mutex);
+	m_sending.clear();
+}
+
+void BlockSendPool::enqueue(BlockSendJob *job)
+{
+	{
+		MutexAutoLock lock(m_sending_mutex);
+		for (session_t peer_id : job->peer_ids)
+			m_sending[std::make_pair(job->snapshot.pos, peer_id)] = job;
+	}
+	m_queue.push_back(job);
+}
+
+bool BlockSendPool::isSending(v3s16 pos, session_t peer_id)
+{
+	MutexAutoLock lock(m_sending_mutex);
+	return m_sending.find(std::make_pair(pos, peer_id)) != m_sending.end();
+}
+
+void BlockSendPool::cancel(v3s16 pos, session_t peer_id)
+{
+	MutexAutoLock lock(m_sending_mutex);
+	m_sending.erase(std::make_pair(pos, peer_id));
+}
+
+void BlockSendPool::processJob(BlockSendJob *job)
+{
+	const MapBlockNetSnapshot &snap = job->snapshot;
+
+	std::ostringstream os(std::ios_base::binary);
+	MapBlock::serializeNetworkSnapshot(os, snap);
+	SerializedBlockCache::Data data = m_cache->set(snap.pos, snap.version,
+			snap.content_version, os.str());
+
+	for (session_t peer_id : job->peer_ids) {
+		MutexAutoLock lock(m_sending_mutex);
+		auto it = m_sending.find(std::make_pair(snap.pos, peer_id));
+		// Superseded by a newer job or cancelled
+		if (it == m_sending.end() || it->second != job)
+			continue;
+		m_server->SendBlockData(peer_id, snap.pos, *data);
+		m_sending.erase(it);
+	}
+}
+
+void BlockSendPool::forgetJob(BlockSendJob *job)
+{
+	MutexAutoLock lock(m_sending_mutex);
+	for (session_t peer_id : job->peer_ids) {
+		auto it = m_sending.find(std::make_pair(job->snapshot.pos, peer_id));
+		if (it != m_sending.end() && it->second == job)
+			m_sending.erase(it);
+	}
+}
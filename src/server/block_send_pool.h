@@ -0,0 +1,90 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+#include "mapblock.h"
+#include "network/networkprotocol.h"
+#include "threading/thread.h"
+#include "util/container.h"
+
+class Server;
+class SerializedBlockCache;
+class BlockSendThread;
+
+struct BlockSendJob
+{
+	MapBlockNetSnapshot snapshot;
+	std::vector<session_t> peer_ids;
+};
+
+/*
+	Serializes and compresses block snapshots on worker threads and sends
+	the result to the peers of each job, so that Server::SendBlocks only has
+	to copy the block data while holding the environment lock.
+
+	Only the latest job for a block and peer sends the block to that peer,
+	so an older snapshot never arrives after a newer one. Changes to a
+	block that is still being sent to a peer must not be sent to the peer
+	on their own, as the snapshot would overwrite them; the block has to be
+	sent again instead.
+*/
+class BlockSendPool
+{
+public:
+	BlockSendPool(Server *server, SerializedBlockCache *cache, u16 thread_count);
+	~BlockSendPool();
+	DISABLE_CLASS_COPY(BlockSendPool);
+
+	void start();
+	// Stops all threads and drops the jobs that were not processed yet
+	void stop();
+
+	// Takes ownership of the job
+	void enqueue(BlockSendJob *job);
+	u32 getQueueSize() const { return m_queue.size(); }
+
+	// Whether a queued or running job is going to send the block to the peer
+	bool isSending(v3s16 pos, session_t peer_id);
+	// Keeps the jobs that were queued so far from sending the block to the
+	// peer, for when it was sent some other way
+	void cancel(v3s16 pos, session_t peer_id);
+
+private:
+	friend class BlockSendThread;
+
+	void processJob(BlockSendJob *job);
+	// Drops the blocks a failed job was going to send
+	void forgetJob(BlockSendJob *job);
+
+	Server *m_server;
+	SerializedBlockCache *m_cache;
+	std::vector<BlockSendThread *> m_threads;
+	bool m_threads_active = false;
+
+	MutexedQueue<BlockSendJob *> m_queue;
+
+	// Held while a block is handed to the connection
+	std::mutex m_sending_mutex;
+	// The latest job for each block and peer
+	std::map<std::pair<v3s16, session_t>, BlockSendJob *> m_sending;
+};
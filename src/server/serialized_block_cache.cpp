@@ -0,0 +1,116 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "serialized_block_cache.h"
+#include "threading/mutex_auto_lock.h"
+
+SerializedBlockCache::Data SerializedBlockCache::get(v3s16 blockpos, u8 ser_ver,
+		u64 content_version)
+{
+	MutexAutoLock lock(m_mutex);
+
+	auto it = m_entries.find(makeKey(blockpos, ser_ver));
+	if (it == m_entries.end()) {
+		m_misses++;
+		return nullptr;
+	}
+
+	if (it->second.content_version != content_version) {
+		// The block changed since, this entry will never be valid again
+		eraseEntry(it);
+		m_misses++;
+		return nullptr;
+	}
+
+	m_lru.splice(m_lru.begin(), m_lru, it->second.lru_it);
+	m_hits++;
+	return it->second.data;
+}
+
+SerializedBlockCache::Data SerializedBlockCache::set(v3s16 blockpos, u8 ser_ver,
+		u64 content_version, std::string &&data)
+{
+	Data shared = std::make_shared<const std::string>(std::move(data));
+	const u64 key = makeKey(blockpos, ser_ver);
+
+	MutexAutoLock lock(m_mutex);
+
+	auto it = m_entries.find(key);
+	if (it != m_entries.end())
+		eraseEntry(it);
+
+	if (shared->size() > m_max_bytes)
+		return shared;
+
+	m_lru.push_front(key);
+	m_entries[key] = Entry{content_version, shared, m_lru.begin()};
+	m_bytes += shared->size();
+	evict();
+
+	return shared;
+}
+
+void SerializedBlockCache::clear()
+{
+	MutexAutoLock lock(m_mutex);
+	m_entries.clear();
+	m_lru.clear();
+	m_bytes = 0;
+}
+
+void SerializedBlockCache::setMaxBytes(size_t max_bytes)
+{
+	MutexAutoLock lock(m_mutex);
+	m_max_bytes = max_bytes;
+	evict();
+}
+
+size_t SerializedBlockCache::getSize() const
+{
+	MutexAutoLock lock(m_mutex);
+	return m_entries.size();
+}
+
+size_t SerializedBlockCache::getBytes() const
+{
+	MutexAutoLock lock(m_mutex);
+	return m_bytes;
+}
+
+void SerializedBlockCache::takeStats(u32 *hits, u32 *misses)
+{
+	MutexAutoLock lock(m_mutex);
+	*hits = m_hits;
+	*misses = m_misses;
+	m_hits = 0;
+	m_misses = 0;
+}
+
+void SerializedBlockCache::eraseEntry(std::unordered_map<u64, Entry>::iterator it)
+{
+	m_bytes -= it->second.data->size();
+	m_lru.erase(it->second.lru_it);
+	m_entries.erase(it);
+}
+
+void SerializedBlockCache::evict()
+{
+	while (m_bytes > m_max_bytes && !m_lru.empty())
+		eraseEntry(m_entries.find(m_lru.back()));
+}
@@ -0,0 +1,92 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "irr_v3d.h"
+#include "util/basic_macros.h"
+
+/*
+	Cache of the network form of map blocks (MapBlock::serialize() with
+	disk == false, followed by MapBlock::serializeNetworkSpecific()).
+
+	Entries are keyed by block position and serialization version and are
+	tagged with the MapBlock content version they were built from, so a
+	block that changed since (see MapBlock::raiseModified) is never served.
+	The cache is bounded by the total size of the stored data and evicts the
+	least recently used entries first.
+
+	All methods are thread-safe.
+*/
+class SerializedBlockCache
+{
+public:
+	typedef std::shared_ptr<const std::string> Data;
+
+	SerializedBlockCache(size_t max_bytes) : m_max_bytes(max_bytes) {}
+	DISABLE_CLASS_COPY(SerializedBlockCache);
+
+	// Returns the cached data or nullptr if there is no up to date entry
+	Data get(v3s16 blockpos, u8 ser_ver, u64 content_version);
+	// Stores data, replacing any previous entry for the position and version.
+	// Returns the shared buffer, which stays valid after eviction.
+	Data set(v3s16 blockpos, u8 ser_ver, u64 content_version, std::string &&data);
+
+	void clear();
+	void setMaxBytes(size_t max_bytes);
+
+	size_t getSize() const;
+	size_t getBytes() const;
+	// Returns hit and miss counts since the last call and resets them
+	void takeStats(u32 *hits, u32 *misses);
+
+private:
+	struct Entry
+	{
+		u64 content_version;
+		Data data;
+		std::list<u64>::iterator lru_it;
+	};
+
+	static inline u64 makeKey(v3s16 blockpos, u8 ser_ver)
+	{
+		return (u64)(u16)blockpos.X |
+			((u64)(u16)blockpos.Y << 16) |
+			((u64)(u16)blockpos.Z << 32) |
+			((u64)ser_ver << 48);
+	}
+
+	void eraseEntry(std::unordered_map<u64, Entry>::iterator it);
+	void evict();
+
+	mutable std::mutex m_mutex;
+	std::unordered_map<u64, Entry> m_entries;
+	// Most recently used key at the front
+	std::list<u64> m_lru;
+	size_t m_bytes = 0;
+	size_t m_max_bytes;
+
+	u32 m_hits = 0;
+	u32 m_misses = 0;
+};
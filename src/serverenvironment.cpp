@@ -26,6 +26,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodemetadata.h"
 #include "gamedef.h"
 #include "map.h"
+#include "noise.h"
+#include "pathfinder.h"
 #include "porting.h"
 #include "profiler.h"
 #include "raycast.h"
@@ -36,6 +38,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/basic_macros.h"
 #include "util/pointedthing.h"
 #include "threading/mutex_auto_lock.h"
+#include "threading/worker_pool.h"
 #include "filesys.h"
 #include "gameparams.h"
 #include "database/database-dummy.h"
@@ -103,11 +106,20 @@ void LBMContentMapping::addLBM(LoadingBlockModifierDef *lbm_def, IGameDef *gamed
 			map[c_id].push_back(lbm_def);
 		}
 	}
+
+	std::vector<content_t> trigger_ids;
+	trigger_ids.reserve(map.size());
+	for (const auto &it : map)
+		trigger_ids.push_back(it.first);
+	trigger_filter = ContentFilter(std::move(trigger_ids));
 }
 
 const std::vector<LoadingBlockModifierDef *> *
 LBMContentMapping::lookup(content_t c) const
 {
+	// Most nodes of a block trigger no LBM at all
+	if (!trigger_filter.contains(c))
+		return NULL;
 	lbm_map::const_iterator it = map.find(c);
 	if (it == map.end())
 		return NULL;
@@ -245,41 +257,85 @@ std::string LBMManager::createIntroductionTimesString()
 	return oss.str();
 }
 
+bool LBMManager::hasLBMsIntroducedAfter(u32 stamp) const
+{
+	// Precondition, we need m_lbm_lookup to be initialized
+	FATAL_ERROR_IF(!m_query_mode,
+		"attempted to query on non fully set up LBMManager");
+	for (auto it = getLBMsIntroducedAfter(stamp); it != m_lbm_lookup.end(); ++it) {
+		if (!it->second.lbm_list.empty())
+			return true;
+	}
+	return false;
+}
+
 void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block, u32 stamp)
 {
 	// Precondition, we need m_lbm_lookup to be initialized
 	FATAL_ERROR_IF(!m_query_mode,
 		"attempted to query on non fully set up LBMManager");
+	if (block->isDummy())
+		return;
+
 	v3s16 pos_of_block = block->getPosRelative();
-	v3s16 pos;
-	MapNode n;
-	content_t c;
+	std::vector<u16> indices;
+	// Time spent in each LBM that was triggered, in microseconds
+	std::vector<std::pair<LoadingBlockModifierDef *, u64>> lbm_times;
+
 	lbm_lookup_map::const_iterator it = getLBMsIntroducedAfter(stamp);
 	for (; it != m_lbm_lookup.end(); ++it) {
-		// Cache previous version to speedup lookup which has a very high performance
-		// penalty on each call
-		content_t previous_c{};
-		std::vector<LoadingBlockModifierDef *> *lbm_list = nullptr;
-
-		for (pos.X = 0; pos.X < MAP_BLOCKSIZE; pos.X++)
-			for (pos.Y = 0; pos.Y < MAP_BLOCKSIZE; pos.Y++)
-				for (pos.Z = 0; pos.Z < MAP_BLOCKSIZE; pos.Z++) {
-					n = block->getNodeNoEx(pos);
-					c = n.getContent();
-
-					// If content_t are not matching perform an LBM lookup
-					if (previous_c != c) {
-						lbm_list = (std::vector<LoadingBlockModifierDef *> *)
-							it->second.lookup(c);
-						previous_c = c;
-					}
+		const LBMContentMapping &mapping = it->second;
+
+		// Fetched again for every mapping, LBMs may have replaced the
+		// block data and with it the index
+		indices.clear();
+		for (const auto &list : block->getContentIndex().getLists()) {
+			if (mapping.trigger_filter.contains(list.first))
+				indices.insert(indices.end(), list.second.begin(), list.second.end());
+		}
+		if (indices.empty())
+			continue;
+		// In the order the nodes were visited before the index was used:
+		// X, then Y, then Z
+		std::sort(indices.begin(), indices.end(), [] (u16 a, u16 b) {
+			v3s16 pa = BlockContentIndex::indexToPos(a);
+			v3s16 pb = BlockContentIndex::indexToPos(b);
+			if (pa.X != pb.X)
+				return pa.X < pb.X;
+			if (pa.Y != pb.Y)
+				return pa.Y < pb.Y;
+			return pa.Z < pb.Z;
+		});
+
+		for (u16 i : indices) {
+			v3s16 pos = BlockContentIndex::indexToPos(i);
+			// LBMs run so far might have replaced the node
+			MapNode n = block->getNodeNoEx(pos);
+			const std::vector<LoadingBlockModifierDef *> *lbm_list =
+				mapping.lookup(n.getContent());
+			if (!lbm_list)
+				continue;
 
-					if (!lbm_list)
-						continue;
-					for (auto lbmdef : *lbm_list) {
-						lbmdef->trigger(env, pos + pos_of_block, n);
-					}
-				}
+			for (auto lbmdef : *lbm_list) {
+				u64 t = porting::getTimeUs();
+				lbmdef->trigger(env, pos + pos_of_block, n);
+				t = porting::getTimeUs() - t;
+
+				auto time_it = std::find_if(lbm_times.begin(), lbm_times.end(),
+					[lbmdef] (const std::pair<LoadingBlockModifierDef *, u64> &p) {
+						return p.first == lbmdef;
+					});
+				if (time_it == lbm_times.end())
+					lbm_times.emplace_back(lbmdef, t);
+				else
+					time_it->second += t;
+			}
+		}
+	}
+
+	for (const auto &lbm_time : lbm_times) {
+		g_profiler->add("LBM: " + lbm_time.first->name + " [ms]",
+			lbm_time.second / 1000.0f);
 	}
 }
 
@@ -287,54 +343,42 @@ void LBMManager::applyLBMs(ServerEnvironment *env, MapBlock *block, u32 stamp)
 	ActiveBlockList
 */
 
-void fillRadiusBlock(v3s16 p0, s16 r, std::set<v3s16> &list)
+bool ActiveBlockArea::operator==(const ActiveBlockArea &other) const
 {
-	v3s16 p;
-	for(p.X=p0.X-r; p.X<=p0.X+r; p.X++)
-		for(p.Y=p0.Y-r; p.Y<=p0.Y+r; p.Y++)
-			for(p.Z=p0.Z-r; p.Z<=p0.Z+r; p.Z++)
-			{
-				// limit to a sphere
-				if (p.getDistanceFrom(p0) <= r) {
-					// Set in list
-					list.insert(p);
-				}
-			}
+	if (pos != other.pos || radius != other.radius ||
+			cone_range != other.cone_range)
+		return false;
+	return cone_range == 0 || (camera_pos == other.camera_pos &&
+		camera_dir == other.camera_dir && fov == other.fov);
 }
 
-void fillViewConeBlock(v3s16 p0,
-	const s16 r,
-	const v3f camera_pos,
-	const v3f camera_dir,
-	const float camera_fov,
-	std::set<v3s16> &list)
+bool ActiveBlockArea::inSphere(v3s16 p) const
 {
-	v3s16 p;
-	const s16 r_nodes = r * BS * MAP_BLOCKSIZE;
-	for (p.X = p0.X - r; p.X <= p0.X+r; p.X++)
-	for (p.Y = p0.Y - r; p.Y <= p0.Y+r; p.Y++)
-	for (p.Z = p0.Z - r; p.Z <= p0.Z+r; p.Z++) {
-		if (isBlockInSight(p, camera_pos, camera_dir, camera_fov, r_nodes)) {
-			list.insert(p);
-		}
-	}
+	return p.getDistanceFrom(pos) <= radius;
+}
+
+bool ActiveBlockArea::inCone(v3s16 p) const
+{
+	if (cone_range == 0 ||
+			std::abs(p.X - pos.X) > cone_range ||
+			std::abs(p.Y - pos.Y) > cone_range ||
+			std::abs(p.Z - pos.Z) > cone_range)
+		return false;
+	const s16 r_nodes = cone_range * BS * MAP_BLOCKSIZE;
+	return isBlockInSight(p, camera_pos, camera_dir, fov, r_nodes);
 }
 
 void ActiveBlockList::update(std::vector<PlayerSAO*> &active_players,
 	s16 active_block_range,
 	s16 active_object_range,
-	std::set<v3s16> &blocks_removed,
-	std::set<v3s16> &blocks_added)
+	std::vector<v3s16> &blocks_removed,
+	std::vector<v3s16> &blocks_added)
 {
-	/*
-		Create the new list
-	*/
-	std::set<v3s16> newlist = m_forceloaded_list;
-	m_abm_list = m_forceloaded_list;
+	std::unordered_map<u16, ActiveBlockArea> areas;
 	for (const PlayerSAO *playersao : active_players) {
-		v3s16 pos = getNodeBlockPos(floatToInt(playersao->getBasePosition(), BS));
-		fillRadiusBlock(pos, active_block_range, m_abm_list);
-		fillRadiusBlock(pos, active_block_range, newlist);
+		ActiveBlockArea &area = areas[playersao->getId()];
+		area.pos = getNodeBlockPos(floatToInt(playersao->getBasePosition(), BS));
+		area.radius = active_block_range;
 
 		s16 player_ao_range = std::min(active_object_range, playersao->getWantedRange());
 		// only do this if this would add blocks
@@ -342,44 +386,143 @@ void ActiveBlockList::update(std::vector<PlayerSAO*> &active_players,
 			v3f camera_dir = v3f(0,0,1);
 			camera_dir.rotateYZBy(playersao->getLookPitch());
 			camera_dir.rotateXZBy(playersao->getRotation().Y);
-			fillViewConeBlock(pos,
-				player_ao_range,
-				playersao->getEyePosition(),
-				camera_dir,
-				playersao->getFov(),
-				newlist);
+			area.cone_range = player_ao_range;
+			area.camera_pos = playersao->getEyePosition();
+			area.camera_dir = camera_dir;
+			area.fov = playersao->getFov();
 		}
 	}
 
+	updateAreas(areas, blocks_removed, blocks_added);
+}
+
+void ActiveBlockList::updateAreas(const std::unordered_map<u16, ActiveBlockArea> &areas,
+	std::vector<v3s16> &blocks_removed,
+	std::vector<v3s16> &blocks_added)
+{
 	/*
-		Find out which blocks on the old list are not on the new list
+		Apply the changes of the forceloaded blocks
 	*/
-	// Go through old list
-	for (v3s16 p : m_list) {
-		// If not on new list, it's been removed
-		if (newlist.find(p) == newlist.end())
-			blocks_removed.insert(p);
+	std::vector<v3s16> unforced;
+	for (v3s16 p : m_forceloaded_applied) {
+		if (!m_forceloaded_list.contains(p))
+			unforced.push_back(p);
+	}
+	for (v3s16 p : unforced) {
+		m_forceloaded_applied.erase(p);
+		changeCounts(p, -1, -1);
+	}
+	for (v3s16 p : m_forceloaded_list) {
+		if (m_forceloaded_applied.insert(p))
+			changeCounts(p, 1, 1);
 	}
 
 	/*
-		Find out which blocks on the new list are not on the old list
+		Apply the changes of the player areas
 	*/
-	// Go through new list
-	for (v3s16 p : newlist) {
-		// If not on old list, it's been added
-		if(m_list.find(p) == m_list.end())
-			blocks_added.insert(p);
+	for (auto it = m_areas.begin(); it != m_areas.end();) {
+		auto new_it = areas.find(it->first);
+		if (new_it == areas.end()) {
+			changeArea(&it->second, nullptr);
+			it = m_areas.erase(it);
+			continue;
+		}
+		if (new_it->second != it->second) {
+			changeArea(&it->second, &new_it->second);
+			it->second = new_it->second;
+		}
+		++it;
+	}
+	for (const auto &area : areas) {
+		if (m_areas.find(area.first) == m_areas.end()) {
+			changeArea(nullptr, &area.second);
+			m_areas[area.first] = area.second;
+		}
 	}
 
 	/*
-		Update m_list
+		Find out which of the touched blocks were added or removed
 	*/
+	m_touched.insert(m_touched.end(), m_retry.begin(), m_retry.end());
+	m_retry.clear();
+
+	for (v3s16 p : m_touched) {
+		const Counts *counts = m_counts.find(p);
+		bool active = counts && counts->active > 0;
+		bool abm = counts && counts->abm > 0;
+
+		if (active && m_list.insert(p))
+			blocks_added.push_back(p);
+		else if (!active && m_list.erase(p))
+			blocks_removed.push_back(p);
+
+		if (abm)
+			m_abm_list.insert(p);
+		else
+			m_abm_list.erase(p);
+	}
+	m_touched.clear();
+}
+
+void ActiveBlockList::retryLater(v3s16 p)
+{
+	m_list.erase(p);
+	m_abm_list.erase(p);
+	m_retry.push_back(p);
+}
+
+void ActiveBlockList::clear()
+{
 	m_list.clear();
-	for (v3s16 p : newlist) {
-		m_list.insert(p);
+	m_abm_list.clear();
+	m_counts.clear();
+	m_areas.clear();
+	m_forceloaded_applied.clear();
+	m_retry.clear();
+	m_touched.clear();
+}
+
+void ActiveBlockList::changeArea(const ActiveBlockArea *from,
+	const ActiveBlockArea *to)
+{
+	// Visit the bounding box of both areas
+	v3s16 minp(S16_MAX, S16_MAX, S16_MAX);
+	v3s16 maxp(S16_MIN, S16_MIN, S16_MIN);
+	for (const ActiveBlockArea *area : {from, to}) {
+		if (!area)
+			continue;
+		v3s16 extent(area->getExtent(), area->getExtent(), area->getExtent());
+		minp.X = MYMIN(minp.X, area->pos.X - extent.X);
+		minp.Y = MYMIN(minp.Y, area->pos.Y - extent.Y);
+		minp.Z = MYMIN(minp.Z, area->pos.Z - extent.Z);
+		maxp.X = MYMAX(maxp.X, area->pos.X + extent.X);
+		maxp.Y = MYMAX(maxp.Y, area->pos.Y + extent.Y);
+		maxp.Z = MYMAX(maxp.Z, area->pos.Z + extent.Z);
+	}
+
+	v3s16 p;
+	for (p.X = minp.X; p.X <= maxp.X; p.X++)
+	for (p.Y = minp.Y; p.Y <= maxp.Y; p.Y++)
+	for (p.Z = minp.Z; p.Z <= maxp.Z; p.Z++) {
+		bool abm_from = from && from->inSphere(p);
+		bool abm_to = to && to->inSphere(p);
+		bool active_from = abm_from || (from && from->inCone(p));
+		bool active_to = abm_to || (to && to->inCone(p));
+		if (active_from != active_to || abm_from != abm_to)
+			changeCounts(p, (s16)active_to - active_from, (s16)abm_to - abm_from);
 	}
 }
 
+void ActiveBlockList::changeCounts(v3s16 p, s16 active, s16 abm)
+{
+	Counts &counts = m_counts[p];
+	counts.active += active;
+	counts.abm += abm;
+	if (counts.active == 0 && counts.abm == 0)
+		m_counts.erase(p);
+	m_touched.push_back(p);
+}
+
 /*
 	ServerEnvironment
 */
@@ -397,6 +540,19 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 	m_path_world(path_world),
 	m_rgen(seed())
 {
+	u16 abm_threads = rangelim(g_settings->getU16("abm_threads"), 0, 32);
+	if (abm_threads > 0)
+		m_abm_pool.reset(new WorkerPool("ABMScan", abm_threads));
+
+	u16 liquid_threads = rangelim(g_settings->getU16("liquid_threads"), 0, 32);
+	if (liquid_threads > 0)
+		m_liquid_pool.reset(new WorkerPool("Liquid", liquid_threads));
+
+	m_lbm_time_budget = MYMAX(g_settings->getFloat("lbm_time_budget"), 0.0f);
+
+	m_nav_cache.reset(new NavigationCache(map, server->ndef()));
+	m_async_pathfinder.reset(new AsyncPathfinder());
+
 	// Determine which database backend to use
 	std::string conf_path = path_world + DIR_DELIM + "world.mt";
 	Settings conf;
@@ -460,6 +616,13 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 
 ServerEnvironment::~ServerEnvironment()
 {
+	// Put the node timers back into the blocks, so that they are saved
+	for (const v3s16 &p : m_active_blocks.m_list) {
+		MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+		if (block)
+			block->detachTimerWheel();
+	}
+
 	// Clear active block list.
 	// This makes the next one delete all active objects.
 	m_active_blocks.clear();
@@ -467,6 +630,17 @@ ServerEnvironment::~ServerEnvironment()
 	// Convert all objects to static and delete the active objects
 	deactivateFarObjects(true);
 
+	// Stop pending path searches and unregister from the map
+	m_async_pathfinder.reset();
+	m_nav_cache.reset();
+
+	// The blocks whose LBMs didn't run yet still have their old timestamps,
+	// so that the LBMs are applied on the next load
+	for (LBMQueuedBlock &queued : m_lbm_queue)
+		queued.block->refDrop();
+	m_lbm_queue.clear();
+	m_lbm_pending.clear();
+
 	// Drop/delete map
 	m_map->drop();
 
@@ -736,7 +910,7 @@ struct ActiveABM
 {
 	ActiveBlockModifier *abm;
 	int chance;
-	std::vector<content_t> required_neighbors;
+	std::shared_ptr<const ContentFilter> required_neighbors;
 	bool check_required_neighbors; // false if required_neighbors is known to be empty
 };
 
@@ -745,6 +919,15 @@ class ABMHandler
 private:
 	ServerEnvironment *m_env;
 	std::vector<std::vector<ActiveABM> *> m_aabms;
+
+	struct Trigger
+	{
+		ActiveABM *aabm;
+		// Content of the node when the chance was rolled
+		content_t c;
+		// Node index within the block
+		u16 i;
+	};
 public:
 	ABMHandler(std::vector<ABMWithState> &abms,
 		float dtime_s, ServerEnvironment *env,
@@ -786,23 +969,16 @@ class ABMHandler
 			// Trigger neighbors
 			const std::vector<std::string> &required_neighbors_s =
 				abm->getRequiredNeighbors();
-			for (const std::string &required_neighbor_s : required_neighbors_s) {
-				ndef->getIds(required_neighbor_s, aabm.required_neighbors);
-			}
+			aabm.required_neighbors = ndef->getFilter(required_neighbors_s);
 			aabm.check_required_neighbors = !required_neighbors_s.empty();
 
 			// Trigger contents
-			const std::vector<std::string> &contents_s = abm->getTriggerContents();
-			for (const std::string &content_s : contents_s) {
-				std::vector<content_t> ids;
-				ndef->getIds(content_s, ids);
-				for (content_t c : ids) {
-					if (c >= m_aabms.size())
-						m_aabms.resize(c + 256, NULL);
-					if (!m_aabms[c])
-						m_aabms[c] = new std::vector<ActiveABM>;
-					m_aabms[c]->push_back(aabm);
-				}
+			for (content_t c : ndef->getFilter(abm->getTriggerContents())->getIds()) {
+				if (c >= m_aabms.size())
+					m_aabms.resize(c + 256, NULL);
+				if (!m_aabms[c])
+					m_aabms[c] = new std::vector<ActiveABM>;
+				m_aabms[c]->push_back(aabm);
 			}
 		}
 	}
@@ -846,24 +1022,12 @@ class ABMHandler
 		if(m_aabms.empty() || block->isDummy())
 			return;
 
-		// Check the content type cache first
-		// to see whether there are any ABMs
-		// to be run at all for this block.
-		if (block->contents_cached) {
+		if (block->hasContentIndex())
 			blocks_cached++;
-			bool run_abms = false;
-			for (content_t c : block->contents) {
-				if (c < m_aabms.size() && m_aabms[c]) {
-					run_abms = true;
-					break;
-				}
-			}
-			if (!run_abms)
-				return;
-		} else {
-			// Clear any caching
-			block->contents.clear();
-		}
+
+		std::vector<Trigger> triggers;
+		if (!collectTriggers(block, [] () { return myrand(); }, triggers))
+			return;
 		blocks_scanned++;
 
 		ServerMap *map = &m_env->getServerMap();
@@ -872,73 +1036,250 @@ class ABMHandler
 		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
 		m_env->m_added_objects = 0;
 
-		v3s16 p0;
-		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
-		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
-		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
-		{
-			const MapNode &n = block->getNodeUnsafe(p0);
-			content_t c = n.getContent();
-			// Cache content types as we go
-			if (!block->contents_cached && !block->do_not_cache_contents) {
-				block->contents.insert(c);
-				if (block->contents.size() > 64) {
-					// Too many different nodes... don't try to cache
-					block->do_not_cache_contents = true;
-					block->contents.clear();
+		for (const Trigger &trigger : triggers) {
+			ActiveABM &aabm = *trigger.aabm;
+			v3s16 p0 = BlockContentIndex::indexToPos(trigger.i);
+			// Callbacks run so far might have replaced the node
+			MapNode n = block->getNodeUnsafe(p0);
+			if (n.getContent() != trigger.c)
+				continue;
+
+			// Check neighbors
+			if (aabm.check_required_neighbors) {
+				v3s16 p1;
+				for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
+				for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
+				for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
+				{
+					if(p1 == p0)
+						continue;
+					content_t c;
+					if (block->isValidPosition(p1)) {
+						// if the neighbor is found on the same map block
+						// get it straight from there
+						const MapNode &n = block->getNodeUnsafe(p1);
+						c = n.getContent();
+					} else {
+						// otherwise consult the map
+						MapNode n = map->getNode(p1 + block->getPosRelative());
+						c = n.getContent();
+					}
+					if (aabm.required_neighbors->contains(c))
+						goto neighbor_found;
 				}
+				// No required neighbor found
+				continue;
 			}
+			neighbor_found:
 
-			if (c >= m_aabms.size() || !m_aabms[c])
+			v3s16 p = p0 + block->getPosRelative();
+			abms_run++;
+			// Call all the trigger variations
+			aabm.abm->trigger(m_env, p, n);
+			aabm.abm->trigger(m_env, p, n,
+				active_object_count, active_object_count_wider);
+
+			// Count surrounding objects again if the abms added any
+			if(m_env->m_added_objects > 0) {
+				active_object_count = countObjects(block, map, active_object_count_wider);
+				m_env->m_added_objects = 0;
+			}
+		}
+	}
+
+	/*
+		Parallel variant of apply(): the blocks are first scanned on the
+		worker pool, which only collects the ABM invocations, then the
+		invocations are replayed on the calling thread.
+
+		The scan only reads the map. This is safe because the caller holds
+		the environment lock and waits for the scan to finish, so nothing
+		can modify or unload blocks meanwhile. The map itself is not thread
+		safe for lookups (it caches the last sector), hence the neighbouring
+		blocks are looked up beforehand.
+	*/
+	struct Invocation
+	{
+		ActiveABM *aabm;
+		v3s16 p;
+		MapNode n;
+	};
+
+	struct BlockScan
+	{
+		MapBlock *block;
+		// Block and its neighbours, indexed by (x+1)*9 + (y+1)*3 + (z+1)
+		MapBlock *neighbors[27];
+		bool scanned = false;
+		bool cached = false;
+		std::vector<Invocation> invocations;
+	};
+	void applyParallel(const std::vector<MapBlock *> &blocks, WorkerPool *pool,
+		std::mt19937 &rgen, u32 max_time_ms, int &blocks_scanned,
+		int &abms_run, int &blocks_cached)
+	{
+		if (m_aabms.empty())
+			return;
+
+		TimeTaker timer("ABMHandler::applyParallel");
+		ServerMap *map = &m_env->getServerMap();
+
+		std::vector<BlockScan> scans(blocks.size());
+		for (size_t i = 0; i < blocks.size(); i++) {
+			BlockScan &scan = scans[i];
+			scan.block = blocks[i];
+			v3s16 blockpos = scan.block->getPos();
+			v3s16 d;
+			for (d.X = -1; d.X <= 1; d.X++)
+			for (d.Y = -1; d.Y <= 1; d.Y++)
+			for (d.Z = -1; d.Z <= 1; d.Z++) {
+				scan.neighbors[(d.X + 1) * 9 + (d.Y + 1) * 3 + (d.Z + 1)] =
+					map->getBlockNoCreateNoEx(blockpos + d);
+			}
+		}
+
+		std::vector<PcgRandom> rands;
+		for (u16 i = 0; i <= pool->getThreadCount(); i++)
+			rands.emplace_back(rgen());
+
+		pool->run(scans.size(), [&] (size_t job, u16 worker) {
+			scanBlock(scans[job], rands[worker]);
+		});
+
+		u32 scan_ms = timer.getTimerTime();
+		g_profiler->avg(PROFILER_KEY("ServerEnv: ABM parallel scan [ms]"), scan_ms);
+
+		size_t replayed = 0;
+		size_t invocation_count = 0;
+		for (BlockScan &scan : scans) {
+			blocks_cached += scan.cached;
+			blocks_scanned += scan.scanned;
+			invocation_count += scan.invocations.size();
+		}
+
+		for (BlockScan &scan : scans) {
+			if (scan.invocations.empty())
 				continue;
 
-			v3s16 p = p0 + block->getPosRelative();
-			for (ActiveABM &aabm : *m_aabms[c]) {
-				if (myrand() % aabm.chance != 0)
-					continue;
+			// An earlier callback might have unloaded the block
+			v3s16 blockpos = scan.block->getPos();
+			MapBlock *block = map->getBlockNoCreateNoEx(blockpos);
+			if (block != scan.block || block->isDummy())
+				continue;
 
-				// Check neighbors
-				if (aabm.check_required_neighbors) {
-					v3s16 p1;
-					for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
-					for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
-					for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
-					{
-						if(p1 == p0)
-							continue;
-						content_t c;
-						if (block->isValidPosition(p1)) {
-							// if the neighbor is found on the same map block
-							// get it straight from there
-							const MapNode &n = block->getNodeUnsafe(p1);
-							c = n.getContent();
-						} else {
-							// otherwise consult the map
-							MapNode n = map->getNode(p1 + block->getPosRelative());
-							c = n.getContent();
-						}
-						if (CONTAINS(aabm.required_neighbors, c))
-							goto neighbor_found;
-					}
-					// No required neighbor found
+			u32 active_object_count_wider;
+			u32 active_object_count = countObjects(block, map, active_object_count_wider);
+			m_env->m_added_objects = 0;
+
+			for (const Invocation &inv : scan.invocations) {
+				// Skip nodes that were changed by the callbacks run so far
+				v3s16 p0 = inv.p - block->getPosRelative();
+				MapNode n = block->getNodeUnsafe(p0);
+				if (n.getContent() != inv.n.getContent())
 					continue;
-				}
-				neighbor_found:
 
 				abms_run++;
-				// Call all the trigger variations
-				aabm.abm->trigger(m_env, p, n);
-				aabm.abm->trigger(m_env, p, n,
+				inv.aabm->abm->trigger(m_env, inv.p, n);
+				inv.aabm->abm->trigger(m_env, inv.p, n,
 					active_object_count, active_object_count_wider);
 
-				// Count surrounding objects again if the abms added any
-				if(m_env->m_added_objects > 0) {
+				if (m_env->m_added_objects > 0) {
 					active_object_count = countObjects(block, map, active_object_count_wider);
 					m_env->m_added_objects = 0;
 				}
 			}
+			replayed++;
+
+			u32 time_ms = timer.getTimerTime();
+			if (time_ms > max_time_ms) {
+				warningstream << "active block modifiers took "
+					<< time_ms << "ms (replayed " << replayed << " of "
+					<< scans.size() << " active blocks)" << std::endl;
+				break;
+			}
+		}
+		g_profiler->avg(PROFILER_KEY("ServerEnv: ABM invocations collected"),
+			invocation_count);
+	}
+
+private:
+	/*
+		Rolls the chances of the ABMs for the nodes of the block, see
+		BlockContentIndex::sample(). Returns false if no ABM applies to any
+		content of the block. May run on any thread.
+	*/
+	template <typename Rand>
+	bool collectTriggers(MapBlock *block, Rand &&rand, std::vector<Trigger> &triggers)
+	{
+		bool found = false;
+		std::vector<u16> picked;
+		for (const auto &list : block->getContentIndex().getLists()) {
+			content_t c = list.first;
+			if (c >= m_aabms.size() || !m_aabms[c])
+				continue;
+			found = true;
+
+			for (ActiveABM &aabm : *m_aabms[c]) {
+				picked.clear();
+				BlockContentIndex::sample(list.second, aabm.chance, rand, picked);
+				for (u16 i : picked)
+					triggers.push_back({&aabm, c, i});
+			}
+		}
+		return found;
+	}
+
+	// Native part of applyParallel()
+	void scanBlock(BlockScan &scan, PcgRandom &rand)
+	{
+		MapBlock *block = scan.block;
+		if (block->isDummy())
+			return;
+
+		scan.cached = block->hasContentIndex();
+		std::vector<Trigger> triggers;
+		scan.scanned = collectTriggers(block, [&rand] () { return rand.next(); },
+			triggers);
+
+		for (const Trigger &trigger : triggers) {
+			v3s16 p0 = BlockContentIndex::indexToPos(trigger.i);
+			if (trigger.aabm->check_required_neighbors &&
+					!hasRequiredNeighbor(scan, p0, *trigger.aabm->required_neighbors))
+				continue;
+
+			scan.invocations.push_back({trigger.aabm, p0 + block->getPosRelative(),
+				block->getNodeUnsafe(p0)});
+		}
+	}
+
+	static bool hasRequiredNeighbor(const BlockScan &scan, v3s16 p0,
+		const ContentFilter &required_neighbors)
+	{
+		v3s16 p1;
+		for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
+		for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
+		for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
+		{
+			if (p1 == p0)
+				continue;
+			// Offset of the block containing p1, -1, 0 or 1 on each axis
+			v3s16 d(
+				(p1.X + MAP_BLOCKSIZE) / MAP_BLOCKSIZE - 1,
+				(p1.Y + MAP_BLOCKSIZE) / MAP_BLOCKSIZE - 1,
+				(p1.Z + MAP_BLOCKSIZE) / MAP_BLOCKSIZE - 1);
+			MapBlock *block = scan.neighbors[(d.X + 1) * 9 + (d.Y + 1) * 3 + (d.Z + 1)];
+			if (!block) {
+				// Same as Map::getNode() for unloaded blocks
+				if (required_neighbors.contains(CONTENT_IGNORE))
+					return true;
+				continue;
+			}
+			bool is_valid;
+			MapNode n = block->getNodeNoCheck(p1 - d * MAP_BLOCKSIZE, &is_valid);
+			if (required_neighbors.contains(n.getContent()))
+				return true;
 		}
-		block->contents_cached = !block->do_not_cache_contents;
+		return false;
 	}
 };
 
@@ -962,14 +1303,25 @@ void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 	/*infostream<<"ServerEnvironment::activateBlock(): block timestamp: "
 			<<stamp<<", game time: "<<m_game_time<<std::endl;*/
 
+	// Activated again before its LBMs ran, the queue finishes the activation
+	if (m_lbm_pending.contains(block->getPos())) {
+		activateObjects(block, 0);
+		return;
+	}
+
 	// Remove stored static objects if clearObjects was called since block's timestamp
 	if (stamp == BLOCK_TIMESTAMP_UNDEFINED || stamp < m_last_clear_objects_time) {
 		block->m_static_objects.m_stored.clear();
 		// do not set changed flag to avoid unnecessary mapblock writes
 	}
 
-	// Set current time as timestamp
-	block->setTimestampNoChangedFlag(m_game_time);
+	bool has_lbms = m_lbm_mgr.hasLBMsIntroducedAfter(stamp);
+	bool queue_lbms = has_lbms && m_lbm_time_budget > 0.0f;
+
+	// Set current time as timestamp. Blocks waiting for their LBMs keep the
+	// old one, so that a save in the meantime doesn't lose the LBMs.
+	if (!queue_lbms)
+		block->setTimestampNoChangedFlag(m_game_time);
 
 	/*infostream<<"ServerEnvironment::activateBlock(): block is "
 			<<dtime_s<<" seconds old."<<std::endl;*/
@@ -978,8 +1330,21 @@ void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 	activateObjects(block, dtime_s);
 
 	/* Handle LoadingBlockModifiers */
-	m_lbm_mgr.applyLBMs(this, block, stamp);
+	if (queue_lbms) {
+		// Keep the block loaded until stepLBMQueue() gets to it
+		block->refGrab();
+		m_lbm_queue.push_back({block, stamp, dtime_s});
+		m_lbm_pending.insert(block->getPos());
+		return;
+	}
+	if (has_lbms)
+		applyLBMs(block, stamp);
 
+	runElapsedTimers(block, dtime_s);
+}
+
+void ServerEnvironment::runElapsedTimers(MapBlock *block, u32 dtime_s)
+{
 	// Run node timers
 	std::vector<NodeTimer> elapsed_timers =
 		block->m_node_timers.step((float)dtime_s);
@@ -993,6 +1358,44 @@ void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 					elapsed_timer.position));
 		}
 	}
+
+	// From now on the timers run in the wheel. Blocks generated outside
+	// of the active area get there once they become active.
+	if (m_active_blocks.contains(block->getPos()))
+		block->attachTimerWheel(&m_node_timer_wheel);
+}
+
+void ServerEnvironment::applyLBMs(MapBlock *block, u32 stamp)
+{
+	bool had_index = block->hasContentIndex();
+	m_lbm_mgr.applyLBMs(this, block, stamp);
+	// Blocks activated by the emerge threads may be outside the active area
+	if (!had_index && !m_active_blocks.contains(block->getPos()))
+		block->clearContentIndex();
+}
+
+void ServerEnvironment::stepLBMQueue()
+{
+	if (m_lbm_queue.empty())
+		return;
+
+	ScopeProfiler sp(g_profiler, SCOPE_PROFILER_KEY("ServerEnv: apply LBMs"), SPT_AVG);
+	u64 start = porting::getTimeUs();
+	// At least one block per step, so that the queue always drains
+	do {
+		LBMQueuedBlock queued = m_lbm_queue.front();
+		m_lbm_queue.pop_front();
+		MapBlock *block = queued.block;
+		applyLBMs(block, queued.stamp);
+		block->setTimestampNoChangedFlag(m_game_time);
+		m_lbm_pending.erase(block->getPos());
+		runElapsedTimers(block, queued.dtime_s);
+		block->refDrop();
+	} while (!m_lbm_queue.empty() &&
+		porting::getTimeUs() - start < m_lbm_time_budget * 1000);
+
+	g_profiler->avg(PROFILER_KEY("ServerEnv: blocks queued for LBMs"),
+		m_lbm_queue.size());
 }
 
 void ServerEnvironment::addActiveBlockModifier(ActiveBlockModifier *abm)
@@ -1179,10 +1582,14 @@ void ServerEnvironment::clearObjects(ClearObjectsMode mode)
 				<< percent << "%)" << std::endl;
 		}
 		if (num_blocks_checked % unload_interval == 0) {
-			m_map->unloadUnreferencedBlocks();
+			std::vector<v3s16> unloaded_blocks;
+			m_map->unloadUnreferencedBlocks(&unloaded_blocks);
+			m_nav_cache->onBlocksUnloaded(unloaded_blocks);
 		}
 	}
-	m_map->unloadUnreferencedBlocks();
+	std::vector<v3s16> unloaded_blocks;
+	m_map->unloadUnreferencedBlocks(&unloaded_blocks);
+	m_nav_cache->onBlocksUnloaded(unloaded_blocks);
 
 	// Drop references that were added above
 	for (v3s16 p : loaded_blocks) {
@@ -1200,7 +1607,7 @@ void ServerEnvironment::clearObjects(ClearObjectsMode mode)
 
 void ServerEnvironment::step(float dtime)
 {
-	ScopeProfiler sp2(g_profiler, "ServerEnv::step()", SPT_AVG);
+	ScopeProfiler sp2(g_profiler, SCOPE_PROFILER_KEY("ServerEnv::step()"), SPT_AVG);
 	/* Step time of day */
 	stepTimeOfDay(dtime);
 
@@ -1225,7 +1632,8 @@ void ServerEnvironment::step(float dtime)
 		Handle players
 	*/
 	{
-		ScopeProfiler sp(g_profiler, "ServerEnv: move players", SPT_AVG);
+		ScopeProfiler sp(g_profiler,
+			SCOPE_PROFILER_KEY("ServerEnv: move players"), SPT_AVG);
 		for (RemotePlayer *player : m_players) {
 			// Ignore disconnected players
 			if (player->getPeerId() == PEER_ID_INEXISTENT)
@@ -1240,7 +1648,8 @@ void ServerEnvironment::step(float dtime)
 		Manage active block list
 	*/
 	if (m_active_blocks_management_interval.step(dtime, m_cache_active_block_mgmt_interval)) {
-		ScopeProfiler sp(g_profiler, "ServerEnv: update active blocks", SPT_AVG);
+		ScopeProfiler sp(g_profiler,
+			SCOPE_PROFILER_KEY("ServerEnv: update active blocks"), SPT_AVG);
 		/*
 			Get player block positions
 		*/
@@ -1265,8 +1674,8 @@ void ServerEnvironment::step(float dtime)
 				g_settings->getS16("active_object_send_range_blocks");
 		static thread_local const s16 active_block_range =
 				g_settings->getS16("active_block_range");
-		std::set<v3s16> blocks_removed;
-		std::set<v3s16> blocks_added;
+		std::vector<v3s16> blocks_removed;
+		std::vector<v3s16> blocks_added;
 		m_active_blocks.update(players, active_block_range, active_object_range,
 			blocks_removed, blocks_added);
 
@@ -1279,11 +1688,16 @@ void ServerEnvironment::step(float dtime)
 
 		for (const v3s16 &p: blocks_removed) {
 			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
-			if (!block)
+			// Left as they are until their LBMs ran
+			if (!block || m_lbm_pending.contains(p))
 				continue;
 
 			// Set current time as timestamp (and let it set ChangedFlag)
 			block->setTimestamp(m_game_time);
+			// Only needed for ABMs
+			block->clearContentIndex();
+			// Timers are stored in inactive blocks
+			block->detachTimerWheel();
 		}
 
 		/*
@@ -1293,8 +1707,7 @@ void ServerEnvironment::step(float dtime)
 		for (const v3s16 &p: blocks_added) {
 			MapBlock *block = m_map->getBlockOrEmerge(p);
 			if (!block) {
-				m_active_blocks.m_list.erase(p);
-				m_active_blocks.m_abm_list.erase(p);
+				m_active_blocks.retryLater(p);
 				continue;
 			}
 
@@ -1302,17 +1715,23 @@ void ServerEnvironment::step(float dtime)
 		}
 	}
 
+	/*
+		Apply LBMs to the blocks activated lately
+	*/
+	stepLBMQueue();
+
 	/*
 		Mess around in active blocks
 	*/
 	if (m_active_blocks_nodemetadata_interval.step(dtime, m_cache_nodetimer_interval)) {
-		ScopeProfiler sp(g_profiler, "ServerEnv: Run node timers", SPT_AVG);
+		ScopeProfiler sp(g_profiler,
+			SCOPE_PROFILER_KEY("ServerEnv: Run node timers"), SPT_AVG);
 
 		float dtime = m_cache_nodetimer_interval;
 
 		for (const v3s16 &p: m_active_blocks.m_list) {
 			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
-			if (!block)
+			if (!block || m_lbm_pending.contains(p))
 				continue;
 
 			// Reset block usage timer
@@ -1325,26 +1744,23 @@ void ServerEnvironment::step(float dtime)
 			if(block->getTimestamp() > block->getDiskTimestamp() + 60)
 				block->raiseModified(MOD_STATE_WRITE_AT_UNLOAD,
 					MOD_REASON_BLOCK_EXPIRED);
+		}
 
-			// Run node timers
-			std::vector<NodeTimer> elapsed_timers = block->m_node_timers.step(dtime);
-			if (!elapsed_timers.empty()) {
-				MapNode n;
-				v3s16 p2;
-				for (const NodeTimer &elapsed_timer: elapsed_timers) {
-					n = block->getNodeNoEx(elapsed_timer.position);
-					p2 = elapsed_timer.position + block->getPosRelative();
-					if (m_script->node_on_timer(p2, n, elapsed_timer.elapsed)) {
-						block->setNodeTimer(NodeTimer(
-							elapsed_timer.timeout, 0, elapsed_timer.position));
-					}
-				}
-			}
+		// Run node timers, the wheel only yields the ones that are due
+		std::vector<NodeTimer> elapsed_timers = m_node_timer_wheel.step(dtime);
+		for (const NodeTimer &elapsed_timer : elapsed_timers) {
+			const v3s16 &p = elapsed_timer.position;
+			MapNode n = m_map->getNode(p);
+			if (m_script->node_on_timer(p, n, elapsed_timer.elapsed))
+				m_map->setNodeTimer(NodeTimer(elapsed_timer.timeout, 0, p));
 		}
+		g_profiler->avg(PROFILER_KEY("ServerEnv: node timers"),
+			m_node_timer_wheel.size());
 	}
 
 	if (m_active_block_modifier_interval.step(dtime, m_cache_abm_interval)) {
-		ScopeProfiler sp(g_profiler, "SEnv: modify in blocks avg per interval", SPT_AVG);
+		ScopeProfiler sp(g_profiler,
+			SCOPE_PROFILER_KEY("SEnv: modify in blocks avg per interval"), SPT_AVG);
 		TimeTaker timer("modify in active blocks per interval");
 
 		// Initialize handling of ActiveBlockModifiers
@@ -1361,12 +1777,28 @@ void ServerEnvironment::step(float dtime)
 		std::copy(m_active_blocks.m_abm_list.begin(), m_active_blocks.m_abm_list.end(), output.begin());
 		std::shuffle(output.begin(), output.end(), m_rgen);
 
-		int i = 0;
 		// The time budget for ABMs is 20%.
 		u32 max_time_ms = m_cache_abm_interval * 1000 / 5;
+
+		if (m_abm_pool) {
+			std::vector<MapBlock *> blocks;
+			blocks.reserve(output.size());
+			for (const v3s16 &p : output) {
+				MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+				if (!block || m_lbm_pending.contains(p))
+					continue;
+				block->setTimestampNoChangedFlag(m_game_time);
+				blocks.push_back(block);
+			}
+			abmhandler.applyParallel(blocks, m_abm_pool.get(), m_rgen, max_time_ms,
+				blocks_scanned, abms_run, blocks_cached);
+			output.clear();
+		}
+
+		int i = 0;
 		for (const v3s16 &p : output) {
 			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
-			if (!block)
+			if (!block || m_lbm_pending.contains(p))
 				continue;
 
 			i++;
@@ -1386,10 +1818,12 @@ void ServerEnvironment::step(float dtime)
 				break;
 			}
 		}
-		g_profiler->avg("ServerEnv: active blocks", m_active_blocks.m_abm_list.size());
-		g_profiler->avg("ServerEnv: active blocks cached", blocks_cached);
-		g_profiler->avg("ServerEnv: active blocks scanned for ABMs", blocks_scanned);
-		g_profiler->avg("ServerEnv: ABMs run", abms_run);
+		g_profiler->avg(PROFILER_KEY("ServerEnv: active blocks"),
+			m_active_blocks.m_abm_list.size());
+		g_profiler->avg(PROFILER_KEY("ServerEnv: active blocks cached"), blocks_cached);
+		g_profiler->avg(PROFILER_KEY("ServerEnv: active blocks scanned for ABMs"),
+			blocks_scanned);
+		g_profiler->avg(PROFILER_KEY("ServerEnv: ABMs run"), abms_run);
 
 		timer.stop(true);
 	}
@@ -1403,7 +1837,8 @@ void ServerEnvironment::step(float dtime)
 		Step active objects
 	*/
 	{
-		ScopeProfiler sp(g_profiler, "ServerEnv: Run SAO::step()", SPT_AVG);
+		ScopeProfiler sp(g_profiler,
+			SCOPE_PROFILER_KEY("ServerEnv: Run SAO::step()"), SPT_AVG);
 
 		// This helps the objects to send data at the same time
 		bool send_recommended = false;
@@ -1699,7 +2134,8 @@ u16 ServerEnvironment::addActiveObjectRaw(ServerActiveObject *object,
 */
 void ServerEnvironment::removeRemovedObjects()
 {
-	ScopeProfiler sp(g_profiler, "ServerEnvironment::removeRemovedObjects()", SPT_AVG);
+	ScopeProfiler sp(g_profiler,
+		SCOPE_PROFILER_KEY("ServerEnvironment::removeRemovedObjects()"), SPT_AVG);
 
 	auto clear_cb = [this] (ServerActiveObject *obj, u16 id) {
 		// This shouldn't happen but check it
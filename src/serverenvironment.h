@@ -22,10 +22,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "activeobject.h"
 #include "environment.h"
 #include "mapnode.h"
+#include "nodedef.h"
+#include "nodetimer.h"
 #include "settings.h"
 #include "server/activeobjectmgr.h"
+#include "util/blockpos_map.h"
 #include "util/numeric.h"
+#include <deque>
+#include <memory>
 #include <set>
+#include <unordered_map>
 #include <random>
 
 class IGameDef;
@@ -42,6 +48,9 @@ struct StaticObject;
 class ServerActiveObject;
 class Server;
 class ServerScripting;
+class WorkerPool;
+class NavigationCache;
+class AsyncPathfinder;
 
 /*
 	{Active, Loading} block modifier interface.
@@ -97,6 +106,8 @@ struct LBMContentMapping
 {
 	typedef std::unordered_map<content_t, std::vector<LoadingBlockModifierDef *>> lbm_map;
 	lbm_map map;
+	// All content IDs that are keys of map
+	ContentFilter trigger_filter;
 
 	std::vector<LoadingBlockModifierDef *> lbm_list;
 
@@ -124,6 +135,11 @@ class LBMManager
 	std::string createIntroductionTimesString();
 
 	// Don't call this before loadIntroductionTimes() ran.
+	bool hasLBMsIntroducedAfter(u32 stamp) const;
+
+	// Don't call this before loadIntroductionTimes() ran.
+	// Only visits the nodes of the contents the LBMs trigger on, which
+	// are found from the content index of the block.
 	void applyLBMs(ServerEnvironment *env, MapBlock *block, u32 stamp);
 
 	// Warning: do not make this std::unordered_map, order is relevant here
@@ -146,7 +162,7 @@ class LBMManager
 	// Returns an iterator to the LBMs that were introduced
 	// after the given time. This is guaranteed to return
 	// valid values for everything
-	lbm_lookup_map::const_iterator getLBMsIntroducedAfter(u32 time)
+	lbm_lookup_map::const_iterator getLBMsIntroducedAfter(u32 time) const
 	{ return m_lbm_lookup.lower_bound(time); }
 };
 
@@ -154,28 +170,80 @@ class LBMManager
 	List of active blocks, used by ServerEnvironment
 */
 
+/*
+	The blocks a single player keeps active: a sphere of blocks that are
+	active and run ABMs, and optionally a view cone of blocks that are
+	only active (for objects).
+*/
+struct ActiveBlockArea
+{
+	v3s16 pos;
+	s16 radius = 0;
+	// 0 if there is no view cone
+	s16 cone_range = 0;
+	v3f camera_pos;
+	v3f camera_dir;
+	f32 fov = 0.0f;
+
+	bool operator==(const ActiveBlockArea &other) const;
+	bool operator!=(const ActiveBlockArea &other) const { return !(*this == other); }
+
+	bool inSphere(v3s16 p) const;
+	bool inCone(v3s16 p) const;
+	s16 getExtent() const { return MYMAX(radius, cone_range); }
+};
+
 class ActiveBlockList
 {
 public:
 	void update(std::vector<PlayerSAO*> &active_players,
 		s16 active_block_range,
 		s16 active_object_range,
-		std::set<v3s16> &blocks_removed,
-		std::set<v3s16> &blocks_added);
+		std::vector<v3s16> &blocks_removed,
+		std::vector<v3s16> &blocks_added);
+
+	/*
+		Incremental part of update(): only the blocks covered by players
+		whose area changed since the last call are visited. areas is keyed
+		by active object id, players that are missing are removed.
+	*/
+	void updateAreas(const std::unordered_map<u16, ActiveBlockArea> &areas,
+		std::vector<v3s16> &blocks_removed,
+		std::vector<v3s16> &blocks_added);
 
 	bool contains(v3s16 p){
-		return (m_list.find(p) != m_list.end());
+		return m_list.contains(p);
 	}
 
-	void clear(){
-		m_list.clear();
-	}
+	// Removes a block that could not be loaded, it is added again
+	// by the next update()
+	void retryLater(v3s16 p);
+
+	void clear();
 
-	std::set<v3s16> m_list;
-	std::set<v3s16> m_abm_list;
-	std::set<v3s16> m_forceloaded_list;
+	BlockPosSet m_list;
+	BlockPosSet m_abm_list;
+	BlockPosSet m_forceloaded_list;
 
 private:
+	// Number of players (or forceloads) that want a block active or
+	// running ABMs. Blocks are in m_list iff active > 0, except for
+	// blocks waiting in m_retry.
+	struct Counts
+	{
+		u16 active;
+		u16 abm;
+	};
+
+	void changeArea(const ActiveBlockArea *from, const ActiveBlockArea *to);
+	void changeCounts(v3s16 p, s16 active, s16 abm);
+
+	BlockPosMap<Counts> m_counts;
+	std::unordered_map<u16, ActiveBlockArea> m_areas;
+	BlockPosSet m_forceloaded_applied;
+	std::vector<v3s16> m_retry;
+	// Blocks whose counts changed since the last update
+	std::vector<v3s16> m_touched;
 };
 
 /*
@@ -209,6 +277,12 @@ class ServerEnvironment : public Environment
 
 	ServerMap & getServerMap();
 
+	NavigationCache *getNavigationCache() { return m_nav_cache.get(); }
+	AsyncPathfinder *getAsyncPathfinder() { return m_async_pathfinder.get(); }
+
+	// nullptr if liquids are transformed on the server thread only
+	WorkerPool *getLiquidPool() { return m_liquid_pool.get(); }
+
 	//TODO find way to remove this fct!
 	ServerScripting* getScriptIface()
 	{ return m_script; }
@@ -328,6 +402,12 @@ class ServerEnvironment : public Environment
 		return m_ao_manager.getObjectsInsideRadius(pos, radius, objects);
 	}
 
+	// Find all active objects inside a box
+	void getObjectsInArea(std::vector<u16> &objects, const aabb3f &box)
+	{
+		return m_ao_manager.getObjectsInArea(box, objects);
+	}
+
 	// Clear objects, loading and going through every MapBlock
 	void clearObjects(ClearObjectsMode mode);
 
@@ -349,7 +429,8 @@ class ServerEnvironment : public Environment
 	void reportMaxLagEstimate(float f) { m_max_lag_estimate = f; }
 	float getMaxLagEstimate() { return m_max_lag_estimate; }
 
-	std::set<v3s16>* getForceloadedBlocks() { return &m_active_blocks.m_forceloaded_list; };
+	BlockPosSet *getForceloadedBlocks() { return &m_active_blocks.m_forceloaded_list; };
+	const BlockPosSet &getActiveBlocks() const { return m_active_blocks.m_list; }
 
 	// Sets the static object status all the active objects in the specified block
 	// This is only really needed for deleting blocks from the map
@@ -423,6 +504,16 @@ class ServerEnvironment : public Environment
 	bool saveStaticToBlock(v3s16 blockpos, u16 store_id,
 			ServerActiveObject *obj, const StaticObject &s_obj, u32 mod_reason);
 
+	/*
+		Applies the LBMs introduced after stamp to the block. The content
+		index built for them is only kept if the block is active.
+	*/
+	void applyLBMs(MapBlock *block, u32 stamp);
+	// The part of activateBlock() that follows the LBMs
+	void runElapsedTimers(MapBlock *block, u32 dtime_s);
+	// Applies the LBMs of queued blocks until the LBM time budget is used up
+	void stepLBMQueue();
+
 	/*
 		Member variables
 	*/
@@ -455,9 +546,26 @@ class ServerEnvironment : public Environment
 	// Time of last clearObjects call (game time).
 	// When a mapblock older than this is loaded, its objects are cleared.
 	u32 m_last_clear_objects_time = 0;
+	// Node timers of the active blocks
+	NodeTimerWheel m_node_timer_wheel;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
 	LBMManager m_lbm_mgr;
+	struct LBMQueuedBlock
+	{
+		MapBlock *block;
+		// Timestamp from before the activation
+		u32 stamp;
+		// For the node timers
+		u32 dtime_s;
+	};
+	// Activated blocks whose LBMs are still to be applied. The blocks are
+	// grabbed and keep their old timestamp until then, and neither their
+	// node timers nor ABMs run.
+	std::deque<LBMQueuedBlock> m_lbm_queue;
+	BlockPosSet m_lbm_pending;
+	// Time per step for applying queued LBMs in ms, 0 to apply them at once
+	float m_lbm_time_budget;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval = 0.1f;
 	// Estimate for general maximum lag as determined by server.
@@ -473,6 +581,16 @@ class ServerEnvironment : public Environment
 	// Pseudo random generator for shuffling, etc.
 	std::mt19937 m_rgen;
 
+	// Threads for the native part of ABM processing, nullptr if disabled
+	std::unique_ptr<WorkerPool> m_abm_pool;
+	// Threads for liquid transformation, nullptr if disabled
+	std::unique_ptr<WorkerPool> m_liquid_pool;
+
+	// Walkability of the map for the pathfinder
+	std::unique_ptr<NavigationCache> m_nav_cache;
+	// Thread for minetest.find_path_async
+	std::unique_ptr<AsyncPathfinder> m_async_pathfinder;
+
 	// Particles
 	IntervalLimiter m_particle_management_interval;
 	std::unordered_map<u32, float> m_particle_spawners;
@@ -43,6 +43,7 @@ Some planning
 */
 
 class ServerEnvironment;
+namespace server { class ActiveObjectMgr; }
 struct ItemStack;
 struct ToolCapabilities;
 struct ObjectProperties;
@@ -79,7 +80,7 @@ class ServerActiveObject : public ActiveObject
 		Some simple getters/setters
 	*/
 	v3f getBasePosition() const { return m_base_position; }
-	void setBasePosition(v3f pos){ m_base_position = pos; }
+	void setBasePosition(v3f pos);
 	ServerEnvironment* getEnv(){ return m_env; }
 
 	/*
@@ -252,10 +253,16 @@ class ServerActiveObject : public ActiveObject
 	static void registerType(u16 type, Factory f);
 
 	ServerEnvironment *m_env;
+	// Only change this through setBasePosition(), which keeps the
+	// spatial index of the object manager up to date
 	v3f m_base_position;
 	std::unordered_set<u32> m_attached_particle_spawners;
 
 private:
+	friend class server::ActiveObjectMgr;
+	// Manager that has this object in its spatial index, if any
+	server::ActiveObjectMgr *m_object_mgr = nullptr;
+
 	// Used for creating objects based on type
 	static std::map<u16, Factory> m_types;
 };
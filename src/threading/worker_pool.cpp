@@ -0,0 +1,102 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "worker_pool.h"
+#include "threading/thread.h"
+
+class WorkerPoolThread : public Thread
+{
+public:
+	WorkerPoolThread(WorkerPool *pool, const std::string &name, u16 worker) :
+		Thread(name),
+		m_pool(pool),
+		m_worker(worker)
+	{}
+
+	// Each thread has its own start signal so that a fast thread cannot
+	// take the turn of another one
+	Semaphore m_start;
+
+protected:
+	void *run()
+	{
+		while (true) {
+			m_start.wait();
+			if (stopRequested())
+				break;
+
+			m_pool->work(m_worker);
+			m_pool->m_done.post();
+		}
+		return nullptr;
+	}
+
+private:
+	WorkerPool *m_pool;
+	u16 m_worker;
+};
+
+WorkerPool::WorkerPool(const std::string &name, u16 thread_count) :
+	m_next_job(0)
+{
+	for (u16 i = 0; i < thread_count; i++) {
+		m_threads.emplace_back(new WorkerPoolThread(this,
+			name + std::to_string(i + 1), i + 1));
+		m_threads.back()->start();
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	for (auto &thread : m_threads) {
+		thread->stop();
+		thread->m_start.post();
+	}
+	for (auto &thread : m_threads)
+		thread->wait();
+}
+
+void WorkerPool::run(size_t job_count, const JobFunc &func)
+{
+	if (job_count == 0)
+		return;
+
+	m_func = &func;
+	m_job_count = job_count;
+	m_next_job = 0;
+
+	// Don't wake up more threads than there is work for
+	size_t woken = MYMIN(m_threads.size(), job_count - 1);
+	for (size_t i = 0; i < woken; i++)
+		m_threads[i]->m_start.post();
+
+	work(0);
+
+	for (size_t i = 0; i < woken; i++)
+		m_done.wait();
+
+	m_func = nullptr;
+}
+
+void WorkerPool::work(u16 worker)
+{
+	size_t job;
+	while ((job = m_next_job++) < m_job_count)
+		(*m_func)(job, worker);
+}
@@ -0,0 +1,67 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "irrlichttypes.h"
+#include "threading/semaphore.h"
+#include "util/basic_macros.h"
+
+class WorkerPoolThread;
+
+/*
+	A fixed set of threads that runs batches of independent jobs.
+
+	run() hands out the jobs to the worker threads and the calling thread
+	and returns once all of them are done, so the caller can rely on every
+	side effect of the jobs afterwards. Only one batch can run at a time.
+*/
+class WorkerPool
+{
+public:
+	// func(job, worker): worker is 0 for the calling thread and
+	// 1..getThreadCount() for the pool threads
+	typedef std::function<void(size_t, u16)> JobFunc;
+
+	WorkerPool(const std::string &name, u16 thread_count);
+	~WorkerPool();
+	DISABLE_CLASS_COPY(WorkerPool);
+
+	u16 getThreadCount() const { return m_threads.size(); }
+
+	void run(size_t job_count, const JobFunc &func);
+
+private:
+	friend class WorkerPoolThread;
+
+	void work(u16 worker);
+
+	std::vector<std::unique_ptr<WorkerPoolThread>> m_threads;
+	Semaphore m_done;
+
+	// State of the current batch, only changed while no thread is working
+	const JobFunc *m_func = nullptr;
+	size_t m_job_count = 0;
+	std::atomic<size_t> m_next_job;
+};
@@ -32,6 +32,7 @@ content_t t_CONTENT_STONE;
 content_t t_CONTENT_GRASS;
 content_t t_CONTENT_TORCH;
 content_t t_CONTENT_WATER;
+content_t t_CONTENT_WATER_FLOWING;
 content_t t_CONTENT_LAVA;
 content_t t_CONTENT_BRICK;
 
@@ -183,6 +184,8 @@ void TestGameDef::defineSomeNodes()
 	f.alpha = 128;
 	f.liquid_type = LIQUID_SOURCE;
 	f.liquid_viscosity = 4;
+	f.liquid_alternative_flowing = "default:water_flowing";
+	f.liquid_alternative_source = "default:water";
 	f.is_ground_content = true;
 	f.groups["liquids"] = 3;
 	for (TileDef &tiledef : f.tiledef)
@@ -190,6 +193,15 @@ void TestGameDef::defineSomeNodes()
 	idef->registerItem(itemdef);
 	t_CONTENT_WATER = ndef->set(f.name, f);
 
+	itemdef.name = "default:water_flowing";
+	itemdef.description = "Flowing Water";
+	f.name = itemdef.name;
+	f.liquid_type = LIQUID_FLOWING;
+	f.param_type_2 = CPT2_FLOWINGLIQUID;
+	f.groups.erase("liquids");
+	idef->registerItem(itemdef);
+	t_CONTENT_WATER_FLOWING = ndef->set(f.name, f);
+
 	//// Lava
 	itemdef = ItemDefinition();
 	itemdef.type = ITEM_NODE;
@@ -255,11 +267,13 @@ bool TestGameDef::sendModChannelMessage(const std::string &channel,
 //// run_tests
 ////
 
-bool run_tests()
+bool run_tests(bool run_benchmarks)
 {
 	u64 t1 = porting::getTimeMs();
 	TestGameDef gamedef;
 
+	TestManager::getRunBenchmarks() = run_benchmarks;
+
 	g_logger.setLevelSilenced(LL_ERROR, true);
 
 	u32 num_modules_failed     = 0;
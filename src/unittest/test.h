@@ -49,6 +49,11 @@ class TestFailedException : public std::exception {
 	rawstream << #fxn << " - " << tdiff << "ms" << std::endl;                 \
 }
 
+// Runs a benchmark like a unit test, but only with --run-benchmarks
+#define BENCHMARK(fxn, ...)                                                   \
+	if (TestManager::getRunBenchmarks())                                      \
+		TEST(fxn, __VA_ARGS__)
+
 // Asserts the specified condition is true, or fails the current unit test
 #define UASSERT(x)                                              \
 	if (!(x)) {                                                 \
@@ -129,6 +134,12 @@ class TestManager {
 	{
 		getTestModules().push_back(module);
 	}
+
+	static bool &getRunBenchmarks()
+	{
+		static bool m_run_benchmarks = false;
+		return m_run_benchmarks;
+	}
 };
 
 // A few item and node definitions for those tests that need them
@@ -136,7 +147,8 @@ extern content_t t_CONTENT_STONE;
 extern content_t t_CONTENT_GRASS;
 extern content_t t_CONTENT_TORCH;
 extern content_t t_CONTENT_WATER;
+extern content_t t_CONTENT_WATER_FLOWING;
 extern content_t t_CONTENT_LAVA;
 extern content_t t_CONTENT_BRICK;
 
-bool run_tests();
+bool run_tests(bool run_benchmarks = false);
@@ -0,0 +1,222 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <set>
+#include "noise.h"
+#include "porting.h"
+#include "serverenvironment.h"
+
+class TestActiveBlockList : public TestBase
+{
+public:
+	TestActiveBlockList() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestActiveBlockList"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testUpdate();
+	void testForceloaded();
+	void benchUpdate();
+};
+
+static TestActiveBlockList g_test_instance;
+
+void TestActiveBlockList::runTests(IGameDef *gamedef)
+{
+	TEST(testUpdate);
+	TEST(testForceloaded);
+	BENCHMARK(benchUpdate);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+typedef std::unordered_map<u16, ActiveBlockArea> AreaMap;
+
+// Builds the lists from scratch, like ActiveBlockList did before it
+// was made incremental
+static void fill_reference(const AreaMap &areas, const BlockPosSet &forceloaded,
+	std::set<v3s16> &list, std::set<v3s16> &abm_list)
+{
+	for (v3s16 p : forceloaded) {
+		list.insert(p);
+		abm_list.insert(p);
+	}
+	for (const auto &it : areas) {
+		const ActiveBlockArea &area = it.second;
+		s16 r = area.getExtent();
+		v3s16 p;
+		for (p.X = area.pos.X - r; p.X <= area.pos.X + r; p.X++)
+		for (p.Y = area.pos.Y - r; p.Y <= area.pos.Y + r; p.Y++)
+		for (p.Z = area.pos.Z - r; p.Z <= area.pos.Z + r; p.Z++) {
+			if (area.inSphere(p)) {
+				list.insert(p);
+				abm_list.insert(p);
+			} else if (area.inCone(p)) {
+				list.insert(p);
+			}
+		}
+	}
+}
+
+static bool set_equals(const BlockPosSet &set, const std::set<v3s16> &ref)
+{
+	if (set.size() != ref.size())
+		return false;
+	for (v3s16 p : ref) {
+		if (!set.contains(p))
+			return false;
+	}
+	return true;
+}
+
+static ActiveBlockArea random_area(PcgRandom &pr, s16 radius, s16 cone_range)
+{
+	ActiveBlockArea area;
+	area.pos = v3s16(pr.range(-20, 20), pr.range(-5, 5), pr.range(-20, 20));
+	area.radius = radius;
+	if (cone_range > radius && pr.range(0, 1)) {
+		area.cone_range = cone_range;
+		area.camera_pos = intToFloat(area.pos * MAP_BLOCKSIZE, BS);
+		area.camera_dir = v3f(0, 0, 1);
+		area.camera_dir.rotateXZBy(pr.range(0, 359));
+		area.fov = 1.2f;
+	}
+	return area;
+}
+
+void TestActiveBlockList::testUpdate()
+{
+	ActiveBlockList list;
+	AreaMap areas;
+	std::set<v3s16> prev_list;
+	PcgRandom pr(5);
+
+	for (u32 step = 0; step < 100; step++) {
+		// Move, add and remove players
+		for (u16 id = 1; id <= 10; id++) {
+			int action = pr.range(0, 5);
+			if (action == 0)
+				areas.erase(id);
+			else if (action < 3 || areas.find(id) == areas.end())
+				areas[id] = random_area(pr, 2, 4);
+			else
+				areas[id].pos.X += 1;
+		}
+
+		std::vector<v3s16> removed, added;
+		list.updateAreas(areas, removed, added);
+
+		std::set<v3s16> ref_list, ref_abm_list;
+		fill_reference(areas, list.m_forceloaded_list, ref_list, ref_abm_list);
+		UASSERT(set_equals(list.m_list, ref_list));
+		UASSERT(set_equals(list.m_abm_list, ref_abm_list));
+
+		// The changes are reported exactly once
+		std::set<v3s16> ref_removed, ref_added;
+		for (v3s16 p : prev_list) {
+			if (ref_list.find(p) == ref_list.end())
+				ref_removed.insert(p);
+		}
+		for (v3s16 p : ref_list) {
+			if (prev_list.find(p) == prev_list.end())
+				ref_added.insert(p);
+		}
+		UASSERT(std::set<v3s16>(removed.begin(), removed.end()) == ref_removed);
+		UASSERT(std::set<v3s16>(added.begin(), added.end()) == ref_added);
+		UASSERTEQ(size_t, removed.size(), ref_removed.size());
+		UASSERTEQ(size_t, added.size(), ref_added.size());
+
+		prev_list = ref_list;
+	}
+}
+
+void TestActiveBlockList::testForceloaded()
+{
+	ActiveBlockList list;
+	AreaMap areas;
+	std::vector<v3s16> removed, added;
+	const v3s16 p(100, 0, 100);
+
+	list.m_forceloaded_list.insert(p);
+	list.updateAreas(areas, removed, added);
+	UASSERT(list.contains(p) && list.m_abm_list.contains(p));
+	UASSERT(added.size() == 1 && added[0] == p);
+
+	// A block that could not be loaded is reported again
+	list.retryLater(p);
+	UASSERT(!list.contains(p));
+	added.clear();
+	list.updateAreas(areas, removed, added);
+	UASSERT(list.contains(p));
+	UASSERT(added.size() == 1 && added[0] == p);
+
+	// A player keeps it active after the forceload is removed
+	ActiveBlockArea area;
+	area.pos = p;
+	area.radius = 1;
+	areas[1] = area;
+	list.m_forceloaded_list.erase(p);
+	added.clear();
+	list.updateAreas(areas, removed, added);
+	UASSERT(list.contains(p) && removed.empty());
+
+	areas.clear();
+	list.updateAreas(areas, removed, added);
+	UASSERT(!list.contains(p) && list.m_list.empty() && list.m_abm_list.empty());
+}
+
+void TestActiveBlockList::benchUpdate()
+{
+	// 100 players with active_block_range 4 walking around, compared to
+	// building the lists from scratch every step
+	ActiveBlockList list;
+	AreaMap areas;
+	PcgRandom pr(77);
+	for (u16 id = 1; id <= 100; id++)
+		areas[id] = random_area(pr, 4, 4);
+
+	u64 time_incremental = 0, time_rebuild = 0;
+	std::vector<v3s16> removed, added;
+	for (u32 step = 0; step < 50; step++) {
+		// A third of the players move to a neighbouring block
+		for (auto &it : areas) {
+			if (pr.range(0, 2) == 0)
+				it.second.pos.X += pr.range(0, 1) * 2 - 1;
+		}
+
+		removed.clear();
+		added.clear();
+		u64 t = porting::getTimeUs();
+		list.updateAreas(areas, removed, added);
+		time_incremental += porting::getTimeUs() - t;
+
+		t = porting::getTimeUs();
+		std::set<v3s16> ref_list, ref_abm_list;
+		fill_reference(areas, list.m_forceloaded_list, ref_list, ref_abm_list);
+		time_rebuild += porting::getTimeUs() - t;
+
+		UASSERTEQ(size_t, list.m_list.size(), ref_list.size());
+	}
+
+	rawstream << "benchUpdate: 100 players, active_block_range 4, 50 steps: "
+		<< "incremental " << time_incremental << "us, rebuild "
+		<< time_rebuild << "us" << std::endl;
+}
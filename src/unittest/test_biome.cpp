@@ -0,0 +1,273 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <cmath>
+#include <memory>
+#include "mapgen/mg_biome.h"
+#include "noise.h"
+#include "porting.h"
+
+class TestBiome : public TestBase
+{
+public:
+	TestBiome() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestBiome"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testIndexEmpty();
+	void testIndexMatchesLinear();
+	void testIndexMemoryLimit();
+	void benchBiomeLookup();
+};
+
+static TestBiome g_test_instance;
+
+void TestBiome::runTests(IGameDef *gamedef)
+{
+	TEST(testIndexEmpty);
+	TEST(testIndexMatchesLinear);
+	TEST(testIndexMemoryLimit);
+	BENCHMARK(benchBiomeLookup);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Biomes like the ones of games: land, shores, oceans and caverns, each
+// with a few heat and humidity points. Or with Y limits of their own, like
+// when many mods add biomes.
+class TestBiomes
+{
+public:
+	TestBiomes(u32 count, PcgRandom &pr, bool own_y_limits = false)
+	{
+		static const s16 layers[][2] = {
+			{4, 31000}, {-1, 3}, {-255, -2}, {-31000, -256},
+		};
+		// BIOME_NONE
+		add(new Biome);
+
+		for (u32 i = 0; i != count; i++) {
+			Biome *b = new Biome;
+			const s16 *layer = layers[pr.range(0, 3)];
+			b->min_pos = v3s16(-31000, layer[0], -31000);
+			b->max_pos = v3s16(31000, layer[1], 31000);
+			b->vertical_blend = pr.range(0, 3) == 0 ? pr.range(1, 8) : 0;
+			// Some share their point
+			b->heat_point = pr.range(0, 20) * 5;
+			b->humidity_point = pr.range(0, 20) * 5;
+			// And some are limited to an area
+			if (pr.range(0, 9) == 0) {
+				b->min_pos.X = pr.range(-500, 0);
+				b->max_pos.Z = pr.range(0, 500);
+			}
+			if (own_y_limits) {
+				s16 y = pr.range(-400, 400);
+				b->min_pos.Y = y - pr.range(0, 300);
+				b->max_pos.Y = y + pr.range(0, 300);
+			}
+			add(b);
+		}
+	}
+
+	void add(Biome *b)
+	{
+		owned.emplace_back(b);
+		biomes.push_back(b);
+	}
+
+	BiomeClosest findLinear(float heat, float humidity, v3s16 pos) const
+	{
+		BiomeClosest closest;
+		for (size_t i = 1; i < biomes.size(); i++)
+			closest.check(biomes[i], heat, humidity, pos);
+		return closest;
+	}
+
+	std::vector<Biome *> biomes;
+
+private:
+	std::vector<std::unique_ptr<Biome>> owned;
+};
+
+void TestBiome::testIndexEmpty()
+{
+	PcgRandom pr(1);
+	TestBiomes none(0, pr);
+	BiomeIndex index;
+	index.build(none.biomes);
+	UASSERTEQ(size_t, index.getBiomeCount(), 1);
+
+	BiomeClosest closest;
+	UASSERT(index.find(50, 50, v3s16(0, 0, 0), closest));
+	UASSERT(!closest.biome && !closest.biome_blend);
+
+	// Not covered by the index
+	TestBiomes some(5, pr);
+	index.build(some.biomes);
+	UASSERT(!index.find(NAN, 50, v3s16(0, 0, 0), closest));
+	UASSERT(!index.find(50, INFINITY, v3s16(0, 0, 0), closest));
+	UASSERT(!index.find(50, 50, v3s16(31001, 0, 0), closest));
+	UASSERT(index.find(50, 50, v3s16(31000, 0, -31000), closest));
+}
+
+// Compares lookups to the linear search, returns how many the index
+// doesn't cover
+static u32 check_index(const TestBiomes &biomes, const BiomeIndex &index,
+	PcgRandom &pr, u32 count)
+{
+	u32 not_covered = 0;
+	for (u32 i = 0; i != count; i++) {
+		float heat, humidity;
+		if (i % 8 == 0) {
+			// Exactly at a point, and ties between shared points
+			const Biome *b = biomes.biomes[pr.range(1, biomes.biomes.size() - 1)];
+			if (!b)
+				continue;
+			heat = b->heat_point;
+			humidity = b->humidity_point;
+		} else {
+			// Beyond the points as well
+			heat = pr.range(-60000, 160000) / 1000.0f;
+			humidity = pr.range(-60000, 160000) / 1000.0f;
+		}
+		v3s16 pos(pr.range(-1000, 1000), pr.range(-300, 300),
+			pr.range(-1000, 1000));
+		if (i % 16 == 1)
+			pos.Y = pr.range(-31000, 31000);
+
+		BiomeClosest expected = biomes.findLinear(heat, humidity, pos);
+		BiomeClosest actual;
+		if (!index.find(heat, humidity, pos, actual)) {
+			not_covered++;
+			continue;
+		}
+		UASSERT(actual.biome == expected.biome);
+		UASSERT(actual.dist == expected.dist);
+		UASSERT(actual.biome_blend == expected.biome_blend);
+		UASSERT(actual.dist_blend == expected.dist_blend);
+	}
+	return not_covered;
+}
+
+void TestBiome::testIndexMatchesLinear()
+{
+	PcgRandom pr(42);
+	static const u32 counts[] = {1, 2, 7, 30, 120};
+	for (u32 count : counts) {
+		TestBiomes biomes(count, pr);
+		// Removed biomes stay as NULL
+		if (count > 5)
+			biomes.biomes[3] = nullptr;
+		BiomeIndex index;
+		index.build(biomes.biomes);
+		UASSERTEQ(u32, check_index(biomes, index, pr, 50000), 0);
+	}
+
+	// Many different Y limits, which are merged into fewer ranges
+	static const u32 counts_own_y[] = {30, 500};
+	for (u32 count : counts_own_y) {
+		TestBiomes biomes(count, pr, true);
+		BiomeIndex index;
+		index.build(biomes.biomes);
+		UASSERTEQ(u32, check_index(biomes, index, pr, 50000), 0);
+	}
+}
+
+void TestBiome::testIndexMemoryLimit()
+{
+	PcgRandom pr(9);
+	TestBiomes biomes(500, pr, true);
+	BiomeIndex index;
+	index.build(biomes.biomes);
+	UASSERT(index.getBytes() <= 8 * 1024 * 1024);
+
+	// The rest of the ranges is left to the linear search
+	const size_t max_bytes = index.getBytes() / 4;
+	index.build(biomes.biomes, max_bytes);
+	UASSERT(index.getBytes() <= max_bytes);
+	u32 not_covered = check_index(biomes, index, pr, 20000);
+	UASSERT(not_covered > 0 && not_covered < 20000);
+
+	// Around the surface first
+	BiomeClosest closest;
+	UASSERT(index.find(50, 50, v3s16(0, 0, 0), closest));
+
+	index.build(biomes.biomes, 0);
+	UASSERTEQ(size_t, index.getBytes(), 0);
+	UASSERT(!index.find(50, 50, v3s16(0, 0, 0), closest));
+}
+
+void TestBiome::benchBiomeLookup()
+{
+	// Heat and humidity of a mapchunk, at heights around the surface
+	const u32 count = 80 * 80 * 20;
+	NoiseParams np_heat(50, 50, v3f(1000, 1000, 1000), 5349, 3, 0.5, 2.0);
+	NoiseParams np_humidity(50, 50, v3f(1000, 1000, 1000), 842, 3, 0.5, 2.0);
+	Noise heat(&np_heat, 1, 80, 80);
+	Noise humidity(&np_humidity, 1, 80, 80);
+	heat.perlinMap2D(-1000, 2000);
+	humidity.perlinMap2D(-1000, 2000);
+
+	rawstream << "benchBiomeLookup: " << count << " lookups:";
+	// And the same count with Y limits of their own
+	static const u32 biome_counts[] = {10, 100, 500, 500};
+	for (u32 n = 0; n != 4; n++) {
+		const u32 biome_count = biome_counts[n];
+		const bool own_y_limits = n == 3;
+		PcgRandom pr(biome_count);
+		TestBiomes biomes(biome_count, pr, own_y_limits);
+
+		u64 t = porting::getTimeUs();
+		BiomeIndex index;
+		index.build(biomes.biomes);
+		u64 time_build = porting::getTimeUs() - t;
+
+		size_t sum_linear = 0;
+		t = porting::getTimeUs();
+		for (u32 i = 0; i != count; i++) {
+			v3s16 pos(i % 80, (s16)(i / 6400) - 6, i / 80 % 80);
+			BiomeClosest closest = biomes.findLinear(heat.result[i % 6400],
+				humidity.result[i % 6400], pos);
+			sum_linear += (size_t)closest.biome + (size_t)closest.biome_blend;
+		}
+		u64 time_linear = porting::getTimeUs() - t;
+
+		size_t sum_index = 0;
+		t = porting::getTimeUs();
+		for (u32 i = 0; i != count; i++) {
+			v3s16 pos(i % 80, (s16)(i / 6400) - 6, i / 80 % 80);
+			BiomeClosest closest;
+			index.find(heat.result[i % 6400], humidity.result[i % 6400], pos,
+				closest);
+			sum_index += (size_t)closest.biome + (size_t)closest.biome_blend;
+		}
+		u64 time_index = porting::getTimeUs() - t;
+		UASSERT(sum_index == sum_linear);
+
+		rawstream << " " << biome_count << " biomes"
+			<< (own_y_limits ? " with own Y limits" : "") << ": linear "
+			<< time_linear / 1000 << "ms, index " << time_index / 1000
+			<< "ms (built in " << time_build / 1000 << "ms, "
+			<< index.getBytes() / 1024 << "KiB),";
+	}
+	rawstream << std::endl;
+}
@@ -0,0 +1,147 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include "mapblock_contentindex.h"
+#include "noise.h"
+
+class TestBlockContentIndex : public TestBase
+{
+public:
+	TestBlockContentIndex() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestBlockContentIndex"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testBuild();
+	void testUpdate();
+	void testSample();
+};
+
+static TestBlockContentIndex g_test_instance;
+
+void TestBlockContentIndex::runTests(IGameDef *gamedef)
+{
+	TEST(testBuild);
+	TEST(testUpdate);
+	TEST(testSample);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const u32 NODECOUNT = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
+
+// Checks that the lists of the index match the nodes exactly
+static bool index_matches(const BlockContentIndex &index, const MapNode *nodes)
+{
+	u32 total = 0;
+	for (const auto &list : index.getLists()) {
+		if (list.second.empty())
+			return false;
+		for (u16 i : list.second) {
+			if (nodes[i].getContent() != list.first)
+				return false;
+		}
+		total += list.second.size();
+	}
+	return total == NODECOUNT;
+}
+
+void TestBlockContentIndex::testBuild()
+{
+	MapNode nodes[NODECOUNT];
+	for (u32 i = 0; i < NODECOUNT; i++)
+		nodes[i] = MapNode(i < 1000 ? CONTENT_AIR : (i % 7 == 0 ? 10 : 11));
+
+	BlockContentIndex index(nodes, NODECOUNT);
+	UASSERTEQ(size_t, index.getLists().size(), 3);
+	UASSERTEQ(size_t, index.get(CONTENT_AIR)->size(), 1000);
+	UASSERT(index.get(12) == nullptr);
+	UASSERT(index_matches(index, nodes));
+
+	v3s16 p = BlockContentIndex::indexToPos(3 + 5 * MAP_BLOCKSIZE +
+		7 * MAP_BLOCKSIZE * MAP_BLOCKSIZE);
+	UASSERT(p == v3s16(3, 5, 7));
+}
+
+void TestBlockContentIndex::testUpdate()
+{
+	MapNode nodes[NODECOUNT];
+	for (u32 i = 0; i < NODECOUNT; i++)
+		nodes[i] = MapNode(CONTENT_AIR);
+	BlockContentIndex index(nodes, NODECOUNT);
+
+	PcgRandom pr(42);
+	for (u32 n = 0; n < 20000; n++) {
+		u16 i = pr.range(0, NODECOUNT - 1);
+		content_t c = pr.range(0, 9);
+		index.update(i, nodes[i].getContent(), c);
+		nodes[i].setContent(c);
+	}
+	UASSERT(index_matches(index, nodes));
+
+	// Lists of contents that are gone are removed
+	for (u32 i = 0; i < NODECOUNT; i++) {
+		index.update(i, nodes[i].getContent(), CONTENT_AIR);
+		nodes[i].setContent(CONTENT_AIR);
+	}
+	UASSERTEQ(size_t, index.getLists().size(), 1);
+	UASSERT(index_matches(index, nodes));
+}
+
+void TestBlockContentIndex::testSample()
+{
+	std::vector<u16> list(NODECOUNT);
+	for (u32 i = 0; i < NODECOUNT; i++)
+		list[i] = i;
+
+	PcgRandom pr(1234);
+	auto rand = [&pr] () { return pr.next(); };
+	std::vector<u16> picked;
+
+	// Chance 1 picks everything
+	BlockContentIndex::sample(list, 1, rand, picked);
+	UASSERT(picked == list);
+
+	// The picks are distinct and in list order; their number follows the
+	// binomial distribution (mean 4096 / 50, standard deviation ~9)
+	const u32 rounds = 1000;
+	u64 total = 0;
+	for (u32 r = 0; r < rounds; r++) {
+		picked.clear();
+		BlockContentIndex::sample(list, 50, rand, picked);
+		UASSERT(std::is_sorted(picked.begin(), picked.end()));
+		UASSERT(std::adjacent_find(picked.begin(), picked.end()) == picked.end());
+		total += picked.size();
+	}
+	double mean = (double)total / rounds;
+	UASSERT(mean > NODECOUNT / 50.0 - 1.5 && mean < NODECOUNT / 50.0 + 1.5);
+
+	// Every position gets picked eventually
+	std::vector<u32> hits(NODECOUNT);
+	for (u32 r = 0; r < 200; r++) {
+		picked.clear();
+		BlockContentIndex::sample(list, 8, rand, picked);
+		for (u16 i : picked)
+			hits[i]++;
+	}
+	UASSERT(std::find(hits.begin(), hits.end(), 0) == hits.end());
+}
@@ -37,6 +37,11 @@ class TestCompression : public TestBase {
 	void testRLECompression();
 	void testZlibCompression();
 	void testZlibLargeData();
+#if USE_ZSTD
+	void testZstdCompression();
+	void testZstdTruncated();
+	void testZstdCorrupt();
+#endif
 };
 
 static TestCompression g_test_instance;
@@ -46,6 +51,11 @@ void TestCompression::runTests(IGameDef *gamedef)
 	TEST(testRLECompression);
 	TEST(testZlibCompression);
 	TEST(testZlibLargeData);
+#if USE_ZSTD
+	TEST(testZstdCompression);
+	TEST(testZstdTruncated);
+	TEST(testZstdCorrupt);
+#endif
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -170,3 +180,101 @@ void TestCompression::testZlibLargeData()
 				i, str_decompressed[i], i, data_in[i]);
 	}
 }
+
+#if USE_ZSTD
+
+static std::string zstd_test_data(u32 size)
+{
+	// Compressible, like node data
+	std::string data(size, '\0');
+	PseudoRandom pseudorandom(size);
+	for (u32 i = 0; i < size; i++)
+		data[i] = pseudorandom.range(0, 3) == 0 ? pseudorandom.range(0, 255) : i / 64;
+	return data;
+}
+
+void TestCompression::testZstdCompression()
+{
+	// Larger than the buffers of decompressZstd() as well
+	static const u32 sizes[] = {0, 1, 4, 4096, 16384, 50000, 200000};
+	for (u32 size : sizes) {
+		std::string data = zstd_test_data(size);
+		std::ostringstream os(std::ios_base::binary);
+		compress(data, os, SER_FMT_VER_ZSTD);
+		// Followed by other data, which must be left in the stream
+		os << "after";
+
+		std::istringstream is(os.str(), std::ios_base::binary);
+		std::ostringstream os2(std::ios_base::binary);
+		decompress(is, os2, SER_FMT_VER_ZSTD);
+		UASSERT(os2.str() == data);
+
+		std::string after;
+		is >> after;
+		UASSERT(after == "after");
+	}
+
+	// Not a zlib stream
+	std::ostringstream os(std::ios_base::binary);
+	compress(zstd_test_data(100), os, SER_FMT_VER_ZSTD);
+	std::istringstream is(os.str(), std::ios_base::binary);
+	std::ostringstream os2(std::ios_base::binary);
+	EXCEPTION_CHECK(SerializationError, decompress(is, os2, SER_FMT_VER_ZSTD - 1));
+}
+
+void TestCompression::testZstdTruncated()
+{
+	std::string data = zstd_test_data(50000);
+	std::ostringstream os(std::ios_base::binary);
+	compressZstd(data, os);
+	const std::string compressed = os.str();
+
+	for (size_t size : {(size_t)0, (size_t)3, compressed.size() / 2,
+			compressed.size() - 1}) {
+		std::istringstream is(compressed.substr(0, size), std::ios_base::binary);
+		std::ostringstream os2(std::ios_base::binary);
+		EXCEPTION_CHECK(SerializationError, decompressZstd(is, os2));
+	}
+}
+
+void TestCompression::testZstdCorrupt()
+{
+	std::string data = zstd_test_data(50000);
+	std::ostringstream os(std::ios_base::binary);
+	compressZstd(data, os);
+	const std::string compressed = os.str();
+
+	// Bad magic number
+	std::string corrupt = compressed;
+	corrupt[0] ^= 0x55;
+	std::istringstream is(corrupt, std::ios_base::binary);
+	std::ostringstream os2(std::ios_base::binary);
+	EXCEPTION_CHECK(SerializationError, decompressZstd(is, os2));
+
+	// Garbage
+	std::string garbage(1000, '\0');
+	PseudoRandom pseudorandom(1);
+	for (char &c : garbage)
+		c = pseudorandom.range(0, 255);
+	is.str(garbage);
+	is.clear();
+	EXCEPTION_CHECK(SerializationError, decompressZstd(is, os2));
+
+	// Damaged compressed data may or may not be detected, but must not
+	// crash or decompress to more than the frame says
+	for (size_t i = 4; i < compressed.size(); i += 97) {
+		corrupt = compressed;
+		corrupt[i] ^= 0xff;
+		is.str(corrupt);
+		is.clear();
+		std::ostringstream os3(std::ios_base::binary);
+		try {
+			decompressZstd(is, os3);
+		} catch (SerializationError &e) {
+			continue;
+		}
+		UASSERT(os3.str().size() <= data.size() + 1024);
+	}
+}
+
+#endif
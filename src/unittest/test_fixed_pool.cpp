@@ -0,0 +1,233 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <set>
+#include <thread>
+#include "mapblock.h"
+#include "noise.h"
+#include "porting.h"
+#include "util/fixed_pool.h"
+
+class TestFixedPool : public TestBase
+{
+public:
+	TestFixedPool() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestFixedPool"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testAllocate();
+	void testThreads();
+	void testTrim();
+	void testMapBlock(IGameDef *gamedef);
+	void benchAllocate();
+};
+
+static TestFixedPool g_test_instance;
+
+void TestFixedPool::runTests(IGameDef *gamedef)
+{
+	TEST(testAllocate);
+	TEST(testThreads);
+	TEST(testTrim);
+	TEST(testMapBlock, gamedef);
+	BENCHMARK(benchAllocate);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestFixedPool::testAllocate()
+{
+	FixedSizePool pool(100, 16, 8);
+	UASSERTEQ(size_t, pool.getObjectSize() % alignof(std::max_align_t), 0);
+	UASSERT(pool.getObjectSize() >= 100);
+
+	std::set<u8 *> objects;
+	for (u32 i = 0; i < 40; i++) {
+		u8 *p = static_cast<u8 *>(pool.allocate());
+		UASSERTEQ(size_t, (size_t)p % alignof(std::max_align_t), 0);
+		memset(p, i, 100);
+		UASSERT(objects.insert(p).second);
+	}
+
+	FixedSizePool::Stats stats = pool.getStats();
+	UASSERTEQ(size_t, stats.slabs, 3);
+	UASSERTEQ(size_t, stats.objects_used, 40);
+	UASSERTEQ(size_t, stats.objects_free, 8);
+	UASSERTEQ(u64, stats.allocations, 40);
+
+	for (u8 *p : objects)
+		pool.deallocate(p);
+	stats = pool.getStats();
+	UASSERTEQ(size_t, stats.objects_used, 0);
+	UASSERTEQ(size_t, stats.objects_free, 48);
+
+	// Freed objects are used again
+	u8 *p = static_cast<u8 *>(pool.allocate());
+	UASSERT(objects.count(p) == 1);
+	pool.deallocate(p);
+	pool.deallocate(nullptr);
+	UASSERTEQ(size_t, pool.getStats().slabs, 3);
+}
+
+void TestFixedPool::testThreads()
+{
+	FixedSizePool pool(64, 32, 16);
+	std::atomic<bool> shared(false);
+	std::vector<std::thread> threads;
+	for (u32 t = 0; t < 4; t++) {
+		threads.emplace_back([&pool, &shared, t] () {
+			PcgRandom pr(t);
+			std::vector<u32 *> objects;
+			for (u32 i = 0; i < 20000; i++) {
+				if (objects.empty() || pr.range(0, 2) != 0) {
+					u32 *p = static_cast<u32 *>(pool.allocate());
+					*p = t;
+					objects.push_back(p);
+				} else {
+					size_t j = pr.range(0, objects.size() - 1);
+					// Nobody else wrote to it
+					if (*objects[j] != t)
+						shared = true;
+					pool.deallocate(objects[j]);
+					objects[j] = objects.back();
+					objects.pop_back();
+				}
+			}
+			// Freed by another thread than the one allocating them
+			std::thread other([&pool, &objects] () {
+				for (u32 *p : objects)
+					pool.deallocate(p);
+			});
+			other.join();
+		});
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+	UASSERT(!shared);
+
+	// The exited threads gave their objects back
+	FixedSizePool::Stats stats = pool.getStats();
+	UASSERTEQ(size_t, stats.objects_used, 0);
+	UASSERTEQ(size_t, stats.objects_free, stats.slabs * 32);
+	UASSERT(stats.allocations > 4 * 10000);
+	UASSERT(stats.shared_allocations < stats.allocations / 4);
+}
+
+void TestFixedPool::testTrim()
+{
+	FixedSizePool pool(32, 8, 0);
+	std::vector<void *> objects;
+	for (u32 i = 0; i < 8 * 5; i++)
+		objects.push_back(pool.allocate());
+	UASSERTEQ(size_t, pool.getStats().slabs, 5);
+	UASSERTEQ(size_t, pool.trim(), 0);
+
+	// Keep one object of the second slab, objects were taken in order
+	for (u32 i = 0; i < objects.size(); i++) {
+		if (i != 12)
+			pool.deallocate(objects[i]);
+	}
+	UASSERTEQ(size_t, pool.trim(), 4);
+	FixedSizePool::Stats stats = pool.getStats();
+	UASSERTEQ(size_t, stats.slabs, 1);
+	UASSERTEQ(size_t, stats.objects_used, 1);
+	UASSERTEQ(size_t, stats.objects_free, 7);
+
+	std::set<void *> again;
+	for (u32 i = 0; i < 7; i++)
+		again.insert(pool.allocate());
+	UASSERT(again.count(objects[12]) == 0);
+	UASSERTEQ(size_t, pool.getStats().slabs, 1);
+	pool.allocate();
+	UASSERTEQ(size_t, pool.getStats().slabs, 2);
+}
+
+void TestFixedPool::testMapBlock(IGameDef *gamedef)
+{
+	FixedSizePool::Stats blocks, nodes;
+	MapBlock::getPoolStats(blocks, nodes);
+	size_t blocks_used = blocks.objects_used;
+	size_t nodes_used = nodes.objects_used;
+
+	std::vector<MapBlock *> created;
+	for (s16 i = 0; i < 100; i++)
+		created.push_back(new MapBlock(nullptr, v3s16(i, 0, 0), gamedef, i % 10 == 0));
+	MapBlock::getPoolStats(blocks, nodes);
+	UASSERTEQ(size_t, blocks.objects_used, blocks_used + 100);
+	// Dummy blocks have no node data
+	UASSERTEQ(size_t, nodes.objects_used, nodes_used + 90);
+	UASSERT(created[1]->getNodeNoEx(v3s16(1, 2, 3)).getContent() == CONTENT_IGNORE);
+
+	for (MapBlock *block : created)
+		delete block;
+	MapBlock::getPoolStats(blocks, nodes);
+	UASSERTEQ(size_t, blocks.objects_used, blocks_used);
+	UASSERTEQ(size_t, nodes.objects_used, nodes_used);
+	UASSERT(MapBlock::getPooledSize() >= sizeof(MapBlock) +
+		MapBlock::nodecount * sizeof(MapNode));
+}
+
+void TestFixedPool::benchAllocate()
+{
+	// Blocks loaded and unloaded while players move: a working set of
+	// node arrays of which a few are replaced each round
+	const size_t size = MapBlock::nodecount * sizeof(MapNode);
+	const u32 working_set = 2000;
+	const u32 rounds = 200000;
+	PcgRandom pr(7);
+	std::vector<u32> replace(rounds);
+	for (u32 &i : replace)
+		i = pr.range(0, working_set - 1);
+
+	FixedSizePool pool(size, 64);
+	std::vector<void *> objects(working_set);
+	u64 t = porting::getTimeUs();
+	for (void *&p : objects)
+		p = pool.allocate();
+	for (u32 i : replace) {
+		pool.deallocate(objects[i]);
+		objects[i] = pool.allocate();
+		static_cast<u8 *>(objects[i])[0] = 1;
+	}
+	for (void *p : objects)
+		pool.deallocate(p);
+	u64 time_pool = porting::getTimeUs() - t;
+
+	std::vector<u8 *> arrays(working_set);
+	t = porting::getTimeUs();
+	for (u8 *&p : arrays)
+		p = new u8[size];
+	for (u32 i : replace) {
+		delete[] arrays[i];
+		arrays[i] = new u8[size];
+		arrays[i][0] = 1;
+	}
+	for (u8 *p : arrays)
+		delete[] p;
+	u64 time_new = porting::getTimeUs() - t;
+
+	rawstream << "benchAllocate: " << rounds << " replaced node arrays: pool "
+		<< time_pool / 1000 << "ms, new[] " << time_new / 1000 << "ms" << std::endl;
+}
@@ -0,0 +1,183 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "mapblock.h"
+#include "serverenvironment.h"
+
+class TestLBMManager : public TestBase
+{
+public:
+	TestLBMManager() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestLBMManager"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testApply(IGameDef *gamedef);
+	void testIntroductionTimes(IGameDef *gamedef);
+	void testReplacedNodes(IGameDef *gamedef);
+};
+
+static TestLBMManager g_test_instance;
+
+void TestLBMManager::runTests(IGameDef *gamedef)
+{
+	TEST(testApply, gamedef);
+	TEST(testIntroductionTimes, gamedef);
+	TEST(testReplacedNodes, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Records where it was triggered, and optionally turns all nodes of the
+// content it was triggered on into air
+struct TestLBM : public LoadingBlockModifierDef
+{
+	TestLBM(const std::string &name_, const std::string &trigger,
+		MapBlock *block_ = nullptr) :
+		block(block_)
+	{
+		name = name_;
+		trigger_contents.insert(trigger);
+	}
+
+	void trigger(ServerEnvironment *env, v3s16 p, MapNode n)
+	{
+		triggered.push_back(p);
+		if (!block)
+			return;
+		MapNode air(CONTENT_AIR);
+		v3s16 rp;
+		for (rp.Z = 0; rp.Z < MAP_BLOCKSIZE; rp.Z++)
+		for (rp.Y = 0; rp.Y < MAP_BLOCKSIZE; rp.Y++)
+		for (rp.X = 0; rp.X < MAP_BLOCKSIZE; rp.X++) {
+			if (block->getNodeNoEx(rp).getContent() == n.getContent())
+				block->setNodeNoCheck(rp, air);
+		}
+	}
+
+	std::vector<v3s16> triggered;
+	MapBlock *block;
+};
+
+static void fill_block(MapBlock *block)
+{
+	MapNode air(CONTENT_AIR);
+	v3s16 rp;
+	for (rp.Z = 0; rp.Z < MAP_BLOCKSIZE; rp.Z++)
+	for (rp.Y = 0; rp.Y < MAP_BLOCKSIZE; rp.Y++)
+	for (rp.X = 0; rp.X < MAP_BLOCKSIZE; rp.X++)
+		block->setNodeNoCheck(rp, air);
+
+	MapNode stone(t_CONTENT_STONE);
+	block->setNodeNoCheck(v3s16(1, 2, 3), stone);
+	block->setNodeNoCheck(v3s16(15, 0, 0), stone);
+	block->setNodeNoCheck(v3s16(0, 15, 15), stone);
+	MapNode grass(t_CONTENT_GRASS);
+	block->setNodeNoCheck(v3s16(4, 4, 4), grass);
+}
+
+void TestLBMManager::testApply(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(1, 0, -1), gamedef);
+	fill_block(&block);
+
+	TestLBM *stone_lbm = new TestLBM("test:stone", "default:stone");
+	TestLBM *grass_lbm = new TestLBM("test:grass", "default:dirt_with_grass");
+	TestLBM *lava_lbm = new TestLBM("test:lava", "default:lava");
+	LBMManager mgr;
+	mgr.addLBMDef(stone_lbm);
+	mgr.addLBMDef(grass_lbm);
+	mgr.addLBMDef(lava_lbm);
+	mgr.loadIntroductionTimes("", gamedef, 100);
+
+	mgr.applyLBMs(nullptr, &block, 50);
+	v3s16 origin = block.getPosRelative();
+	UASSERTEQ(size_t, stone_lbm->triggered.size(), 3);
+	// In the order of X, then Y, then Z, like when all nodes were visited
+	UASSERT(stone_lbm->triggered[0] == origin + v3s16(0, 15, 15));
+	UASSERT(stone_lbm->triggered[1] == origin + v3s16(1, 2, 3));
+	UASSERT(stone_lbm->triggered[2] == origin + v3s16(15, 0, 0));
+	UASSERTEQ(size_t, grass_lbm->triggered.size(), 1);
+	UASSERT(grass_lbm->triggered[0] == origin + v3s16(4, 4, 4));
+	UASSERT(lava_lbm->triggered.empty());
+
+	// The content index stays valid for the next activation
+	MapNode stone(t_CONTENT_STONE);
+	block.setNodeNoCheck(v3s16(4, 4, 4), stone);
+	stone_lbm->triggered.clear();
+	grass_lbm->triggered.clear();
+	mgr.applyLBMs(nullptr, &block, 50);
+	UASSERTEQ(size_t, stone_lbm->triggered.size(), 4);
+	UASSERT(grass_lbm->triggered.empty());
+}
+
+void TestLBMManager::testIntroductionTimes(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(0, 0, 0), gamedef);
+	fill_block(&block);
+
+	TestLBM *old_lbm = new TestLBM("test:old", "default:stone");
+	TestLBM *new_lbm = new TestLBM("test:new", "default:stone");
+	TestLBM *always_lbm = new TestLBM("test:always", "default:stone");
+	always_lbm->run_at_every_load = true;
+	LBMManager mgr;
+	mgr.addLBMDef(old_lbm);
+	mgr.addLBMDef(new_lbm);
+	mgr.addLBMDef(always_lbm);
+	mgr.loadIntroductionTimes("test:old~20;", gamedef, 100);
+
+	UASSERT(mgr.hasLBMsIntroducedAfter(20));
+	UASSERT(mgr.hasLBMsIntroducedAfter(200));
+
+	mgr.applyLBMs(nullptr, &block, 50);
+	UASSERT(old_lbm->triggered.empty());
+	UASSERTEQ(size_t, new_lbm->triggered.size(), 3);
+	UASSERTEQ(size_t, always_lbm->triggered.size(), 3);
+
+	mgr.applyLBMs(nullptr, &block, 10);
+	UASSERTEQ(size_t, old_lbm->triggered.size(), 3);
+
+	mgr.applyLBMs(nullptr, &block, 200);
+	UASSERTEQ(size_t, new_lbm->triggered.size(), 6);
+	UASSERTEQ(size_t, always_lbm->triggered.size(), 9);
+
+	LBMManager mgr2;
+	mgr2.addLBMDef(new TestLBM("test:some", "default:stone"));
+	mgr2.loadIntroductionTimes("", gamedef, 100);
+	UASSERT(mgr2.hasLBMsIntroducedAfter(100));
+	UASSERT(!mgr2.hasLBMsIntroducedAfter(101));
+}
+
+void TestLBMManager::testReplacedNodes(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(0, 0, 0), gamedef);
+	fill_block(&block);
+
+	// Removes all stone when it is first triggered
+	TestLBM *stone_lbm = new TestLBM("test:stone", "default:stone", &block);
+	LBMManager mgr;
+	mgr.addLBMDef(stone_lbm);
+	mgr.loadIntroductionTimes("", gamedef, 100);
+
+	mgr.applyLBMs(nullptr, &block, 50);
+	UASSERTEQ(size_t, stone_lbm->triggered.size(), 1);
+	UASSERT(block.getNodeNoEx(v3s16(15, 0, 0)).getContent() == CONTENT_AIR);
+}
@@ -0,0 +1,574 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <atomic>
+#include <cstring>
+#include <thread>
+#include "gamedef.h"
+#include "inventory.h"
+#include "map.h"
+#include "mapblock.h"
+#include "mapsector.h"
+#include "nodedef.h"
+#include "nodemetadata.h"
+#include "noise.h"
+#include "porting.h"
+#include "serialization.h"
+#include "threading/worker_pool.h"
+
+class TestMap : public TestBase
+{
+public:
+	TestMap() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMap"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testBlockIndex(IGameDef *gamedef);
+	void testGetNode(IGameDef *gamedef);
+	void testDeSerializeIds(IGameDef *gamedef);
+	void testDeSerializeWhileAllocating(IGameDef *gamedef);
+	void testNetworkSnapshot(IGameDef *gamedef);
+	void testTransformLiquids(IGameDef *gamedef);
+	void testUnloadKeepsActive(IGameDef *gamedef);
+#if USE_ZSTD
+	void testSerializeZstd(IGameDef *gamedef);
+#endif
+	void benchGetNode(IGameDef *gamedef);
+};
+
+static TestMap g_test_instance;
+
+void TestMap::runTests(IGameDef *gamedef)
+{
+	TEST(testBlockIndex, gamedef);
+	TEST(testGetNode, gamedef);
+	TEST(testDeSerializeIds, gamedef);
+	TEST(testDeSerializeWhileAllocating, gamedef);
+	TEST(testNetworkSnapshot, gamedef);
+	TEST(testTransformLiquids, gamedef);
+	TEST(testUnloadKeepsActive, gamedef);
+#if USE_ZSTD
+	TEST(testSerializeZstd, gamedef);
+#endif
+	BENCHMARK(benchGetNode, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Map with blocks created in memory, without a database or mapgen
+class BlankMap : public Map
+{
+public:
+	BlankMap(IGameDef *gamedef) : Map(dstream, gamedef) {}
+
+	MapBlock *createBlock(v3s16 p)
+	{
+		v2s16 p2d(p.X, p.Z);
+		MapSector *sector = getSectorNoGenerate(p2d);
+		if (!sector) {
+			sector = new MapSector(this, p2d, m_gamedef);
+			m_sectors[p2d] = sector;
+		}
+		return sector->createBlankBlock(p.Y);
+	}
+
+	void fill(v3s16 min, v3s16 max, MapNode n)
+	{
+		v3s16 p;
+		for (p.Z = min.Z; p.Z <= max.Z; p.Z++)
+		for (p.Y = min.Y; p.Y <= max.Y; p.Y++)
+		for (p.X = min.X; p.X <= max.X; p.X++) {
+			MapBlock *block = getBlockNoCreateNoEx(p);
+			if (!block)
+				block = createBlock(p);
+			for (u32 i = 0; i < MapBlock::nodecount; i++)
+				block->getData()[i] = n;
+		}
+	}
+
+	void fill(v3s16 min, v3s16 max)
+	{
+		v3s16 p;
+		for (p.Z = min.Z; p.Z <= max.Z; p.Z++)
+		for (p.Y = min.Y; p.Y <= max.Y; p.Y++)
+		for (p.X = min.X; p.X <= max.X; p.X++) {
+			MapBlock *block = createBlock(p);
+			// A different content per block
+			MapNode n((p.X * 7 + p.Y * 3 + p.Z) & 0xff);
+			for (u32 i = 0; i < MapBlock::nodecount; i++)
+				block->getData()[i] = n;
+		}
+	}
+};
+
+void TestMap::testBlockIndex(IGameDef *gamedef)
+{
+	BlankMap map(gamedef);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(0, 0, 0)) == nullptr);
+
+	MapBlock *a = map.createBlock(v3s16(1, -2, 3));
+	MapBlock *b = map.createBlock(v3s16(1, 5, 3));
+	MapBlock *c = map.createBlock(v3s16(-1, -2, 3));
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, -2, 3)) == a);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, 5, 3)) == b);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(-1, -2, 3)) == c);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, 0, 3)) == nullptr);
+
+	// Same sector, the sector is still there to iterate over
+	MapSector *sector = map.getSectorNoGenerate(v2s16(1, 3));
+	UASSERT(sector);
+	MapBlockVect blocks;
+	sector->getBlocks(blocks);
+	UASSERTEQ(size_t, blocks.size(), 2);
+	UASSERT(sector->getBlockNoCreateNoEx(5) == b);
+
+	// Removed from the index and from the lookup cache
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, 5, 3)) == b);
+	sector->deleteBlock(b);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, 5, 3)) == nullptr);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, -2, 3)) == a);
+
+	// Unloaded by the map along with their sectors
+	a->refGrab();
+	std::vector<v3s16> unloaded;
+	map.unloadUnreferencedBlocks(&unloaded);
+	UASSERTEQ(size_t, unloaded.size(), 1);
+	UASSERT(unloaded[0] == v3s16(-1, -2, 3));
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(-1, -2, 3)) == nullptr);
+	UASSERT(map.getSectorNoGenerate(v2s16(-1, 3)) == nullptr);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, -2, 3)) == a);
+	a->refDrop();
+
+	// Inserting a block that was created elsewhere
+	MapBlock *d = new MapBlock(&map, v3s16(1, 9, 3), gamedef);
+	sector->insertBlock(d);
+	UASSERT(map.getBlockNoCreateNoEx(v3s16(1, 9, 3)) == d);
+}
+
+void TestMap::testGetNode(IGameDef *gamedef)
+{
+	BlankMap map(gamedef);
+	map.fill(v3s16(-2, -2, -2), v3s16(1, 1, 1));
+
+	bool valid;
+	MapNode n = map.getNode(v3s16(-32, 0, 17), &valid);
+	UASSERT(valid);
+	UASSERTEQ(content_t, n.getContent(), (-2 * 7 + 0 * 3 + 1) & 0xff);
+	n = map.getNode(v3s16(-33, 0, 0), &valid);
+	UASSERT(!valid);
+	UASSERTEQ(content_t, n.getContent(), CONTENT_IGNORE);
+	n = map.getNode(v3s16(31, 31, 31), &valid);
+	UASSERT(valid);
+	UASSERTEQ(content_t, n.getContent(), (7 + 3 + 1) & 0xff);
+}
+
+void TestMap::testDeSerializeIds(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(0, 0, 0), gamedef);
+	MapNode stone(t_CONTENT_STONE);
+	block.setNodeNoCheck(v3s16(1, 1, 1), stone);
+	std::ostringstream os(std::ios_base::binary);
+	block.serialize(os, SER_FMT_VER_HIGHEST_WRITE, true);
+
+	// Only known nodes, as emerge threads load blocks without the lock
+	MapBlock loaded(nullptr, v3s16(0, 0, 0), gamedef);
+	std::istringstream is(os.str(), std::ios_base::binary);
+	loaded.deSerialize(is, SER_FMT_VER_HIGHEST_WRITE, true, false);
+	UASSERTEQ(content_t, loaded.getNodeNoEx(v3s16(1, 1, 1)).getContent(),
+		t_CONTENT_STONE);
+
+	// A node that is not defined yet would need a new id
+	std::string data = os.str();
+	size_t name_pos = data.find("default:stone");
+	UASSERT(name_pos != std::string::npos);
+	data.replace(name_pos, 13, "default:stonf");
+	is.str(data);
+	is.clear();
+	bool thrown = false;
+	try {
+		loaded.deSerialize(is, SER_FMT_VER_HIGHEST_WRITE, true, false);
+	} catch (SerializationError &e) {
+		thrown = true;
+	}
+	UASSERT(thrown);
+
+	// The test gamedef allocates id 0 for unknown nodes
+	is.str(data);
+	is.clear();
+	loaded.deSerialize(is, SER_FMT_VER_HIGHEST_WRITE, true);
+	UASSERTEQ(content_t, loaded.getNodeNoEx(v3s16(1, 1, 1)).getContent(), 0);
+}
+
+// The test gamedef with node definitions of its own, which it allocates
+// ids for like the server does
+class AllocatingGameDef : public IGameDef
+{
+public:
+	AllocatingGameDef(IGameDef *base, NodeDefManager *ndef) :
+		m_base(base), m_ndef(ndef)
+	{}
+
+	IItemDefManager *getItemDefManager() { return m_base->getItemDefManager(); }
+	const NodeDefManager *getNodeDefManager() { return m_ndef; }
+	ICraftDefManager *getCraftDefManager() { return m_base->getCraftDefManager(); }
+	u16 allocateUnknownNodeId(const std::string &name)
+	{
+		return m_ndef->allocateDummy(name);
+	}
+
+	const std::vector<ModSpec> &getMods() const { return m_base->getMods(); }
+	const ModSpec *getModSpec(const std::string &modname) const
+	{
+		return m_base->getModSpec(modname);
+	}
+	std::string getModStoragePath() const { return m_base->getModStoragePath(); }
+	bool registerModStorage(ModMetadata *storage) { return false; }
+	void unregisterModStorage(const std::string &name) {}
+	bool joinModChannel(const std::string &channel) { return false; }
+	bool leaveModChannel(const std::string &channel) { return false; }
+	bool sendModChannelMessage(const std::string &channel,
+		const std::string &message) { return false; }
+	ModChannel *getModChannel(const std::string &channel) { return nullptr; }
+
+private:
+	IGameDef *m_base;
+	NodeDefManager *m_ndef;
+};
+
+void TestMap::testDeSerializeWhileAllocating(IGameDef *gamedef)
+{
+	std::unique_ptr<NodeDefManager> ndef(createNodeDefManager());
+	AllocatingGameDef allocating_gamedef(gamedef, ndef.get());
+	std::vector<content_t> ids;
+	for (u32 i = 0; i < 64; i++) {
+		ContentFeatures f;
+		f.name = "test:node" + std::to_string(i);
+		ids.push_back(ndef->set(f.name, f));
+	}
+
+	MapBlock block(nullptr, v3s16(0, 0, 0), &allocating_gamedef);
+	for (u32 i = 0; i < MapBlock::nodecount; i++)
+		block.getData()[i] = MapNode(ids[i * 7 % ids.size()]);
+	std::ostringstream os(std::ios_base::binary);
+	block.serialize(os, SER_FMT_VER_HIGHEST_WRITE, true);
+	const std::string data = os.str();
+
+	// Emerge threads deserialize blocks of known nodes without the lock...
+	std::atomic<bool> allocating(true);
+	std::atomic<bool> failed(false);
+	std::atomic<u32> loads(0);
+	std::vector<std::thread> threads;
+	for (u32 t = 0; t < 2; t++) {
+		threads.emplace_back([&] () {
+			MapBlock loaded(nullptr, v3s16(0, 0, 0), &allocating_gamedef);
+			do {
+				std::istringstream is(data, std::ios_base::binary);
+				try {
+					loaded.deSerialize(is, SER_FMT_VER_HIGHEST_WRITE, true, false);
+				} catch (SerializationError &e) {
+					failed = true;
+					break;
+				}
+				if (memcmp(loaded.getData(), block.getData(),
+						MapBlock::nodecount * sizeof(MapNode)) != 0)
+					failed = true;
+				loads++;
+			} while (allocating);
+		});
+	}
+
+	// ...while the environment thread allocates ids for unknown nodes
+	u32 allocated = 0;
+	for (u32 i = 0; i < 10000; i++) {
+		if (allocating_gamedef.allocateUnknownNodeId(
+				"test:unknown" + std::to_string(i)) != CONTENT_IGNORE)
+			allocated++;
+	}
+	allocating = false;
+	for (std::thread &thread : threads)
+		thread.join();
+
+	UASSERTEQ(u32, allocated, 10000);
+	UASSERT(!failed);
+	UASSERT(loads >= 2);
+	UASSERTEQ(content_t, ndef->getId("test:node63"), ids[63]);
+}
+
+void TestMap::testNetworkSnapshot(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(2, -1, 5), gamedef);
+	PcgRandom pr(7);
+	const content_t contents[] = {
+		CONTENT_AIR, t_CONTENT_STONE, t_CONTENT_GRASS, t_CONTENT_WATER,
+		t_CONTENT_TORCH,
+	};
+	for (u32 i = 0; i < MapBlock::nodecount; i++) {
+		block.getData()[i] = MapNode(contents[pr.range(0, 4)],
+			pr.range(0, 255), pr.range(0, 255));
+	}
+
+	auto serialize_both = [&block] (u8 version, std::string *direct,
+			std::string *snapshot) {
+		std::ostringstream os(std::ios_base::binary);
+		block.serialize(os, version, false);
+		block.serializeNetworkSpecific(os);
+		*direct = os.str();
+
+		MapBlockNetSnapshot snap;
+		block.makeNetworkSnapshot(snap, version);
+		std::ostringstream os_snap(std::ios_base::binary);
+		MapBlock::serializeNetworkSnapshot(os_snap, snap);
+		*snapshot = os_snap.str();
+	};
+
+	std::string direct, snapshot;
+	for (u8 version = SER_FMT_VER_LOWEST_WRITE;
+			version <= SER_FMT_VER_HIGHEST_READ; version++) {
+		serialize_both(version, &direct, &snapshot);
+		UASSERT(direct == snapshot);
+	}
+
+	// With metadata, including private fields and an inventory, and
+	// with the flags set
+	for (u32 i = 0; i != 5; i++) {
+		NodeMetadata *meta = new NodeMetadata(gamedef->idef());
+		meta->setString("infotext", "node " + std::to_string(i));
+		meta->setString("secret", "hidden");
+		meta->markPrivate("secret", true);
+		meta->getInventory()->addList("main", 4);
+		block.m_node_metadata.set(v3s16(i, i * 3, 15 - i), meta);
+	}
+	block.setIsUnderground(true);
+	block.setGenerated(false);
+	block.setLightingComplete(0x1234);
+	for (u8 version = SER_FMT_VER_LOWEST_WRITE;
+			version <= SER_FMT_VER_HIGHEST_READ; version++) {
+		serialize_both(version, &direct, &snapshot);
+		UASSERT(direct == snapshot);
+	}
+}
+
+// Water running down a step and into a pit, from sources on the borders
+// of mapblocks and from one in the air
+static void make_liquid_map(BlankMap &map)
+{
+	map.fill(v3s16(-2, -1, -2), v3s16(1, 0, 1), MapNode(CONTENT_AIR));
+	MapNode stone(t_CONTENT_STONE);
+	v3s16 p;
+	for (p.Z = -32; p.Z < 32; p.Z++)
+	for (p.X = -32; p.X < 32; p.X++) {
+		bool pit = p.X >= -24 && p.X < -17 && p.Z >= -24 && p.Z < -17;
+		s16 top = pit ? -16 : p.X >= 0 ? -6 : -10;
+		for (p.Y = -16; p.Y <= top; p.Y++)
+			map.setNode(p, stone);
+	}
+
+	static const v3s16 sources[] = {
+		v3s16(0, -5, 0), v3s16(-1, -9, -1), v3s16(15, -5, -20),
+		v3s16(-16, -9, -16), v3s16(-5, 3, 10),
+	};
+	MapNode water(t_CONTENT_WATER);
+	for (const v3s16 &source : sources) {
+		map.setNode(source, water);
+		map.transforming_liquid_add(source);
+	}
+}
+
+// Hash of the content and param2 of all nodes
+static u64 hash_liquid_map(BlankMap &map)
+{
+	u64 h = 0xcbf29ce484222325ULL;
+	v3s16 p;
+	for (p.Z = -32; p.Z < 32; p.Z++)
+	for (p.Y = -16; p.Y < 16; p.Y++)
+	for (p.X = -32; p.X < 32; p.X++) {
+		MapNode n = map.getNode(p);
+		h = (h ^ n.getContent()) * 0x100000001b3ULL;
+		h = (h ^ n.getParam2()) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static bool liquid_maps_equal(BlankMap &a, BlankMap &b)
+{
+	v3s16 p;
+	for (p.Z = -32; p.Z < 32; p.Z++)
+	for (p.Y = -16; p.Y < 16; p.Y++)
+	for (p.X = -32; p.X < 32; p.X++) {
+		MapNode na = a.getNode(p);
+		MapNode nb = b.getNode(p);
+		if (na.getContent() != nb.getContent() || na.getParam2() != nb.getParam2())
+			return false;
+	}
+	return true;
+}
+
+void TestMap::testTransformLiquids(IGameDef *gamedef)
+{
+	BlankMap serial(gamedef), one_thread(gamedef), four_threads(gamedef);
+	make_liquid_map(serial);
+	make_liquid_map(one_thread);
+	make_liquid_map(four_threads);
+	WorkerPool pool_one("Liquid", 1);
+	WorkerPool pool_four("Liquid", 4);
+
+	// The serial path as before compute_liquid_update() was split out of
+	// transformLiquids(), after 10 and after 200 steps
+	std::map<v3s16, MapBlock *> modified_blocks;
+	for (u32 step = 1; step <= 200; step++) {
+		serial.transformLiquids(modified_blocks, nullptr);
+		if (step == 10)
+			UASSERT(hash_liquid_map(serial) == 14054876100394100718ULL);
+
+		// The same result on any number of threads, at every step
+		one_thread.transformLiquids(modified_blocks, nullptr, &pool_one);
+		four_threads.transformLiquids(modified_blocks, nullptr, &pool_four);
+		UASSERT(liquid_maps_equal(one_thread, four_threads));
+	}
+	UASSERT(hash_liquid_map(serial) == 16314512539905748867ULL);
+
+	// Neighbours are read from before the step on the threads, so the
+	// water may spread in another order, but it settles the same way
+	UASSERT(liquid_maps_equal(serial, one_thread));
+}
+
+void TestMap::testUnloadKeepsActive(IGameDef *gamedef)
+{
+	BlankMap map(gamedef);
+	map.fill(v3s16(0, 0, 0), v3s16(3, 3, 3));
+
+	// The least recently used blocks, which are unloaded first otherwise
+	BlockPosSet active;
+	active.insert(v3s16(1, 1, 1));
+	active.insert(v3s16(2, 3, 0));
+	for (v3s16 p : active)
+		map.getBlockNoCreateNoEx(p)->incrementUsageTimer(10.0f);
+
+	std::vector<v3s16> unloaded;
+	map.timerUpdate(1.0f, 100.0f, 10, &unloaded, &active);
+	UASSERTEQ(size_t, unloaded.size(), 64 - 10 - 2);
+	for (v3s16 p : active)
+		UASSERT(map.getBlockNoCreateNoEx(p) != nullptr);
+
+	unloaded.clear();
+	map.timerUpdate(1.0f, 100.0f, 10, &unloaded);
+	UASSERTEQ(size_t, unloaded.size(), 2);
+	for (v3s16 p : active)
+		UASSERT(map.getBlockNoCreateNoEx(p) == nullptr);
+}
+
+#if USE_ZSTD
+void TestMap::testSerializeZstd(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(0, 0, 0), gamedef);
+	PcgRandom pr(3);
+	for (u32 i = 0; i < MapBlock::nodecount; i++) {
+		content_t c = i < MapBlock::nodecount / 2 ? t_CONTENT_STONE :
+			pr.range(0, 3) == 0 ? t_CONTENT_WATER : CONTENT_AIR;
+		block.getData()[i] = MapNode(c, pr.range(0, 15), 0);
+	}
+	NodeMetadata *meta = new NodeMetadata(gamedef->idef());
+	meta->setString("infotext", "zstd");
+	block.m_node_metadata.set(v3s16(3, 4, 5), meta);
+	block.setTimestamp(1234);
+
+	// Same block as with zlib, on disk and over the network
+	for (bool disk : {true, false}) {
+		std::ostringstream os(std::ios_base::binary);
+		block.serialize(os, SER_FMT_VER_ZSTD, disk);
+		std::ostringstream os_zlib(std::ios_base::binary);
+		block.serialize(os_zlib, SER_FMT_VER_ZSTD - 1, disk);
+		UASSERT(os.str() != os_zlib.str());
+
+		MapBlock loaded(nullptr, v3s16(0, 0, 0), gamedef);
+		std::istringstream is(os.str(), std::ios_base::binary);
+		loaded.deSerialize(is, SER_FMT_VER_ZSTD, disk);
+		UASSERT(memcmp(loaded.getData(), block.getData(),
+			MapBlock::nodecount * sizeof(MapNode)) == 0);
+		NodeMetadata *loaded_meta = loaded.m_node_metadata.get(v3s16(3, 4, 5));
+		UASSERT(loaded_meta && loaded_meta->getString("infotext") == "zstd");
+		if (disk)
+			UASSERTEQ(u32, loaded.getTimestamp(), 1234);
+
+		// Serialized again from the loaded block
+		std::ostringstream os2(std::ios_base::binary);
+		loaded.serialize(os2, SER_FMT_VER_ZSTD, disk);
+		UASSERT(os2.str() == os.str());
+	}
+}
+#endif
+
+void TestMap::benchGetNode(IGameDef *gamedef)
+{
+	// About the blocks loaded around a few players
+	BlankMap map(gamedef);
+	const s16 r = 10;
+	map.fill(v3s16(-r, -4, -r), v3s16(r - 1, 3, r - 1));
+	const s16 extent = r * MAP_BLOCKSIZE;
+
+	const u32 count = 4000000;
+	PcgRandom pr(99);
+	std::vector<v3s16> random(count / 16);
+	for (v3s16 &p : random) {
+		p = v3s16(pr.range(-extent, extent - 1), pr.range(-64, 63),
+			pr.range(-extent, extent - 1));
+	}
+
+	// Random positions all over the loaded area
+	u32 sum = 0;
+	u64 t = porting::getTimeUs();
+	for (u32 i = 0; i < count; i++)
+		sum += map.getNode(random[i % random.size()]).getContent();
+	u64 time_random = porting::getTimeUs() - t;
+
+	// Coherent: walking through the nodes in order, like a mapgen or
+	// VoxelManipulator would
+	u32 sum_coherent = 0;
+	t = porting::getTimeUs();
+	v3s16 p;
+	u32 done = 0;
+	for (p.Y = -64; p.Y < 64 && done < count; p.Y++)
+	for (p.Z = -extent; p.Z < extent && done < count; p.Z++)
+	for (p.X = -extent; p.X < extent && done < count; p.X++, done++)
+		sum_coherent += map.getNode(p).getContent();
+	u64 time_coherent = porting::getTimeUs() - t;
+
+	// The way blocks were found before: sector, then block in the sector
+	u32 sum_sectors = 0;
+	t = porting::getTimeUs();
+	for (u32 i = 0; i < count; i++) {
+		v3s16 np = random[i % random.size()];
+		v3s16 bp = getNodeBlockPos(np);
+		MapSector *sector = map.getSectorNoGenerate(v2s16(bp.X, bp.Z));
+		MapBlock *block = sector ? sector->getBlockNoCreateNoEx(bp.Y) : nullptr;
+		if (block)
+			sum_sectors += block->getNodeNoEx(np - bp * MAP_BLOCKSIZE).getContent();
+	}
+	u64 time_sectors = porting::getTimeUs() - t;
+	UASSERTEQ(u32, sum, sum_sectors);
+	UASSERT(done == count);
+
+	rawstream << "benchGetNode: " << count << " getNode: random "
+		<< time_random / 1000 << "ms (sector lookup " << time_sectors / 1000
+		<< "ms), coherent " << time_coherent / 1000 << "ms ("
+		<< sum_coherent << ")" << std::endl;
+}
@@ -0,0 +1,293 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <atomic>
+#include "database/database-dummy.h"
+#include "database/database-sqlite3.h"
+#include "database/database-writebehind.h"
+#include "exceptions.h"
+#include "filesys.h"
+#include "porting.h"
+#include "util/string.h"
+
+class TestMapDatabase : public TestBase
+{
+public:
+	TestMapDatabase() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestMapDatabase"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testLoadBlocks(MapDatabase *db);
+	void testWriteBehind();
+	void testWriteBehindBackpressure();
+	void testWriteBehindReadsDuringWrite();
+	void testWriteBehindFailedWrite();
+};
+
+static TestMapDatabase g_test_instance;
+
+void TestMapDatabase::runTests(IGameDef *gamedef)
+{
+	rawstream << "-------- Dummy database" << std::endl;
+	{
+		Database_Dummy db;
+		TEST(testLoadBlocks, &db);
+	}
+
+	rawstream << "-------- SQLite3 database" << std::endl;
+	std::string test_dir = getTestTempDirectory();
+	{
+		MapDatabaseSQLite3 db(test_dir);
+		TEST(testLoadBlocks, &db);
+	}
+	fs::DeleteSingleFileOrEmptyDirectory(test_dir + DIR_DELIM + "map.sqlite");
+
+	rawstream << "-------- Write-behind database" << std::endl;
+	{
+		WriteBehindMapDatabase db(new Database_Dummy(), "dummy", 1024 * 1024);
+		TEST(testLoadBlocks, &db);
+	}
+	TEST(testWriteBehind);
+	TEST(testWriteBehindBackpressure);
+	TEST(testWriteBehindReadsDuringWrite);
+	TEST(testWriteBehindFailedWrite);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestMapDatabase::testLoadBlocks(MapDatabase *db)
+{
+	// More positions than fit into one SQLite3 query, with every third
+	// one missing from the database and a few repeated
+	std::vector<v3s16> pos;
+	db->beginSave();
+	for (s16 i = 0; i < 40; i++) {
+		v3s16 p(i - 20, i % 3 - 1, -i);
+		pos.push_back(p);
+		if (i % 3 != 0)
+			UASSERT(db->saveBlock(p, "block " + itos(i)));
+	}
+	db->endSave();
+	pos.push_back(pos[1]);
+	pos.push_back(pos[0]);
+
+	std::vector<std::string> blocks;
+	db->loadBlocks(pos, &blocks);
+	UASSERTEQ(size_t, blocks.size(), pos.size());
+
+	for (size_t i = 0; i < pos.size(); i++) {
+		std::string single;
+		db->loadBlock(pos[i], &single);
+		UASSERTEQ(std::string, blocks[i], single);
+	}
+	UASSERTEQ(std::string, blocks[1], "block 1");
+	UASSERT(blocks[0].empty());
+	UASSERTEQ(std::string, blocks[40], "block 1");
+
+	db->loadBlocks(std::vector<v3s16>(), &blocks);
+	UASSERT(blocks.empty());
+}
+
+void TestMapDatabase::testWriteBehind()
+{
+	Database_Dummy *dummy = new Database_Dummy();
+	WriteBehindMapDatabase db(dummy, "dummy", 1024 * 1024, 8);
+
+	// Saved blocks can be loaded right away, queued or not
+	for (s16 i = 0; i < 100; i++)
+		db.saveBlock(v3s16(i, 0, 0), "old " + itos(i));
+	for (s16 i = 0; i < 100; i += 2)
+		db.saveBlock(v3s16(i, 0, 0), "new " + itos(i));
+	UASSERT(db.deleteBlock(v3s16(3, 0, 0)));
+
+	for (s16 i = 0; i < 100; i++) {
+		std::string block;
+		db.loadBlock(v3s16(i, 0, 0), &block);
+		if (i == 3) {
+			UASSERT(block.empty());
+		} else {
+			UASSERTEQ(std::string, block, (i % 2 ? "old " : "new ") + itos(i));
+		}
+	}
+
+	db.flush();
+	UASSERTEQ(size_t, db.getQueuedBytes(), 0);
+
+	WriteBehindMapDatabase::Stats stats = db.getStats();
+	UASSERTEQ(u64, stats.blocks_queued, 150);
+	// Deleting a queued block drops it without counting it as written
+	UASSERT(stats.blocks_written + stats.blocks_coalesced <= 150);
+	UASSERT(stats.blocks_written >= 99);
+	UASSERT(stats.transactions >= stats.blocks_written / 8);
+
+	// Everything ended up in the wrapped database
+	std::vector<v3s16> list;
+	db.listAllLoadableBlocks(list);
+	UASSERTEQ(size_t, list.size(), 99);
+	std::string block;
+	dummy->loadBlock(v3s16(98, 0, 0), &block);
+	UASSERTEQ(std::string, block, "new 98");
+}
+
+void TestMapDatabase::testWriteBehindBackpressure()
+{
+	std::string test_dir = getTestTempDirectory();
+	{
+		// Every save has to wait until the previous one is written
+		WriteBehindMapDatabase db(new MapDatabaseSQLite3(test_dir), "sqlite3", 0);
+		for (s16 i = 0; i < 20; i++) {
+			db.saveBlock(v3s16(0, i, 0), std::string(100, 'x'));
+			UASSERT(db.getQueuedBytes() <= 100);
+		}
+		// Written when the database is closed
+	}
+
+	{
+		MapDatabaseSQLite3 db(test_dir);
+		for (s16 i = 0; i < 20; i++) {
+			std::string block;
+			db.loadBlock(v3s16(0, i, 0), &block);
+			UASSERTEQ(std::string, block, std::string(100, 'x'));
+		}
+	}
+	fs::DeleteSingleFileOrEmptyDirectory(test_dir + DIR_DELIM + "map.sqlite");
+}
+
+// Takes its time to write, like a database on a slow disk
+class SlowDatabase : public Database_Dummy
+{
+public:
+	bool saveBlock(const v3s16 &pos, const std::string &data)
+	{
+		saving = true;
+		sleep_ms(20);
+		return Database_Dummy::saveBlock(pos, data);
+	}
+
+	std::atomic<bool> saving{false};
+};
+
+void TestMapDatabase::testWriteBehindReadsDuringWrite()
+{
+	SlowDatabase *slow = new SlowDatabase();
+	slow->Database_Dummy::saveBlock(v3s16(0, -1, 0), "on disk");
+	WriteBehindMapDatabase db(slow, "slow", 1024 * 1024, 50);
+
+	// A transaction of 50 blocks takes a second
+	for (s16 i = 0; i < 50; i++)
+		db.saveBlock(v3s16(0, i, 0), "block " + itos(i));
+	while (!slow->saving)
+		sleep_ms(1);
+
+	// Loads neither wait for the transaction nor miss the blocks in it
+	u64 t = porting::getTimeMs();
+	std::string block;
+	db.loadBlock(v3s16(0, -1, 0), &block);
+	UASSERTEQ(std::string, block, "on disk");
+	std::vector<std::string> blocks;
+	db.loadBlocks({v3s16(0, 49, 0), v3s16(0, -1, 0), v3s16(0, 50, 0)}, &blocks);
+	UASSERTEQ(std::string, blocks[0], "block 49");
+	UASSERTEQ(std::string, blocks[1], "on disk");
+	UASSERT(blocks[2].empty());
+	UASSERT(porting::getTimeMs() - t < 500);
+
+	// Deleting a block that is being written, it is deleted afterwards
+	UASSERT(db.deleteBlock(v3s16(0, 48, 0)));
+	db.loadBlock(v3s16(0, 48, 0), &block);
+	UASSERT(block.empty());
+
+	db.flush();
+	slow->loadBlock(v3s16(0, 48, 0), &block);
+	UASSERT(block.empty());
+	slow->loadBlock(v3s16(0, 47, 0), &block);
+	UASSERTEQ(std::string, block, "block 47");
+	UASSERTEQ(size_t, db.getQueuedBytes(), 0);
+	UASSERT(db.getStats().blocks_written >= 49);
+}
+
+// Fails the first save, after the block was written into the transaction
+class FlakyDatabase : public MapDatabase
+{
+public:
+	FlakyDatabase(const std::string &savedir) : m_db(savedir) {}
+
+	bool saveBlock(const v3s16 &pos, const std::string &data)
+	{
+		m_db.saveBlock(pos, data);
+		if (!failed) {
+			failed = true;
+			throw DatabaseException("Disk full");
+		}
+		return true;
+	}
+	void loadBlock(const v3s16 &pos, std::string *block)
+	{
+		m_db.loadBlock(pos, block);
+	}
+	bool deleteBlock(const v3s16 &pos) { return m_db.deleteBlock(pos); }
+	void listAllLoadableBlocks(std::vector<v3s16> &dst)
+	{
+		m_db.listAllLoadableBlocks(dst);
+	}
+
+	void beginSave() { m_db.beginSave(); }
+	void endSave() { m_db.endSave(); }
+	void rollbackSave() { m_db.rollbackSave(); }
+
+	std::atomic<bool> failed{false};
+
+private:
+	MapDatabaseSQLite3 m_db;
+};
+
+void TestMapDatabase::testWriteBehindFailedWrite()
+{
+	std::string test_dir = getTestTempDirectory();
+	{
+		FlakyDatabase *flaky = new FlakyDatabase(test_dir);
+		WriteBehindMapDatabase db(flaky, "flaky", 1024 * 1024);
+		db.saveBlock(v3s16(0, 0, 0), "first");
+		while (!flaky->failed)
+			sleep_ms(1);
+
+		// The failed transaction was rolled back, so the next one commits
+		u64 t = porting::getTimeMs();
+		while (db.getStats().transactions == 0 && porting::getTimeMs() - t < 5000)
+			sleep_ms(10);
+		UASSERTEQ(u64, db.getStats().transactions, 1);
+
+		db.saveBlock(v3s16(0, 1, 0), "second");
+		db.deleteBlock(v3s16(0, 0, 0));
+		db.flush();
+	}
+
+	{
+		MapDatabaseSQLite3 db(test_dir);
+		std::string block;
+		db.loadBlock(v3s16(0, 1, 0), &block);
+		UASSERTEQ(std::string, block, "second");
+		std::string deleted;
+		db.loadBlock(v3s16(0, 0, 0), &deleted);
+		UASSERT(deleted.empty());
+	}
+	fs::DeleteSingleFileOrEmptyDirectory(test_dir + DIR_DELIM + "map.sqlite");
+}
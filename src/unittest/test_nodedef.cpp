@@ -34,6 +34,8 @@ class TestNodeDef : public TestBase
 	void runTests(IGameDef *gamedef);
 
 	void testContentFeaturesSerialization();
+	void testContentFilter();
+	void testGetFilter();
 };
 
 static TestNodeDef g_test_instance;
@@ -41,6 +43,8 @@ static TestNodeDef g_test_instance;
 void TestNodeDef::runTests(IGameDef *gamedef)
 {
 	TEST(testContentFeaturesSerialization);
+	TEST(testContentFilter);
+	TEST(testGetFilter);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -65,3 +69,63 @@ void TestNodeDef::testContentFeaturesSerialization()
 	UASSERT(f.walkable == f2.walkable);
 	UASSERT(f.node_box.type == f2.node_box.type);
 }
+
+void TestNodeDef::testContentFilter()
+{
+	ContentFilter empty;
+	UASSERT(empty.empty());
+	UASSERT(!empty.contains(0));
+	UASSERT(!empty.contains(CONTENT_IGNORE));
+
+	ContentFilter filter({700, 3, 64, 63, 3, 65, 700});
+	UASSERTEQ(size_t, filter.size(), 5);
+	const std::vector<content_t> expected = {3, 63, 64, 65, 700};
+	UASSERT(filter.getIds() == expected);
+	for (u32 i = 0; i < expected.size(); i++) {
+		UASSERT(filter.contains(expected[i]));
+		UASSERTEQ(u32, filter.indexOf(expected[i]), i);
+	}
+	UASSERT(!filter.contains(0));
+	UASSERT(!filter.contains(4));
+	UASSERT(!filter.contains(699));
+	UASSERT(!filter.contains(701));
+	UASSERT(!filter.contains(CONTENT_IGNORE));
+}
+
+void TestNodeDef::testGetFilter()
+{
+	NodeDefManager ndef;
+	ContentFeatures f;
+	f.name = "test:stone";
+	f.groups["cracky"] = 3;
+	content_t stone = ndef.set(f.name, f);
+	f.name = "test:cobble";
+	content_t cobble = ndef.set(f.name, f);
+	f.name = "test:dirt";
+	f.groups.clear();
+	f.groups["crumbly"] = 1;
+	content_t dirt = ndef.set(f.name, f);
+
+	auto filter = ndef.getFilter({"group:cracky", "test:dirt", "test:nothing"});
+	UASSERTEQ(size_t, filter->size(), 3);
+	UASSERT(filter->contains(stone));
+	UASSERT(filter->contains(cobble));
+	UASSERT(filter->contains(dirt));
+	UASSERT(!filter->contains(CONTENT_AIR));
+
+	// Cached until the definitions change
+	UASSERT(ndef.getFilter({"group:cracky", "test:dirt", "test:nothing"}) == filter);
+	UASSERT(ndef.getFilter("group:cracky") != filter);
+	UASSERTEQ(size_t, ndef.getFilter("group:cracky")->size(), 2);
+
+	f.name = "test:gravel";
+	content_t gravel = ndef.set(f.name, f);
+	auto filter2 = ndef.getFilter("group:crumbly");
+	UASSERTEQ(size_t, filter2->size(), 2);
+	UASSERT(filter2->contains(gravel));
+
+	ndef.removeNode("test:gravel");
+	UASSERT(!ndef.getFilter("test:gravel")->contains(gravel));
+	// Filters that were handed out are left alone
+	UASSERT(filter2->contains(gravel));
+}
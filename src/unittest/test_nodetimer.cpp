@@ -0,0 +1,245 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include "constants.h"
+#include "nodetimer.h"
+#include "noise.h"
+#include "porting.h"
+#include "util/numeric.h"
+
+class TestNodeTimer : public TestBase
+{
+public:
+	TestNodeTimer() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestNodeTimer"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testWheelGetSet();
+	void testWheelStep();
+	void testWheelBlocks();
+	void benchWheel();
+};
+
+static TestNodeTimer g_test_instance;
+
+void TestNodeTimer::runTests(IGameDef *gamedef)
+{
+	TEST(testWheelGetSet);
+	TEST(testWheelStep);
+	TEST(testWheelBlocks);
+	BENCHMARK(benchWheel);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static bool position_less(const NodeTimer &a, const NodeTimer &b)
+{
+	if (a.position.X != b.position.X)
+		return a.position.X < b.position.X;
+	if (a.position.Y != b.position.Y)
+		return a.position.Y < b.position.Y;
+	return a.position.Z < b.position.Z;
+}
+
+void TestNodeTimer::testWheelGetSet()
+{
+	NodeTimerWheel wheel;
+	v3s16 p(1, -2, 3);
+	UASSERT(wheel.get(p).timeout == 0.0f);
+
+	wheel.set(NodeTimer(2.0f, 0.5f, p));
+	UASSERTEQ(size_t, wheel.size(), 1);
+	UASSERT(wheel.get(p).timeout == 2.0f);
+	UASSERT(std::fabs(wheel.get(p).elapsed - 0.5f) < 0.001f);
+
+	UASSERT(wheel.step(1.0f).empty());
+	UASSERT(std::fabs(wheel.get(p).elapsed - 1.5f) < 0.001f);
+
+	// Replaced by a new timer
+	wheel.set(NodeTimer(1.0f, 0.0f, p));
+	UASSERTEQ(size_t, wheel.size(), 1);
+	UASSERT(wheel.step(0.9f).empty());
+	std::vector<NodeTimer> elapsed = wheel.step(0.2f);
+	UASSERTEQ(size_t, elapsed.size(), 1);
+	UASSERT(elapsed[0].position == p);
+	UASSERT(std::fabs(elapsed[0].elapsed - 1.1f) < 0.001f);
+	UASSERTEQ(size_t, wheel.size(), 0);
+
+	wheel.set(NodeTimer(1.0f, 0.0f, p));
+	wheel.remove(p);
+	UASSERTEQ(size_t, wheel.size(), 0);
+	UASSERT(wheel.step(2.0f).empty());
+}
+
+void TestNodeTimer::testWheelStep()
+{
+	// Compared to a NodeTimerList, which keeps its timers sorted by time
+	NodeTimerWheel wheel;
+	NodeTimerList list;
+	PcgRandom pr(1234);
+	std::vector<v3s16> positions;
+	for (u32 i = 0; i < 3000; i++) {
+		v3s16 p(pr.range(-50, 50), pr.range(-50, 50), pr.range(-50, 50));
+		// Up to about a day, for all levels of the wheel
+		float timeout = pr.range(0, 3) == 0 ?
+			pr.range(1, 90000) : pr.range(1, 3000) * 0.1f;
+		NodeTimer t(timeout, 0.0f, p);
+		wheel.set(t);
+		list.set(t);
+		positions.push_back(p);
+	}
+
+	for (u32 step = 0; step < 2000; step++) {
+		// Steps of up to a minute reach the long timers too
+		float dtime = pr.range(1, 600) * 0.1f;
+		std::vector<NodeTimer> from_wheel = wheel.step(dtime);
+		std::vector<NodeTimer> from_list = list.step(dtime);
+		UASSERTEQ(size_t, from_wheel.size(), from_list.size());
+		std::sort(from_wheel.begin(), from_wheel.end(), position_less);
+		std::sort(from_list.begin(), from_list.end(), position_less);
+		for (size_t i = 0; i < from_wheel.size(); i++) {
+			UASSERT(from_wheel[i].position == from_list[i].position);
+			UASSERT(std::fabs(from_wheel[i].elapsed - from_list[i].elapsed) < 0.01f);
+		}
+
+		// Restart some, stop some and start new ones
+		for (const NodeTimer &t : from_wheel) {
+			if (pr.range(0, 1)) {
+				wheel.set(NodeTimer(t.timeout, 0.0f, t.position));
+				list.set(NodeTimer(t.timeout, 0.0f, t.position));
+			}
+		}
+		for (u32 i = 0; i < 3; i++) {
+			v3s16 p = positions[pr.range(0, positions.size() - 1)];
+			wheel.remove(p);
+			list.remove(p);
+			NodeTimer t(pr.range(1, 100) * 0.5f, 0.0f, p);
+			wheel.set(t);
+			list.set(t);
+		}
+
+		v3s16 p = positions[pr.range(0, positions.size() - 1)];
+		UASSERT(std::fabs(wheel.get(p).elapsed - list.get(p).elapsed) < 0.01f);
+		UASSERT(wheel.get(p).timeout == list.get(p).timeout);
+	}
+}
+
+void TestNodeTimer::testWheelBlocks()
+{
+	NodeTimerWheel wheel;
+	wheel.set(NodeTimer(5.0f, 1.0f, v3s16(0, 0, 0)));
+	wheel.set(NodeTimer(6.0f, 0.0f, v3s16(15, 15, 15)));
+	wheel.set(NodeTimer(7.0f, 0.0f, v3s16(16, 0, 0)));
+	wheel.set(NodeTimer(8.0f, 0.0f, v3s16(-1, 0, 0)));
+	wheel.step(2.0f);
+
+	std::vector<NodeTimer> timers;
+	wheel.getBlockTimers(v3s16(0, 0, 0), timers);
+	UASSERTEQ(size_t, timers.size(), 2);
+	std::sort(timers.begin(), timers.end(), position_less);
+	UASSERT(timers[0].position == v3s16(0, 0, 0));
+	UASSERT(std::fabs(timers[0].elapsed - 3.0f) < 0.001f);
+	UASSERT(timers[1].position == v3s16(15, 15, 15));
+	UASSERTEQ(size_t, wheel.size(), 4);
+
+	timers.clear();
+	wheel.takeBlockTimers(v3s16(0, 0, 0), timers);
+	UASSERTEQ(size_t, timers.size(), 2);
+	UASSERTEQ(size_t, wheel.size(), 2);
+	timers.clear();
+	wheel.getBlockTimers(v3s16(0, 0, 0), timers);
+	UASSERT(timers.empty());
+
+	wheel.takeBlockTimers(v3s16(-1, 0, 0), timers);
+	UASSERTEQ(size_t, timers.size(), 1);
+	UASSERT(timers[0].position == v3s16(-1, 0, 0));
+
+	// The remaining timer still runs
+	std::vector<NodeTimer> elapsed = wheel.step(5.0f);
+	UASSERTEQ(size_t, elapsed.size(), 1);
+	UASSERT(elapsed[0].position == v3s16(16, 0, 0));
+}
+
+void TestNodeTimer::benchWheel()
+{
+	// 1M timers spread over 4000 blocks that restart when they elapse, like
+	// furnaces and growing plants, stepped at the default nodetimer_interval
+	const u32 count = 1000000;
+	const float interval = 0.2f;
+	PcgRandom pr(42);
+	std::vector<NodeTimer> timers;
+	timers.reserve(count);
+	for (u32 i = 0; i < count; i++) {
+		v3s16 p(i % 250, (i / 250) % 16, i / 4000);
+		timers.emplace_back(pr.range(10, 6000) * 0.1f, 0.0f, p);
+	}
+
+	NodeTimerWheel wheel;
+	u64 t = porting::getTimeUs();
+	for (const NodeTimer &timer : timers)
+		wheel.set(timer);
+	u64 time_insert = porting::getTimeUs() - t;
+
+	// Timers per block, as they were stepped before
+	std::map<v3s16, NodeTimerList> lists;
+	t = porting::getTimeUs();
+	for (const NodeTimer &timer : timers)
+		lists[getContainerPos(timer.position, MAP_BLOCKSIZE)].insert(timer);
+	u64 time_insert_lists = porting::getTimeUs() - t;
+
+	u64 time_step = 0, time_step_lists = 0;
+	size_t fired = 0, fired_lists = 0;
+	for (u32 step = 0; step < 300; step++) {
+		t = porting::getTimeUs();
+		std::vector<NodeTimer> elapsed = wheel.step(interval);
+		for (const NodeTimer &timer : elapsed)
+			wheel.set(NodeTimer(timer.timeout, 0.0f, timer.position));
+		time_step += porting::getTimeUs() - t;
+		fired += elapsed.size();
+
+		t = porting::getTimeUs();
+		for (auto &it : lists) {
+			std::vector<NodeTimer> elapsed = it.second.step(interval);
+			for (const NodeTimer &timer : elapsed)
+				it.second.set(NodeTimer(timer.timeout, 0.0f, timer.position));
+			fired_lists += elapsed.size();
+		}
+		time_step_lists += porting::getTimeUs() - t;
+	}
+	UASSERTEQ(size_t, fired, fired_lists);
+	UASSERTEQ(size_t, wheel.size(), count);
+
+	t = porting::getTimeUs();
+	for (u32 i = 0; i < count; i += 2)
+		wheel.remove(timers[i].position);
+	u64 time_remove = porting::getTimeUs() - t;
+	UASSERTEQ(size_t, wheel.size(), count / 2);
+
+	rawstream << "benchWheel: " << count << " timers, 300 steps firing "
+		<< fired << ": wheel insert " << time_insert / 1000 << "ms, step "
+		<< time_step / 1000 << "ms, remove half " << time_remove / 1000
+		<< "ms; per block lists insert " << time_insert_lists / 1000
+		<< "ms, step " << time_step_lists / 1000 << "ms" << std::endl;
+}
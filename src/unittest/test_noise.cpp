@@ -20,8 +20,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include <cmath>
+#include <cstring>
 #include "exceptions.h"
 #include "noise.h"
+#include "porting.h"
 
 class TestNoise : public TestBase {
 public:
@@ -35,6 +37,9 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseSimd2d();
+	void testNoiseSimd3d();
+	void benchPerlinMap();
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -49,6 +54,9 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseSimd2d);
+	TEST(testNoiseSimd3d);
+	BENCHMARK(benchPerlinMap);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -121,6 +129,150 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+// Noises used by the mapgens and some that hit the edge cases of the kernels:
+// spreads smaller than a node, sizes that are not a multiple of the vector
+// width, negative coordinates and every flag
+static const NoiseParams simd_test_params[] = {
+	NoiseParams(20, 40, v3f(50, 50, 50), 9, 5, 0.6, 2.0),
+	NoiseParams(4, 70, v3f(600, 600, 600), 82341, 5, 0.6, 2.0),
+	NoiseParams(0, 1, v3f(100, 100, 100), 6467, 4, 0.75, 2.0),
+	NoiseParams(0, 12, v3f(61, 61, 61), 52534, 3, 0.5, 2.0,
+		NOISE_FLAG_EASED),
+	NoiseParams(0, 1, v3f(7, 3, 11), 99, 6, 0.8, 2.3,
+		NOISE_FLAG_DEFAULTS | NOISE_FLAG_ABSVALUE),
+	NoiseParams(-3, 2, v3f(0.7, 0.4, 1.3), 5, 3, 0.5, 2.0,
+		NOISE_FLAG_EASED | NOISE_FLAG_ABSVALUE),
+	NoiseParams(0, 1, v3f(33, 250, 5), 1234, 2, 1.2, 1.5, 0),
+};
+
+static const v3f simd_test_origins[] = {
+	v3f(0, 0, 0),
+	v3f(-1203.5, 48, -31000),
+	v3f(30920.25, -47.75, 17),
+};
+
+// The results of every instruction set must be bit-identical to the ones of
+// the scalar code, mapgens must not depend on the CPU
+static bool noise_simd_identical(const NoiseParams &params, v3u16 size,
+	v3f origin, bool persistence)
+{
+	NoiseParams np = params;
+	Noise scalar(&np, 1337, size.X, size.Y, size.Z);
+	scalar.setSimd(NOISE_SIMD_NONE);
+	scalar.setTileCache(nullptr);
+	size_t bufsize = size.X * size.Y * size.Z;
+	bool is3d = size.Z > 1;
+
+	std::vector<float> persist_map(bufsize);
+	for (size_t i = 0; i != bufsize; i++)
+		persist_map[i] = 0.3f + (i % 17) * 0.05f;
+	float *pmap = persistence ? &persist_map[0] : nullptr;
+
+	std::vector<float> expected(bufsize);
+	memcpy(&expected[0], is3d ?
+		scalar.perlinMap3D(origin.X, origin.Y, origin.Z, pmap) :
+		scalar.perlinMap2D(origin.X, origin.Z, pmap),
+		bufsize * sizeof(float));
+
+	for (u8 simd = NOISE_SIMD_SSE2; simd <= noise_simd_best(); simd++) {
+		Noise noise(&np, 1337, size.X, size.Y, size.Z);
+		noise.setSimd((NoiseSimd)simd);
+		noise.setTileCache(nullptr);
+		if (noise.getSimd() != simd)
+			return false;
+		float *actual = is3d ?
+			noise.perlinMap3D(origin.X, origin.Y, origin.Z, pmap) :
+			noise.perlinMap2D(origin.X, origin.Z, pmap);
+		if (memcmp(actual, &expected[0], bufsize * sizeof(float)) != 0)
+			return false;
+	}
+	return true;
+}
+
+void TestNoise::testNoiseSimd2d()
+{
+	// Nothing to compare against without SIMD, the scalar code is tested above
+	if (noise_simd_best() == NOISE_SIMD_NONE)
+		return;
+
+	static const v3u16 sizes[] = {
+		v3u16(80, 80, 1), v3u16(13, 7, 1), v3u16(1, 1, 1), v3u16(35, 3, 1)
+	};
+	for (const NoiseParams &np : simd_test_params)
+	for (const v3u16 &size : sizes)
+	for (const v3f &origin : simd_test_origins) {
+		UASSERT(noise_simd_identical(np, size, origin, false));
+		UASSERT(noise_simd_identical(np, size, origin, true));
+	}
+}
+
+void TestNoise::testNoiseSimd3d()
+{
+	if (noise_simd_best() == NOISE_SIMD_NONE)
+		return;
+
+	static const v3u16 sizes[] = {
+		v3u16(16, 18, 16), v3u16(11, 5, 3), v3u16(3, 2, 2), v3u16(41, 4, 9)
+	};
+	for (const NoiseParams &np : simd_test_params)
+	for (const v3u16 &size : sizes)
+	for (const v3f &origin : simd_test_origins) {
+		UASSERT(noise_simd_identical(np, size, origin, false));
+		UASSERT(noise_simd_identical(np, size, origin, true));
+	}
+}
+
+void TestNoise::benchPerlinMap()
+{
+	// Noises of the mapgens, over a mapchunk
+	struct MapgenNoise {
+		const char *name;
+		NoiseParams np;
+		v3u16 size;
+	};
+	static const MapgenNoise noises[] = {
+		{"v7 terrain_base", NoiseParams(4, 70, v3f(600, 600, 600), 82341, 5, 0.6, 2.0),
+			v3u16(80, 80, 1)},
+		{"v7 mountain", NoiseParams(-0.6, 1, v3f(250, 350, 250), 5333, 5, 0.63, 2.0),
+			v3u16(80, 82, 80)},
+		{"v7 ridge", NoiseParams(0, 1, v3f(100, 100, 100), 6467, 4, 0.75, 2.0),
+			v3u16(80, 82, 80)},
+		{"valleys inter_valley_fill", NoiseParams(0, 1, v3f(256, 512, 256), 1993, 6, 0.8, 2.0),
+			v3u16(80, 82, 80)},
+		{"valleys terrain_height", NoiseParams(-10, 50, v3f(1024, 1024, 1024), 5202, 6, 0.4, 2.0),
+			v3u16(80, 80, 1)},
+		{"carpathian ridge_mnt", NoiseParams(0, 12, v3f(743, 743, 743), 5520, 6, 0.7, 2.0),
+			v3u16(80, 80, 1)},
+		{"cave1", NoiseParams(0, 12, v3f(61, 61, 61), 52534, 3, 0.5, 2.0),
+			v3u16(80, 82, 80)},
+	};
+
+	NoiseSimd best = noise_simd_best();
+	rawstream << "benchPerlinMap: scalar vs " << noise_simd_name(best) << ":";
+	for (const MapgenNoise &mn : noises) {
+		NoiseParams np = mn.np;
+		bool is3d = mn.size.Z > 1;
+		u32 runs = is3d ? 4 : 100;
+		u64 times[2];
+		for (u32 n = 0; n != 2; n++) {
+			Noise noise(&np, 1337, mn.size.X, mn.size.Y, mn.size.Z);
+			noise.setSimd(n == 0 ? NOISE_SIMD_NONE : best);
+			noise.setTileCache(nullptr);
+			u64 t = porting::getTimeUs();
+			for (u32 i = 0; i != runs; i++) {
+				if (is3d)
+					noise.perlinMap3D(i * 80, -32, 0);
+				else
+					noise.perlinMap2D(i * 80, 0);
+			}
+			times[n] = (porting::getTimeUs() - t) / runs;
+		}
+		rawstream << " " << mn.name << " " << times[0] << "us/"
+			<< times[1] << "us,";
+	}
+	rawstream << std::endl;
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
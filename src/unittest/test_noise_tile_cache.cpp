@@ -0,0 +1,193 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include <cstring>
+#include "noise_tile_cache.h"
+#include "porting.h"
+
+class TestNoiseTileCache : public TestBase
+{
+public:
+	TestNoiseTileCache() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestNoiseTileCache"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testKeys();
+	void testEviction();
+	void testPerlinMap();
+	void benchMapgenColumns();
+};
+
+static TestNoiseTileCache g_test_instance;
+
+void TestNoiseTileCache::runTests(IGameDef *gamedef)
+{
+	TEST(testKeys);
+	TEST(testEviction);
+	TEST(testPerlinMap);
+	BENCHMARK(benchMapgenColumns);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static const NoiseParams test_np(4, 70, v3f(600, 600, 600), 82341, 5, 0.6, 2.0);
+
+void TestNoiseTileCache::testKeys()
+{
+	NoiseTileCache cache(1024);
+	const float values[4] = {1, 2, 3, 4};
+	const float persist[4] = {0.5, 0.5, 0.5, 0.5};
+
+	NoiseTileCache::Key key(test_np, 1, -80, 48, 2, 2, nullptr);
+	UASSERT(cache.get(key) == nullptr);
+	cache.set(key, values, 4);
+	NoiseTileCache::Data d = cache.get(key);
+	UASSERT(d && d->size() == 4 && (*d)[3] == 4);
+
+	// Everything the map depends on is part of the key
+	NoiseParams np = test_np;
+	np.octaves = 4;
+	UASSERT(cache.get(NoiseTileCache::Key(np, 1, -80, 48, 2, 2, nullptr)) == nullptr);
+	UASSERT(cache.get(NoiseTileCache::Key(test_np, 2, -80, 48, 2, 2, nullptr)) == nullptr);
+	UASSERT(cache.get(NoiseTileCache::Key(test_np, 1, -80, 49, 2, 2, nullptr)) == nullptr);
+	UASSERT(cache.get(NoiseTileCache::Key(test_np, 1, -80, 48, 4, 1, nullptr)) == nullptr);
+	UASSERT(cache.get(NoiseTileCache::Key(test_np, 1, -80, 48, 2, 2, persist)) == nullptr);
+
+	NoiseTileCache::Key key_persist(test_np, 1, -80, 48, 2, 2, persist);
+	cache.set(key_persist, values, 4);
+	const float other_persist[4] = {0.5, 0.5, 0.5, 0.6};
+	UASSERT(cache.get(NoiseTileCache::Key(test_np, 1, -80, 48, 2, 2, other_persist)) == nullptr);
+	UASSERT(cache.get(NoiseTileCache::Key(test_np, 1, -80, 48, 2, 2, persist)) != nullptr);
+
+	u32 hits, misses;
+	cache.takeStats(&hits, &misses);
+	UASSERTEQ(u32, hits, 2);
+	UASSERTEQ(u32, misses, 7);
+}
+
+void TestNoiseTileCache::testEviction()
+{
+	const float values[10] = {};
+	NoiseTileCache cache(3 * sizeof(values));
+	for (u32 i = 0; i != 3; i++)
+		cache.set(NoiseTileCache::Key(test_np, 0, i, 0, 10, 1, nullptr), values, 10);
+	UASSERTEQ(size_t, cache.getBytes(), 3 * sizeof(values));
+
+	// Touch the oldest entry so that the second one gets evicted
+	UASSERT(cache.get(NoiseTileCache::Key(test_np, 0, 0, 0, 10, 1, nullptr)) != nullptr);
+	cache.set(NoiseTileCache::Key(test_np, 0, 3, 0, 10, 1, nullptr), values, 10);
+	UASSERTEQ(size_t, cache.getSize(), 3);
+	UASSERT(cache.get(NoiseTileCache::Key(test_np, 0, 1, 0, 10, 1, nullptr)) == nullptr);
+	UASSERT(cache.get(NoiseTileCache::Key(test_np, 0, 0, 0, 10, 1, nullptr)) != nullptr);
+
+	// Maps larger than the whole cache are not stored
+	float big[100] = {};
+	cache.set(NoiseTileCache::Key(test_np, 0, 4, 0, 100, 1, nullptr), big, 100);
+	UASSERT(cache.get(NoiseTileCache::Key(test_np, 0, 4, 0, 100, 1, nullptr)) == nullptr);
+
+	cache.setMaxBytes(0);
+	UASSERT(!cache.isEnabled());
+	UASSERTEQ(size_t, cache.getSize(), 0);
+	UASSERTEQ(size_t, cache.getBytes(), 0);
+}
+
+void TestNoiseTileCache::testPerlinMap()
+{
+	NoiseTileCache cache(1024 * 1024);
+	NoiseParams np = test_np;
+	NoiseParams np_persist(0.6, 0.1, v3f(2000, 2000, 2000), 539, 3, 0.6, 2.0);
+
+	Noise uncached(&np, 7, 80, 80);
+	uncached.setTileCache(nullptr);
+	Noise noise(&np, 7, 80, 80);
+	noise.setTileCache(&cache);
+	Noise noise_persist(&np_persist, 7, 80, 80);
+	noise_persist.setTileCache(nullptr);
+	float *persistmap = noise_persist.perlinMap2D(-80, 0);
+
+	// Stored on the first call, then the same values are returned
+	const size_t bytes = 80 * 80 * sizeof(float);
+	float *expected = uncached.perlinMap2D(-80, 0, persistmap);
+	UASSERT(memcmp(noise.perlinMap2D(-80, 0, persistmap), expected, bytes) == 0);
+	noise.perlinMap2D(0, 0, persistmap);
+	UASSERT(memcmp(noise.perlinMap2D(-80, 0, persistmap), expected, bytes) == 0);
+	u32 hits, misses;
+	cache.takeStats(&hits, &misses);
+	UASSERTEQ(u32, hits, 1);
+	UASSERTEQ(u32, misses, 2);
+
+	// Shared by all the Noise objects with the same parameters
+	Noise other(&np, 7, 80, 80);
+	other.setTileCache(&cache);
+	UASSERT(memcmp(other.perlinMap2D(-80, 0, persistmap), expected, bytes) == 0);
+	other.perlinMap2D(-80, 0);
+	cache.takeStats(&hits, &misses);
+	UASSERTEQ(u32, hits, 1);
+	UASSERTEQ(u32, misses, 1);
+}
+
+void TestNoiseTileCache::benchMapgenColumns()
+{
+	// The 2D noises of mapgen v7 and of the biomes for a 5x5 area of
+	// mapchunks, generated 3 mapchunks high
+	static const NoiseParams noises[] = {
+		NoiseParams(4, 70, v3f(600, 600, 600), 82341, 5, 0.6, 2.0),
+		NoiseParams(-4, 25, v3f(600, 600, 600), 5934, 5, 0.6, 2.0),
+		NoiseParams(0.6, 0.1, v3f(2000, 2000, 2000), 539, 3, 0.6, 2.0),
+		NoiseParams(-8, 16, v3f(500, 500, 500), 4213, 6, 0.7, 2.0),
+		NoiseParams(50, 50, v3f(1000, 1000, 1000), 5349, 3, 0.5, 2.0),
+		NoiseParams(50, 50, v3f(1000, 1000, 1000), 842, 3, 0.5, 2.0),
+		NoiseParams(0, 1.5, v3f(8, 8, 8), 13, 2, 1.0, 2.0),
+		NoiseParams(0, 1.5, v3f(8, 8, 8), 90003, 2, 1.0, 2.0),
+	};
+	const u32 chunks = 5 * 5 * 3;
+
+	u64 times[2];
+	u32 hits, misses;
+	for (u32 n = 0; n != 2; n++) {
+		NoiseTileCache cache(32 * 1024 * 1024);
+		std::vector<Noise *> maps;
+		for (const NoiseParams &params : noises) {
+			NoiseParams np = params;
+			maps.push_back(new Noise(&np, 1337, 80, 80));
+			maps.back()->setTileCache(n == 0 ? nullptr : &cache);
+		}
+
+		u64 t = porting::getTimeUs();
+		for (u32 i = 0; i != chunks; i++) {
+			// A layer of mapchunks at a time
+			float x = (s32)(i % 5) * 80 - 32;
+			float z = (s32)(i / 5 % 5) * 80 - 32;
+			for (Noise *noise : maps)
+				noise->perlinMap2D(x, z);
+		}
+		times[n] = porting::getTimeUs() - t;
+
+		cache.takeStats(&hits, &misses);
+		for (Noise *noise : maps)
+			delete noise;
+	}
+
+	rawstream << "benchMapgenColumns: " << chunks << " mapchunks: uncached "
+		<< times[0] << "us, cached " << times[1] << "us (" << hits
+		<< " hits, " << misses << " misses)" << std::endl;
+}
@@ -0,0 +1,125 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "pathfinder.h"
+
+class TestPathfinder : public TestBase
+{
+public:
+	TestPathfinder() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestPathfinder"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testNavigationGrid();
+	void testShortestPath(PathAlgorithm algo);
+};
+
+static TestPathfinder g_test_instance;
+
+void TestPathfinder::runTests(IGameDef *gamedef)
+{
+	TEST(testNavigationGrid);
+	TEST(testShortestPath, PA_PLAIN_NP);
+	TEST(testShortestPath, PA_PLAIN);
+	TEST(testShortestPath, PA_DIJKSTRA);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+static u32 nav_index(v3s16 p)
+{
+	return p.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + p.Y * MAP_BLOCKSIZE + p.X;
+}
+
+/*
+	2x1x2 blocks with a floor at y = 0 and a wall from (8, 1, 0)
+	to (8, 2, 11)
+*/
+static std::shared_ptr<NavigationGrid> make_test_grid()
+{
+	std::shared_ptr<NavigationGrid> grid = std::make_shared<NavigationGrid>(
+		v3s16(0, 0, 0), v3s16(1, 0, 1));
+
+	v3s16 bp;
+	for (bp.Z = 0; bp.Z <= 1; bp.Z++)
+	for (bp.X = 0; bp.X <= 1; bp.X++) {
+		std::shared_ptr<NavBlock> block = std::make_shared<NavBlock>();
+		block->content_version = 0;
+		v3s16 p;
+		for (p.Z = 0; p.Z < MAP_BLOCKSIZE; p.Z++)
+		for (p.Y = 0; p.Y < MAP_BLOCKSIZE; p.Y++)
+		for (p.X = 0; p.X < MAP_BLOCKSIZE; p.X++) {
+			v3s16 pos = bp * MAP_BLOCKSIZE + p;
+			bool wall = pos.X == 8 && pos.Y <= 2 && pos.Z <= 11;
+			if (pos.Y == 0 || wall)
+				block->walkable[nav_index(p)] = true;
+		}
+		grid->setBlock(bp, block);
+	}
+	return grid;
+}
+
+void TestPathfinder::testNavigationGrid()
+{
+	std::shared_ptr<NavigationGrid> grid = make_test_grid();
+
+	UASSERT(grid->get(v3s16(3, 0, 3)) == NAV_WALKABLE);
+	UASSERT(grid->get(v3s16(3, 1, 3)) == NAV_OPEN);
+	UASSERT(grid->get(v3s16(8, 2, 20)) == NAV_OPEN);
+	UASSERT(grid->get(v3s16(8, 2, 11)) == NAV_WALKABLE);
+	// Outside of the grid
+	UASSERT(grid->get(v3s16(3, -1, 3)) == NAV_IGNORE);
+	UASSERT(grid->get(v3s16(32, 1, 3)) == NAV_IGNORE);
+
+	// Missing blocks are not loaded
+	NavigationGrid empty(v3s16(0, 0, 0), v3s16(0, 0, 0));
+	UASSERT(empty.get(v3s16(3, 1, 3)) == NAV_IGNORE);
+}
+
+void TestPathfinder::testShortestPath(PathAlgorithm algo)
+{
+	std::shared_ptr<NavigationGrid> grid = make_test_grid();
+
+	PathRequest req;
+	req.source = v3s16(2, 1, 2);
+	req.destination = v3s16(14, 1, 2);
+	req.searchdistance = 12;
+	req.max_jump = 1;
+	req.max_drop = 1;
+	req.algo = algo;
+
+	std::vector<v3s16> path = get_path(*grid, req);
+
+	// Around the wall: 10 nodes to z = 12, 12 along x and 10 back
+	UASSERTEQ(size_t, path.size(), 33);
+	UASSERT(path.front() == req.source);
+	UASSERT(path.back() == req.destination);
+	for (size_t i = 1; i < path.size(); i++) {
+		v3s16 d = path[i] - path[i - 1];
+		UASSERTEQ(int, abs(d.X) + abs(d.Z), 1);
+		UASSERTEQ(int, d.Y, 0);
+	}
+
+	// Nothing is found once the way around is blocked by the search distance
+	req.searchdistance = 8;
+	UASSERT(get_path(*grid, req).empty());
+}
@@ -19,6 +19,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <sstream>
+#include <thread>
+#include "porting.h"
 #include "profiler.h"
 
 class TestProfiler : public TestBase
@@ -30,6 +33,11 @@ class TestProfiler : public TestBase
 	void runTests(IGameDef *gamedef);
 
 	void testProfilerAverage();
+	void testKeys();
+	void testTree();
+	void testTrace();
+	void testThreadBufferReuse();
+	void benchScopes();
 };
 
 static TestProfiler g_test_instance;
@@ -37,6 +45,11 @@ static TestProfiler g_test_instance;
 void TestProfiler::runTests(IGameDef *gamedef)
 {
 	TEST(testProfilerAverage);
+	TEST(testKeys);
+	TEST(testTree);
+	TEST(testTrace);
+	TEST(testThreadBufferReuse);
+	BENCHMARK(benchScopes);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -71,3 +84,160 @@ void TestProfiler::testProfilerAverage()
 
 	UASSERT(p.getValue("Test2") == 123.57f);
 }
+
+void TestProfiler::testKeys()
+{
+	Profiler p;
+
+	// Keys of the same name are the same key
+	const ProfilerKey &key = PROFILER_KEY("TestKeys avg");
+	UASSERT(ProfilerKey("TestKeys avg").getId() == key.getId());
+	UASSERT(key.getName() == "TestKeys avg");
+
+	// Recorded by several threads, merged when read
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 4; i++) {
+		threads.emplace_back([&p] () {
+			for (int j = 0; j < 1000; j++) {
+				p.avg(PROFILER_KEY("TestKeys avg"), j % 2 ? 1.f : 3.f);
+				p.add(PROFILER_KEY("TestKeys add"), 0.5f);
+			}
+		});
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+
+	UASSERT(p.getValue("TestKeys avg") == 2.f);
+	UASSERT(p.getAvgCount("TestKeys avg") == 4000);
+	UASSERT(p.getValue("TestKeys add") == 2000.f);
+
+	// Mixes with values recorded by name
+	p.add("TestKeys add", 1.f);
+	UASSERT(p.getValue("TestKeys add") == 2001.f);
+
+	p.clear();
+	UASSERT(p.getValue("TestKeys add") == 0.f);
+	p.add(PROFILER_KEY("TestKeys add"), 2.f);
+	UASSERT(p.getValue("TestKeys add") == 2.f);
+}
+
+void TestProfiler::testTree()
+{
+	Profiler p;
+
+	for (int i = 0; i < 3; i++) {
+		ScopeProfiler outer(&p, SCOPE_PROFILER_KEY("TestTree outer"), SPT_AVG);
+		for (int j = 0; j < 2; j++) {
+			ScopeProfiler inner(&p, SCOPE_PROFILER_KEY("TestTree inner"), SPT_AVG);
+		}
+	}
+	{
+		// The same scope elsewhere in the tree
+		ScopeProfiler inner(&p, SCOPE_PROFILER_KEY("TestTree inner"), SPT_AVG);
+	}
+
+	std::vector<Profiler::TreeNode> tree = p.getTree();
+	UASSERTEQ(size_t, tree.size(), 3);
+	UASSERT(tree[0].name == "TestTree outer [ms]" && tree[0].depth == 0);
+	UASSERTEQ(u32, tree[0].count, 3);
+	UASSERT(tree[1].name == "TestTree inner [ms]" && tree[1].depth == 1);
+	UASSERTEQ(u32, tree[1].count, 6);
+	UASSERT(tree[2].name == "TestTree inner [ms]" && tree[2].depth == 0);
+	UASSERTEQ(u32, tree[2].count, 1);
+	UASSERT(tree[0].total_ms >= tree[1].total_ms);
+
+	// Scopes are recorded as values too
+	UASSERTEQ(int, p.getAvgCount("TestTree inner [ms]"), 7);
+
+	p.clear();
+	UASSERTEQ(size_t, p.getTree().size(), 0);
+}
+
+void TestProfiler::testTrace()
+{
+	Profiler p;
+
+	{
+		// Not traced yet
+		ScopeProfiler sp(&p, SCOPE_PROFILER_KEY("TestTrace before"));
+	}
+	p.startTrace();
+	std::thread thread([&p] () {
+		ScopeProfiler sp(&p, SCOPE_PROFILER_KEY("TestTrace \"thread\""));
+	});
+	thread.join();
+	{
+		ScopeProfiler outer(&p, SCOPE_PROFILER_KEY("TestTrace outer"));
+		ScopeProfiler inner(&p, SCOPE_PROFILER_KEY("TestTrace inner"));
+	}
+	p.stopTrace();
+	{
+		ScopeProfiler sp(&p, SCOPE_PROFILER_KEY("TestTrace after"));
+	}
+
+	std::ostringstream os;
+	p.writeTrace(os);
+	std::string trace = os.str();
+	UASSERT(trace.find("{\"traceEvents\":[") == 0);
+	UASSERT(trace.find("\"TestTrace outer [ms]\"") != std::string::npos);
+	UASSERT(trace.find("\"TestTrace inner [ms]\"") != std::string::npos);
+	UASSERT(trace.find("\"TestTrace \\\"thread\\\" [ms]\"") != std::string::npos);
+	UASSERT(trace.find("TestTrace before") == std::string::npos);
+	UASSERT(trace.find("TestTrace after") == std::string::npos);
+	UASSERT(trace.find("\"ph\":\"X\"") != std::string::npos);
+}
+
+void TestProfiler::testThreadBufferReuse()
+{
+	Profiler p;
+	p.startTrace();
+
+	// Threads that run one after another share a buffer, and nothing they
+	// recorded gets lost
+	for (int i = 0; i < 4; i++) {
+		std::thread thread([&p] () {
+			ScopeProfiler sp(&p, SCOPE_PROFILER_KEY("TestReuse scope"));
+			p.add(PROFILER_KEY("TestReuse add"), 1.f);
+		});
+		thread.join();
+		UASSERT(p.getValue("TestReuse add") == i + 1.f);
+	}
+	p.stopTrace();
+	std::vector<Profiler::TreeNode> tree = p.getTree();
+	UASSERTEQ(size_t, tree.size(), 1);
+	UASSERTEQ(u32, tree[0].count, 4);
+
+	std::ostringstream os;
+	p.writeTrace(os);
+	std::string trace = os.str();
+	std::vector<std::string> tids;
+	for (size_t pos = trace.find("\"tid\":"); pos != std::string::npos;
+			pos = trace.find("\"tid\":", pos + 1))
+		tids.push_back(trace.substr(pos, trace.find(',', pos) - pos));
+	UASSERTEQ(size_t, tids.size(), 4);
+	for (const std::string &tid : tids)
+		UASSERTEQ(std::string, tid, tids[0]);
+}
+
+void TestProfiler::benchScopes()
+{
+	// What a scope costs when recorded by name and by key
+	Profiler p;
+	const u32 count = 100000;
+
+	u64 t = porting::getTimeUs();
+	for (u32 i = 0; i < count; i++)
+		ScopeProfiler sp(&p, "BenchScopes named", SPT_AVG);
+	u64 time_named = porting::getTimeUs() - t;
+
+	t = porting::getTimeUs();
+	for (u32 i = 0; i < count; i++)
+		ScopeProfiler sp(&p, SCOPE_PROFILER_KEY("BenchScopes keyed"), SPT_AVG);
+	u64 time_keyed = porting::getTimeUs() - t;
+
+	UASSERTEQ(int, p.getAvgCount("BenchScopes named [ms]"), count);
+	UASSERTEQ(int, p.getAvgCount("BenchScopes keyed [ms]"), count);
+
+	rawstream << "benchScopes: " << count << " scopes: named "
+		<< time_named << "us, keyed " << time_keyed << "us" << std::endl;
+}
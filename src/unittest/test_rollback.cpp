@@ -0,0 +1,333 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+
+#include "test.h"
+
+#include <ctime>
+#include "filesys.h"
+#include "porting.h"
+#include "rollback.h"
+#include "sqlite3.h"
+#include "noise.h"
+#include "util/numeric.h"
+
+class TestRollback : public TestBase
+{
+public:
+	TestRollback() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestRollback"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testPartitions();
+	void testNodeActors();
+	void testRevertActions();
+	void testRetention();
+	void testLegacyTable();
+	void testFailedWrite();
+	void benchRollback();
+
+private:
+	std::string makeWorldDir(const std::string &name);
+};
+
+static TestRollback g_test_instance;
+
+void TestRollback::runTests(IGameDef *gamedef)
+{
+	TEST(testPartitions);
+	TEST(testNodeActors);
+	TEST(testRevertActions);
+	TEST(testRetention);
+	TEST(testLegacyTable);
+	TEST(testFailedWrite);
+	BENCHMARK(benchRollback);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#define DAY (24 * 3600)
+
+static RollbackAction set_node(const std::string &actor, time_t t, v3s16 p,
+	const std::string &old_name, const std::string &new_name)
+{
+	RollbackNode n_old, n_new;
+	n_old.name = old_name;
+	n_new.name = new_name;
+
+	RollbackAction action;
+	action.setSetNode(p, n_old, n_new);
+	action.actor = actor;
+	action.unix_time = t;
+	return action;
+}
+
+std::string TestRollback::makeWorldDir(const std::string &name)
+{
+	std::string dir = getTestTempDirectory() + DIR_DELIM + name;
+	UASSERT(fs::CreateDir(dir));
+	return dir;
+}
+
+void TestRollback::testPartitions()
+{
+	const std::string dir = makeWorldDir("partitions");
+	const time_t now = time(0);
+	{
+		RollbackManager rollback(dir, nullptr, 7, 0);
+		rollback.addAction(set_node("a", now - 20 * DAY, v3s16(0, 0, 0), "air", "stone"));
+		rollback.addAction(set_node("a", now - 10 * DAY, v3s16(1, 0, 0), "air", "stone"));
+		rollback.addAction(set_node("b", now, v3s16(2, 0, 0), "air", "dirt"));
+		rollback.waitForWrites();
+
+		// Ten days apart can't be in the same week
+		std::vector<time_t> starts = rollback.getPartitionStarts();
+		UASSERTEQ(size_t, starts.size(), 3);
+		for (time_t start : starts)
+			UASSERT(start % (7 * DAY) == 0);
+
+		std::list<RollbackAction> actions = rollback.getEntriesSince(now - 30 * DAY);
+		UASSERTEQ(size_t, actions.size(), 3);
+		// Newest first
+		UASSERT(actions.front().p == v3s16(2, 0, 0));
+		UASSERT(actions.back().p == v3s16(0, 0, 0));
+		UASSERT(actions.front().n_new.name == "dirt");
+
+		UASSERTEQ(size_t, rollback.getEntriesSince(now - 5 * DAY).size(), 1);
+	}
+
+	// The partitions are found again when the world is loaded
+	RollbackManager rollback(dir, nullptr, 7, 0);
+	UASSERTEQ(size_t, rollback.getPartitionStarts().size(), 3);
+	UASSERTEQ(size_t, rollback.getEntriesSince(now - 30 * DAY).size(), 3);
+}
+
+void TestRollback::testNodeActors()
+{
+	const std::string dir = makeWorldDir("node_actors");
+	const time_t now = time(0);
+	RollbackManager rollback(dir, nullptr, 1, 0);
+
+	// Spread over several blocks, days and actors
+	for (s16 i = 0; i < 100; i++) {
+		v3s16 p(i - 50, (i * 7) % 20 - 10, (i * 13) % 40 - 20);
+		rollback.addAction(set_node("player" + itos(i % 3),
+			now - (100 - i) * 3600, p, "air", "stone"));
+	}
+
+	// Small ranges are looked up block by block, large ones by coordinates
+	for (int range : {0, 5, 20, 80}) {
+		std::list<RollbackAction> actions =
+			rollback.getNodeActors(v3s16(0, 0, 0), range, 200 * 3600, 1000);
+		u32 expected = 0;
+		for (s16 i = 0; i < 100; i++) {
+			v3s16 p(i - 50, (i * 7) % 20 - 10, (i * 13) % 40 - 20);
+			if (std::abs(p.X) <= range && std::abs(p.Y) <= range &&
+					std::abs(p.Z) <= range)
+				expected++;
+		}
+		UASSERTEQ(size_t, actions.size(), expected);
+
+		time_t last = now;
+		for (const RollbackAction &action : actions) {
+			UASSERT(action.unix_time <= last);
+			last = action.unix_time;
+		}
+	}
+
+	// The limit applies to all partitions together
+	std::list<RollbackAction> actions =
+		rollback.getNodeActors(v3s16(0, 0, 0), 80, 200 * 3600, 10);
+	UASSERTEQ(size_t, actions.size(), 10);
+	UASSERT(actions.front().p == v3s16(49, (99 * 7) % 20 - 10, (99 * 13) % 40 - 20));
+
+	// Only the given time is searched
+	actions = rollback.getNodeActors(v3s16(0, 0, 0), 80, 10 * 3600 + 1800, 1000);
+	UASSERTEQ(size_t, actions.size(), 10);
+}
+
+void TestRollback::testRevertActions()
+{
+	const std::string dir = makeWorldDir("revert");
+	const time_t now = time(0);
+	RollbackManager rollback(dir, nullptr, 1, 0);
+
+	// The same node changed several times within one second and across days
+	v3s16 p(3, 4, 5);
+	rollback.addAction(set_node("griefer", now - 2 * DAY, p, "air", "a"));
+	rollback.addAction(set_node("other", now - DAY, p, "a", "b"));
+	rollback.addAction(set_node("griefer", now, p, "b", "c"));
+	rollback.addAction(set_node("griefer", now, p, "c", "d"));
+
+	std::list<RollbackAction> actions = rollback.getRevertActions("griefer", 3 * DAY);
+	UASSERTEQ(size_t, actions.size(), 3);
+	// Reverted newest first, in reverse order of the changes
+	auto it = actions.begin();
+	UASSERT(it->n_new.name == "d");
+	UASSERT((++it)->n_new.name == "c");
+	UASSERT((++it)->n_new.name == "a");
+	for (const RollbackAction &action : actions)
+		UASSERT(action.actor == "griefer");
+
+	UASSERTEQ(size_t, rollback.getRevertActions("other", 3 * DAY).size(), 1);
+	UASSERTEQ(size_t, rollback.getRevertActions("nobody", 3 * DAY).size(), 0);
+}
+
+void TestRollback::testRetention()
+{
+	const std::string dir = makeWorldDir("retention");
+	const time_t now = time(0);
+	{
+		RollbackManager rollback(dir, nullptr, 1, 0);
+		for (int day = 0; day < 10; day++)
+			rollback.addAction(set_node("a", now - day * DAY, v3s16(day, 0, 0),
+				"air", "stone"));
+		rollback.waitForWrites();
+		UASSERTEQ(size_t, rollback.getPartitionStarts().size(), 10);
+	}
+
+	// Partitions that ended more than 5 days ago are dropped on startup
+	RollbackManager rollback(dir, nullptr, 1, 5);
+	std::vector<time_t> starts = rollback.getPartitionStarts();
+	UASSERT(starts.size() == 5 || starts.size() == 6);
+	for (time_t start : starts)
+		UASSERT(start + DAY > now - 5 * DAY);
+
+	std::list<RollbackAction> actions = rollback.getEntriesSince(0);
+	UASSERTEQ(size_t, actions.size(), starts.size());
+}
+
+void TestRollback::testLegacyTable()
+{
+	const std::string dir = makeWorldDir("legacy");
+	const time_t now = time(0);
+
+	// A database written by older versions
+	sqlite3 *db;
+	UASSERT(sqlite3_open((dir + DIR_DELIM "rollback.sqlite").c_str(), &db) == SQLITE_OK);
+	UASSERT(sqlite3_exec(db,
+		"CREATE TABLE `actor` (`id` INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,"
+		" `name` TEXT NOT NULL);"
+		"CREATE TABLE `node` (`id` INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,"
+		" `name` TEXT NOT NULL);"
+		"CREATE TABLE `action` (`id` INTEGER PRIMARY KEY AUTOINCREMENT,"
+		" `actor` INTEGER NOT NULL, `timestamp` TIMESTAMP NOT NULL,"
+		" `type` INTEGER NOT NULL, `list` TEXT, `index` INTEGER, `add` INTEGER,"
+		" `stackNode` INTEGER, `stackQuantity` INTEGER, `nodeMeta` INTEGER,"
+		" `x` INT, `y` INT, `z` INT, `oldNode` INTEGER, `oldParam1` INTEGER,"
+		" `oldParam2` INTEGER, `oldMeta` TEXT, `newNode` INTEGER,"
+		" `newParam1` INTEGER, `newParam2` INTEGER, `newMeta` TEXT,"
+		" `guessedActor` INTEGER);"
+		"INSERT INTO `actor` (`name`) VALUES ('old');"
+		"INSERT INTO `node` (`name`) VALUES ('air');"
+		"INSERT INTO `node` (`name`) VALUES ('stone');",
+		NULL, NULL, NULL) == SQLITE_OK);
+	std::string insert = "INSERT INTO `action` (`actor`, `timestamp`, `type`,"
+		" `x`, `y`, `z`, `oldNode`, `oldParam1`, `oldParam2`, `oldMeta`,"
+		" `newNode`, `newParam1`, `newParam2`, `newMeta`, `guessedActor`)"
+		" VALUES (1, " + i64tos(now - 60) + ", 1, 1, 2, 3, 1, 0, 0, '', 2, 0, 0, '', 0)";
+	UASSERT(sqlite3_exec(db, insert.c_str(), NULL, NULL, NULL) == SQLITE_OK);
+	sqlite3_close(db);
+
+	RollbackManager rollback(dir, nullptr, 7, 30);
+	rollback.addAction(set_node("new", now, v3s16(1, 2, 3), "stone", "air"));
+
+	std::list<RollbackAction> actions = rollback.getNodeActors(v3s16(1, 2, 3), 0, 3600, 10);
+	UASSERTEQ(size_t, actions.size(), 2);
+	UASSERT(actions.front().actor == "new");
+	UASSERT(actions.back().actor == "old");
+	UASSERT(actions.back().n_new.name == "stone");
+
+	UASSERTEQ(size_t, rollback.getRevertActions("old", 3600).size(), 1);
+	UASSERTEQ(size_t, rollback.getPartitionStarts().size(), 1);
+}
+
+void TestRollback::testFailedWrite()
+{
+	const std::string dir = makeWorldDir("failed");
+	const time_t now = time(0);
+	RollbackManager rollback(dir, nullptr, 7, 0);
+
+	// Writing the actor "bad" fails, after "good" and a partition for its
+	// action were added in the same transaction
+	sqlite3 *db;
+	UASSERT(sqlite3_open((dir + DIR_DELIM "rollback.sqlite").c_str(), &db) == SQLITE_OK);
+	UASSERT(sqlite3_exec(db,
+		"CREATE TRIGGER `reject_bad` BEFORE INSERT ON `actor`"
+		" WHEN NEW.`name` = 'bad' BEGIN SELECT RAISE(ABORT, 'rejected'); END",
+		NULL, NULL, NULL) == SQLITE_OK);
+	rollback.addAction(set_node("good", now - 100 * DAY, v3s16(0, 0, 0), "air", "stone"));
+	rollback.addAction(set_node("bad", now - 100 * DAY, v3s16(1, 0, 0), "air", "stone"));
+	rollback.waitForWrites();
+	UASSERT(rollback.getPartitionStarts().empty());
+	UASSERT(rollback.getEntriesSince(now - 200 * DAY).empty());
+
+	// Nothing of the failed transaction is remembered
+	UASSERT(sqlite3_exec(db, "DROP TRIGGER `reject_bad`", NULL, NULL, NULL) == SQLITE_OK);
+	sqlite3_close(db);
+	rollback.addAction(set_node("good", now - 100 * DAY, v3s16(2, 0, 0), "air", "dirt"));
+	rollback.waitForWrites();
+	UASSERTEQ(size_t, rollback.getPartitionStarts().size(), 1);
+	std::list<RollbackAction> actions = rollback.getEntriesSince(now - 200 * DAY);
+	UASSERTEQ(size_t, actions.size(), 1);
+	UASSERT(actions.front().actor == "good");
+	UASSERT(actions.front().n_new.name == "dirt");
+}
+
+void TestRollback::benchRollback()
+{
+	// Replays a busy server recording actions for 30 days. Raise to
+	// 10000000 to measure a full replay; kept small for the unit tests.
+	const u32 action_count = 200000;
+	const std::string dir = makeWorldDir("bench");
+	const time_t now = time(0);
+	const time_t start = now - 30 * DAY;
+	PcgRandom pr(42);
+
+	u64 t = porting::getTimeUs();
+	u64 time_insert, time_query = 0, time_revert = 0;
+	{
+		RollbackManager rollback(dir, nullptr, 7, 0);
+		for (u32 i = 0; i < action_count; i++) {
+			v3s16 p(pr.range(-2000, 2000), pr.range(-50, 50), pr.range(-2000, 2000));
+			rollback.addAction(set_node("player" + itos(pr.range(0, 99)),
+				start + (time_t)i * 30 * DAY / action_count, p, "air", "stone"));
+		}
+		rollback.waitForWrites();
+		time_insert = porting::getTimeUs() - t;
+
+		// What players inspecting nodes and moderators reverting ask for
+		for (u32 i = 0; i < 100; i++) {
+			v3s16 p(pr.range(-2000, 2000), pr.range(-50, 50), pr.range(-2000, 2000));
+			t = porting::getTimeUs();
+			rollback.getNodeActors(p, 5, 7 * DAY, 100);
+			time_query += porting::getTimeUs() - t;
+		}
+		for (u32 i = 0; i < 10; i++) {
+			t = porting::getTimeUs();
+			rollback.getRevertActions("player" + itos(i), DAY);
+			time_revert += porting::getTimeUs() - t;
+		}
+	}
+
+	rawstream << "benchRollback: " << action_count << " actions: insert "
+		<< time_insert << "us, 100 node queries " << time_query
+		<< "us, 10 reverts " << time_revert << "us" << std::endl;
+}
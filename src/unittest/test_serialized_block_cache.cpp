@@ -0,0 +1,116 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "server/serialized_block_cache.h"
+
+class TestSerializedBlockCache : public TestBase
+{
+public:
+	TestSerializedBlockCache() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestSerializedBlockCache"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testGetSet();
+	void testContentVersion();
+	void testEviction();
+};
+
+static TestSerializedBlockCache g_test_instance;
+
+void TestSerializedBlockCache::runTests(IGameDef *gamedef)
+{
+	TEST(testGetSet);
+	TEST(testContentVersion);
+	TEST(testEviction);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestSerializedBlockCache::testGetSet()
+{
+	SerializedBlockCache cache(1024);
+	const v3s16 p(1, -2, 3);
+
+	UASSERT(cache.get(p, 28, 1) == nullptr);
+
+	SerializedBlockCache::Data d = cache.set(p, 28, 1, std::string("hello"));
+	UASSERT(*d == "hello");
+	UASSERT(cache.get(p, 28, 1) == d);
+
+	// Serialization version and position are part of the key
+	UASSERT(cache.get(p, 27, 1) == nullptr);
+	UASSERT(cache.get(v3s16(1, 2, 3), 28, 1) == nullptr);
+	UASSERT(cache.get(v3s16(-1, -2, 3), 28, 1) == nullptr);
+
+	u32 hits, misses;
+	cache.takeStats(&hits, &misses);
+	UASSERTEQ(u32, hits, 1);
+	UASSERTEQ(u32, misses, 4);
+	cache.takeStats(&hits, &misses);
+	UASSERTEQ(u32, hits + misses, 0);
+}
+
+void TestSerializedBlockCache::testContentVersion()
+{
+	SerializedBlockCache cache(1024);
+	const v3s16 p(0, 0, 0);
+
+	cache.set(p, 28, 5, std::string("old"));
+	UASSERT(cache.get(p, 28, 6) == nullptr);
+	// Stale entries are dropped when detected
+	UASSERTEQ(size_t, cache.getSize(), 0);
+	UASSERT(cache.get(p, 28, 5) == nullptr);
+
+	cache.set(p, 28, 6, std::string("new"));
+	cache.set(p, 28, 7, std::string("newer"));
+	UASSERTEQ(size_t, cache.getSize(), 1);
+	UASSERTEQ(size_t, cache.getBytes(), 5);
+	UASSERT(*cache.get(p, 28, 7) == "newer");
+}
+
+void TestSerializedBlockCache::testEviction()
+{
+	SerializedBlockCache cache(30);
+	const std::string data(10, 'x');
+
+	cache.set(v3s16(0, 0, 0), 28, 1, std::string(data));
+	cache.set(v3s16(1, 0, 0), 28, 1, std::string(data));
+	cache.set(v3s16(2, 0, 0), 28, 1, std::string(data));
+	UASSERTEQ(size_t, cache.getBytes(), 30);
+
+	// Touch the oldest entry so that the second one gets evicted
+	UASSERT(cache.get(v3s16(0, 0, 0), 28, 1) != nullptr);
+	cache.set(v3s16(3, 0, 0), 28, 1, std::string(data));
+	UASSERTEQ(size_t, cache.getSize(), 3);
+	UASSERT(cache.get(v3s16(1, 0, 0), 28, 1) == nullptr);
+	UASSERT(cache.get(v3s16(0, 0, 0), 28, 1) != nullptr);
+
+	// Data larger than the whole cache is returned but not stored
+	SerializedBlockCache::Data big = cache.set(v3s16(4, 0, 0), 28, 1,
+			std::string(100, 'y'));
+	UASSERTEQ(size_t, big->size(), 100);
+	UASSERT(cache.get(v3s16(4, 0, 0), 28, 1) == nullptr);
+
+	cache.setMaxBytes(0);
+	UASSERTEQ(size_t, cache.getSize(), 0);
+	UASSERTEQ(size_t, cache.getBytes(), 0);
+}
@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include "profiler.h"
+#include "noise.h"
 
 class TestServerActiveObject : public ServerActiveObject
 {
@@ -47,7 +48,10 @@ class TestServerActiveObjectMgr : public TestBase
 	void testRegisterObject();
 	void testRemoveObject();
 	void testGetObjectsInsideRadius();
+	void testGetObjectsInArea();
 	void testGetAddedActiveObjectsAroundPos();
+	void testSpatialIndexMove();
+	void benchGetObjectsInsideRadius();
 };
 
 static TestServerActiveObjectMgr g_test_instance;
@@ -58,7 +62,10 @@ void TestServerActiveObjectMgr::runTests(IGameDef *gamedef)
 	TEST(testRegisterObject)
 	TEST(testRemoveObject)
 	TEST(testGetObjectsInsideRadius);
+	TEST(testGetObjectsInArea);
 	TEST(testGetAddedActiveObjectsAroundPos);
+	TEST(testSpatialIndexMove);
+	BENCHMARK(benchGetObjectsInsideRadius);
 }
 
 void clearSAOMgr(server::ActiveObjectMgr *saomgr)
@@ -186,3 +193,105 @@ void TestServerActiveObjectMgr::testGetAddedActiveObjectsAroundPos()
 
 	clearSAOMgr(&saomgr);
 }
+
+void TestServerActiveObjectMgr::testGetObjectsInArea()
+{
+	server::ActiveObjectMgr saomgr;
+	static const v3f sao_pos[] = {
+			v3f(10, 40, 10),
+			v3f(740, 100, -304),
+			v3f(-200, 100, -304),
+			v3f(740, -740, -304),
+			v3f(1500, -740, -304),
+	};
+
+	for (const auto &p : sao_pos) {
+		saomgr.registerObject(new TestServerActiveObject(p));
+	}
+
+	std::vector<u16> result;
+	saomgr.getObjectsInArea(aabb3f(v3f(-50, -50, -50), v3f(50, 50, 50)), result);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(v3f(-200, 0, -400), v3f(740, 100, 10)), result);
+	UASSERTCMP(int, ==, result.size(), 3);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(v3f(-2000, -2000, -2000),
+			v3f(2000, 2000, 2000)), result);
+	UASSERTCMP(int, ==, result.size(), 5);
+
+	clearSAOMgr(&saomgr);
+}
+
+void TestServerActiveObjectMgr::testSpatialIndexMove()
+{
+	server::ActiveObjectMgr saomgr;
+	auto tsao = new TestServerActiveObject(v3f(0, 0, 0));
+	saomgr.registerObject(tsao);
+
+	std::vector<u16> result;
+	saomgr.getObjectsInsideRadius(v3f(), 10, result);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	// Moves to another cell must be picked up by the index
+	tsao->setBasePosition(v3f(5000, -3000, 1000));
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(), 10, result);
+	UASSERTCMP(int, ==, result.size(), 0);
+	saomgr.getObjectsInsideRadius(v3f(5000, -3000, 1000), 10, result);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	// Removed objects must not be found anymore
+	saomgr.removeObject(tsao->getId());
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(5000, -3000, 1000), 10, result);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	clearSAOMgr(&saomgr);
+}
+
+void TestServerActiveObjectMgr::benchGetObjectsInsideRadius()
+{
+	// Compare the spatial index against a plain scan over many objects
+	server::ActiveObjectMgr saomgr;
+	PcgRandom pr(42);
+	const s32 extent = 1000 * BS;
+	for (u32 i = 0; i < 3000; i++) {
+		saomgr.registerObject(new TestServerActiveObject(v3f(
+				pr.range(-extent, extent),
+				pr.range(-100 * BS, 100 * BS),
+				pr.range(-extent, extent))));
+	}
+
+	const float radius = 5 * BS;
+	u64 time_index = 0, time_scan = 0;
+	std::vector<u16> result;
+	for (u32 i = 0; i < 1000; i++) {
+		v3f pos(pr.range(-extent, extent), pr.range(-100 * BS, 100 * BS),
+				pr.range(-extent, extent));
+
+		u64 t = porting::getTimeUs();
+		result.clear();
+		saomgr.getObjectsInsideRadius(pos, radius, result);
+		time_index += porting::getTimeUs() - t;
+
+		t = porting::getTimeUs();
+		size_t count = 0;
+		for (auto &it : saomgr.m_active_objects) {
+			if (it.second->getBasePosition().getDistanceFromSQ(pos) <=
+					radius * radius)
+				count++;
+		}
+		time_scan += porting::getTimeUs() - t;
+
+		UASSERTEQ(size_t, result.size(), count);
+	}
+
+	rawstream << "benchGetObjectsInsideRadius: 3000 objects, 1000 queries: "
+		<< "index " << time_index << "us, scan " << time_scan << "us"
+		<< std::endl;
+
+	clearSAOMgr(&saomgr);
+}
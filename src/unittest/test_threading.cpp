@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <atomic>
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "threading/worker_pool.h"
 
 
 class TestThreading : public TestBase {
@@ -33,6 +34,7 @@ class TestThreading : public TestBase {
 	void testStartStopWait();
 	void testThreadKill();
 	void testAtomicSemaphoreThread();
+	void testWorkerPool();
 };
 
 static TestThreading g_test_instance;
@@ -42,6 +44,7 @@ void TestThreading::runTests(IGameDef *gamedef)
 	TEST(testStartStopWait);
 	TEST(testThreadKill);
 	TEST(testAtomicSemaphoreThread);
+	TEST(testWorkerPool);
 }
 
 class SimpleTestThread : public Thread {
@@ -181,3 +184,29 @@ void TestThreading::testAtomicSemaphoreThread()
 	UASSERT(val == num_threads * 0x10000);
 }
 
+
+
+void TestThreading::testWorkerPool()
+{
+	WorkerPool pool("WorkerPoolTest", 4);
+	UASSERTEQ(u16, pool.getThreadCount(), 4);
+
+	// Run several batches to check that the threads come back for more
+	for (size_t batch = 0; batch != 10; batch++) {
+		const size_t job_count = batch * 100;
+		std::vector<std::atomic<u32>> done(job_count);
+		for (auto &d : done)
+			d = 0;
+		std::atomic<bool> bad_worker(false);
+
+		pool.run(job_count, [&] (size_t job, u16 worker) {
+			if (worker > 4)
+				bad_worker = true;
+			done[job]++;
+		});
+
+		UASSERT(!bad_worker);
+		for (auto &d : done)
+			UASSERTEQ(u32, d, 1);
+	}
+}
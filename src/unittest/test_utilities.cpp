@@ -20,6 +20,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include <cmath>
+#include <map>
+#include "noise.h"
+#include "util/blockpos_map.h"
 #include "util/numeric.h"
 #include "util/string.h"
 
@@ -54,6 +57,7 @@ class TestUtilities : public TestBase {
 	void testMyround();
 	void testStringJoin();
 	void testEulerConversion();
+	void testBlockPosMap();
 };
 
 static TestUtilities g_test_instance;
@@ -84,6 +88,7 @@ void TestUtilities::runTests(IGameDef *gamedef)
 	TEST(testMyround);
 	TEST(testStringJoin);
 	TEST(testEulerConversion);
+	TEST(testBlockPosMap);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -508,3 +513,40 @@ void TestUtilities::testEulerConversion()
 	setPitchYawRoll(m2, v2);
 	UASSERT(within(m1, m2, tolL));
 }
+
+void TestUtilities::testBlockPosMap()
+{
+	// Compare against std::map with many colliding insertions and erasures
+	BlockPosMap<int> map;
+	std::map<v3s16, int> ref;
+	PcgRandom pr(7);
+	for (int i = 0; i < 20000; i++) {
+		v3s16 p(pr.range(-8, 8), pr.range(-8, 8), pr.range(-8, 8));
+		if (pr.range(0, 2) == 0) {
+			UASSERT(map.erase(p) == (ref.erase(p) == 1));
+		} else {
+			map[p] = i;
+			ref[p] = i;
+		}
+	}
+
+	UASSERTEQ(size_t, map.size(), ref.size());
+	for (const auto &it : ref) {
+		const int *value = map.find(it.first);
+		UASSERT(value && *value == it.second);
+	}
+	size_t count = 0;
+	for (const auto &slot : map) {
+		UASSERT(ref.count(slot.first) == 1);
+		count++;
+	}
+	UASSERTEQ(size_t, count, ref.size());
+	UASSERT(!map.contains(v3s16(100, 0, 0)));
+
+	BlockPosSet set;
+	UASSERT(set.insert(v3s16(1, 2, 3)));
+	UASSERT(!set.insert(v3s16(1, 2, 3)));
+	UASSERT(set.contains(v3s16(1, 2, 3)));
+	UASSERT(set.erase(v3s16(1, 2, 3)));
+	UASSERT(set.empty());
+}
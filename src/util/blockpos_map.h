@@ -0,0 +1,246 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <vector>
+#include "irr_v3d.h"
+
+/*
+	Hash map keyed by v3s16, stored in a single flat array with open
+	addressing (linear probing). Lookups touch one or two cache lines and
+	inserting or erasing does not allocate unless the table grows.
+
+	Any insertion or erasure invalidates iterators and pointers to values.
+*/
+template <typename T>
+class BlockPosMap
+{
+public:
+	struct Slot
+	{
+		v3s16 first;
+		T second;
+		bool used;
+	};
+
+	class iterator
+	{
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef Slot value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef Slot *pointer;
+		typedef Slot &reference;
+
+		iterator(Slot *slot, Slot *end) : m_slot(slot), m_end(end) { skip(); }
+
+		Slot &operator*() const { return *m_slot; }
+		Slot *operator->() const { return m_slot; }
+		iterator &operator++() { m_slot++; skip(); return *this; }
+		bool operator==(const iterator &other) const { return m_slot == other.m_slot; }
+		bool operator!=(const iterator &other) const { return m_slot != other.m_slot; }
+
+	private:
+		void skip() { while (m_slot != m_end && !m_slot->used) m_slot++; }
+
+		Slot *m_slot;
+		Slot *m_end;
+	};
+
+	BlockPosMap() = default;
+
+	iterator begin() { return iterator(m_slots.data(), m_slots.data() + m_slots.size()); }
+	iterator end()
+	{
+		Slot *end = m_slots.data() + m_slots.size();
+		return iterator(end, end);
+	}
+
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+
+	void clear()
+	{
+		m_slots.clear();
+		m_size = 0;
+	}
+
+	// Returns nullptr if there is no such key
+	T *find(v3s16 p)
+	{
+		if (m_slots.empty())
+			return nullptr;
+		for (size_t i = slotIndex(p); ; i = (i + 1) & mask()) {
+			Slot &slot = m_slots[i];
+			if (!slot.used)
+				return nullptr;
+			if (slot.first == p)
+				return &slot.second;
+		}
+	}
+
+	const T *find(v3s16 p) const
+	{
+		return const_cast<BlockPosMap *>(this)->find(p);
+	}
+
+	bool contains(v3s16 p) const { return find(p) != nullptr; }
+
+	// Inserts a value-initialized entry if there is no such key
+	T &operator[](v3s16 p)
+	{
+		// Keep the load factor at or below 1/2
+		if ((m_size + 1) * 2 > m_slots.size())
+			rehash(m_slots.empty() ? 16 : m_slots.size() * 2);
+
+		size_t i = slotIndex(p);
+		for (; m_slots[i].used; i = (i + 1) & mask()) {
+			if (m_slots[i].first == p)
+				return m_slots[i].second;
+		}
+		m_slots[i].first = p;
+		m_slots[i].second = T();
+		m_slots[i].used = true;
+		m_size++;
+		return m_slots[i].second;
+	}
+
+	bool erase(v3s16 p)
+	{
+		if (m_slots.empty())
+			return false;
+		size_t i = slotIndex(p);
+		for (; ; i = (i + 1) & mask()) {
+			if (!m_slots[i].used)
+				return false;
+			if (m_slots[i].first == p)
+				break;
+		}
+
+		// Shift following entries of the probe sequence back into the gap
+		size_t gap = i;
+		for (size_t j = (i + 1) & mask(); m_slots[j].used; j = (j + 1) & mask()) {
+			size_t home = slotIndex(m_slots[j].first);
+			// Can the entry at j move to the gap without passing its home?
+			if (((j - home) & mask()) >= ((j - gap) & mask())) {
+				m_slots[gap] = m_slots[j];
+				gap = j;
+			}
+		}
+		m_slots[gap].used = false;
+		m_slots[gap].second = T();
+		m_size--;
+		return true;
+	}
+
+	void reserve(size_t count)
+	{
+		size_t capacity = 16;
+		while (capacity < count * 2)
+			capacity *= 2;
+		if (capacity > m_slots.size())
+			rehash(capacity);
+	}
+
+private:
+	size_t mask() const { return m_slots.size() - 1; }
+
+	size_t slotIndex(v3s16 p) const
+	{
+		u64 key = (u64)(u16)p.X | ((u64)(u16)p.Y << 16) | ((u64)(u16)p.Z << 32);
+		// Fibonacci hashing, the high bits are the best mixed
+		return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask();
+	}
+
+	void rehash(size_t capacity)
+	{
+		std::vector<Slot> old(capacity);
+		old.swap(m_slots);
+		for (Slot &slot : old) {
+			if (!slot.used)
+				continue;
+			size_t i = slotIndex(slot.first);
+			while (m_slots[i].used)
+				i = (i + 1) & mask();
+			m_slots[i] = std::move(slot);
+		}
+	}
+
+	std::vector<Slot> m_slots;
+	size_t m_size = 0;
+};
+
+/*
+	Set of v3s16 on top of BlockPosMap, with the std::set interface
+	used for block position lists.
+*/
+class BlockPosSet
+{
+	struct Empty {};
+	typedef BlockPosMap<Empty> Map;
+
+public:
+	class iterator
+	{
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef v3s16 value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const v3s16 *pointer;
+		typedef const v3s16 &reference;
+
+		iterator(Map::iterator it) : m_it(it) {}
+
+		const v3s16 &operator*() const { return m_it->first; }
+		iterator &operator++() { ++m_it; return *this; }
+		bool operator==(const iterator &other) const { return m_it == other.m_it; }
+		bool operator!=(const iterator &other) const { return m_it != other.m_it; }
+
+	private:
+		Map::iterator m_it;
+	};
+
+	iterator begin() const { return iterator(m_map.begin()); }
+	iterator end() const { return iterator(m_map.end()); }
+
+	size_t size() const { return m_map.size(); }
+	bool empty() const { return m_map.empty(); }
+	void clear() { m_map.clear(); }
+	void reserve(size_t count) { m_map.reserve(count); }
+
+	bool contains(v3s16 p) const { return m_map.contains(p); }
+	size_t count(v3s16 p) const { return contains(p) ? 1 : 0; }
+
+	// Returns true if p was not in the set yet
+	bool insert(v3s16 p)
+	{
+		size_t size = m_map.size();
+		m_map[p];
+		return m_map.size() != size;
+	}
+
+	bool erase(v3s16 p) { return m_map.erase(p); }
+
+private:
+	// Iterating does not modify the map
+	mutable Map m_map;
+};
@@ -136,6 +136,12 @@ class MutexedQueue
 		return m_queue.empty();
 	}
 
+	u32 size() const
+	{
+		MutexAutoLock lock(m_mutex);
+		return m_queue.size();
+	}
+
 	void push_back(T t)
 	{
 		MutexAutoLock lock(m_mutex);
@@ -0,0 +1,282 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "fixed_pool.h"
+#include <algorithm>
+#include <cstddef>
+#include <unordered_map>
+#include "threading/mutex_auto_lock.h"
+
+/*
+	Free list of a thread
+
+	Only the owning thread changes it. The counters are atomic so that
+	getStats() can read them from other threads.
+*/
+struct FixedSizePool::ThreadCache
+{
+	FreeObject *head = nullptr;
+	std::atomic<u32> count {0};
+	std::atomic<u64> allocations {0};
+};
+
+/*
+	Live pools by instance id
+
+	Threads look their pools up here when they exit, to give the objects
+	of their caches back. Never destroyed, as pools and thread caches can
+	outlive static objects.
+*/
+static std::mutex &live_pools_mutex()
+{
+	static std::mutex *mutex = new std::mutex();
+	return *mutex;
+}
+
+static std::unordered_map<u64, FixedSizePool *> &live_pools()
+{
+	static auto *pools = new std::unordered_map<u64, FixedSizePool *>();
+	return *pools;
+}
+
+static std::atomic<u64> next_instance_id(1);
+
+struct ThreadCacheList
+{
+	struct Entry
+	{
+		u64 instance_id;
+		FixedSizePool::ThreadCache *cache;
+	};
+
+	~ThreadCacheList()
+	{
+		MutexAutoLock lock(live_pools_mutex());
+		for (const Entry &entry : entries) {
+			auto it = live_pools().find(entry.instance_id);
+			if (it != live_pools().end())
+				it->second->releaseThreadCache(entry.cache);
+		}
+	}
+
+	std::vector<Entry> entries;
+};
+
+FixedSizePool::FixedSizePool(size_t object_size, u32 slab_objects,
+		u32 thread_cache_size) :
+	// Every object is suitably aligned for anything
+	m_object_size((std::max(object_size, sizeof(FreeObject)) +
+		alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1)),
+	m_slab_objects(std::max<u32>(slab_objects, 1)),
+	m_thread_cache_size(thread_cache_size),
+	m_instance_id(next_instance_id++)
+{
+	MutexAutoLock lock(live_pools_mutex());
+	live_pools()[m_instance_id] = this;
+}
+
+FixedSizePool::~FixedSizePool()
+{
+	{
+		MutexAutoLock lock(live_pools_mutex());
+		live_pools().erase(m_instance_id);
+	}
+	for (u8 *slab : m_slabs)
+		delete[] slab;
+}
+
+void *FixedSizePool::allocate()
+{
+	ThreadCache *cache = getThreadCache();
+	u32 count = cache->count.load(std::memory_order_relaxed);
+	if (!cache->head) {
+		MutexAutoLock lock(m_mutex);
+		u32 batch = std::max<u32>(m_thread_cache_size / 2, 1);
+		for (u32 i = 0; i < batch; i++) {
+			if (!m_free)
+				addSlab();
+			FreeObject *object = m_free;
+			m_free = object->next;
+			m_free_count--;
+			object->next = cache->head;
+			cache->head = object;
+		}
+		count += batch;
+		m_shared_allocations++;
+	}
+
+	FreeObject *object = cache->head;
+	cache->head = object->next;
+	cache->count.store(count - 1, std::memory_order_relaxed);
+	cache->allocations.store(cache->allocations.load(std::memory_order_relaxed) + 1,
+		std::memory_order_relaxed);
+	return object;
+}
+
+void FixedSizePool::deallocate(void *p)
+{
+	if (!p)
+		return;
+	ThreadCache *cache = getThreadCache();
+	FreeObject *object = static_cast<FreeObject *>(p);
+	object->next = cache->head;
+	cache->head = object;
+	u32 count = cache->count.load(std::memory_order_relaxed) + 1;
+	cache->count.store(count, std::memory_order_relaxed);
+
+	// Keep half of the cache for the next allocations
+	if (count > m_thread_cache_size)
+		flushThreadCache(cache, count - m_thread_cache_size / 2);
+}
+
+FixedSizePool::Stats FixedSizePool::getStats()
+{
+	Stats stats;
+	stats.object_size = m_object_size;
+
+	MutexAutoLock lock(m_mutex);
+	stats.slabs = m_slabs.size();
+	stats.reserved_bytes = m_slabs.size() * m_slab_objects * m_object_size;
+	stats.objects_free = m_free_count;
+	stats.allocations = m_released_allocations;
+	for (const std::unique_ptr<ThreadCache> &cache : m_caches) {
+		stats.objects_free += cache->count.load(std::memory_order_relaxed);
+		stats.allocations += cache->allocations.load(std::memory_order_relaxed);
+	}
+	size_t total = m_slabs.size() * m_slab_objects;
+	// The caches may have been counted while changing
+	stats.objects_free = std::min(stats.objects_free, total);
+	stats.objects_used = total - stats.objects_free;
+	stats.shared_allocations = m_shared_allocations;
+	return stats;
+}
+
+size_t FixedSizePool::trim()
+{
+	MutexAutoLock lock(m_mutex);
+	if (m_free_count < m_slab_objects)
+		return 0;
+
+	auto slab_index = [this] (FreeObject *object) -> size_t {
+		auto it = std::upper_bound(m_slabs.begin(), m_slabs.end(), (u8 *)object);
+		return it - m_slabs.begin() - 1;
+	};
+
+	std::vector<u32> free_counts(m_slabs.size(), 0);
+	for (FreeObject *object = m_free; object; object = object->next)
+		free_counts[slab_index(object)]++;
+
+	std::vector<bool> unused(m_slabs.size(), false);
+	size_t unused_count = 0;
+	for (size_t i = 0; i < m_slabs.size(); i++) {
+		if (free_counts[i] == m_slab_objects) {
+			unused[i] = true;
+			unused_count++;
+		}
+	}
+	if (unused_count == 0)
+		return 0;
+
+	// Unlink the objects of the unused slabs
+	FreeObject **link = &m_free;
+	while (*link) {
+		if (unused[slab_index(*link)]) {
+			*link = (*link)->next;
+			m_free_count--;
+		} else {
+			link = &(*link)->next;
+		}
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < m_slabs.size(); i++) {
+		if (unused[i])
+			delete[] m_slabs[i];
+		else
+			m_slabs[kept++] = m_slabs[i];
+	}
+	m_slabs.resize(kept);
+	return unused_count;
+}
+
+FixedSizePool::ThreadCache *FixedSizePool::getThreadCache()
+{
+	static thread_local ThreadCacheList t_list;
+
+	// Only a few pools exist
+	for (const ThreadCacheList::Entry &entry : t_list.entries) {
+		if (entry.instance_id == m_instance_id)
+			return entry.cache;
+	}
+
+	ThreadCache *cache = new ThreadCache();
+	{
+		MutexAutoLock lock(m_mutex);
+		m_caches.emplace_back(cache);
+	}
+	t_list.entries.push_back({m_instance_id, cache});
+	return cache;
+}
+
+void FixedSizePool::flushThreadCache(ThreadCache *cache, u32 count)
+{
+	if (count == 0)
+		return;
+
+	FreeObject *first = cache->head;
+	FreeObject *last = first;
+	for (u32 i = 1; i < count; i++)
+		last = last->next;
+	cache->head = last->next;
+	cache->count.store(cache->count.load(std::memory_order_relaxed) - count,
+		std::memory_order_relaxed);
+
+	MutexAutoLock lock(m_mutex);
+	last->next = m_free;
+	m_free = first;
+	m_free_count += count;
+}
+
+void FixedSizePool::releaseThreadCache(ThreadCache *cache)
+{
+	flushThreadCache(cache, cache->count.load(std::memory_order_relaxed));
+
+	MutexAutoLock lock(m_mutex);
+	m_released_allocations += cache->allocations.load(std::memory_order_relaxed);
+	for (auto it = m_caches.begin(); it != m_caches.end(); ++it) {
+		if (it->get() == cache) {
+			m_caches.erase(it);
+			break;
+		}
+	}
+}
+
+void FixedSizePool::addSlab()
+{
+	u8 *slab = new u8[m_slab_objects * m_object_size];
+	m_slabs.insert(std::upper_bound(m_slabs.begin(), m_slabs.end(), slab), slab);
+
+	// In address order when taken
+	for (u32 i = m_slab_objects; i-- > 0;) {
+		FreeObject *object = reinterpret_cast<FreeObject *>(slab + i * m_object_size);
+		object->next = m_free;
+		m_free = object;
+	}
+	m_free_count += m_slab_objects;
+}
@@ -0,0 +1,101 @@
+/*
+Minetest
+Copyright (C) 2020 Minetest core developers & community
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "irrlichttypes.h"
+#include "basic_macros.h"
+
+/*
+	Allocator for objects of a single size, carved out of large slabs.
+
+	Every thread has its own free list, so allocating and freeing do not
+	lock most of the time. The thread lists pass objects to and from a
+	shared free list in batches, and give all their objects back to it when
+	their thread exits. trim() returns the slabs that only hold free objects
+	to the system.
+
+	Memory handed out is not initialized. The pool must not be destroyed
+	while objects allocated from it are in use.
+*/
+class FixedSizePool
+{
+public:
+	struct Stats
+	{
+		size_t object_size = 0;
+		size_t slabs = 0;
+		// Size of all slabs
+		size_t reserved_bytes = 0;
+		size_t objects_used = 0;
+		size_t objects_free = 0;
+		u64 allocations = 0;
+		// Allocations that had to go to the shared free list
+		u64 shared_allocations = 0;
+	};
+
+	// thread_cache_size objects at most are kept free per thread
+	FixedSizePool(size_t object_size, u32 slab_objects, u32 thread_cache_size = 32);
+	~FixedSizePool();
+	DISABLE_CLASS_COPY(FixedSizePool);
+
+	void *allocate();
+	void deallocate(void *p);
+
+	size_t getObjectSize() const { return m_object_size; }
+	Stats getStats();
+
+	// Frees the slabs without objects in use, returns how many were freed.
+	// Free objects kept by threads are not looked at.
+	size_t trim();
+
+private:
+	struct FreeObject
+	{
+		FreeObject *next;
+	};
+	struct ThreadCache;
+	friend struct ThreadCacheList;
+
+	ThreadCache *getThreadCache();
+	// Moves count objects from the cache to the shared free list
+	void flushThreadCache(ThreadCache *cache, u32 count);
+	void releaseThreadCache(ThreadCache *cache);
+	// Needs m_mutex
+	void addSlab();
+
+	const size_t m_object_size;
+	const u32 m_slab_objects;
+	const u32 m_thread_cache_size;
+	const u64 m_instance_id;
+
+	std::mutex m_mutex;
+	// Sorted by address
+	std::vector<u8 *> m_slabs;
+	FreeObject *m_free = nullptr;
+	size_t m_free_count = 0;
+	u64 m_shared_allocations = 0;
+	std::vector<std::unique_ptr<ThreadCache>> m_caches;
+	// Allocations counted by the caches of threads that exited
+	u64 m_released_allocations = 0;
+};
@@ -26,6 +26,19 @@ install_linux_deps() {
 		libjpeg-dev libxxf86vm-dev libgl1-mesa-dev libsqlite3-dev \
 		libhiredis-dev libogg-dev libgmp-dev libvorbis-dev libopenal-dev \
 		gettext libpq-dev libleveldb-dev
+	if [[ "${ZSTD}" == "1" ]]; then
+		install_zstd
+	fi
+}
+
+# The libzstd of trusty is too old, build a release
+install_zstd() {
+	local version=1.4.4
+	wget https://github.com/facebook/zstd/releases/download/v${version}/zstd-${version}.tar.gz
+	tar -xzf zstd-${version}.tar.gz
+	make -C zstd-${version}/lib -j2
+	sudo make -C zstd-${version}/lib install PREFIX=/usr/local
+	sudo ldconfig
 }
 
 # Mac OSX build only
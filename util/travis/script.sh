@@ -31,6 +31,10 @@ if [[ ${PLATFORM} == "Unix" ]]; then
 		-DENABLE_GETTEXT=TRUE \
 		-DBUILD_SERVER=TRUE \
 		${CMAKE_FLAGS} ..
+	if [[ "${ZSTD}" == "1" ]] && ! grep -q "USE_ZSTD 1" src/cmake_config.h; then
+		echo "zstd was not found."
+		exit 1
+	fi
 	make -j2
 
 	echo "Running unit tests."